@@ -279,6 +279,36 @@ otama_search(otama_t *otama,
 	return OTAMA_STATUS_OK;
 }
 
+otama_status_t
+otama_search_batch(otama_t *otama,
+				   otama_result_t **results, int n,
+				   otama_variant_t **queries, int nq)
+{
+	otama_status_t ret;
+	long t = nv_clock();
+	int i;
+	
+	NV_ASSERT(otama != NULL);
+	
+	for (i = 0; i < nq; ++i) {
+		results[i] = NULL;
+		if (!OTAMA_VARIANT_IS_HASH(queries[i])) {
+			return OTAMA_STATUS_INVALID_ARGUMENTS;
+		}
+	}
+	ret = otama->driver->search_batch(results, n, queries, nq);
+	if (ret != OTAMA_STATUS_OK) {
+		for (i = 0; i < nq; ++i) {
+			otama_result_free(&results[i]);
+		}
+		return ret;
+	}
+	
+	OTAMA_LOG_DEBUG("otama_search_batch: %d queries, %dms\n", nq, nv_clock() - t);
+
+	return OTAMA_STATUS_OK;
+}
+
 otama_status_t
 otama_search_file(otama_t *otama,
 				  otama_result_t **results, int n,
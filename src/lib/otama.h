@@ -70,6 +70,15 @@ otama_search(otama_t *otama,
 			 int n,
 			 otama_variant_t *query);
 
+/* results[i] receives the result of queries[i].
+ * fixed drivers scan the database once for all queries. */
+otama_status_t
+otama_search_batch(otama_t *otama,
+				   otama_result_t **results,
+				   int n,
+				   otama_variant_t **queries,
+				   int nq);
+
 otama_status_t otama_search_file(otama_t *otama,
 								 otama_result_t **results, int n,
 								 const char *file);
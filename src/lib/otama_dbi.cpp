@@ -150,6 +150,12 @@ otama_dbi_result_seek(otama_dbi_result_t *res, int64_t j)
 	return res->dbi->func.result_seek(res, j);
 }
 
+int64_t
+otama_dbi_result_count(otama_dbi_result_t *res)
+{
+	return res->dbi->func.result_count(res);
+}
+
 static float
 otama_dbi_to_float(const char *s)
 {
@@ -67,6 +67,8 @@ int otama_dbi_rollback(otama_dbi_t *dbi);
 
 int otama_dbi_result_next(otama_dbi_result_t *res);
 int otama_dbi_result_seek(otama_dbi_result_t *res, int64_t row);
+/* number of rows, -1 when the driver can not know it before fetching */
+int64_t otama_dbi_result_count(otama_dbi_result_t *res);
 
 int64_t otama_dbi_result_int64(otama_dbi_result_t *res, int column_no);
 int otama_dbi_result_is_null(otama_dbi_result_t *res, int column_no);
@@ -32,6 +32,7 @@ typedef int (*otama_dbi_table_exist_t)(otama_dbi_t *dbi, int *exist, const char
 
 typedef int (*otama_dbi_result_next_t)(otama_dbi_result_t *res);
 typedef int (*otama_dbi_result_seek_t)(otama_dbi_result_t *res, int64_t j);
+typedef int64_t (*otama_dbi_result_count_t)(otama_dbi_result_t *res);
 
 typedef const char *(*otama_dbi_result_string_t)(otama_dbi_result_t *res, int i);
 typedef void (*otama_dbi_result_free_t)(otama_dbi_result_t **res);
@@ -75,6 +76,7 @@ typedef struct {
 	otama_dbi_table_exist_t table_exist;
 	otama_dbi_result_next_t result_next;
 	otama_dbi_result_seek_t result_seek;
+	otama_dbi_result_count_t result_count;
 	otama_dbi_result_string_t result_string;
 	otama_dbi_result_free_t result_free;
 	otama_dbi_begin_t begin;
@@ -204,6 +204,12 @@ otama_dbi_mysql_result_seek(otama_dbi_result_t *res, int64_t j)
 	return ret;
 }
 
+static int64_t
+otama_dbi_mysql_result_count(otama_dbi_result_t *res)
+{
+	return res->tuples;
+}
+
 static int
 otama_dbi_mysql_exec_sql(otama_dbi_t *dbi, const char *sql)
 {
@@ -487,6 +493,7 @@ otama_dbi_mysql_open(otama_dbi_t *dbi)
 	dbi->func.table_exist = otama_dbi_mysql_table_exist;
 	dbi->func.result_next = otama_dbi_mysql_result_next;
 	dbi->func.result_seek = otama_dbi_mysql_result_seek;
+	dbi->func.result_count = otama_dbi_mysql_result_count;
 	dbi->func.result_string = otama_dbi_mysql_result_string;
 	dbi->func.result_free = otama_dbi_mysql_result_free;
 	dbi->func.begin = otama_dbi_mysql_begin;
@@ -139,6 +139,12 @@ otama_dbi_pgsql_result_seek(otama_dbi_result_t *res, int64_t j)
 	return -1;
 }
 
+static int64_t
+otama_dbi_pgsql_result_count(otama_dbi_result_t *res)
+{
+	return res->tuples;
+}
+
 static int
 otama_dbi_pgsql_begin(otama_dbi_t *dbi)
 {
@@ -456,6 +462,7 @@ otama_dbi_pgsql_open(otama_dbi_t *dbi)
 	dbi->func.table_exist = otama_dbi_pgsql_table_exist;
 	dbi->func.result_next = otama_dbi_pgsql_result_next;
 	dbi->func.result_seek = otama_dbi_pgsql_result_seek;
+	dbi->func.result_count = otama_dbi_pgsql_result_count;
 	dbi->func.result_string = otama_dbi_pgsql_result_string;
 	dbi->func.result_free = otama_dbi_pgsql_result_free;
 	dbi->func.begin = otama_dbi_pgsql_begin;
@@ -174,6 +174,13 @@ otama_dbi_sqlite3_result_seek(otama_dbi_result_t *res, int64_t j)
 	return res->index == j + 1 ? 0 : -1;
 }
 
+static int64_t
+otama_dbi_sqlite3_result_count(otama_dbi_result_t *res)
+{
+	/* rows are stepped one by one */
+	return -1;
+}
+
 static int
 otama_dbi_sqlite3_begin(otama_dbi_t *dbi)
 {
@@ -408,6 +415,7 @@ otama_dbi_sqlite3_open(otama_dbi_t *dbi)
 	dbi->func.table_exist = otama_dbi_sqlite3_table_exist;
 	dbi->func.result_next = otama_dbi_sqlite3_result_next;
 	dbi->func.result_seek = otama_dbi_sqlite3_result_seek;
+	dbi->func.result_count = otama_dbi_sqlite3_result_count;
 	dbi->func.result_string = otama_dbi_sqlite3_result_string;
 	dbi->func.result_free = otama_dbi_sqlite3_result_free;
 	dbi->func.begin = otama_dbi_sqlite3_begin;
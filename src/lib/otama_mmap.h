@@ -26,6 +26,14 @@ extern "C" {
 #endif
 
 typedef struct otama_mmap otama_mmap_t;
+typedef struct otama_mmap_lock otama_mmap_lock_t;
+
+/* otama_mmap_advise() flags */
+#define OTAMA_MMAP_POPULATE   0x01
+#define OTAMA_MMAP_HUGEPAGE   0x02
+#define OTAMA_MMAP_WILLNEED   0x04
+#define OTAMA_MMAP_SEQUENTIAL 0x08
+#define OTAMA_MMAP_LOCK       0x10
 
 int otama_mmap_open(otama_mmap_t **shm, const char *shm_dir,
 				   const char *name, int64_t len);
@@ -36,7 +44,23 @@ void *otama_mmap_mem(const otama_mmap_t *shm);
 int64_t otama_mmap_len(const otama_mmap_t *shm);
 int otama_mmap_sync(const otama_mmap_t *shm);
 int otama_mmap_unlink(const char *shm_dir, const char *name);
+/* replaces to with from. existing mappings of to stay valid until closed */
+int otama_mmap_rename(const char *shm_dir, const char *from, const char *to);
 void otama_mmap_close(otama_mmap_t **shm);
+/* applies flags now and again after otama_mmap_extend(). best effort */
+int otama_mmap_advise(otama_mmap_t *shm, int flags);
+/* bytes in core. -1 when unknown */
+int64_t otama_mmap_resident(const otama_mmap_t *shm);
+/* reads the file in a detached thread to fill the page cache */
+int otama_mmap_warmup(const char *shm_dir, const char *name);
+/*
+ * an exclusive lock on the file name, created when missing.
+ * the lock is held by the open file, so it also excludes the same process.
+ * returns 0 when locked, 1 when another holder has it and wait is 0, -1 on error.
+ */
+int otama_mmap_lock(otama_mmap_lock_t **lock, const char *shm_dir,
+					const char *name, int wait);
+void otama_mmap_unlock(otama_mmap_lock_t **lock);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,274 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE /* sched_setaffinity */
+#endif
+#include "otama_config.h"
+#include "otama_log.h"
+#include "otama_numa.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#  include <sched.h>
+#  include <errno.h>
+#  include <unistd.h>
+#  include <sys/stat.h>
+#  include <sys/syscall.h>
+#  define OTAMA_NUMA_LINUX 1
+#  define OTAMA_NUMA_SYSFS "/sys/devices/system/node"
+#  define OTAMA_MPOL_PREFERRED 1
+#  define OTAMA_MPOL_MF_MOVE (1 << 1)
+#  define OTAMA_NUMA_MASK_BYTES \
+	(sizeof(((otama_numa_affinity_t *)0)->mask) < sizeof(cpu_set_t) ? \
+	 sizeof(((otama_numa_affinity_t *)0)->mask) : sizeof(cpu_set_t))
+#elif OTAMA_WINDOWS
+#  include <windows.h>
+#endif
+
+int
+otama_numa_nodes(void)
+{
+#if OTAMA_NUMA_LINUX
+	char path[256];
+	struct stat st;
+	int nodes = 0;
+	
+	for (;;) {
+		snprintf(path, sizeof(path) - 1, OTAMA_NUMA_SYSFS "/node%d", nodes);
+		if (stat(path, &st) != 0) {
+			break;
+		}
+		++nodes;
+	}
+	return nodes > 0 ? nodes : 1;
+#else
+	return 1;
+#endif
+}
+
+#if OTAMA_NUMA_LINUX
+/* node's cpus from sysfs, 0-15,32-47 */
+static int
+otama_numa_read_cpus(int node, cpu_set_t *set)
+{
+	char path[256];
+	char line[4096];
+	char *p;
+	FILE *fp;
+	int cpus = 0;
+	
+	snprintf(path, sizeof(path) - 1, OTAMA_NUMA_SYSFS "/node%d/cpulist", node);
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return 0;
+	}
+	if (fgets(line, sizeof(line), fp) == NULL) {
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+	
+	CPU_ZERO(set);
+	p = line;
+	while (*p >= '0' && *p <= '9') {
+		int first = (int)strtol(p, &p, 10);
+		int last = first;
+		int cpu;
+		
+		if (*p == '-') {
+			last = (int)strtol(p + 1, &p, 10);
+		}
+		for (cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+			CPU_SET(cpu, set);
+			++cpus;
+		}
+		if (*p == ',') {
+			++p;
+		}
+	}
+	return cpus;
+}
+#endif
+
+void
+otama_numa_topology(otama_numa_topology_t *topology)
+{
+	memset(topology, 0, sizeof(*topology));
+	topology->nodes = 1;
+#if OTAMA_NUMA_LINUX
+	{
+		const int nodes = otama_numa_nodes();
+		cpu_set_t set;
+		int node;
+		
+		CPU_ZERO(&set);
+		if (nodes <= 1 || sched_getaffinity(0, sizeof(set), &set) != 0) {
+			return;
+		}
+		memcpy(topology->process.mask, &set, OTAMA_NUMA_MASK_BYTES);
+		for (node = 0; node < nodes && node < OTAMA_NUMA_NODES_MAX; ++node) {
+			/* a node without cpus keeps an empty mask and is not bound */
+			if (otama_numa_read_cpus(node, &set) > 0) {
+				memcpy(topology->cpus[node].mask, &set, OTAMA_NUMA_MASK_BYTES);
+			}
+		}
+		topology->nodes = node;
+	}
+#endif
+}
+
+int
+otama_numa_bind_thread(const otama_numa_topology_t *topology, int node)
+{
+#if OTAMA_NUMA_LINUX
+	cpu_set_t set;
+	
+	if (topology == NULL || node < 0 || node >= topology->nodes) {
+		return -1;
+	}
+	CPU_ZERO(&set);
+	memcpy(&set, topology->cpus[node].mask, OTAMA_NUMA_MASK_BYTES);
+	if (CPU_COUNT(&set) == 0) {
+		return -1;
+	}
+	if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+		OTAMA_LOG_NOTICE("sched_setaffinity: node%d: %s", node, strerror(errno));
+		return -1;
+	}
+	
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+int
+otama_numa_restore_thread(const otama_numa_topology_t *topology)
+{
+#if OTAMA_NUMA_LINUX
+	cpu_set_t set;
+	
+	CPU_ZERO(&set);
+	memcpy(&set, topology->process.mask, OTAMA_NUMA_MASK_BYTES);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+		OTAMA_LOG_NOTICE("sched_setaffinity: %s", strerror(errno));
+		return -1;
+	}
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+int
+otama_numa_bind_memory(void *mem, int64_t len, int node)
+{
+#if OTAMA_NUMA_LINUX && defined(SYS_mbind)
+	const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t begin = ((uintptr_t)mem + page - 1) / page * page;
+	uintptr_t end = ((uintptr_t)mem + (uintptr_t)len) / page * page;
+	unsigned long mask[4];
+	
+	if (node < 0 || node >= (int)(sizeof(mask) * 8)) {
+		return -1;
+	}
+	if (end <= begin) {
+		/* less than a page, left to the neighbour partition */
+		return 0;
+	}
+	memset(mask, 0, sizeof(mask));
+	mask[node / (sizeof(mask[0]) * 8)] |= 1UL << (node % (sizeof(mask[0]) * 8));
+	if (syscall(SYS_mbind, (void *)begin, (unsigned long)(end - begin),
+				OTAMA_MPOL_PREFERRED, mask, (unsigned long)(sizeof(mask) * 8),
+				OTAMA_MPOL_MF_MOVE) != 0)
+	{
+		OTAMA_LOG_DEBUG("mbind: node%d: %s", node, strerror(errno));
+		return -1;
+	}
+	
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+int
+otama_numa_move_memory(void *mem, int64_t len, int node)
+{
+#if OTAMA_NUMA_LINUX && defined(SYS_move_pages)
+	enum { CHUNK = 1024 };
+	const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t begin = ((uintptr_t)mem + page - 1) / page * page;
+	uintptr_t end = ((uintptr_t)mem + (uintptr_t)len) / page * page;
+	void *pages[CHUNK];
+	int nodes[CHUNK];
+	int status[CHUNK];
+	uintptr_t addr;
+	
+	if (node < 0) {
+		return -1;
+	}
+	/* page cache pages stay where they were first read, first-touch does not move them */
+	for (addr = begin; addr < end;) {
+		unsigned long n = 0;
+		
+		for (; addr < end && n < CHUNK; addr += page, ++n) {
+			pages[n] = (void *)addr;
+			nodes[n] = node;
+		}
+		if (syscall(SYS_move_pages, 0, n, pages, nodes, status,
+					OTAMA_MPOL_MF_MOVE) < 0)
+		{
+			OTAMA_LOG_DEBUG("move_pages: node%d: %s", node, strerror(errno));
+			return -1;
+		}
+	}
+	
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+void
+otama_numa_touch(const void *mem, int64_t len)
+{
+	const volatile char *p = (const volatile char *)mem;
+	int64_t i;
+	char c = 0;
+#if OTAMA_NUMA_LINUX
+	const int64_t page = (int64_t)sysconf(_SC_PAGESIZE);
+#elif OTAMA_WINDOWS
+	SYSTEM_INFO info;
+	int64_t page;
+	
+	GetSystemInfo(&info);
+	page = (int64_t)info.dwPageSize;
+#else
+	const int64_t page = 4096;
+#endif
+	
+	for (i = 0; i < len; i += page) {
+		c ^= p[i];
+	}
+	(void)c;
+}
@@ -0,0 +1,63 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_config.h"
+#ifndef OTAMA_NUMA_H
+#define OTAMA_NUMA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Linux only (sysfs, sched_setaffinity, mbind, move_pages). elsewhere 1 node and -1 */
+
+/* the cpu mask of a thread, 1024 cpus */
+typedef struct {
+	unsigned long mask[1024 / (sizeof(unsigned long) * 8)];
+} otama_numa_affinity_t;
+
+#define OTAMA_NUMA_NODES_MAX 64
+
+/* the online nodes, the cpus of each node and the mask of the process */
+typedef struct {
+	int nodes;
+	otama_numa_affinity_t process;
+	otama_numa_affinity_t cpus[OTAMA_NUMA_NODES_MAX];
+} otama_numa_topology_t;
+
+/* online nodes. 1 when unknown */
+int otama_numa_nodes(void);
+/* reads the topology from sysfs once, so a scan does not touch the files */
+void otama_numa_topology(otama_numa_topology_t *topology);
+/* pins the calling thread to the cpus of node (no file I/O) */
+int otama_numa_bind_thread(const otama_numa_topology_t *topology, int node);
+/* restores the process mask of topology */
+int otama_numa_restore_thread(const otama_numa_topology_t *topology);
+/* prefers node for the pages of [mem, mem + len) and moves the resident ones */
+int otama_numa_bind_memory(void *mem, int64_t len, int node);
+/* moves the resident pages of [mem, mem + len) to node once, the policy is not changed */
+int otama_numa_move_memory(void *mem, int64_t len, int node);
+/* faults in [mem, mem + len) from the calling thread (first-touch placement) */
+void otama_numa_touch(const void *mem, int64_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -27,10 +27,13 @@
 #  include <sys/types.h>
 #  include <unistd.h>
 #  include <dirent.h>
+#  include <fcntl.h>
 #elif OTAMA_WINDOWS
 #  include <windows.h>
 #  include <process.h>
 #  include <direct.h>
+#  include <io.h>
+#  include <sys/stat.h>
 #endif
 #include <stdlib.h>
 #include <string.h>
@@ -196,6 +199,68 @@ otama_split_path(char *dir,
 	return 0;
 }
 
+/* writes the buffer of fp and the file to the disk */
+int
+otama_fsync(FILE *fp)
+{
+	if (fflush(fp) != 0) {
+		return -1;
+	}
+#if OTAMA_POSIX
+	return fsync(fileno(fp));
+#elif OTAMA_WINDOWS
+	return _commit(_fileno(fp));
+#else
+# error "not implemented"
+#endif
+}
+
+/* writes the entries of dir, a rename in dir is on the disk after this */
+int
+otama_fsync_dir(const char *dir)
+{
+#if OTAMA_POSIX
+	int fd = open(dir, O_RDONLY);
+	int ret;
+	
+	if (fd == -1) {
+		return -1;
+	}
+	ret = fsync(fd);
+	close(fd);
+	
+	return ret;
+#elif OTAMA_WINDOWS
+	// a directory can not be flushed, MoveFileEx writes through
+	return 0;
+#else
+# error "not implemented"
+#endif
+}
+
+/* -1 when file is not found */
+int64_t
+otama_file_size(const char *file)
+{
+#if OTAMA_POSIX
+	struct stat st;
+	
+	if (stat(file, &st) != 0) {
+		return -1;
+	}
+	return (int64_t)st.st_size;
+#elif OTAMA_WINDOWS
+	struct _stati64 st;
+	
+	if (_stati64(file, &st) != 0) {
+		return -1;
+	}
+	return (int64_t)st.st_size;
+#else
+# error "not implemented"
+#endif
+}
+
 int
 otama_mkdir(const char *dir)
 {
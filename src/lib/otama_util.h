@@ -20,6 +20,7 @@
 #include "otama_config.h"
 #ifndef OTAMA_UTIL_H
 #define OTAMA_UTIL_H
+#include <stdio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -37,6 +38,9 @@ int otama_split_path(char *dirname,
 void otama_rcpath(char *path, size_t path_len);
 int otama_unlink(const char *file);
 int otama_writeable_directory(const char *dir);
+int otama_fsync(FILE *fp);
+int otama_fsync_dir(const char *dir);
+int64_t otama_file_size(const char *file);
 
 int otama_mkdir(const char *dir);
 
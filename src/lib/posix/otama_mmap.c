@@ -25,6 +25,8 @@
 #include "otama_mmap.h"
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
@@ -32,16 +34,47 @@
 #include <string.h>
 #include <stdlib.h>
 #include <limits.h>
+#include <pthread.h>
+
+#if defined(MREMAP_MAYMOVE) && !OTAMA_POSIX_SHMOPEN
+#  define OTAMA_MMAP_MREMAP 1
+#endif
+#ifdef MAP_NORESERVE
+#  define OTAMA_MMAP_FLAGS (MAP_SHARED | MAP_NORESERVE)
+#else
+#  define OTAMA_MMAP_FLAGS MAP_SHARED
+#endif
+#ifdef __linux__
+typedef unsigned char otama_mincore_t;
+#else
+typedef char otama_mincore_t;
+#endif
 
 struct otama_mmap {
 	int fd;
 	void *mem;
 	int64_t len;
+	int advice;
 	char path[PATH_MAX * 2];
 	char dir[PATH_MAX];	
 	char name[PATH_MAX];
 };
 
+static int64_t
+otama_mmap_touch(const void *mem, int64_t len)
+{
+	const volatile char *p = (const volatile char *)mem;
+	int64_t page = (int64_t)sysconf(_SC_PAGESIZE);
+	int64_t i;
+	char c = 0;
+	
+	for (i = 0; i < len; i += page) {
+		c ^= p[i];
+	}
+	
+	return (int64_t)c;
+}
+
 int
 otama_mmap_open(otama_mmap_t **new_shm, const char *shm_dir,
 				const char *name, int64_t len)
@@ -69,8 +102,8 @@ otama_mmap_open(otama_mmap_t **new_shm, const char *shm_dir,
 		return -1;
 	}
 	
-	shm->mem = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, shm->fd, 0);
-	if (shm->mem == NULL) {
+	shm->mem = mmap(NULL, len, PROT_READ|PROT_WRITE, OTAMA_MMAP_FLAGS, shm->fd, 0);
+	if (shm->mem == MAP_FAILED) {
 		OTAMA_LOG_ERROR("%s", strerror(errno));
 		*new_shm = NULL;
 		close(shm->fd);
@@ -130,26 +163,47 @@ otama_mmap_create(const char *shm_dir,
 	return 0;
 }
 
+/* the extended part of the file reads as zero, so it is not touched here */
 int
 otama_mmap_extend(otama_mmap_t **shm, int64_t len)
 {
+#if OTAMA_MMAP_MREMAP
+	void *mem;
+	
+	if (ftruncate((*shm)->fd, len) != 0) {
+		OTAMA_LOG_ERROR("%s: %s", (*shm)->path, strerror(errno));
+		return -1;
+	}
+	mem = mremap((*shm)->mem, (size_t)(*shm)->len, (size_t)len, MREMAP_MAYMOVE);
+	if (mem == MAP_FAILED) {
+		OTAMA_LOG_ERROR("%s: %s", (*shm)->path, strerror(errno));
+		return -1;
+	}
+	(*shm)->mem = mem;
+	(*shm)->len = len;
+	if ((*shm)->advice) {
+		otama_mmap_advise(*shm, (*shm)->advice);
+	}
+	
+	return 0;
+#else
 	int ret = 0;
 	otama_mmap_t backup = **shm;
-	int64_t old_len = (*shm)->len;
 	
 	otama_mmap_close(shm);
 	
 	ret = truncate(backup.path, len);
 	if (ret == 0) {
 		ret = otama_mmap_open(shm, backup.dir, backup.name, len);
-		if (ret == 0 && len > old_len) {
-			memset(((char *)(*shm)->mem) + old_len,  0, len - old_len);
+		if (ret == 0 && backup.advice) {
+			otama_mmap_advise(*shm, backup.advice);
 		}
 	} else {
 		OTAMA_LOG_ERROR("%s", strerror(errno));
 	}
 	
 	return ret;
+#endif
 }
 
 void *
@@ -184,6 +238,271 @@ otama_mmap_unlink(const char *shm_dir, const char *name)
 #endif
 }
 
+struct otama_mmap_lock {
+	int fd;
+};
+
+int
+otama_mmap_lock(otama_mmap_lock_t **lock, const char *shm_dir,
+				const char *name, int wait)
+{
+	char path[PATH_MAX];
+	int fd;
+	
+	*lock = NULL;
+	snprintf(path, sizeof(path) - 1, "%s/%s", shm_dir, name);
+#if OTAMA_POSIX_SHMOPEN
+	fd = shm_open(path, O_RDWR|O_CREAT, 0600);
+#else
+	fd = open(path, O_RDWR|O_CREAT, 0600);
+#endif
+	if (fd < 0) {
+		OTAMA_LOG_ERROR("%s: %s", path, strerror(errno));
+		return -1;
+	}
+	while (flock(fd, LOCK_EX | (wait ? 0 : LOCK_NB)) != 0) {
+		if (errno == EINTR) {
+			continue;
+		}
+		if (errno == EWOULDBLOCK) {
+			close(fd);
+			return 1;
+		}
+		OTAMA_LOG_ERROR("flock: %s: %s", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	*lock = (otama_mmap_lock_t *)malloc(sizeof(otama_mmap_lock_t));
+	(*lock)->fd = fd;
+	
+	return 0;
+}
+
+void
+otama_mmap_unlock(otama_mmap_lock_t **lock)
+{
+	if (*lock != NULL) {
+		flock((*lock)->fd, LOCK_UN);
+		close((*lock)->fd);
+		free(*lock);
+		*lock = NULL;
+	}
+}
+
+int
+otama_mmap_rename(const char *shm_dir, const char *from, const char *to)
+{
+#if OTAMA_POSIX_SHMOPEN
+	OTAMA_LOG_ERROR("rename is not supported for shm_open: %s", from);
+	return -1;
+#else
+	char from_path[PATH_MAX];
+	char to_path[PATH_MAX];
+	
+	snprintf(from_path, sizeof(from_path) - 1, "%s/%s", shm_dir, from);
+	snprintf(to_path, sizeof(to_path) - 1, "%s/%s", shm_dir, to);
+	if (rename(from_path, to_path) != 0) {
+		OTAMA_LOG_ERROR("%s: %s", from_path, strerror(errno));
+		return -1;
+	}
+	
+	return 0;
+#endif
+}
+
+int
+otama_mmap_advise(otama_mmap_t *shm, int flags)
+{
+	int ret = 0;
+	
+	shm->advice = flags;
+	if (shm->len == 0) {
+		return 0;
+	}
+	if (flags & OTAMA_MMAP_POPULATE) {
+		/* same as MAP_POPULATE, but for a mapping that already exists */
+#ifdef MADV_POPULATE_READ
+		if (madvise(shm->mem, (size_t)shm->len, MADV_POPULATE_READ) != 0)
+#endif
+		{
+			otama_mmap_touch(shm->mem, shm->len);
+		}
+	}
+#ifdef MADV_HUGEPAGE
+	if ((flags & OTAMA_MMAP_HUGEPAGE)
+		&& madvise(shm->mem, (size_t)shm->len, MADV_HUGEPAGE) != 0)
+	{
+		OTAMA_LOG_DEBUG("MADV_HUGEPAGE: %s: %s", shm->path, strerror(errno));
+		ret = -1;
+	}
+#endif
+	if ((flags & OTAMA_MMAP_WILLNEED)
+		&& madvise(shm->mem, (size_t)shm->len, MADV_WILLNEED) != 0)
+	{
+		OTAMA_LOG_DEBUG("MADV_WILLNEED: %s: %s", shm->path, strerror(errno));
+		ret = -1;
+	}
+	if ((flags & OTAMA_MMAP_SEQUENTIAL)
+		&& madvise(shm->mem, (size_t)shm->len, MADV_SEQUENTIAL) != 0)
+	{
+		OTAMA_LOG_DEBUG("MADV_SEQUENTIAL: %s: %s", shm->path, strerror(errno));
+		ret = -1;
+	}
+	if ((flags & OTAMA_MMAP_LOCK)
+		&& mlock(shm->mem, (size_t)shm->len) != 0)
+	{
+		/* RLIMIT_MEMLOCK */
+		OTAMA_LOG_NOTICE("mlock: %s: %s", shm->path, strerror(errno));
+		ret = -1;
+	}
+	
+	return ret;
+}
+
+int64_t
+otama_mmap_resident(const otama_mmap_t *shm)
+{
+	int64_t page = (int64_t)sysconf(_SC_PAGESIZE);
+	int64_t npages = (shm->len + page - 1) / page;
+	int64_t i, resident = 0;
+	otama_mincore_t *vec;
+	
+	if (npages == 0) {
+		return 0;
+	}
+	vec = (otama_mincore_t *)malloc((size_t)npages);
+	if (vec == NULL) {
+		return -1;
+	}
+	if (mincore(shm->mem, (size_t)shm->len, vec) != 0) {
+		OTAMA_LOG_DEBUG("mincore: %s: %s", shm->path, strerror(errno));
+		free(vec);
+		return -1;
+	}
+	for (i = 0; i < npages; ++i) {
+		resident += (vec[i] & 1);
+	}
+	free(vec);
+	
+	resident *= page;
+	
+	return resident < shm->len ? resident : shm->len;
+}
+
+/* the paths being warmed up, one thread per file */
+typedef struct otama_mmap_warmup {
+	struct otama_mmap_warmup *next;
+	char path[PATH_MAX * 2];
+} otama_mmap_warmup_t;
+
+static otama_mmap_warmup_t *s_warmup = NULL;
+static pthread_mutex_t s_warmup_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+otama_mmap_warmup_running(const char *path)
+{
+	otama_mmap_warmup_t *w;
+	
+	for (w = s_warmup; w != NULL; w = w->next) {
+		if (strcmp(w->path, path) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void
+otama_mmap_warmup_leave(otama_mmap_warmup_t *warmup)
+{
+	otama_mmap_warmup_t **w;
+	
+	pthread_mutex_lock(&s_warmup_lock);
+	for (w = &s_warmup; *w != NULL; w = &(*w)->next) {
+		if (*w == warmup) {
+			*w = warmup->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&s_warmup_lock);
+	free(warmup);
+}
+
+static void *
+otama_mmap_warmup_thread(void *arg)
+{
+	otama_mmap_warmup_t *warmup = (otama_mmap_warmup_t *)arg;
+	const char *path = warmup->path;
+	struct stat st;
+	void *mem;
+	int fd;
+	
+#if OTAMA_POSIX_SHMOPEN
+	fd = shm_open(path, O_RDONLY, 0600);
+#else
+	fd = open(path, O_RDONLY);
+#endif
+	if (fd == -1) {
+		OTAMA_LOG_NOTICE("warmup: %s: %s", path, strerror(errno));
+		otama_mmap_warmup_leave(warmup);
+		return NULL;
+	}
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		/* own read-only mapping, the caller may close or remap its own at any time */
+		mem = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (mem != MAP_FAILED) {
+			madvise(mem, (size_t)st.st_size, MADV_SEQUENTIAL);
+			otama_mmap_touch(mem, (int64_t)st.st_size);
+			munmap(mem, (size_t)st.st_size);
+			OTAMA_LOG_DEBUG("warmup: %s: %"PRId64" bytes", path, (int64_t)st.st_size);
+		}
+	}
+	close(fd);
+	otama_mmap_warmup_leave(warmup);
+	
+	return NULL;
+}
+
+int
+otama_mmap_warmup(const char *shm_dir, const char *name)
+{
+	pthread_t thread;
+	pthread_attr_t attr;
+	otama_mmap_warmup_t *warmup;
+	int ret;
+	
+	warmup = (otama_mmap_warmup_t *)malloc(sizeof(*warmup));
+	if (warmup == NULL) {
+		OTAMA_LOG_ERROR("malloc: %s", strerror(errno));
+		return -1;
+	}
+	snprintf(warmup->path, sizeof(warmup->path) - 1, "%s/%s", shm_dir, name);
+	warmup->path[sizeof(warmup->path) - 1] = '\0';
+	
+	pthread_mutex_lock(&s_warmup_lock);
+	if (otama_mmap_warmup_running(warmup->path)) {
+		/* reopened while the previous one is still reading */
+		pthread_mutex_unlock(&s_warmup_lock);
+		free(warmup);
+		return 0;
+	}
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = pthread_create(&thread, &attr, otama_mmap_warmup_thread, warmup);
+	pthread_attr_destroy(&attr);
+	if (ret != 0) {
+		pthread_mutex_unlock(&s_warmup_lock);
+		OTAMA_LOG_ERROR("pthread_create: %s", strerror(ret));
+		free(warmup);
+		return -1;
+	}
+	/* the thread waits for the lock before it unlinks itself */
+	warmup->next = s_warmup;
+	s_warmup = warmup;
+	pthread_mutex_unlock(&s_warmup_lock);
+	
+	return 0;
+}
+
 void
 otama_mmap_close(otama_mmap_t **shm)
 {
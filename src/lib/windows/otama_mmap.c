@@ -28,6 +28,7 @@
 #include "nv_core.h"
 #include <windows.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifndef NAME_MAX
 #define NAME_MAX MAX_PATH
@@ -42,6 +43,7 @@ struct otama_mmap {
 	HANDLE fd;
 	void *mem;
 	int64_t len;
+	int advice;
 	char path[PATH_MAX * 2];
 	char dir[PATH_MAX];	
 	char name[PATH_MAX];
@@ -140,6 +142,7 @@ otama_mmap_open(otama_mmap_t **new_shm, const char *shm_dir,
 		return -1;
 	}
 	shm->len = len;
+	shm->advice = 0;
 	*new_shm = shm;
 
 	if (exists == TRUE) {
@@ -219,6 +222,9 @@ otama_mmap_extend(otama_mmap_t **shm, int64_t len)
 		if (len > old_len) {
 			memset(((char *)(*shm)->mem) + old_len,  0, (size_t)(len - old_len));
 		}
+		if (backup.advice) {
+			otama_mmap_advise(*shm, backup.advice);
+		}
 	} else {
 	}
 	
@@ -270,6 +276,247 @@ otama_mmap_unlink(const char *shm_dir, const char *name)
 	return 0;
 }
 
+struct otama_mmap_lock {
+	HANDLE fd;
+};
+
+int
+otama_mmap_lock(otama_mmap_lock_t **lock, const char *shm_dir,
+				const char *name, int wait)
+{
+	char path[PATH_MAX];
+	char err[ERRMSG_MAX];
+	OVERLAPPED overlapped;
+	HANDLE fd;
+	
+	*lock = NULL;
+	nv_snprintf(path, sizeof(path) - 1, "%s\\%s", shm_dir, name);
+	fd = CreateFile(path,
+					GENERIC_READ|GENERIC_WRITE,
+					FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE,
+					NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fd == INVALID_HANDLE_VALUE) {
+		OTAMA_LOG_ERROR("CreateFile: %s: %s", path, otama_last_error(err));
+		return -1;
+	}
+	memset(&overlapped, 0, sizeof(overlapped));
+	if (LockFileEx(fd, LOCKFILE_EXCLUSIVE_LOCK | (wait ? 0 : LOCKFILE_FAIL_IMMEDIATELY),
+				   0, 1, 0, &overlapped) == 0)
+	{
+		const DWORD error = GetLastError();
+		CloseHandle(fd);
+		if (error == ERROR_LOCK_VIOLATION || error == ERROR_IO_PENDING) {
+			return 1;
+		}
+		OTAMA_LOG_ERROR("LockFileEx: %s: %s", path, otama_last_error(err));
+		return -1;
+	}
+	*lock = (otama_mmap_lock_t *)malloc(sizeof(otama_mmap_lock_t));
+	(*lock)->fd = fd;
+	
+	return 0;
+}
+
+void
+otama_mmap_unlock(otama_mmap_lock_t **lock)
+{
+	if (*lock != NULL) {
+		OVERLAPPED overlapped;
+		
+		memset(&overlapped, 0, sizeof(overlapped));
+		UnlockFileEx((*lock)->fd, 0, 1, 0, &overlapped);
+		CloseHandle((*lock)->fd);
+		free(*lock);
+		*lock = NULL;
+	}
+}
+
+int
+otama_mmap_rename(const char *shm_dir, const char *from, const char *to)
+{
+	char from_path[PATH_MAX];
+	char to_path[PATH_MAX];
+	char err[ERRMSG_MAX];
+	
+	nv_snprintf(from_path, sizeof(from_path) - 1, "%s\\%s", shm_dir, from);
+	nv_snprintf(to_path, sizeof(to_path) - 1, "%s\\%s", shm_dir, to);
+	
+	/* fails while another handle maps to */
+	if (MoveFileEx(from_path, to_path, MOVEFILE_REPLACE_EXISTING) == 0) {
+		OTAMA_LOG_ERROR("MoveFileEx: %s: %s",
+						from_path, otama_last_error(err));
+		return -1;
+	}
+	
+	return 0;
+}
+
+static int64_t
+otama_mmap_touch(const void *mem, int64_t len)
+{
+	const volatile char *p = (const volatile char *)mem;
+	SYSTEM_INFO info;
+	int64_t i;
+	char c = 0;
+	
+	GetSystemInfo(&info);
+	for (i = 0; i < len; i += info.dwPageSize) {
+		c ^= p[i];
+	}
+	
+	return (int64_t)c;
+}
+
+/* only POPULATE/WILLNEED (touch) and LOCK (VirtualLock) have an effect */
+int
+otama_mmap_advise(otama_mmap_t *shm, int flags)
+{
+	char err[ERRMSG_MAX];
+	int ret = 0;
+	
+	shm->advice = flags;
+	if (flags & (OTAMA_MMAP_POPULATE | OTAMA_MMAP_WILLNEED)) {
+		otama_mmap_touch(shm->mem, shm->len);
+	}
+	if ((flags & OTAMA_MMAP_LOCK)
+		&& VirtualLock(shm->mem, (SIZE_T)shm->len) == 0)
+	{
+		OTAMA_LOG_NOTICE("VirtualLock: %s: %s", shm->path, otama_last_error(err));
+		ret = -1;
+	}
+	
+	return ret;
+}
+
+int64_t
+otama_mmap_resident(const otama_mmap_t *shm)
+{
+	return -1;
+}
+
+/* the paths being warmed up, one thread per file */
+typedef struct otama_mmap_warmup {
+	struct otama_mmap_warmup *next;
+	char path[PATH_MAX * 2];
+} otama_mmap_warmup_t;
+
+static otama_mmap_warmup_t *s_warmup = NULL;
+static volatile LONG s_warmup_lock = 0;
+
+static void
+otama_mmap_warmup_lock(void)
+{
+	while (InterlockedCompareExchange(&s_warmup_lock, 1, 0) != 0) {
+		Sleep(0);
+	}
+}
+
+static void
+otama_mmap_warmup_unlock(void)
+{
+	InterlockedExchange(&s_warmup_lock, 0);
+}
+
+static int
+otama_mmap_warmup_running(const char *path)
+{
+	otama_mmap_warmup_t *w;
+	
+	for (w = s_warmup; w != NULL; w = w->next) {
+		if (strcmp(w->path, path) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void
+otama_mmap_warmup_leave(otama_mmap_warmup_t *warmup)
+{
+	otama_mmap_warmup_t **w;
+	
+	otama_mmap_warmup_lock();
+	for (w = &s_warmup; *w != NULL; w = &(*w)->next) {
+		if (*w == warmup) {
+			*w = warmup->next;
+			break;
+		}
+	}
+	otama_mmap_warmup_unlock();
+	free(warmup);
+}
+
+static DWORD WINAPI
+otama_mmap_warmup_thread(LPVOID arg)
+{
+	otama_mmap_warmup_t *warmup = (otama_mmap_warmup_t *)arg;
+	const char *path = warmup->path;
+	HANDLE file_fd, fd;
+	LARGE_INTEGER size;
+	void *mem;
+	
+	file_fd = CreateFile(path, GENERIC_READ,
+						 FILE_SHARE_READ|FILE_SHARE_WRITE|FILE_SHARE_DELETE,
+						 NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file_fd == INVALID_HANDLE_VALUE) {
+		otama_mmap_warmup_leave(warmup);
+		return 0;
+	}
+	if (GetFileSizeEx(file_fd, &size) && size.QuadPart > 0) {
+		fd = CreateFileMapping(file_fd, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (fd != NULL) {
+			mem = MapViewOfFile(fd, FILE_MAP_READ, 0, 0, 0);
+			if (mem != NULL) {
+				otama_mmap_touch(mem, (int64_t)size.QuadPart);
+				UnmapViewOfFile(mem);
+			}
+			CloseHandle(fd);
+		}
+	}
+	CloseHandle(file_fd);
+	otama_mmap_warmup_leave(warmup);
+	
+	return 0;
+}
+
+int
+otama_mmap_warmup(const char *shm_dir, const char *name)
+{
+	otama_mmap_warmup_t *warmup;
+	char err[ERRMSG_MAX];
+	HANDLE thread;
+	
+	warmup = (otama_mmap_warmup_t *)malloc(sizeof(*warmup));
+	if (warmup == NULL) {
+		OTAMA_LOG_ERROR("malloc: %s", otama_last_error(err));
+		return -1;
+	}
+	nv_snprintf(warmup->path, sizeof(warmup->path) - 1, "%s\\%s", shm_dir, name);
+	warmup->path[sizeof(warmup->path) - 1] = '\0';
+	
+	otama_mmap_warmup_lock();
+	if (otama_mmap_warmup_running(warmup->path)) {
+		/* reopened while the previous one is still reading */
+		otama_mmap_warmup_unlock();
+		free(warmup);
+		return 0;
+	}
+	thread = CreateThread(NULL, 0, otama_mmap_warmup_thread, warmup, 0, NULL);
+	if (thread == NULL) {
+		otama_mmap_warmup_unlock();
+		OTAMA_LOG_ERROR("CreateThread: %s", otama_last_error(err));
+		free(warmup);
+		return -1;
+	}
+	/* the thread waits for the lock before it unlinks itself */
+	warmup->next = s_warmup;
+	s_warmup = warmup;
+	otama_mmap_warmup_unlock();
+	CloseHandle(thread);
+	
+	return 0;
+}
+
 void
 otama_mmap_close(otama_mmap_t **shm)
 {
@@ -0,0 +1,141 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_config.h"
+#ifndef OTAMA_BOVW_CASCADE_FIXED_DRIVER_HPP
+#define OTAMA_BOVW_CASCADE_FIXED_DRIVER_HPP
+
+#include "otama_bovw_packed_fixed_driver.hpp"
+
+namespace otama
+{
+	/*
+	 * two-level search. the rows hold the words folded into 8k bits
+	 * (and the color), the full records are stored in the blob file.
+	 * a search scans the rows and scores the best coarse_n records
+	 * with the full records.
+	 */
+	template <nv_bovw_bit_e BIT, typename COLOR_CLASS>
+	class BOVWCascadeFixedDriver:
+		public BOVWPackedFixedDriver<BIT, COLOR_CLASS,
+									 typename nv_bovw_ctx<BIT, COLOR_CLASS>::cascade_t>
+	{
+	protected:
+		typedef nv_bovw_ctx<BIT, COLOR_CLASS> T;
+		typedef BOVWPackedFixedDriver<BIT, COLOR_CLASS, typename T::cascade_t> B;
+
+		int m_coarse_n;
+
+		virtual int
+		search_coarse_n(otama_variant_t *options)
+		{
+			otama_variant_t *value;
+
+			if (OTAMA_VARIANT_IS_HASH(options)
+				&& !OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(options, "coarse_n")))
+			{
+				int64_t coarse_n = otama_variant_to_int(value);
+				if (coarse_n < 0) {
+					OTAMA_LOG_ERROR("invalid coarse_n: %"PRId64", ignored", coarse_n);
+					return m_coarse_n;
+				}
+				return (int)NV_MIN(coarse_n, (int64_t)INT_MAX);
+			}
+			return m_coarse_n;
+		}
+
+	public:
+		virtual std::string
+		name(void)
+		{
+			if (typeid(COLOR_CLASS) == typeid(nv_color_sboc_t)) {
+				return this->prefixed_name(std::string("otama_bovw") + B::itos(BIT/1024) + "k_cascade_sboc");
+			} else {
+				return this->prefixed_name(std::string("otama_bovw") + B::itos(BIT/1024) + "k_cascade");
+			}
+		}
+
+		BOVWCascadeFixedDriver(otama_variant_t *options)
+			: B(options)
+		{
+			otama_variant_t *driver, *value;
+
+			m_coarse_n = 0;
+			driver = otama_variant_hash_at(options, "driver");
+			if (OTAMA_VARIANT_IS_HASH(driver)) {
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "coarse_n"))) {
+					// 0: max(n, 10) * first_scale
+					m_coarse_n = (int)otama_variant_to_int(value);
+					if (m_coarse_n < 0) {
+						OTAMA_LOG_ERROR("invalid driver[coarse_n]: %d, using 0", m_coarse_n);
+						m_coarse_n = 0;
+					}
+				}
+			}
+			OTAMA_LOG_DEBUG("driver[coarse_n] => %d", m_coarse_n);
+		}
+
+		virtual otama_status_t
+		set(const std::string &key, otama_variant_t *value)
+		{
+			if (key == "coarse_n") {
+#ifdef _OPENMP
+				OMPLock lock(this->m_lock);
+#endif
+				int64_t coarse_n = otama_variant_to_int(value);
+				if (coarse_n < 0 || coarse_n > INT_MAX) {
+					OTAMA_LOG_ERROR("invalid coarse_n: %"PRId64, coarse_n);
+					return OTAMA_STATUS_INVALID_ARGUMENTS;
+				}
+				m_coarse_n = (int)coarse_n;
+				return OTAMA_STATUS_OK;
+			}
+			return B::set(key, value);
+		}
+
+		virtual otama_status_t
+		get(const std::string &key,
+			otama_variant_t *value)
+		{
+			if (key == "coarse_n") {
+#ifdef _OPENMP
+				OMPLock lock(this->m_lock);
+#endif
+				otama_variant_set_int(value, m_coarse_n);
+				return OTAMA_STATUS_OK;
+			}
+			return B::get(key, value);
+		}
+
+		virtual otama_status_t
+		unset(const std::string &key)
+		{
+			if (key == "coarse_n") {
+#ifdef _OPENMP
+				OMPLock lock(this->m_lock);
+#endif
+				m_coarse_n = 0;
+				return OTAMA_STATUS_OK;
+			}
+			return B::unset(key);
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_config.h"
+#ifndef OTAMA_BOVW_COLUMN_STRAGE_HPP
+#define OTAMA_BOVW_COLUMN_STRAGE_HPP
+
+#include "nv_core.h"
+#include "otama_log.h"
+#include "otama_mmap.h"
+#include "otama_fixed_strage.hpp"
+#include <string>
+
+namespace otama
+{
+	/*
+	 * struct-of-arrays copy of FixedStrage<T::dense_t>.
+	 * bovw blocks, norms and colors are stored in separate files,
+	 * so a scan only reads the columns it scores.
+	 * deleted records are taken from the row strage bitmap.
+	 */
+	template<class T>
+	class BOVWColumnStrage
+	{
+	private:
+		typedef typename T::dense_t FT;
+		typedef typename T::columns_t columns_t;
+		typedef typename T::color_t C;
+
+		static const int DEFAULT_COUNT_MAX = 10000;
+		static const int ALIGNMENT = 64;
+
+		typedef struct {
+			otama_mmap_t *metadata;
+			otama_mmap_t *bovw;
+			otama_mmap_t *norm;
+			otama_mmap_t *color;
+		} shm_t;
+		typedef struct {
+			int64_t count_max;
+			int64_t count;
+		} metadata_t;
+
+		shm_t m_shm;
+		metadata_t *m_metadata;
+		columns_t m_columns;
+		int64_t m_count;
+		double m_growth;
+		int m_advice;
+		bool m_warmup;
+		std::string m_shm_dir, m_prefix;
+
+		static inline int64_t
+		aligned_len(int64_t len)
+		{
+			return (len + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		}
+		static inline int64_t bovw_len(int64_t n) { return aligned_len(n * T::INT_BLOCKS * sizeof(uint64_t)); }
+		static inline int64_t norm_len(int64_t n) { return aligned_len(n * sizeof(float)); }
+		static inline int64_t color_len(int64_t n) { return aligned_len(n * sizeof(C)); }
+
+		inline std::string metadata_name(void) { return m_prefix + "_col_metadata"; }
+		inline std::string bovw_name(void) { return m_prefix + "_col_bovw"; }
+		inline std::string norm_name(void) { return m_prefix + "_col_norm"; }
+		inline std::string color_name(void) { return m_prefix + "_col_color"; }
+
+		int
+		open_column(otama_mmap_t **shm, const std::string &name, int64_t len)
+		{
+			int ret = otama_mmap_open(shm, m_shm_dir.c_str(), name.c_str(), len);
+			if (ret != 0) {
+				OTAMA_LOG_ERROR("shm_open failed: %s", name.c_str());
+			}
+			return ret;
+		}
+
+		int
+		create_column(const std::string &name, int64_t len)
+		{
+			int ret = otama_mmap_create(m_shm_dir.c_str(), name.c_str(), len);
+			if (ret != 0) {
+				OTAMA_LOG_ERROR("shm_create: %s", name.c_str());
+			}
+			return ret;
+		}
+
+		void
+		update_columns(void)
+		{
+			m_columns.bovw = (const uint64_t *)otama_mmap_mem(m_shm.bovw);
+			m_columns.norm = (const float *)otama_mmap_mem(m_shm.norm);
+			m_columns.boc = (const C *)otama_mmap_mem(m_shm.color);
+		}
+
+		inline uint64_t *bovw_at(int64_t i) { return (uint64_t *)otama_mmap_mem(m_shm.bovw) + i * T::INT_BLOCKS; }
+		inline float *norm_at(int64_t i) { return (float *)otama_mmap_mem(m_shm.norm) + i; }
+		inline C *color_at(int64_t i) { return (C *)otama_mmap_mem(m_shm.color) + i; }
+
+		/* not virtual, also called from the destructor */
+		void
+		close_columns(void)
+		{
+			if (m_shm.metadata) {
+				otama_mmap_close(&m_shm.metadata);
+			}
+			if (m_shm.bovw) {
+				otama_mmap_close(&m_shm.bovw);
+			}
+			if (m_shm.norm) {
+				otama_mmap_close(&m_shm.norm);
+			}
+			if (m_shm.color) {
+				otama_mmap_close(&m_shm.color);
+			}
+			m_metadata = NULL;
+			m_count = 0;
+			memset(&m_columns, 0, sizeof(m_columns));
+		}
+
+	public:
+		BOVWColumnStrage(const std::string &dir,
+						 const std::string &prefix = "m")
+		{
+			m_shm_dir = dir;
+			m_prefix = prefix;
+			m_metadata = NULL;
+			m_count = 0;
+			m_growth = FixedStrage<FT>::DEFAULT_GROWTH();
+			m_advice = 0;
+			m_warmup = false;
+			memset(&m_shm, 0, sizeof(m_shm));
+			memset(&m_columns, 0, sizeof(m_columns));
+		}
+
+		virtual
+		~BOVWColumnStrage()
+		{
+			close_columns();
+		}
+
+		otama_status_t
+		create(void)
+		{
+			otama_mmap_t *metadata_shm;
+			metadata_t *metadata;
+
+			if (create_column(metadata_name(), sizeof(metadata_t)) != 0
+				|| create_column(bovw_name(), bovw_len(DEFAULT_COUNT_MAX)) != 0
+				|| create_column(norm_name(), norm_len(DEFAULT_COUNT_MAX)) != 0
+				|| create_column(color_name(), color_len(DEFAULT_COUNT_MAX)) != 0)
+			{
+				return OTAMA_STATUS_SYSERROR;
+			}
+			if (open_column(&metadata_shm, metadata_name(), sizeof(metadata_t)) != 0) {
+				return OTAMA_STATUS_SYSERROR;
+			}
+			metadata = (metadata_t *)otama_mmap_mem(metadata_shm);
+			metadata->count_max = DEFAULT_COUNT_MAX;
+			metadata->count = 0;
+			otama_mmap_sync(metadata_shm);
+			otama_mmap_close(&metadata_shm);
+
+			return OTAMA_STATUS_OK;
+		}
+
+		otama_status_t
+		open(void)
+		{
+			int64_t count_max;
+
+			if (otama_mmap_open(&m_shm.metadata, m_shm_dir.c_str(),
+								metadata_name().c_str(), sizeof(metadata_t)) != 0)
+			{
+				close();
+				// file not found
+				return OTAMA_STATUS_SYSERROR;
+			}
+			m_metadata = (metadata_t *)otama_mmap_mem(m_shm.metadata);
+			count_max = m_metadata->count_max;
+			if (count_max == 0) {
+				close();
+				return OTAMA_STATUS_SYSERROR;
+			}
+			if (open_column(&m_shm.bovw, bovw_name(), bovw_len(count_max)) != 0
+				|| open_column(&m_shm.norm, norm_name(), norm_len(count_max)) != 0
+				|| open_column(&m_shm.color, color_name(), color_len(count_max)) != 0)
+			{
+				close();
+				return OTAMA_STATUS_SYSERROR;
+			}
+			update_columns();
+			m_count = m_metadata->count;
+			if (m_advice) {
+				otama_mmap_advise(m_shm.bovw, m_advice);
+				otama_mmap_advise(m_shm.norm, m_advice);
+				otama_mmap_advise(m_shm.color, m_advice);
+			}
+			if (m_warmup) {
+				otama_mmap_warmup(m_shm_dir.c_str(), bovw_name().c_str());
+			}
+
+			return OTAMA_STATUS_OK;
+		}
+
+		bool
+		is_active(void)
+		{
+			return m_metadata != NULL;
+		}
+
+		otama_status_t
+		close(void)
+		{
+			close_columns();
+
+			return OTAMA_STATUS_OK;
+		}
+
+		otama_status_t
+		sync(void)
+		{
+			if (m_metadata == NULL) {
+				return OTAMA_STATUS_SYSERROR;
+			}
+			otama_mmap_sync(m_shm.metadata);
+			otama_mmap_sync(m_shm.bovw);
+			otama_mmap_sync(m_shm.norm);
+			otama_mmap_sync(m_shm.color);
+			m_count = m_metadata->count;
+
+			if (otama_mmap_len(m_shm.norm) != norm_len(m_metadata->count_max)) {
+				// extended or replaced by another process
+				close();
+				return open();
+			}
+
+			return OTAMA_STATUS_OK;
+		}
+
+		/* same policy as FixedStrage::extend() */
+		otama_status_t
+		extend(int64_t s)
+		{
+			int64_t count = m_metadata->count_max;
+			int ret;
+
+			if (s < count) {
+				return OTAMA_STATUS_OK;
+			}
+			while (s >= count) {
+				count = NV_MAX(count + DEFAULT_COUNT_MAX, (int64_t)(count * m_growth));
+			}
+			ret = otama_mmap_extend(&m_shm.bovw, bovw_len(count));
+			ret |= otama_mmap_extend(&m_shm.norm, norm_len(count));
+			ret |= otama_mmap_extend(&m_shm.color, color_len(count));
+			if (ret != 0) {
+				return OTAMA_STATUS_SYSERROR;
+			}
+			m_metadata->count_max = count;
+			update_columns();
+
+			return OTAMA_STATUS_OK;
+		}
+
+		otama_status_t
+		unlink(void)
+		{
+			otama_status_t ret;
+
+			if (m_metadata) {
+				// tell the readers of the old files to reopen
+				m_metadata->count_max = 0;
+				otama_mmap_sync(m_shm.metadata);
+			}
+			close();
+			otama_mmap_unlink(m_shm_dir.c_str(), metadata_name().c_str());
+			otama_mmap_unlink(m_shm_dir.c_str(), bovw_name().c_str());
+			otama_mmap_unlink(m_shm_dir.c_str(), norm_name().c_str());
+			otama_mmap_unlink(m_shm_dir.c_str(), color_name().c_str());
+
+			ret = create();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			return open();
+		}
+
+		/* append new records from the row strage */
+		otama_status_t
+		update(FixedStrage<FT> &strage)
+		{
+			int64_t i, count = strage.count();
+			int64_t last_count = m_metadata->count;
+			otama_status_t ret;
+
+			if (count < last_count) {
+				// row strage was recreated
+				last_count = 0;
+			}
+			ret = extend(count);
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			if (count > last_count) {
+				OTAMA_LOG_DEBUG("columns: copy %"PRId64" records", count - last_count);
+			}
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+			for (i = last_count; i < count; ++i) {
+				const FT *vec = strage.vec_at(i);
+				memcpy(bovw_at(i), vec->bovw, sizeof(vec->bovw));
+				*norm_at(i) = vec->norm;
+				*color_at(i) = vec->boc;
+			}
+			m_metadata->count = count;
+
+			return sync();
+		}
+
+		int64_t
+		count(void)
+		{
+			return m_count;
+		}
+
+		inline void set_growth(double growth) { m_growth = growth; }
+		inline void set_advice(int flags) { m_advice = flags; }
+		inline void set_warmup(bool warmup) { m_warmup = warmup; }
+
+		/* -1 when unknown */
+		int64_t
+		resident_bytes(void)
+		{
+			int64_t bovw, norm, color;
+
+			if (m_metadata == NULL) {
+				return 0;
+			}
+			bovw = otama_mmap_resident(m_shm.bovw);
+			norm = otama_mmap_resident(m_shm.norm);
+			color = otama_mmap_resident(m_shm.color);
+			if (bovw < 0 || norm < 0 || color < 0) {
+				return -1;
+			}
+			return bovw + norm + color;
+		}
+
+		inline const columns_t &
+		columns(void)
+		{
+			return m_columns;
+		}
+	};
+}
+
+#endif
@@ -22,14 +22,23 @@
 #define OTAMA_BOVW_FIXED_DRIVER_HPP
 
 #include "otama_fixed_driver.hpp"
+#include "otama_bovw_column_strage.hpp"
+#include "otama_bovw_packed_strage.hpp"
+#include "otama_numa.h"
 #include "nv_bovw.hpp"
 #include <typeinfo>
 
 namespace otama
 {
-	template <nv_bovw_bit_e BIT, typename COLOR_CLASS>
+	/*
+	 * S is the strage of the records, FixedStrage<dense_t> or a
+	 * BOVWPackedStrage (see BOVWPackedFixedDriver).
+	 * the columns and the norm index are built from dense rows only.
+	 */
+	template <nv_bovw_bit_e BIT, typename COLOR_CLASS,
+			  typename S = FixedStrage<typename nv_bovw_ctx<BIT, COLOR_CLASS>::dense_t> >
 	class BOVWFixedDriver:
-		public FixedDriver<typename nv_bovw_ctx<BIT, COLOR_CLASS>::dense_t >
+		public FixedDriver<typename nv_bovw_ctx<BIT, COLOR_CLASS>::dense_t, S>
 	{
 	protected:
 		typedef nv_bovw_ctx<BIT, COLOR_CLASS> T;
@@ -42,10 +51,41 @@ namespace otama
 		
 		bool m_strip;
 		size_t m_fit_area;
+		float m_sparse_query_th;
+		int m_idf_levels;
+		int m_first_scale;
 		float m_color_weight;
 		nv_bovw_rerank_method_t m_rerank_method;
 		nv_matrix_t *m_color;
 		std::string m_idf_file;
+		bool m_columnar;
+		BOVWColumnStrage<T> *m_columns;
+		/*
+		 * the idf norms of the rows. a search holds a reference,
+		 * sync() builds a new one and swaps it under the lock,
+		 * the old one is freed by its last reader.
+		 * generation is the strage generation the rows were read from.
+		 */
+		typedef struct {
+			std::vector<float> norm;
+			int64_t generation;
+			int refs;
+		} idf_norm_t;
+		idf_norm_t *m_idf_norm;
+		bool m_norm_pruning;
+		/* the norm index of the rows, shared as idf_norm_t */
+		typedef struct {
+			typename T::norm_index_t index;
+			int64_t generation;
+			int refs;
+		} norm_index_t;
+		norm_index_t *m_norm_index;
+		int64_t m_generation;
+		int m_numa_nodes;
+		otama_numa_topology_t m_numa_topology;
+		bool m_numa_bind;
+		int64_t m_numa_count;
+		int64_t m_numa_placed;
 		T *m_ctx;
 
 		virtual FT *
@@ -141,40 +181,355 @@ namespace otama
 			otama_result_set_id(results, i, id);
 		}
 
-		virtual otama_status_t
-		feature_search(otama_result_t **results, int n,
-							 const FT *query,
-							 otama_variant_t *options)
+		static inline bool dense_rows(FixedStrage<FT> *rows) { return true; }
+		template <typename PT>
+		static inline bool dense_rows(BOVWPackedStrage<T, PT> *rows) { return false; }
+		
+		/* the record i, packed rows are unpacked into buf */
+		static inline const FT *
+		row(FixedStrage<FT> *rows, int64_t i, FT *buf)
+		{
+			return &rows->vec()[i];
+		}
+		template <typename PT>
+		static inline const FT *
+		row(BOVWPackedStrage<T, PT> *rows, int64_t i, FT *buf)
+		{
+			T::unpack(buf, &rows->rows()[i], rows->blob());
+			return buf;
+		}
+		
+		/* NULL when the norms of count rows of this generation are not ready */
+		idf_norm_t *
+		idf_norm_acquire(int64_t count)
+		{
+#ifdef _OPENMP
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
+#endif
+			if (m_idf_norm == NULL || count <= 0
+				|| (int64_t)m_idf_norm->norm.size() < count
+				|| m_idf_norm->generation != FixedDriver<FT, S>::m_mmap->generation())
+			{
+				return NULL;
+			}
+			++m_idf_norm->refs;
+			return m_idf_norm;
+		}
+		
+		void
+		idf_norm_release(idf_norm_t *idf_norm)
+		{
+#ifdef _OPENMP
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
+#endif
+			if (idf_norm != NULL && --idf_norm->refs == 0 && idf_norm != m_idf_norm) {
+				delete idf_norm;
+			}
+		}
+		
+		void
+		idf_norm_replace(idf_norm_t *idf_norm)
+		{
+#ifdef _OPENMP
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
+#endif
+			idf_norm_t *old = m_idf_norm;
+			
+			m_idf_norm = idf_norm;
+			if (old != NULL && old->refs == 0) {
+				delete old;
+			}
+		}
+		
+		static inline const float *
+		idf_norm_ptr(const idf_norm_t *idf_norm)
+		{
+			return idf_norm ? &idf_norm->norm[0] : NULL;
+		}
+		
+		void
+		update_idf_norm(bool reset = false)
+		{
+			const int64_t generation = this->m_mmap->generation();
+			int64_t last_count, count = this->m_mmap->count();
+			idf_norm_t *old, *idf_norm;
+			
+			if (m_rerank_method != NV_BOVW_RERANK_IDF || m_ctx == NULL) {
+				return;
+			}
+			if (reset) {
+				// the rows or the idf changed, searches compute the norms until the rebuild is done
+				idf_norm_replace(NULL);
+			}
+			old = idf_norm_acquire(1);
+			if (!reset && old != NULL && (int64_t)old->norm.size() == count) {
+				idf_norm_release(old);
+				return;
+			}
+			// the searches keep reading the old one while the new one is built
+			idf_norm = new idf_norm_t;
+			idf_norm->generation = generation;
+			idf_norm->refs = 0;
+			if (!reset && old != NULL && (int64_t)old->norm.size() < count) {
+				idf_norm->norm = old->norm;
+			}
+			idf_norm_release(old);
+			last_count = (int64_t)idf_norm->norm.size();
+			idf_norm->norm.resize((size_t)count);
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+			{
+				FT *buf = feature_new();
+				int64_t i;
+				
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 256)
+#endif
+				for (i = last_count; i < count; ++i) {
+					idf_norm->norm[(size_t)i] = m_ctx->idf_norm(row(this->m_mmap, i, buf));
+				}
+				feature_free(buf);
+			}
+			idf_norm_replace(idf_norm);
+		}
+		
+		/* NULL when there is no norm index of this generation */
+		norm_index_t *
+		norm_index_acquire(void)
+		{
+#ifdef _OPENMP
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
+#endif
+			if (m_norm_index == NULL
+				|| m_norm_index->generation != FixedDriver<FT, S>::m_mmap->generation())
+			{
+				return NULL;
+			}
+			++m_norm_index->refs;
+			return m_norm_index;
+		}
+		
+		void
+		norm_index_release(norm_index_t *norm_index)
+		{
+#ifdef _OPENMP
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
+#endif
+			if (norm_index != NULL && --norm_index->refs == 0 && norm_index != m_norm_index) {
+				delete norm_index;
+			}
+		}
+		
+		void
+		norm_index_replace(norm_index_t *norm_index)
+		{
+#ifdef _OPENMP
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
+#endif
+			norm_index_t *old = m_norm_index;
+			
+			m_norm_index = norm_index;
+			if (old != NULL && old->refs == 0) {
+				delete old;
+			}
+		}
+		
+		static inline const typename T::norm_index_t *
+		norm_index_ptr(const norm_index_t *norm_index)
+		{
+			return norm_index ? &norm_index->index : NULL;
+		}
+		
+		void
+		update_norm_index(bool reset = false)
+		{
+			const int64_t generation = this->m_mmap->generation();
+			const int64_t count = this->m_mmap->count();
+			norm_index_t *old, *norm_index;
+			
+			if (!m_norm_pruning) {
+				return;
+			}
+			if (reset) {
+				// searches scan without pruning until the rebuild is done
+				norm_index_replace(NULL);
+			}
+			old = norm_index_acquire();
+			if (old != NULL && (int64_t)old->index.order.size() == count) {
+				norm_index_release(old);
+				return;
+			}
+			// the searches keep walking the old one while the new one is built
+			norm_index = new norm_index_t;
+			norm_index->generation = generation;
+			norm_index->refs = 0;
+			if (old != NULL && (int64_t)old->index.order.size() < count) {
+				norm_index->index = old->index;
+			}
+			norm_index_release(old);
+			norm_index_update(norm_index->index, this->m_mmap);
+			norm_index_replace(norm_index);
+		}
+		
+		static void
+		norm_index_update(typename T::norm_index_t &norm_index, FixedStrage<FT> *rows)
+		{
+			T::norm_index_update(norm_index, rows->vec(), rows->count());
+		}
+		template <typename PT>
+		static void
+		norm_index_update(typename T::norm_index_t &norm_index,
+						  BOVWPackedStrage<T, PT> *rows)
+		{
+		}
+		
+		otama_status_t
+		columns_update(FixedStrage<FT> *rows)
+		{
+			return m_columns->update(*rows);
+		}
+		template <typename PT>
+		otama_status_t
+		columns_update(BOVWPackedStrage<T, PT> *rows)
+		{
+			return OTAMA_STATUS_OK;
+		}
+		
+		/* rebuilds the per-row caches when the rows were moved by vacuum_index */
+		void
+		update_caches(void)
+		{
+			const int64_t generation = FixedDriver<FT, S>::m_mmap->generation();
+			const bool reset = m_generation != generation;
+			
+			m_generation = generation;
+			update_idf_norm(reset);
+			update_norm_index(reset);
+			if (reset) {
+				m_numa_count = -1;
+			}
+			numa_place();
+		}
+		
+		static inline void
+		numa_place_rows(const void *rows, int64_t row_bytes,
+						int64_t begin, int64_t end, int node, bool bind)
+		{
+			char *p = (char *)rows + row_bytes * begin;
+			const int64_t len = row_bytes * (end - begin);
+			
+			if (bind) {
+				otama_numa_bind_memory(p, len, node);
+			} else {
+				otama_numa_touch(p, len);
+				otama_numa_move_memory(p, len, node);
+			}
+		}
+		
+		void
+		numa_place_strage(FixedStrage<FT> *rows, int64_t begin, int64_t end, int node)
+		{
+			numa_place_rows(rows->vec(), sizeof(FT), begin, end, node, m_numa_bind);
+		}
+		/* the blob is written in row order, the rows [begin, end) own one range of it */
+		template <typename PT>
+		void
+		numa_place_strage(BOVWPackedStrage<T, PT> *rows, int64_t begin, int64_t end, int node)
+		{
+			const PT *packed = rows->rows();
+			const int64_t blob_begin = packed[begin].offset;
+			const int64_t blob_end = packed[end - 1].offset + packed[end - 1].len;
+			
+			numa_place_rows(packed, sizeof(PT), begin, end, node, m_numa_bind);
+			if (blob_begin < blob_end) {
+				numa_place_rows(rows->blob(), 1, blob_begin, blob_end, node, m_numa_bind);
+			}
+		}
+		
+		/*
+		 * places the rows of each scan partition on its node, with mbind or
+		 * with a one-time move of the pages. the scan pins its threads itself.
+		 * node = partition % online nodes, so partitions can be simulated on one node.
+		 * a pull places only the appended rows. the partitions of the old rows
+		 * drift as the store grows, so all rows are placed again when it doubled.
+		 */
+		void
+		numa_place(void)
+		{
+#ifdef _OPENMP
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
+#endif
+			const int threads = nv_omp_procs();
+			const int partitions = NV_MIN(m_numa_nodes, threads);
+			const int nodes = m_numa_topology.nodes;
+			const int64_t count = FixedDriver<FT, S>::m_mmap->count();
+			int64_t from;
+			int t;
+			
+			if (partitions <= 1 || count == m_numa_count
+				|| (m_columns != NULL && m_columns->count() != count))
+			{
+				// columns are placed after they catch up in pull()
+				return;
+			}
+			if (m_numa_count < 0 || count < m_numa_count || count > m_numa_placed * 2) {
+				from = 0;
+				m_numa_placed = count;
+			} else {
+				from = m_numa_count;
+			}
+			m_numa_count = count;
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static, 1)
+#endif
+			for (t = 0; t < threads; ++t) {
+				int64_t begin, end;
+				const int node = T::numa_partition(t, threads, partitions, count, &begin, &end) % nodes;
+				
+				begin = NV_MAX(begin, from);
+				if (begin >= end) {
+					continue;
+				}
+				if (m_columns != NULL) {
+					const typename T::columns_t &columns = m_columns->columns();
+					numa_place_rows(columns.bovw, T::INT_BLOCKS * sizeof(uint64_t),
+									begin, end, node, m_numa_bind);
+					numa_place_rows(columns.norm, sizeof(float),
+									begin, end, node, m_numa_bind);
+				} else {
+					numa_place_strage(FixedDriver<FT, S>::m_mmap, begin, end, node);
+				}
+			}
+			OTAMA_LOG_DEBUG("numa: %d partitions on %d nodes, %"PRId64" - %"PRId64" records",
+							partitions, nodes, from, count);
+		}
+		
+		float
+		search_color_weight(otama_variant_t *options)
 		{
-			const int first_n = m_strip ? (n * CLUSTER_K / 2) : n;
-			nv_bovw_result_t *first_results = nv_alloc_type(nv_bovw_result_t, first_n);
-			int nresult = 0;
-			int i, j, results_size;
-			FT bovw = *query;
-			float color_weight = m_color_weight;
 			otama_variant_t *cw;
 			
 			if (OTAMA_VARIANT_IS_HASH(options)
 				&& !OTAMA_VARIANT_IS_NULL(cw = otama_variant_hash_at(options, "color_weight")))
 			{
-				color_weight = otama_variant_to_float(cw);
-			}
-			*results = otama_result_alloc(n);
-			nresult = m_ctx->search(first_results, first_n,
-									FixedDriver<FT>::m_mmap->vec(),
-									FixedDriver<FT>::m_mmap->count(),
-									&bovw,
-									m_rerank_method, color_weight);
-			
-			for (j = i = 0; j < nresult; ++j) {
-				if ((FixedDriver<FT>::m_mmap->flag_at(first_results[j].index) &
-					 FixedDriver<FT>::FLAG_DELETE) == 0)
-				{
-					first_results[i] = first_results[j];
-					++i;
-				}
+				return otama_variant_to_float(cw);
 			}
-			nresult = i;
+			return m_color_weight;
+		}
+		
+		inline int
+		search_first_n(int n)
+		{
+			return m_strip ? (n * CLUSTER_K / 2) : n;
+		}
+		
+		void
+		set_results(otama_result_t *results, int n,
+					nv_bovw_result_t *first_results, int nresult)
+		{
+			int i, results_size;
+			
 			if (nresult > CLUSTER_K && m_strip) {
 				int  max_k, step;
 				nv_matrix_t *similarity, *labels, *centroid, *count;
@@ -201,8 +556,8 @@ namespace otama
 				results_size = 0;
 				for (i = 0; i < nresult && i < n; ++i) {
 					if ((int)NV_MAT_V(labels, i, 0) == max_k) {
-						set_result(*results, results_size++,
-								   FixedDriver<FT>::m_mmap->id_at(first_results[i].index),
+						set_result(results, results_size++,
+								   FixedDriver<FT, S>::m_mmap->id_at(first_results[i].index),
 								   first_results[i].similarity);
 					} else {
 						break;
@@ -223,15 +578,15 @@ namespace otama
 						
 						for (i = results_size; i < nresult && i < n; ++i) {
 							if ((int)NV_MAT_V(labels, i, 0) == max_k) {
-								set_result(*results, results_size++,
-										   FixedDriver<FT>::m_mmap->id_at(first_results[i].index),
+								set_result(results, results_size++,
+										   FixedDriver<FT, S>::m_mmap->id_at(first_results[i].index),
 										   first_results[i].similarity);
 							} else {
 								break;
 							}
 						}
 					}
-					otama_result_set_count(*results, results_size);
+					otama_result_set_count(results, results_size);
 				}
 				nv_matrix_free(&similarity);
 				nv_matrix_free(&labels);
@@ -240,51 +595,223 @@ namespace otama
 			} else {
 				results_size = 0;
 				for (i = 0; i < nresult && i < n; ++i) {
-					set_result(*results, results_size++,
-							   FixedDriver<FT>::m_mmap->id_at(first_results[i].index),
+					set_result(results, results_size++,
+							   FixedDriver<FT, S>::m_mmap->id_at(first_results[i].index),
 							   first_results[i].similarity);
 				}
-				otama_result_set_count(*results, results_size);		
+				otama_result_set_count(results, results_size);		
 			}
-
+		}
+		
+		/* first_n of the cascade, 0: as the other searches */
+		virtual int
+		search_coarse_n(otama_variant_t *options)
+		{
+			return 0;
+		}
+		
+		int
+		search_rows(FixedStrage<FT> *rows,
+					nv_bovw_result_t *results, int k,
+					const FT *query, float color_weight,
+					const float *idf_norm, otama_variant_t *options)
+		{
+			norm_index_t *norm_index = m_norm_pruning ? norm_index_acquire() : NULL;
+			int nresult;
+			
+			if (m_columns != NULL && m_columns->count() == rows->count()) {
+				typename T::columns_t columns = m_columns->columns();
+				
+				columns.deleted = rows->deleted();
+				nresult = m_ctx->search(results, k,
+										columns, m_columns->count(),
+										query,
+										m_rerank_method, color_weight,
+										idf_norm,
+										norm_index_ptr(norm_index),
+										m_numa_nodes);
+			} else {
+				nresult = m_ctx->search(results, k,
+										rows->vec(), rows->count(),
+										query,
+										m_rerank_method, color_weight,
+										idf_norm,
+										norm_index_ptr(norm_index),
+										rows->deleted(),
+										m_numa_nodes);
+			}
+			norm_index_release(norm_index);
+			
+			return nresult;
+		}
+		
+		int
+		search_rows(BOVWPackedStrage<T, typename T::packed_t> *rows,
+					nv_bovw_result_t *results, int k,
+					const FT *query, float color_weight,
+					const float *idf_norm, otama_variant_t *options)
+		{
+			return m_ctx->search(results, k,
+								 rows->rows(), rows->blob(), rows->count(),
+								 query,
+								 m_rerank_method, color_weight,
+								 idf_norm,
+								 rows->deleted(),
+								 m_numa_nodes);
+		}
+		
+		int
+		search_rows(BOVWPackedStrage<T, typename T::cascade_t> *rows,
+					nv_bovw_result_t *results, int k,
+					const FT *query, float color_weight,
+					const float *idf_norm, otama_variant_t *options)
+		{
+			return m_ctx->search(results, k,
+								 rows->rows(), rows->blob(), rows->count(),
+								 query,
+								 m_rerank_method, color_weight,
+								 idf_norm,
+								 rows->deleted(),
+								 (int)NV_MIN((int64_t)search_coarse_n(options), rows->count()));
+		}
+		
+		void
+		search_batch_rows(FixedStrage<FT> *rows,
+						  nv_bovw_result_t **results, int *nresults, int k,
+						  const FT **queries, int nq,
+						  const float *color_weight,
+						  const float *idf_norm, otama_variant_t **options)
+		{
+			if (m_columns != NULL && m_columns->count() == rows->count()) {
+				typename T::columns_t columns = m_columns->columns();
+				
+				columns.deleted = rows->deleted();
+				m_ctx->search_batch(results, nresults, k,
+									columns, m_columns->count(),
+									queries, nq,
+									m_rerank_method, color_weight,
+									idf_norm);
+			} else {
+				m_ctx->search_batch(results, nresults, k,
+									rows->vec(), rows->count(),
+									queries, nq,
+									m_rerank_method, color_weight,
+									idf_norm,
+									rows->deleted());
+			}
+		}
+		
+		/* no shared scan over the packed rows, one search per query */
+		template <typename PT>
+		void
+		search_batch_rows(BOVWPackedStrage<T, PT> *rows,
+						  nv_bovw_result_t **results, int *nresults, int k,
+						  const FT **queries, int nq,
+						  const float *color_weight,
+						  const float *idf_norm, otama_variant_t **options)
+		{
+			int q;
+			
+			for (q = 0; q < nq; ++q) {
+				nresults[q] = search_rows(rows, results[q], k, queries[q],
+										  color_weight[q], idf_norm, options[q]);
+			}
+		}
+		
+		virtual otama_status_t
+		feature_search(otama_result_t **results, int n,
+							 const FT *query,
+							 otama_variant_t *options)
+		{
+			const int first_n = search_first_n(n);
+			nv_bovw_result_t *first_results = nv_alloc_type(nv_bovw_result_t, first_n);
+			int nresult = 0;
+			FT bovw = *query;
+			float color_weight = search_color_weight(options);
+			idf_norm_t *idf_norm = idf_norm_acquire(FixedDriver<FT, S>::m_mmap->count());
+			
+			*results = otama_result_alloc(n);
+			nresult = search_rows(FixedDriver<FT, S>::m_mmap,
+								  first_results, first_n, &bovw, color_weight,
+								  idf_norm_ptr(idf_norm), options);
+			idf_norm_release(idf_norm);
+			set_results(*results, n, first_results, nresult);
 			nv_free(first_results);
 	
 			return OTAMA_STATUS_OK;
 		}
+		
+		virtual otama_status_t
+		feature_search_batch(otama_result_t **results, int n,
+							 const FT **queries, int nq,
+							 otama_variant_t **options)
+		{
+			const int first_n = search_first_n(n);
+			nv_bovw_result_t *first_results = nv_alloc_type(nv_bovw_result_t, first_n * nq);
+			std::vector<nv_bovw_result_t *> first_results_q(nq);
+			std::vector<int> nresults(nq);
+			std::vector<float> color_weight(nq);
+			idf_norm_t *idf_norm = idf_norm_acquire(FixedDriver<FT, S>::m_mmap->count());
+			int q;
+			
+			for (q = 0; q < nq; ++q) {
+				first_results_q[q] = first_results + (int64_t)first_n * q;
+				color_weight[q] = search_color_weight(options[q]);
+			}
+			search_batch_rows(FixedDriver<FT, S>::m_mmap,
+							  &first_results_q[0], &nresults[0], first_n,
+							  queries, nq, &color_weight[0],
+							  idf_norm_ptr(idf_norm), options);
+			idf_norm_release(idf_norm);
+			for (q = 0; q < nq; ++q) {
+				results[q] = otama_result_alloc(n);
+				set_results(results[q], n, first_results_q[q], nresults[q]);
+			}
+			nv_free(first_results);
+			
+			return OTAMA_STATUS_OK;
+		}
 
-		void update_idf(otama_variant_t *value)
+		/* document frequency of the words */
+		void
+		word_freq(nv_matrix_t *freq)
 		{
-			int stopword_th = 0;
 			int64_t i, count = this->m_mmap->count();
-			nv_matrix_t *freq = nv_matrix_alloc(T::BIT, 1);
 			nv_matrix_t *vec = nv_matrix_alloc(T::BIT, 1);
-			const FT *db = this->m_mmap->vec();
+			FT *buf = feature_new();
 			
-			if (value) {
-				stopword_th = (int)otama_variant_to_int(value);
-			}
 			nv_matrix_zero(freq);
-			
 			for (i = 0; i < count; ++i) {
-				m_ctx->decode(vec, 0, &db[i]);
+				m_ctx->decode(vec, 0, row(this->m_mmap, i, buf));
 				nv_vector_add(freq, 0, freq, 0, vec, 0);
 			}
-			m_ctx->update_idf(freq, 0, count, stopword_th);
+			feature_free(buf);
+			nv_matrix_free(&vec);
+		}
+		
+		void update_idf(otama_variant_t *value)
+		{
+			int stopword_th = 0;
+			nv_matrix_t *freq = nv_matrix_alloc(T::BIT, 1);
+			
+			if (value) {
+				stopword_th = (int)otama_variant_to_int(value);
+			}
+			word_freq(freq);
+			m_ctx->update_idf(freq, 0, this->m_mmap->count(), stopword_th);
+			update_idf_norm(true);
 			
 			nv_matrix_free(&freq);
-			nv_matrix_free(&vec);
 		}
 		
 		otama_status_t
 		save_idf(otama_variant_t *argv)
 		{
 			int64_t stopword_th = 0, feature_count = 0;
-			int64_t i, count = this->m_mmap->count();
-			const FT *db = this->m_mmap->vec();			
+			int64_t i;
 			char filename[8192] = "./idf.matb";
 			nv_matrix_t *freq = nv_matrix_alloc(T::BIT, 1);
 			nv_matrix_t *idf = nv_matrix_alloc(T::BIT, 1);
-			nv_matrix_t *vec = nv_matrix_alloc(T::BIT, 1);
 			otama_status_t ret = OTAMA_STATUS_OK;
 			if (OTAMA_VARIANT_IS_HASH(argv)) {
 				otama_variant_t *file = otama_variant_hash_at(argv, "filename");
@@ -298,12 +825,8 @@ namespace otama
 			} else {
 				strncpy(filename, otama_variant_to_string(argv), sizeof(filename)-1);
 			}
-			nv_matrix_zero(freq);
-			for (i = 0; i < count; ++i) {
-				m_ctx->decode(vec, 0, &db[i]);
-				nv_vector_add(freq, 0, freq, 0, vec, 0);
-			}
-			m_ctx->calc_idf(idf, 0, freq, 0, count, stopword_th);
+			word_freq(freq);
+			m_ctx->calc_idf(idf, 0, freq, 0, this->m_mmap->count(), stopword_th);
 			for (i = 0; i < idf->n; ++i) {
 				if (NV_MAT_V(idf, 0, i) > 0.0f) {
 					feature_count += 1;
@@ -318,7 +841,6 @@ namespace otama
 			}
 			nv_matrix_free(&freq);
 			nv_matrix_free(&idf);
-			nv_matrix_free(&vec);
 			
 			return ret;
 		}
@@ -337,17 +859,32 @@ namespace otama
 		}
 		
 		BOVWFixedDriver(otama_variant_t *options)
-			: FixedDriver<FT>(options)
+			: FixedDriver<FT, S>(options)
 		{
 			otama_variant_t *driver, *value;
 			
 			m_fit_area = 0;
+			m_sparse_query_th = T::DEFAULT_SPARSE_QUERY_TH();
+			m_idf_levels = 0;
+			m_first_scale = T::DEFAULT_FIRST_SCALE;
 			m_color = nv_matrix_alloc(3, 1);
 			m_color_weight = DEFAULT_COLOR_WEIGHT();
 			m_strip = false;
 			m_rerank_method = NV_BOVW_RERANK_IDF;
 			m_ctx = NULL;
 			m_idf_file.clear();
+			m_columnar = false;
+			m_columns = NULL;
+			m_idf_norm = NULL;
+			m_norm_pruning = false;
+			m_norm_index = NULL;
+			m_generation = 0;
+			m_numa_nodes = 0;
+			memset(&m_numa_topology, 0, sizeof(m_numa_topology));
+			m_numa_topology.nodes = 1;
+			m_numa_bind = false;
+			m_numa_count = -1;
+			m_numa_placed = 0;
 			
 			driver = otama_variant_hash_at(options, "driver");
 			if (OTAMA_VARIANT_IS_HASH(driver)) {
@@ -370,13 +907,59 @@ namespace otama
 				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "fit_area"))) {
 					m_fit_area = otama_variant_to_int(value);
 				}
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "sparse_query_th"))) {
+					m_sparse_query_th = otama_variant_to_float(value);
+				}
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "idf_levels"))) {
+					// 0: bit cosine, 1-4: quantized idf in the first stage
+					m_idf_levels = (int)otama_variant_to_int(value);
+				}
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "first_scale"))) {
+					m_first_scale = (int)otama_variant_to_int(value);
+				}
 				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "idf_file"))) {
 					m_idf_file.assign(otama_variant_to_string(value));
 				}
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "columnar"))) {
+					m_columnar = otama_variant_to_bool(value) ? true : false;
+				}
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "norm_pruning"))) {
+					m_norm_pruning = otama_variant_to_bool(value) ? true : false;
+				}
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "numa_nodes"))) {
+					// -1: online nodes
+					m_numa_nodes = (int)otama_variant_to_int(value);
+					if (m_numa_nodes < 0) {
+						m_numa_nodes = otama_numa_nodes();
+					}
+				}
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "numa_policy"))) {
+					const char *s = otama_variant_to_string(value);
+					if (nv_strcasecmp(s, "bind") == 0) {
+						m_numa_bind = true;
+					} else if (nv_strcasecmp(s, "first_touch") == 0) {
+						m_numa_bind = false;
+					} else {
+						OTAMA_LOG_NOTICE("invalid numa_policy `%s'", s);
+					}
+				}
+			}
+			
+			if (!dense_rows((S *)NULL) && (m_columnar || m_norm_pruning)) {
+				OTAMA_LOG_NOTICE("%s", "columnar and norm_pruning need the dense records, ignored");
+				m_columnar = false;
+				m_norm_pruning = false;
 			}
 			
 			OTAMA_LOG_DEBUG("driver[color_weight] => %f", m_color_weight);
 			OTAMA_LOG_DEBUG("driver[strip] => %d", m_strip ? 1 : 0);
+			OTAMA_LOG_DEBUG("driver[columnar] => %d", m_columnar ? 1 : 0);
+			OTAMA_LOG_DEBUG("driver[norm_pruning] => %d", m_norm_pruning ? 1 : 0);
+			OTAMA_LOG_DEBUG("driver[sparse_query_th] => %f", m_sparse_query_th);
+			OTAMA_LOG_DEBUG("driver[idf_levels] => %d", m_idf_levels);
+			OTAMA_LOG_DEBUG("driver[first_scale] => %d", m_first_scale);
+			OTAMA_LOG_DEBUG("driver[numa_nodes] => %d", m_numa_nodes);
+			OTAMA_LOG_DEBUG("driver[numa_policy] => %s", m_numa_bind ? "bind" : "first_touch");
 			switch (m_rerank_method) {
 			case NV_BOVW_RERANK_IDF:
 				OTAMA_LOG_DEBUG("driver[rerank_method] => %s", "idf");
@@ -387,6 +970,9 @@ namespace otama
 			}
 		}
 		~BOVWFixedDriver() {
+			close();
+			delete m_idf_norm;
+			delete m_norm_index;
 			nv_matrix_free(&m_color);
 			delete m_ctx;
 		}
@@ -396,7 +982,7 @@ namespace otama
 		{
 			otama_status_t ret;
 			
-			ret = FixedDriver<FT>::open();
+			ret = FixedDriver<FT, S>::open();
 			if (ret != OTAMA_STATUS_OK) {
 				return ret;
 			}
@@ -411,15 +997,141 @@ namespace otama
 				}
 			}
 			m_ctx->set_fit_area(m_fit_area);
+			m_ctx->set_sparse_query_th(m_sparse_query_th);
+			m_ctx->set_idf_levels(m_idf_levels);
+			m_ctx->set_first_scale(m_first_scale);
+			if (m_numa_nodes > 1) {
+				otama_numa_topology(&m_numa_topology);
+				m_ctx->set_numa_topology(&m_numa_topology);
+			}
+			
+			if (m_columnar) {
+				m_columns = new BOVWColumnStrage<T>(this->data_dir(), this->table_name());
+				m_columns->set_growth(FixedDriver<FT, S>::m_mmap_growth);
+				m_columns->set_advice(FixedDriver<FT, S>::m_mmap_advice);
+				m_columns->set_warmup(FixedDriver<FT, S>::m_mmap_warmup);
+				if (m_columns->open() != OTAMA_STATUS_OK) {
+					if (m_columns->create() != OTAMA_STATUS_OK) {
+						return OTAMA_STATUS_SYSERROR;
+					}
+					if (m_columns->open() != OTAMA_STATUS_OK) {
+						return OTAMA_STATUS_SYSERROR;
+					}
+				}
+				// migrate records from the existing vector file
+				if (columns_update(FixedDriver<FT, S>::m_mmap) != OTAMA_STATUS_OK) {
+					return OTAMA_STATUS_SYSERROR;
+				}
+			}
+			m_generation = FixedDriver<FT, S>::m_mmap->generation();
+			update_idf_norm();
+			update_norm_index(true);
+			numa_place();
 			
 			return OTAMA_STATUS_OK;
 		}
+		
+		virtual otama_status_t
+		close(void)
+		{
+			if (m_columns) {
+				m_columns->close();
+				delete m_columns;
+				m_columns = NULL;
+			}
+			return FixedDriver<FT, S>::close();
+		}
+		
+		virtual otama_status_t
+		sync(void)
+		{
+			otama_status_t ret = FixedDriver<FT, S>::sync();
+			if (ret == OTAMA_STATUS_OK && m_columns) {
+				ret = m_columns->sync();
+			}
+			update_caches();
+			
+			return ret;
+		}
+		
+		virtual otama_status_t
+		pull(void)
+		{
+			otama_status_t ret;
+#ifdef _OPENMP
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
+#endif
+			const int64_t generation = FixedDriver<FT, S>::m_mmap->generation();
+			
+			ret = FixedDriver<FT, S>::pull();
+			if (ret == OTAMA_STATUS_OK && m_columns) {
+				if (generation != FixedDriver<FT, S>::m_mmap->generation()) {
+					// undeleted records were restored
+					ret = m_columns->unlink();
+				}
+				if (ret == OTAMA_STATUS_OK) {
+					ret = columns_update(FixedDriver<FT, S>::m_mmap);
+				}
+			}
+			numa_place();
+			
+			return ret;
+		}
+		
+		virtual otama_status_t
+		vacuum_index(void)
+		{
+			otama_status_t ret;
+#ifdef _OPENMP
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
+#endif
+			ret = FixedDriver<FT, S>::vacuum_index();
+			if (ret == OTAMA_STATUS_OK && m_columns) {
+				ret = m_columns->unlink();
+				if (ret == OTAMA_STATUS_OK) {
+					ret = columns_update(FixedDriver<FT, S>::m_mmap);
+				}
+			}
+			update_caches();
+			
+			return ret;
+		}
+		
+		virtual otama_status_t
+		drop_database(void)
+		{
+			otama_status_t ret;
+#ifdef _OPENMP
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
+#endif
+			ret = FixedDriver<FT, S>::drop_database();
+			if (ret == OTAMA_STATUS_OK && m_columns) {
+				ret = m_columns->unlink();
+			}
+			update_norm_index(true);
+			return ret;
+		}
+		
+		virtual otama_status_t
+		drop_index(void)
+		{
+			otama_status_t ret;
+#ifdef _OPENMP
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
+#endif
+			ret = FixedDriver<FT, S>::drop_index();
+			if (ret == OTAMA_STATUS_OK && m_columns) {
+				ret = m_columns->unlink();
+			}
+			update_norm_index(true);
+			return ret;
+		}
 
 		virtual otama_status_t
 		set(const std::string &key, otama_variant_t *value)
 		{
 #ifdef _OPENMP
-			OMPLock lock(FixedDriver<FT>::m_lock);
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
 #endif
 			OTAMA_LOG_DEBUG("set key: %s\n", key.c_str());
 			
@@ -430,7 +1142,20 @@ namespace otama
 				m_strip = otama_variant_to_bool(value) ? true : false;
 				return OTAMA_STATUS_OK;
 			}
-			return FixedDriver<FT>::set(key, value);
+			return FixedDriver<FT, S>::set(key, value);
+		}
+		
+		virtual int64_t
+		resident_bytes(void)
+		{
+			int64_t rows = FixedDriver<FT, S>::resident_bytes();
+			int64_t columns;
+			
+			if (m_columns == NULL || rows < 0) {
+				return rows;
+			}
+			columns = m_columns->resident_bytes();
+			return columns < 0 ? -1 : rows + columns;
 		}
 		
 		virtual otama_status_t
@@ -438,20 +1163,20 @@ namespace otama
 			otama_variant_t *value)
 		{
 #ifdef _OPENMP
-			OMPLock lock(FixedDriver<FT>::m_lock);
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
 #endif
 			if (key == "color_weight") {
 				otama_variant_set_float(value, m_color_weight);
 				return OTAMA_STATUS_OK;
 			}
-			return FixedDriver<FT>::get(key, value);
+			return FixedDriver<FT, S>::get(key, value);
 		}
 		
 		virtual otama_status_t
 		unset(const std::string &key)
 		{
 #ifdef _OPENMP
-			OMPLock lock(FixedDriver<FT>::m_lock);
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
 #endif
 			OTAMA_LOG_DEBUG("unset key: %s\n", key.c_str());
 			if (key == "color_weight") {
@@ -462,7 +1187,7 @@ namespace otama
 				return OTAMA_STATUS_OK;
 			}
 			
-			return FixedDriver<FT>::unset(key);
+			return FixedDriver<FT, S>::unset(key);
 		}
 
 
@@ -472,7 +1197,7 @@ namespace otama
 			   otama_variant_t *input)
 		{
 #ifdef _OPENMP
-			OMPLock lock(FixedDriver<FT>::m_lock);
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
 #endif
 			OTAMA_LOG_DEBUG("invoke: %s\n", method.c_str());
 			
@@ -485,7 +1210,7 @@ namespace otama
 				otama_variant_set_null(output);
 				return ret;
 			}
-			return FixedDriver<FT>::invoke(method, output, input);
+			return FixedDriver<FT, S>::invoke(method, output, input);
 		}
 	};
 }
@@ -0,0 +1,75 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_config.h"
+#ifndef OTAMA_BOVW_PACKED_FIXED_DRIVER_HPP
+#define OTAMA_BOVW_PACKED_FIXED_DRIVER_HPP
+
+#include "otama_bovw_fixed_driver.hpp"
+
+namespace otama
+{
+	/*
+	 * BOVWFixedDriver with the records stored as delta/VByte coded word ids.
+	 * about 3.6KB per 512k record instead of 64KB.
+	 * PT is the row type of the strage, see BOVWCascadeFixedDriver.
+	 */
+	template <nv_bovw_bit_e BIT, typename COLOR_CLASS,
+			  typename PT = typename nv_bovw_ctx<BIT, COLOR_CLASS>::packed_t>
+	class BOVWPackedFixedDriver:
+		public BOVWFixedDriver<BIT, COLOR_CLASS,
+							   BOVWPackedStrage<nv_bovw_ctx<BIT, COLOR_CLASS>, PT> >
+	{
+	protected:
+		typedef nv_bovw_ctx<BIT, COLOR_CLASS> T;
+		typedef BOVWFixedDriver<BIT, COLOR_CLASS, BOVWPackedStrage<T, PT> > B;
+		
+	public:
+		virtual std::string
+		name(void)
+		{
+			if (typeid(COLOR_CLASS) == typeid(nv_color_sboc_t)) {
+				return this->prefixed_name(std::string("otama_bovw") + B::itos(BIT/1024) + "k_packed_sboc");
+			} else {
+				return this->prefixed_name(std::string("otama_bovw") + B::itos(BIT/1024) + "k_packed");
+			}
+		}
+
+		BOVWPackedFixedDriver(otama_variant_t *options)
+			: B(options)
+		{
+		}
+
+		virtual otama_status_t
+		get(const std::string &key,
+			otama_variant_t *value)
+		{
+			if (key == "blob_bytes") {
+#ifdef _OPENMP
+				OMPLock lock(this->m_lock);
+#endif
+				otama_variant_set_int(value, this->m_mmap->blob_used());
+				return OTAMA_STATUS_OK;
+			}
+			return B::get(key, value);
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,584 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_config.h"
+#ifndef OTAMA_BOVW_PACKED_STRAGE_HPP
+#define OTAMA_BOVW_PACKED_STRAGE_HPP
+
+#include "nv_core.h"
+#include "otama_log.h"
+#include "otama_mmap.h"
+#include "otama_fixed_strage.hpp"
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace otama
+{
+	/*
+	 * FixedStrage<T::dense_t> interface over sparse records.
+	 * the rows are FixedStrage<PT> headers and the body of each record is
+	 * appended to a blob file by T::pack(), the word ids for T::packed_t
+	 * and the full dense_t for T::cascade_t.
+	 * the blob is written in row order, vacuum() writes a new one with the
+	 * rows it keeps.
+	 */
+	template<class T, class PT = typename T::packed_t>
+	class BOVWPackedStrage
+	{
+	private:
+		typedef typename T::dense_t FT;
+
+		static const int64_t DEFAULT_BLOB_BYTES = 16 * 1024 * 1024;
+
+		typedef struct {
+			int64_t capacity;
+			int64_t used;
+		} blob_metadata_t;
+		
+		typedef typename FixedStrage<PT>::record_t row_record_t;
+		
+		/* vacuum() moves the live rows to the offsets of the new blob */
+		struct vacuum_offset_t {
+			const std::vector<int64_t> &offsets;
+			vacuum_offset_t(const std::vector<int64_t> &o)
+				: offsets(o) {}
+			inline void
+			operator()(PT &vec, int64_t index) const
+			{
+				vec.offset = offsets[(size_t)index];
+			}
+		};
+		
+		typedef struct {
+			int64_t offset;
+			const uint8_t *src;
+			int32_t len;
+		} blob_copy_t;
+
+		FixedStrage<PT> m_rows;
+		otama_mmap_t *m_blob_metadata_shm;
+		otama_mmap_t *m_blob_shm;
+		blob_metadata_t *m_blob_metadata;
+		std::vector<uint8_t> m_buf;
+		std::string m_shm_dir, m_prefix;
+		double m_growth;
+		int m_advice;
+		bool m_warmup;
+
+		inline std::string blob_metadata_name(void) { return m_prefix + "_blob_metadata"; }
+		inline std::string blob_name(void) { return m_prefix + "_blob"; }
+
+		static inline bool
+		row_record_less(const row_record_t &r1, const row_record_t &r2)
+		{
+			return r1.seq < r2.seq;
+		}
+
+		/* suffix: the new files of vacuum() */
+		otama_status_t
+		create_blob(const std::string &suffix = "",
+					int64_t capacity = DEFAULT_BLOB_BYTES, int64_t used = 0)
+		{
+			otama_mmap_t *metadata_shm;
+			blob_metadata_t *metadata;
+
+			if (otama_mmap_create(m_shm_dir.c_str(), (blob_metadata_name() + suffix).c_str(),
+								  sizeof(blob_metadata_t)) != 0)
+			{
+				OTAMA_LOG_ERROR("shm_create: %s", (blob_metadata_name() + suffix).c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+			if (otama_mmap_create(m_shm_dir.c_str(), (blob_name() + suffix).c_str(),
+								  capacity) != 0)
+			{
+				OTAMA_LOG_ERROR("shm_create: %s", (blob_name() + suffix).c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+			if (otama_mmap_open(&metadata_shm, m_shm_dir.c_str(),
+								(blob_metadata_name() + suffix).c_str(),
+								sizeof(blob_metadata_t)) != 0)
+			{
+				OTAMA_LOG_ERROR("shm_open failed: %s", (blob_metadata_name() + suffix).c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+			metadata = (blob_metadata_t *)otama_mmap_mem(metadata_shm);
+			metadata->capacity = capacity;
+			metadata->used = used;
+			otama_mmap_sync(metadata_shm);
+			otama_mmap_close(&metadata_shm);
+
+			return OTAMA_STATUS_OK;
+		}
+
+		otama_status_t
+		open_blob(void)
+		{
+			if (otama_mmap_open(&m_blob_metadata_shm, m_shm_dir.c_str(),
+								blob_metadata_name().c_str(), sizeof(blob_metadata_t)) != 0)
+			{
+				return OTAMA_STATUS_SYSERROR;
+			}
+			m_blob_metadata = (blob_metadata_t *)otama_mmap_mem(m_blob_metadata_shm);
+			if (m_blob_metadata->capacity == 0) {
+				close_blob();
+				return OTAMA_STATUS_SYSERROR;
+			}
+			if (otama_mmap_open(&m_blob_shm, m_shm_dir.c_str(),
+								blob_name().c_str(), m_blob_metadata->capacity) != 0)
+			{
+				close_blob();
+				OTAMA_LOG_ERROR("shm_open failed: %s", blob_name().c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+			if (m_advice) {
+				otama_mmap_advise(m_blob_shm, m_advice);
+			}
+			if (m_warmup) {
+				otama_mmap_warmup(m_shm_dir.c_str(), blob_name().c_str());
+			}
+
+			return OTAMA_STATUS_OK;
+		}
+
+		void
+		close_blob(void)
+		{
+			if (m_blob_metadata_shm) {
+				otama_mmap_close(&m_blob_metadata_shm);
+			}
+			if (m_blob_shm) {
+				otama_mmap_close(&m_blob_shm);
+			}
+			m_blob_metadata = NULL;
+		}
+
+		otama_status_t
+		extend_blob(int64_t len)
+		{
+			int64_t capacity = m_blob_metadata->capacity;
+
+			if (len <= capacity) {
+				return OTAMA_STATUS_OK;
+			}
+			while (len > capacity) {
+				capacity = NV_MAX(capacity + DEFAULT_BLOB_BYTES, (int64_t)(capacity * m_growth));
+			}
+			OTAMA_LOG_DEBUG("blob exceed. capacity=%"PRId64" => %"PRId64,
+							m_blob_metadata->capacity, capacity);
+			if (otama_mmap_extend(&m_blob_shm, capacity) != 0) {
+				return OTAMA_STATUS_SYSERROR;
+			}
+			m_blob_metadata->capacity = capacity;
+
+			return OTAMA_STATUS_OK;
+		}
+
+		/*
+		 * writes the word ids of vec for the row i right after the row i - 1,
+		 * so the tail of a batch that was not committed is written over.
+		 */
+		otama_status_t
+		append(int64_t i, PT *packed, const FT *vec)
+		{
+			const PT *prev = i > 0 ? &m_rows.vec()[i - 1] : NULL;
+			otama_status_t ret;
+
+			T::pack(m_buf, packed, vec);
+			packed->offset = prev != NULL ? prev->offset + prev->len : 0;
+			ret = extend_blob(packed->offset + packed->len);
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			if (!m_buf.empty()) {
+				memcpy((uint8_t *)otama_mmap_mem(m_blob_shm) + packed->offset,
+					   &m_buf[0], m_buf.size());
+			}
+			m_blob_metadata->used = packed->offset + packed->len;
+
+			return OTAMA_STATUS_OK;
+		}
+		
+		/* the rows of the new blob in vacuum(), restore[k].vec.offset is in staging */
+		int64_t
+		vacuum_plan(std::vector<blob_copy_t> &copies,
+					std::vector<int64_t> &offsets,
+					std::vector<row_record_t> &restore,
+					const std::vector<uint8_t> &staging)
+		{
+			const int64_t count = m_rows.count();
+			const int64_t nrestore = (int64_t)restore.size();
+			const PT *packed = m_rows.vec();
+			int64_t i, k, used = 0;
+			blob_copy_t copy;
+			
+			// the same order as FixedStrage::vacuum(), a live row wins over a restored one
+			offsets.assign((size_t)count, 0);
+			for (i = k = 0; i < count || k < nrestore;) {
+				if (i < count && m_rows.deleted_at(i)) {
+					++i;
+				} else if (k == nrestore
+						   || (i < count && m_rows.seq_at(i) < restore[k].seq))
+				{
+					copy.offset = offsets[(size_t)i] = used;
+					copy.src = blob() + packed[i].offset;
+					copy.len = packed[i].len;
+					copies.push_back(copy);
+					used += copy.len;
+					++i;
+				} else if (i < count && m_rows.seq_at(i) == restore[k].seq) {
+					++k;
+				} else {
+					copy.src = staging.empty() ? NULL : &staging[0] + restore[k].vec.offset;
+					copy.offset = restore[k].vec.offset = used;
+					copy.len = restore[k].vec.len;
+					copies.push_back(copy);
+					used += copy.len;
+					++k;
+				}
+			}
+			return used;
+		}
+
+	public:
+		static inline double DEFAULT_GROWTH() { return FixedStrage<PT>::DEFAULT_GROWTH(); }
+
+		/* a record restored by vacuum() */
+		typedef struct {
+			int64_t seq;
+			otama_id_t id;
+			FT vec;
+		} record_t;
+
+		BOVWPackedStrage(const std::string &dir,
+						 const std::string &prefix = "m")
+			: m_rows(dir, prefix)
+		{
+			m_shm_dir = dir;
+			m_prefix = prefix;
+			m_blob_metadata_shm = NULL;
+			m_blob_shm = NULL;
+			m_blob_metadata = NULL;
+			m_growth = DEFAULT_GROWTH();
+			m_advice = 0;
+			m_warmup = false;
+
+			// not compatible with the files of FixedStrage<dense_t>
+			m_rows.metadata_name(m_prefix + "_packed_metadata");
+			m_rows.index_name(m_prefix + "_packed_index");
+			m_rows.vector_name(m_prefix + "_packed_vector");
+			m_rows.deleted_name(m_prefix + "_packed_deleted");
+			// the new blob of vacuum() is renamed with the new rows
+			m_rows.companion_name(blob_metadata_name());
+			m_rows.companion_name(blob_name());
+		}
+
+		virtual
+		~BOVWPackedStrage()
+		{
+			close();
+		}
+
+		otama_status_t
+		create(void)
+		{
+			otama_status_t ret = m_rows.create();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			return create_blob();
+		}
+
+		otama_status_t
+		open(void)
+		{
+			otama_status_t ret = m_rows.open();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			ret = open_blob();
+			if (ret != OTAMA_STATUS_OK) {
+				m_rows.close();
+			}
+			return ret;
+		}
+
+		bool
+		is_active(void)
+		{
+			return m_rows.is_active() && m_blob_metadata != NULL;
+		}
+
+		otama_status_t
+		close(void)
+		{
+			close_blob();
+			return m_rows.close();
+		}
+
+		otama_status_t
+		sync(void)
+		{
+			const int64_t generation = m_rows.generation();
+			otama_status_t ret = m_rows.sync();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			if (m_blob_metadata == NULL) {
+				return open_blob();
+			}
+			if (generation != m_rows.generation()) {
+				// the rows were replaced by vacuum(), so was the blob
+				close_blob();
+				return open_blob();
+			}
+			otama_mmap_sync(m_blob_metadata_shm);
+			otama_mmap_sync(m_blob_shm);
+			if (otama_mmap_len(m_blob_shm) != m_blob_metadata->capacity) {
+				// extended or replaced by unlink()
+				close_blob();
+				return open_blob();
+			}
+
+			return OTAMA_STATUS_OK;
+		}
+
+		otama_status_t
+		unlink(void)
+		{
+			otama_status_t ret;
+
+			// rows first, the old blob stays valid for the old rows
+			ret = m_rows.unlink();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			if (m_blob_metadata) {
+				// tell the readers of the old blob to reopen
+				m_blob_metadata->capacity = 0;
+				otama_mmap_sync(m_blob_metadata_shm);
+			}
+			close_blob();
+			otama_mmap_unlink(m_shm_dir.c_str(), blob_metadata_name().c_str());
+			otama_mmap_unlink(m_shm_dir.c_str(), blob_name().c_str());
+			ret = create_blob();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			return open_blob();
+		}
+
+		/*
+		 * writes the blob of the live rows and restore into new files,
+		 * FixedStrage<PT>::vacuum() renames them with the rows.
+		 * NOT_IMPLEMENTED on Windows, a mapped file can not be replaced.
+		 */
+		otama_status_t
+		vacuum(std::vector<record_t> &restore, int64_t *reclaimed_bytes)
+		{
+#if OTAMA_WINDOWS
+			*reclaimed_bytes = 0;
+			return OTAMA_STATUS_NOT_IMPLEMENTED;
+#else
+			const std::string suffix = FixedStrage<PT>::VACUUM_SUFFIX();
+			std::vector<row_record_t> rows(restore.size());
+			std::vector<uint8_t> staging;
+			std::vector<blob_copy_t> copies;
+			std::vector<int64_t> offsets;
+			otama_mmap_t *new_blob;
+			uint8_t *dest;
+			int64_t used, capacity, old_capacity, rows_reclaimed, j;
+			otama_status_t ret;
+			size_t k;
+
+			// the restored records are packed at their offsets of staging
+			for (k = 0; k < restore.size(); ++k) {
+				T::pack(m_buf, &rows[k].vec, &restore[k].vec);
+				rows[k].vec.offset = (int64_t)staging.size();
+				rows[k].seq = restore[k].seq;
+				rows[k].id = restore[k].id;
+				staging.insert(staging.end(), m_buf.begin(), m_buf.end());
+			}
+			std::sort(rows.begin(), rows.end(), row_record_less);
+			used = vacuum_plan(copies, offsets, rows, staging);
+			capacity = NV_MAX(used, (int64_t)DEFAULT_BLOB_BYTES);
+			
+			ret = create_blob(suffix, capacity, used);
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			if (otama_mmap_open(&new_blob, m_shm_dir.c_str(),
+								(blob_name() + suffix).c_str(), capacity) != 0)
+			{
+				OTAMA_LOG_ERROR("shm_open failed: %s", (blob_name() + suffix).c_str());
+				otama_mmap_unlink(m_shm_dir.c_str(), (blob_metadata_name() + suffix).c_str());
+				otama_mmap_unlink(m_shm_dir.c_str(), (blob_name() + suffix).c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+			dest = (uint8_t *)otama_mmap_mem(new_blob);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 256)
+#endif
+			for (j = 0; j < (int64_t)copies.size(); ++j) {
+				const blob_copy_t &copy = copies[(size_t)j];
+				if (copy.len > 0) {
+					memcpy(dest + copy.offset, copy.src, (size_t)copy.len);
+				}
+			}
+			otama_mmap_sync(new_blob);
+			otama_mmap_close(&new_blob);
+			
+			old_capacity = m_blob_metadata->capacity;
+			ret = m_rows.vacuum(rows, &rows_reclaimed, vacuum_offset_t(offsets));
+			if (ret != OTAMA_STATUS_OK) {
+				*reclaimed_bytes = 0;
+				return ret;
+			}
+			*reclaimed_bytes = rows_reclaimed + old_capacity - capacity;
+			
+			// tell the readers of the old blob to reopen
+			m_blob_metadata->capacity = 0;
+			otama_mmap_sync(m_blob_metadata_shm);
+			close_blob();
+			
+			return open_blob();
+#endif
+		}
+
+		otama_status_t
+		load(const otama_id_t *id,
+			 uint64_t seq,
+			 FT *vec)
+		{
+			PT packed;
+			otama_status_t ret = m_rows.load(id, seq, &packed);
+
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			T::unpack(vec, &packed, blob());
+
+			return OTAMA_STATUS_OK;
+		}
+
+		bool
+		set(int64_t i,
+			int64_t seq,
+			const char *id,
+			uint8_t flag,
+			const FT *vec)
+		{
+			PT packed;
+
+			if (append(i, &packed, vec) != OTAMA_STATUS_OK) {
+				return false;
+			}
+			return m_rows.set(i, seq, id, flag, &packed);
+		}
+
+		bool
+		set(int64_t i,
+			int64_t seq,
+			const otama_id_t *id,
+			uint8_t flag,
+			const FT *vec)
+		{
+			PT packed;
+
+			if (append(i, &packed, vec) != OTAMA_STATUS_OK) {
+				return false;
+			}
+			return m_rows.set(i, seq, id, flag, &packed);
+		}
+
+		void
+		update_flags(std::vector<std::pair<int64_t, uint8_t> > &updates,
+					 std::vector<int64_t> *missing = NULL)
+		{
+			m_rows.update_flags(updates, missing);
+		}
+
+		otama_status_t extend(int64_t s) { return m_rows.extend(s); }
+		int64_t count(void) { return m_rows.count(); }
+		void set_count(int64_t count) { m_rows.set_count(count); }
+		int64_t get_last_no(void) { return m_rows.get_last_no(); }
+		void set_last_no(int64_t no) { m_rows.set_last_no(no); }
+		int64_t get_last_commit_no(void) { return m_rows.get_last_commit_no(); }
+		void set_last_commit_no(int64_t no) { m_rows.set_last_commit_no(no); }
+		inline int64_t generation(void) { return m_rows.generation(); }
+
+		inline void
+		set_growth(double growth)
+		{
+			m_growth = growth;
+			m_rows.set_growth(growth);
+		}
+		inline void
+		set_advice(int flags)
+		{
+			m_advice = flags;
+			m_rows.set_advice(flags);
+		}
+		inline void
+		set_warmup(bool warmup)
+		{
+			m_warmup = warmup;
+			m_rows.set_warmup(warmup);
+		}
+
+		/* -1 when unknown */
+		int64_t
+		resident_bytes(void)
+		{
+			int64_t rows, blob;
+
+			if (m_blob_metadata == NULL) {
+				return m_rows.resident_bytes();
+			}
+			rows = m_rows.resident_bytes();
+			blob = otama_mmap_resident(m_blob_shm);
+			if (rows < 0 || blob < 0) {
+				return -1;
+			}
+			return rows + blob;
+		}
+
+		inline int64_t
+		file_bytes(void)
+		{
+			return m_rows.file_bytes()
+				+ (m_blob_metadata != NULL ? m_blob_metadata->capacity : 0);
+		}
+
+		/* bytes of the records in the blob, the deleted ones until vacuum() */
+		inline int64_t
+		blob_used(void)
+		{
+			return m_blob_metadata != NULL ? m_blob_metadata->used : 0;
+		}
+
+		inline const PT *rows(void) { return m_rows.vec(); }
+		inline const uint8_t *blob(void) { return (const uint8_t *)otama_mmap_mem(m_blob_shm); }
+		inline const uint64_t *deleted(void) { return m_rows.deleted(); }
+		inline uint8_t flag_at(int64_t index) { return m_rows.flag_at(index); }
+		inline const otama_id_t *id_at(int64_t index) { return m_rows.id_at(index); }
+	};
+}
+
+#endif
@@ -354,6 +354,27 @@ namespace otama
 			}
 			return res;
 		}
+		
+		otama_dbi_result_t *
+		select_records(const std::vector<int64_t> &seqs)
+		{
+			std::string in;
+			char buff[32];
+			size_t i;
+			
+			for (i = 0; i < seqs.size(); ++i) {
+				nv_snprintf(buff, sizeof(buff) - 1, "%s%"PRId64,
+							i == 0 ? "" : ",", seqs[i]);
+				in += buff;
+			}
+			return otama_dbi_queryf(
+				this->m_dbi,
+				" SELECT id, otama_id, vector FROM %s "
+				" WHERE id IN (%s) "
+				" ORDER BY id;",
+				this->table_name().c_str(),
+				in.c_str());
+		}
 	private:
 		inline bool
 		stmt_ready(void)
@@ -72,6 +72,21 @@ namespace otama
 											  otama_variant_t *options) = 0;
 		virtual float feature_similarity(const T *fv1, const T *fv2,
 										  otama_variant_t *options) = 0;
+		/* drivers that can score several queries in one pass override this */
+		virtual otama_status_t
+		feature_search_batch(otama_result_t **results, int n,
+							 const T **queries, int nq,
+							 otama_variant_t **options)
+		{
+			int i;
+			for (i = 0; i < nq; ++i) {
+				otama_status_t ret = feature_search(&results[i], n, queries[i], options[i]);
+				if (ret != OTAMA_STATUS_OK) {
+					return ret;
+				}
+			}
+			return OTAMA_STATUS_OK;
+		}
 		
 		virtual otama_status_t load_local(otama_id_t *id,
 										  uint64_t seq,
@@ -578,17 +593,14 @@ namespace otama
 			return ret;
 		}
 
-		virtual otama_status_t
-		search(otama_result_t **results, int n,
-			   otama_variant_t *query)
+		otama_status_t
+		extract_query(T *fv, otama_variant_t *query)
 		{
 			otama_id_t id;
-			T *fv = this->feature_new();
 			bool has_id, has_feature, exist;
 			otama_status_t ret;
 			
 			if (!OTAMA_VARIANT_IS_HASH(query)) {
-				feature_free(fv);
 				return OTAMA_STATUS_INVALID_ARGUMENTS;
 			}
 			if (m_load_fv
@@ -599,19 +611,59 @@ namespace otama
 				ret = extract(NULL, has_id, fv, has_feature, exist, query);
 			}
 			if (ret != OTAMA_STATUS_OK) {
-				feature_free(fv);
 				return ret;
 			}
 			if (!has_feature) {
-				feature_free(fv);
 				return OTAMA_STATUS_INVALID_ARGUMENTS;
 			}
+			return OTAMA_STATUS_OK;
+		}
+		
+		virtual otama_status_t
+		search(otama_result_t **results, int n,
+			   otama_variant_t *query)
+		{
+			T *fv = this->feature_new();
+			otama_status_t ret;
+			
+			ret = extract_query(fv, query);
+			if (ret != OTAMA_STATUS_OK) {
+				feature_free(fv);
+				return ret;
+			}
 			ret = feature_search(results, n, fv, query);
 			feature_free(fv);
 			
 			return ret;
 		}
 		
+		virtual otama_status_t
+		search_batch(otama_result_t **results, int n,
+					 otama_variant_t **queries, int nq)
+		{
+			std::vector<T *> fv(nq, (T *)NULL);
+			otama_status_t ret = OTAMA_STATUS_OK;
+			int i;
+			
+			for (i = 0; i < nq; ++i) {
+				fv[i] = this->feature_new();
+				ret = extract_query(fv[i], queries[i]);
+				if (ret != OTAMA_STATUS_OK) {
+					break;
+				}
+			}
+			if (ret == OTAMA_STATUS_OK && nq > 0) {
+				ret = feature_search_batch(results, n, (const T **)&fv[0], nq, queries);
+			}
+			for (i = 0; i < nq; ++i) {
+				if (fv[i]) {
+					feature_free(fv[i]);
+				}
+			}
+			
+			return ret;
+		}
+		
 		virtual otama_status_t
 		exists(bool &result, const otama_id_t *id)
 		{
@@ -20,8 +20,13 @@
 #include "otama_config.h"
 #include "otama_driver_factory.hpp"
 #include "otama_bovw_fixed_driver.hpp"
+#include "otama_bovw_packed_fixed_driver.hpp"
+#include "otama_bovw_cascade_fixed_driver.hpp"
 #include "otama_lmca_fixed_driver.hpp"
 #include "otama_lmca_nodb_driver.hpp"
+#include "otama_lmca_quant_fixed_driver.hpp"
+#include "otama_lmca_ivf_fixed_driver.hpp"
+#include "otama_lmca_hnsw_fixed_driver.hpp"
 #include "otama_bovw_inverted_index_driver.hpp"
 #include "otama_bovw_vsplit3_inverted_index_driver.hpp"
 #include "otama_bovw_nodb_driver.hpp"
@@ -68,6 +73,10 @@ otama::createDriver(otama_variant_t *config)
 	{
 		return new BOVWInvertedIndexDriver<NV_BOVW_BIT512K, InvertedIndexBucket>(config);
 	}
+	else if (strcmp(driver_name, "id_vsplit3") == 0)
+	{
+		return new BOVWVSplit3InvertedIndexDriver<NV_BOVW_BIT512K, InvertedIndexBucket>(config);
+	}
 #endif
 	if (strcmp(driver_name, "sim_nodb") == 0) {
 		return new BOVWNoDBDriver<NV_BOVW_BIT8K, nv_color_sboc_t>(config);
@@ -149,10 +158,38 @@ otama::createDriver(otama_variant_t *config)
 	{
 		return new BOVWNoDBDriver<NV_BOVW_BIT512K, nv_color_sboc_t>(config);
 	}
+	else if (strcmp(driver_name, "bovw512k_packed") == 0)
+	{
+		return new BOVWPackedFixedDriver<NV_BOVW_BIT512K, nv_bovw_dummy_color_t>(config);
+	}
+	else if (strcmp(driver_name, "bovw512k_boc_packed") == 0)
+	{
+		return new BOVWPackedFixedDriver<NV_BOVW_BIT512K, nv_color_boc_t>(config);
+	}
+	else if (strcmp(driver_name, "bovw512k_sboc_packed") == 0)
+	{
+		return new BOVWPackedFixedDriver<NV_BOVW_BIT512K, nv_color_sboc_t>(config);
+	}
+	else if (strcmp(driver_name, "bovw512k_cascade") == 0)
+	{
+		return new BOVWCascadeFixedDriver<NV_BOVW_BIT512K, nv_bovw_dummy_color_t>(config);
+	}
+	else if (strcmp(driver_name, "bovw512k_boc_cascade") == 0)
+	{
+		return new BOVWCascadeFixedDriver<NV_BOVW_BIT512K, nv_color_boc_t>(config);
+	}
+	else if (strcmp(driver_name, "bovw512k_sboc_cascade") == 0)
+	{
+		return new BOVWCascadeFixedDriver<NV_BOVW_BIT512K, nv_color_sboc_t>(config);
+	}
 	else if (strcmp(driver_name, "bovw512k_iv") == 0)
 	{
 		return new BOVWInvertedIndexDriver<NV_BOVW_BIT512K, InvertedIndexBucket>(config);
 	}
+	else if (strcmp(driver_name, "bovw512k_vsplit3_iv") == 0)
+	{
+		return new BOVWVSplit3InvertedIndexDriver<NV_BOVW_BIT512K, InvertedIndexBucket>(config);
+	}
 #if OTAMA_WITH_LEVELDB
 	else if (strcmp(driver_name, "bovw512k_iv_ldb") == 0)
 	{
@@ -208,6 +245,86 @@ otama::createDriver(otama_variant_t *config)
 	{
 		return new LMCAFixedDriver<NV_LMCA_FEATURE_VLAD_COLORCODE, nv_lmca_colorcode_t>(config);
 	}
+	else if (strcmp(driver_name, "lmca_vlad_int8") == 0)
+	{
+		return new LMCAQuantFixedDriver<NV_LMCA_FEATURE_VLAD, nv_lmca_empty_color_t, NV_LMCA_QUANT_INT8>(config);
+	}
+	else if (strcmp(driver_name, "lmca_hsv_int8") == 0)
+	{
+		return new LMCAQuantFixedDriver<NV_LMCA_FEATURE_HSV, nv_lmca_empty_color_t, NV_LMCA_QUANT_INT8>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vlad_hsv_int8") == 0)
+	{
+		return new LMCAQuantFixedDriver<NV_LMCA_FEATURE_VLAD_HSV, nv_lmca_hsv_t, NV_LMCA_QUANT_INT8>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vladhsv_int8") == 0)
+	{
+		return new LMCAQuantFixedDriver<NV_LMCA_FEATURE_VLADHSV, nv_lmca_empty_color_t, NV_LMCA_QUANT_INT8>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vlad_colorcode_int8") == 0)
+	{
+		return new LMCAQuantFixedDriver<NV_LMCA_FEATURE_VLAD_COLORCODE, nv_lmca_colorcode_t, NV_LMCA_QUANT_INT8>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vlad_fp16") == 0)
+	{
+		return new LMCAQuantFixedDriver<NV_LMCA_FEATURE_VLAD, nv_lmca_empty_color_t, NV_LMCA_QUANT_FP16>(config);
+	}
+	else if (strcmp(driver_name, "lmca_hsv_fp16") == 0)
+	{
+		return new LMCAQuantFixedDriver<NV_LMCA_FEATURE_HSV, nv_lmca_empty_color_t, NV_LMCA_QUANT_FP16>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vlad_hsv_fp16") == 0)
+	{
+		return new LMCAQuantFixedDriver<NV_LMCA_FEATURE_VLAD_HSV, nv_lmca_hsv_t, NV_LMCA_QUANT_FP16>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vladhsv_fp16") == 0)
+	{
+		return new LMCAQuantFixedDriver<NV_LMCA_FEATURE_VLADHSV, nv_lmca_empty_color_t, NV_LMCA_QUANT_FP16>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vlad_colorcode_fp16") == 0)
+	{
+		return new LMCAQuantFixedDriver<NV_LMCA_FEATURE_VLAD_COLORCODE, nv_lmca_colorcode_t, NV_LMCA_QUANT_FP16>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vlad_ivf") == 0)
+	{
+		return new LMCAIVFFixedDriver<NV_LMCA_FEATURE_VLAD, nv_lmca_empty_color_t>(config);
+	}
+	else if (strcmp(driver_name, "lmca_hsv_ivf") == 0)
+	{
+		return new LMCAIVFFixedDriver<NV_LMCA_FEATURE_HSV, nv_lmca_empty_color_t>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vlad_hsv_ivf") == 0)
+	{
+		return new LMCAIVFFixedDriver<NV_LMCA_FEATURE_VLAD_HSV, nv_lmca_hsv_t>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vladhsv_ivf") == 0)
+	{
+		return new LMCAIVFFixedDriver<NV_LMCA_FEATURE_VLADHSV, nv_lmca_empty_color_t>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vlad_colorcode_ivf") == 0)
+	{
+		return new LMCAIVFFixedDriver<NV_LMCA_FEATURE_VLAD_COLORCODE, nv_lmca_colorcode_t>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vlad_hnsw") == 0)
+	{
+		return new LMCAHNSWFixedDriver<NV_LMCA_FEATURE_VLAD, nv_lmca_empty_color_t>(config);
+	}
+	else if (strcmp(driver_name, "lmca_hsv_hnsw") == 0)
+	{
+		return new LMCAHNSWFixedDriver<NV_LMCA_FEATURE_HSV, nv_lmca_empty_color_t>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vlad_hsv_hnsw") == 0)
+	{
+		return new LMCAHNSWFixedDriver<NV_LMCA_FEATURE_VLAD_HSV, nv_lmca_hsv_t>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vladhsv_hnsw") == 0)
+	{
+		return new LMCAHNSWFixedDriver<NV_LMCA_FEATURE_VLADHSV, nv_lmca_empty_color_t>(config);
+	}
+	else if (strcmp(driver_name, "lmca_vlad_colorcode_hnsw") == 0)
+	{
+		return new LMCAHNSWFixedDriver<NV_LMCA_FEATURE_VLAD_COLORCODE, nv_lmca_colorcode_t>(config);
+	}
 	
 	else if (strcmp(driver_name, "lmca_vlad_nodb") == 0)
 	{
@@ -65,6 +65,8 @@ namespace otama
 		virtual otama_status_t remove(const otama_id_t *id) = 0;
 		virtual otama_status_t search(otama_result_t **results, int n,
 									  otama_variant_t *query) = 0;
+		virtual otama_status_t search_batch(otama_result_t **results, int n,
+											otama_variant_t **queries, int nq) = 0;
 		virtual otama_status_t similarity(float *v,
 										  otama_variant_t *data1,
 										  otama_variant_t *data2) = 0;
@@ -25,6 +25,7 @@
 #include "otama_id.h"
 #include "otama_log.h"
 #include "otama_dbi.h"
+#include "otama_mmap.h"
 #include "otama_omp_lock.hpp"
 #include "otama_fixed_strage.hpp"
 #include "otama_dbi_driver.hpp"
@@ -32,17 +33,48 @@
 #include <inttypes.h>
 #include <vector>
 #include <string>
+#include <map>
 
 namespace otama
 {
-	template<typename T>
+	/* driver options for otama_mmap_advise() */
+	static const struct {
+		const char *key;
+		int flag;
+	} MMAP_ADVICE[] = {
+		{ "mmap_populate", OTAMA_MMAP_POPULATE },
+		{ "mmap_hugepage", OTAMA_MMAP_HUGEPAGE },
+		{ "mmap_willneed", OTAMA_MMAP_WILLNEED },
+		{ "mmap_sequential", OTAMA_MMAP_SEQUENTIAL },
+		{ "mmap_lock", OTAMA_MMAP_LOCK },
+		{ NULL, 0 }
+	};
+	
+	/* S: row strage with the FixedStrage interface, T in and out */
+	template<typename T, typename S = FixedStrage<T> >
 	class FixedDriver: public DBIDriver<T>
 	{
 	protected:
 		static const int SYNC_INTERVAL = 60;
 		
 		bool m_sync_before_search;
-		FixedStrage<T> *m_mmap;
+		double m_mmap_growth;
+		int m_mmap_advice;
+		bool m_mmap_warmup;
+		S *m_mmap;
+		int64_t m_vacuum_reclaimed_bytes;
+		
+		/* bytes of the mappings in core, -1 when unknown */
+		virtual int64_t
+		resident_bytes(void)
+		{
+			return m_mmap->resident_bytes();
+		}
+		virtual int64_t
+		mapped_bytes(void)
+		{
+			return m_mmap->file_bytes();
+		}
 		
 		inline std::string	header_name(void) {	return m_mmap->header_name(); }
 		inline std::string index_name(void) { return m_mmap->index_name(); }
@@ -77,12 +109,13 @@ namespace otama
 			int64_t last_no = -1;
 			int64_t count;
 			int64_t ntuples = 0;
+			int64_t nrows;
 			
 			redo = false;
 			
 			sync();
 			count = m_mmap->count();
-			last_no = count == 0 ? -1 : m_mmap->get_last_no();
+			last_no = m_mmap->get_last_no();
 			
 			// select id, otama_id, vector
 			res = this->select_new_records(last_no, max_id);
@@ -91,6 +124,15 @@ namespace otama
 			}
 			
 			OTAMA_LOG_DEBUG("count: %d", count);
+			
+			// reserve the whole batch at once
+			nrows = otama_dbi_result_count(res);
+			if (nrows < 0) {
+				nrows = NV_MIN((int64_t)DBIDriver<T>::PULL_LIMIT, max_id - last_no);
+			}
+			if (nrows > 0) {
+				m_mmap->extend(count + nrows);
+			}
 			while (otama_dbi_result_next(res)) {
 				int ng;
 				int64_t seq = otama_dbi_result_int64(res, 0);
@@ -126,17 +168,61 @@ namespace otama
 			return ret;
 		}
 		
+		/* loads undeleted records that were removed by vacuum_index() */
 		otama_status_t
-		pull_flags(int64_t max_commit_id)
+		load_restore_records(const std::vector<int64_t> &seqs,
+							 std::vector<typename S::record_t> &restore)
+		{
+			otama_status_t ret = OTAMA_STATUS_OK;
+			otama_dbi_result_t *res;
+			
+			// select id, otama_id, vector
+			res = this->select_records(seqs);
+			if (res == NULL) {
+				return OTAMA_STATUS_SYSERROR;
+			}
+			while (otama_dbi_result_next(res)) {
+				typename S::record_t rec;
+				const char *id = otama_dbi_result_string(res, 1);
+				const char *vec = otama_dbi_result_string(res, 2);
+				
+				rec.seq = otama_dbi_result_int64(res, 0);
+				otama_id_hexstr2bin(&rec.id, id);
+				if (this->feature_deserialize(&rec.vec, vec)) {
+					ret = OTAMA_STATUS_ASSERTION_FAILURE;
+					OTAMA_LOG_ERROR("invalid vector size. id(%s), size(%zd), vec(%s)",
+									id, strlen(vec), vec);
+					break;
+				}
+				restore.push_back(rec);
+			}
+			otama_dbi_result_free(&res);
+			
+			return ret;
+		}
+		
+		/*
+		 * an undeleted record that was removed by vacuum_index() is not
+		 * restored here, a vacuum per pull is O(store size).
+		 * last_commit_no stays before its update, so the next pulls see it
+		 * again and vacuum_index() restores it. missing: the seqs of
+		 * these records, commit_no: the last commit no that was pulled.
+		 */
+		otama_status_t
+		pull_flags(int64_t max_commit_id,
+				   std::vector<int64_t> *missing = NULL,
+				   int64_t *commit_no = NULL)
 		{
 			int64_t last_commit_no;
 			
 			sync();
 			last_commit_no = m_mmap->get_last_commit_no();
 			
-			if (m_mmap->count() != 0) {
+			if (m_mmap->get_last_no() != -1) {
 				otama_dbi_result_t *res;
-				int64_t ntuples = 0;
+				std::vector<std::pair<int64_t, uint8_t> > updates;
+				std::map<int64_t, int64_t> update_commits;
+				std::vector<int64_t> undeleted;
 
 				// select id, flag, commit_id
 				res = this->select_updated_records(last_commit_no, max_commit_id);
@@ -148,14 +234,32 @@ namespace otama
 					uint8_t flag = (uint8_t)(otama_dbi_result_int(res, 1)) & 0xff;
 					
 					last_commit_no = otama_dbi_result_int64(res, 2);
-					m_mmap->update_flag(seq, flag);
-					++ntuples;
+					updates.push_back(std::make_pair(seq, flag));
+					update_commits[seq] = last_commit_no;
+				}
+				otama_dbi_result_free(&res);
+				if (commit_no != NULL) {
+					*commit_no = last_commit_no;
 				}
-				if (ntuples > 0) {
+				if (!updates.empty()) {
+					std::vector<int64_t>::const_iterator i;
+					
+					m_mmap->update_flags(updates, &undeleted);
+					for (i = undeleted.begin(); i != undeleted.end(); ++i) {
+						last_commit_no = NV_MIN(last_commit_no, update_commits[*i] - 1);
+					}
 					m_mmap->set_last_commit_no(last_commit_no);
+					if (!undeleted.empty()) {
+						OTAMA_LOG_DEBUG("%zd undeleted records wait for vacuum_index",
+										undeleted.size());
+					}
+				}
+				if (missing != NULL) {
+					*missing = undeleted;
 				}
-				otama_dbi_result_free(&res);
 				sync();
+			} else if (commit_no != NULL) {
+				*commit_no = last_commit_no;
 			}
 			
 			return OTAMA_STATUS_OK;
@@ -168,15 +272,37 @@ namespace otama
 			otama_variant_t *driver, *value;
 			m_mmap = NULL;
 			m_sync_before_search = false;
+			m_mmap_growth = S::DEFAULT_GROWTH();
+			m_mmap_advice = 0;
+			m_mmap_warmup = false;
+			m_vacuum_reclaimed_bytes = 0;
 			
 			driver = otama_variant_hash_at(options, "driver");
 			if (OTAMA_VARIANT_IS_HASH(driver)) {
 				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "sync_before_search"))) {
 					m_sync_before_search = otama_variant_to_bool(value) ? true : false;
 				}
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "mmap_growth"))) {
+					m_mmap_growth = otama_variant_to_float(value);
+				}
+				for (int i = 0; MMAP_ADVICE[i].key != NULL; ++i) {
+					value = otama_variant_hash_at(driver, MMAP_ADVICE[i].key);
+					if (!OTAMA_VARIANT_IS_NULL(value) && otama_variant_to_bool(value)) {
+						m_mmap_advice |= MMAP_ADVICE[i].flag;
+					}
+				}
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "mmap_warmup"))) {
+					m_mmap_warmup = otama_variant_to_bool(value) ? true : false;
+				}
 			}
 			OTAMA_LOG_DEBUG("driver[sync_before_search] => %d",
 							m_sync_before_search ? 1:0);
+			OTAMA_LOG_DEBUG("driver[mmap_growth] => %f", m_mmap_growth);
+			for (int i = 0; MMAP_ADVICE[i].key != NULL; ++i) {
+				OTAMA_LOG_DEBUG("driver[%s] => %d", MMAP_ADVICE[i].key,
+								(m_mmap_advice & MMAP_ADVICE[i].flag) ? 1:0);
+			}
+			OTAMA_LOG_DEBUG("driver[mmap_warmup] => %d", m_mmap_warmup ? 1:0);
 		}
 
 		virtual
@@ -196,7 +322,10 @@ namespace otama
 			if (ret != OTAMA_STATUS_OK) {
 				return ret;
 			}
-			m_mmap = new FixedStrage<T>(this->data_dir(), this->table_name());
+			m_mmap = new S(this->data_dir(), this->table_name());
+			m_mmap->set_growth(m_mmap_growth);
+			m_mmap->set_advice(m_mmap_advice);
+			m_mmap->set_warmup(m_mmap_warmup);
 			if (m_mmap->open() != OTAMA_STATUS_OK) {
 				if (m_mmap->create() != OTAMA_STATUS_OK) {
 					return OTAMA_STATUS_SYSERROR;
@@ -245,6 +374,19 @@ namespace otama
 			return DBIDriver<T>::search(results, n, query);
 		}
 		
+		virtual otama_status_t
+		search_batch(otama_result_t **results, int n,
+					 otama_variant_t **queries, int nq)
+		{
+			if (m_sync_before_search) {
+				otama_status_t ret = sync();
+				if (ret != OTAMA_STATUS_OK) {
+					return ret;
+				}
+			}
+			return DBIDriver<T>::search_batch(results, n, queries, nq);
+		}
+		
 		virtual otama_status_t
 		count(int64_t *count)
 		{
@@ -314,7 +456,70 @@ namespace otama
 		virtual otama_status_t
 		vacuum_index(void)
 		{
-			return OTAMA_STATUS_OK;
+			otama_status_t ret;
+			std::vector<typename S::record_t> restore;
+			std::vector<int64_t> missing;
+			int64_t reclaimed_bytes = 0;
+			int64_t max_id, max_commit_id, commit_no;
+			
+#ifdef _OPENMP
+			OMPLock lock(this->m_lock);
+#endif
+			// the records undeleted since the last vacuum are merged into this one
+			ret = this->select_max_ids(&max_id, &max_commit_id);
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			ret = pull_flags(max_commit_id, &missing, &commit_no);
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			if (!missing.empty()) {
+				ret = load_restore_records(missing, restore);
+				if (ret != OTAMA_STATUS_OK) {
+					return ret;
+				}
+				OTAMA_LOG_DEBUG("restore %zd records", restore.size());
+			}
+			ret = m_mmap->vacuum(restore, &reclaimed_bytes);
+			if (ret == OTAMA_STATUS_NOT_IMPLEMENTED) {
+				// keeps the deleted records as before
+				OTAMA_LOG_NOTICE("vacuum_index: %s", "not supported on this platform");
+				return OTAMA_STATUS_OK;
+			}
+			if (ret == OTAMA_STATUS_OK) {
+				m_mmap->set_last_commit_no(commit_no);
+				sync();
+				m_vacuum_reclaimed_bytes = reclaimed_bytes;
+				OTAMA_LOG_NOTICE("vacuum_index: %"PRId64" bytes reclaimed, %"PRId64" records",
+								 reclaimed_bytes, m_mmap->count());
+			}
+			return ret;
+		}
+		
+		virtual otama_status_t
+		get(const std::string &key,
+			otama_variant_t *value)
+		{
+#ifdef _OPENMP
+			OMPLock lock(this->m_lock);
+#endif
+			if (key == "vacuum_reclaimed_bytes") {
+				otama_variant_set_int(value, m_vacuum_reclaimed_bytes);
+				return OTAMA_STATUS_OK;
+			} else if (key == "resident_bytes") {
+				int64_t resident = resident_bytes();
+				if (resident < 0) {
+					/* the platform can not tell */
+					return OTAMA_STATUS_NOT_IMPLEMENTED;
+				}
+				otama_variant_set_int(value, resident);
+				return OTAMA_STATUS_OK;
+			} else if (key == "mapped_bytes") {
+				otama_variant_set_int(value, mapped_bytes());
+				return OTAMA_STATUS_OK;
+			}
+			return DBIDriver<T>::get(key, value);
 		}
 	};
 }
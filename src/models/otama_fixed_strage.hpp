@@ -24,6 +24,9 @@
 #include "nv_core.h"
 #include "otama_mmap.h"
 #include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
 
 namespace otama
 {
@@ -32,11 +35,13 @@ namespace otama
 	{
 	private:
 		static const int DEFAULT_COUNT_MAX = 10000;
+		static const uint8_t FLAG_DELETE = 0x01;
 		
 		typedef struct {
 			otama_mmap_t *metadata;
 			otama_mmap_t *index;
 			otama_mmap_t *vec;
+			otama_mmap_t *deleted;
 		} shm_t;
 		typedef struct {
 			int64_t count_max;
@@ -55,11 +60,18 @@ namespace otama
 			metadata_t *metadata;
 			index_t *index;
 			T *vec;
+			uint64_t *deleted;
 		} memory_table_t;
 		
 		shm_t m_shm;
 		memory_table_t m_memory_table;
-		std::string m_metadata_name, m_index_name, m_vector_name, m_shm_dir, m_prefix;
+		std::string m_metadata_name, m_index_name, m_vector_name, m_deleted_name;
+		std::vector<std::string> m_companion_names;
+		std::string m_shm_dir, m_prefix;
+		int64_t m_generation;
+		double m_growth;
+		int m_advice;
+		bool m_warmup;
 		
 		static inline int
 		seq_cmp(const void *p1, const void *p2)
@@ -75,6 +87,243 @@ namespace otama
 			return 0;
 		}
 		
+		static inline bool
+		seq_less(const index_t &rec, int64_t seq)
+		{
+			return rec.seq < seq;
+		}
+		
+		static inline bool
+		update_less(const std::pair<int64_t, uint8_t> &u1,
+					const std::pair<int64_t, uint8_t> &u2)
+		{
+			return u1.first < u2.first;
+		}
+		
+	public:
+		static inline double DEFAULT_GROWTH() { return 2.0; }
+		static inline const char *VACUUM_SUFFIX() { return ".vacuum"; }
+		/* metadata_name() + this marks the .vacuum files as complete */
+		static inline const char *VACUUM_COMMIT_SUFFIX() { return ".vacuum_commit"; }
+		/* metadata_name() + this is locked by vacuum() while it runs */
+		static inline const char *VACUUM_LOCK_SUFFIX() { return ".vacuum_lock"; }
+		
+		/* a record restored by vacuum() */
+		typedef struct {
+			int64_t seq;
+			otama_id_t id;
+			T vec;
+		} record_t;
+		
+		/* vacuum() copies the live rows as they are */
+		struct vacuum_copy_t {
+			inline void operator()(T &vec, int64_t index) const {}
+		};
+		
+		/* size of the index, vector and deleted files */
+		inline int64_t
+		file_bytes(void)
+		{
+			return (int64_t)(sizeof(*m_memory_table.index) + sizeof(*m_memory_table.vec))
+				* m_memory_table.metadata->count_max
+				+ (int64_t)deleted_len(m_memory_table.metadata->count_max);
+		}
+		
+	private:
+		static inline bool
+		record_less(const record_t &r1, const record_t &r2)
+		{
+			return r1.seq < r2.seq;
+		}
+		
+		/* deleted-record bitmap: one bit per row, 64 rows per word */
+		static inline size_t
+		deleted_len(int64_t count_max)
+		{
+			return sizeof(uint64_t) * (size_t)((count_max + 63) / 64);
+		}
+		
+		inline void
+		set_deleted(int64_t i, uint8_t flag)
+		{
+			if (flag & FLAG_DELETE) {
+				m_memory_table.deleted[i >> 6] |= (UINT64_C(1) << (i & 63));
+			} else {
+				m_memory_table.deleted[i >> 6] &= ~(UINT64_C(1) << (i & 63));
+			}
+		}
+		
+		int
+		open_deleted(void)
+		{
+			size_t len = deleted_len(m_memory_table.metadata->count_max);
+			int64_t i;
+			int ret;
+			
+			ret = otama_mmap_open(&m_shm.deleted,
+								  m_shm_dir.c_str(),
+								  deleted_name().c_str(), len);
+			if (ret == 0) {
+				m_memory_table.deleted = (uint64_t *)otama_mmap_mem(m_shm.deleted);
+				return 0;
+			}
+			// database created by an older version: build from the index
+			OTAMA_LOG_NOTICE("rebuild deleted bitmap: %s", deleted_name().c_str());
+			ret = otama_mmap_create(m_shm_dir.c_str(), deleted_name().c_str(), len);
+			if (ret != 0) {
+				return ret;
+			}
+			ret = otama_mmap_open(&m_shm.deleted,
+								  m_shm_dir.c_str(),
+								  deleted_name().c_str(), len);
+			if (ret != 0) {
+				return ret;
+			}
+			m_memory_table.deleted = (uint64_t *)otama_mmap_mem(m_shm.deleted);
+			memset(m_memory_table.deleted, 0, len);
+			for (i = 0; i < m_memory_table.metadata->count; ++i) {
+				set_deleted(i, m_memory_table.index[i].flag);
+			}
+			otama_mmap_sync(m_shm.deleted);
+			
+			return 0;
+		}
+		
+		bool
+		file_exists(const std::string &name)
+		{
+			otama_mmap_t *shm;
+			
+			if (otama_mmap_open(&shm, m_shm_dir.c_str(), name.c_str(), 1) != 0) {
+				return false;
+			}
+			otama_mmap_close(&shm);
+			return true;
+		}
+		
+		/* the new companion files of vacuum(), renamed with the rows */
+		int
+		rename_companions(void)
+		{
+			const std::string suffix = VACUUM_SUFFIX();
+			std::vector<std::string>::const_iterator i;
+			
+			for (i = m_companion_names.begin(); i != m_companion_names.end(); ++i) {
+				if (file_exists(*i + suffix)
+					&& otama_mmap_rename(m_shm_dir.c_str(), (*i + suffix).c_str(),
+										 i->c_str()) != 0)
+				{
+					return -1;
+				}
+			}
+			return 0;
+		}
+		
+		void
+		unlink_companions(void)
+		{
+			const std::string suffix = VACUUM_SUFFIX();
+			std::vector<std::string>::const_iterator i;
+			
+			for (i = m_companion_names.begin(); i != m_companion_names.end(); ++i) {
+				otama_mmap_unlink(m_shm_dir.c_str(), (*i + suffix).c_str());
+			}
+		}
+		
+		inline std::string
+		vacuum_commit_name(void)
+		{
+			return metadata_name() + VACUUM_COMMIT_SUFFIX();
+		}
+		
+		inline std::string
+		vacuum_lock_name(void)
+		{
+			return metadata_name() + VACUUM_LOCK_SUFFIX();
+		}
+		
+		/* the temporary files of vacuum(), companions included */
+		void
+		unlink_vacuum_files(void)
+		{
+			const std::string suffix = VACUUM_SUFFIX();
+			
+			otama_mmap_unlink(m_shm_dir.c_str(), (vector_name() + suffix).c_str());
+			otama_mmap_unlink(m_shm_dir.c_str(), (index_name() + suffix).c_str());
+			otama_mmap_unlink(m_shm_dir.c_str(), (deleted_name() + suffix).c_str());
+			otama_mmap_unlink(m_shm_dir.c_str(), (metadata_name() + suffix).c_str());
+			unlink_companions();
+		}
+		
+		/*
+		 * finishes the renames of a vacuum() that stopped on the way.
+		 * vacuum() writes the commit marker only after the new files are
+		 * written and synced. without it the .vacuum files may be partial
+		 * (a crash in create()), so they are dropped and the current files kept.
+		 */
+		void
+		recover_vacuum(void)
+		{
+			const std::string suffix = VACUUM_SUFFIX();
+			otama_mmap_lock_t *lock = NULL;
+			
+			if (!file_exists(vacuum_commit_name())
+				&& !file_exists(metadata_name() + suffix))
+			{
+				return;
+			}
+			// a running vacuum() holds the lock, its files are left alone
+			if (otama_mmap_lock(&lock, m_shm_dir.c_str(), vacuum_lock_name().c_str(), 0) != 0) {
+				return;
+			}
+			recover_vacuum_locked();
+			otama_mmap_unlock(&lock);
+		}
+		
+		void
+		recover_vacuum_locked(void)
+		{
+			const std::string suffix = VACUUM_SUFFIX();
+			
+			if (!file_exists(vacuum_commit_name())) {
+				if (file_exists(metadata_name() + suffix)) {
+					OTAMA_LOG_NOTICE("drop the files of an unfinished vacuum: %s",
+									 metadata_name().c_str());
+					unlink_vacuum_files();
+				}
+				return;
+			}
+			OTAMA_LOG_NOTICE("finish the renames of vacuum: %s", metadata_name().c_str());
+			if (file_exists(vector_name() + suffix)
+				&& otama_mmap_rename(m_shm_dir.c_str(), (vector_name() + suffix).c_str(),
+									 vector_name().c_str()) != 0)
+			{
+				return;
+			}
+			if (rename_companions() != 0) {
+				return;
+			}
+			if (file_exists(index_name() + suffix)
+				&& otama_mmap_rename(m_shm_dir.c_str(), (index_name() + suffix).c_str(),
+									 index_name().c_str()) != 0)
+			{
+				return;
+			}
+			if (file_exists(deleted_name() + suffix)
+				&& otama_mmap_rename(m_shm_dir.c_str(), (deleted_name() + suffix).c_str(),
+									 deleted_name().c_str()) != 0)
+			{
+				return;
+			}
+			if (file_exists(metadata_name() + suffix)
+				&& otama_mmap_rename(m_shm_dir.c_str(), (metadata_name() + suffix).c_str(),
+									 metadata_name().c_str()) != 0)
+			{
+				return;
+			}
+			otama_mmap_unlink(m_shm_dir.c_str(), vacuum_commit_name().c_str());
+		}
+		
 	public:
 		FixedStrage(const std::string &dir,
 					const std::string &prefix = "m")
@@ -84,6 +333,11 @@ namespace otama
 			m_metadata_name = m_prefix + "_metadata";
 			m_index_name = m_prefix + "_index";
 			m_vector_name = m_prefix + "_vector";
+			m_deleted_name = m_prefix + "_deleted";
+			m_generation = 0;
+			m_growth = DEFAULT_GROWTH();
+			m_advice = 0;
+			m_warmup = false;
 			
 			memset(&m_shm, 0, sizeof(m_shm));
 			memset(&m_memory_table, 0, sizeof(m_memory_table ));
@@ -113,6 +367,12 @@ namespace otama
 			return m_vector_name;
 		}
 
+		inline std::string
+		deleted_name(void)
+		{
+			return m_deleted_name;
+		}
+
 		inline void
 		metadata_name(const std::string &name)
 		{
@@ -130,6 +390,23 @@ namespace otama
 		{
 			m_vector_name = name;
 		}
+		
+		inline void
+		deleted_name(const std::string &name)
+		{
+			m_deleted_name = name;
+		}
+		
+		/*
+		 * a file of the caller that refers to the rows by index.
+		 * vacuum() renames name + VACUUM_SUFFIX() to name right after
+		 * the vector file, when the caller has written it.
+		 */
+		inline void
+		companion_name(const std::string &name)
+		{
+			m_companion_names.push_back(name);
+		}
 
 		otama_status_t
 		create(void)
@@ -165,6 +442,15 @@ namespace otama
 				return OTAMA_STATUS_SYSERROR;
 			}
 			
+			ret = otama_mmap_create(m_shm_dir.c_str(),
+								   deleted_name().c_str(),
+								   deleted_len(DEFAULT_COUNT_MAX));
+			if (ret != 0) {
+				OTAMA_LOG_ERROR("shm_create: %s",
+								deleted_name().c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+			
 			ret = otama_mmap_open(&metadata_shm,
 								 m_shm_dir.c_str(), metadata_name().c_str(),
 								 sizeof(metadata_t));
@@ -189,6 +475,7 @@ namespace otama
 		{
 			int ret;
 			
+			recover_vacuum();
 			ret = otama_mmap_open(&m_shm.metadata,
 								 m_shm_dir.c_str(),
 								 metadata_name().c_str(), sizeof(metadata_t));
@@ -229,9 +516,25 @@ namespace otama
 			}
 			m_memory_table.vec = (T*)otama_mmap_mem(m_shm.vec);
 
+			ret = open_deleted();
+			if (ret != 0) {
+				close();
+				OTAMA_LOG_ERROR("shm_open failed: %s", deleted_name().c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+
 			// sync count
 			m_memory_table.count = m_memory_table.metadata->count;
 			
+			if (m_advice) {
+				otama_mmap_advise(m_shm.index, m_advice);
+				otama_mmap_advise(m_shm.vec, m_advice);
+				otama_mmap_advise(m_shm.deleted, m_advice);
+			}
+			if (m_warmup) {
+				otama_mmap_warmup(m_shm_dir.c_str(), vector_name().c_str());
+			}
+			
 			return OTAMA_STATUS_OK;
 		}
 
@@ -253,6 +556,16 @@ namespace otama
 			if (m_shm.vec) {
 				otama_mmap_sync(m_shm.vec);
 			}
+			if (m_shm.deleted) {
+				otama_mmap_sync(m_shm.deleted);
+			}
+			if (m_memory_table.metadata->count_max == 0) {
+				// replaced by vacuum()
+				OTAMA_LOG_DEBUG("detecting vacuum: reopen: %s", metadata_name().c_str());
+				close();
+				++m_generation;
+				return open();
+			}
 			// update count
 			m_memory_table.count = m_memory_table.metadata->count;
 			
@@ -272,22 +585,22 @@ namespace otama
 		}
 		
 		otama_status_t
-		extend(void)
+		resize(int64_t count)
 		{
-			int64_t count;
 			int ret;
 
-			count = m_memory_table.metadata->count_max + DEFAULT_COUNT_MAX;
 			ret = otama_mmap_extend(&m_shm.index,
 								   sizeof(*m_memory_table.index) * count);
 			ret |= otama_mmap_extend(&m_shm.vec,
 									sizeof(*m_memory_table.vec) * count);
+			ret |= otama_mmap_extend(&m_shm.deleted, deleted_len(count));
 			if (ret != 0) {
 				return OTAMA_STATUS_SYSERROR;
 			}
 			m_memory_table.metadata->count_max = count;
 			m_memory_table.index = (index_t *)otama_mmap_mem(m_shm.index);
 			m_memory_table.vec = (T *)otama_mmap_mem(m_shm.vec);
+			m_memory_table.deleted = (uint64_t *)otama_mmap_mem(m_shm.deleted);
 			
 			return sync();
 		}
@@ -307,23 +620,42 @@ namespace otama
 				otama_mmap_close(&m_shm.vec);
 				m_memory_table.vec = NULL;
 			}
+			if (m_shm.deleted) {
+				otama_mmap_close(&m_shm.deleted);
+				m_memory_table.deleted = NULL;
+			}
 			memset(&m_memory_table, 0, sizeof(m_memory_table));
 			
 			return OTAMA_STATUS_OK;
 		}
 		
+		void
+		unlink_files(void)
+		{
+			otama_mmap_unlink(m_shm_dir.c_str(), index_name().c_str());
+			otama_mmap_unlink(m_shm_dir.c_str(), metadata_name().c_str());
+			otama_mmap_unlink(m_shm_dir.c_str(), vector_name().c_str());
+			otama_mmap_unlink(m_shm_dir.c_str(), deleted_name().c_str());
+			otama_mmap_unlink(m_shm_dir.c_str(), vacuum_commit_name().c_str());
+			otama_mmap_unlink(m_shm_dir.c_str(), vacuum_lock_name().c_str());
+		}
+		
 		otama_status_t
 		unlink(void)
 		{
 			otama_status_t ret;
 			
+			if (m_memory_table.metadata) {
+				// tell the readers of the old files to reopen
+				m_memory_table.metadata->count_max = 0;
+				otama_mmap_sync(m_shm.metadata);
+			}
 			ret = close();
 			if (ret != OTAMA_STATUS_OK) {
 				return ret;
 			}
-			otama_mmap_unlink(m_shm_dir.c_str(), index_name().c_str());
-			otama_mmap_unlink(m_shm_dir.c_str(), metadata_name().c_str());
-			otama_mmap_unlink(m_shm_dir.c_str(), vector_name().c_str());
+			unlink_files();
+			++m_generation;
 
 			ret = create();
 			if (ret != OTAMA_STATUS_OK) {
@@ -345,6 +677,7 @@ namespace otama
 									 seq_cmp);
 			if (rec != NULL) {
 				rec->flag = flag;
+				set_deleted(rec->index, flag);
 				OTAMA_LOG_DEBUG("seq => %"PRId64" updated ", seq);				
 			} else {
 				OTAMA_LOG_DEBUG("seq => %"PRId64" not found", seq, flag);
@@ -352,6 +685,203 @@ namespace otama
 			
 		}
 		
+		/*
+		 * apply (seq, flag) pairs in commit order.
+		 * the pairs are sorted by seq and merged with the index,
+		 * the last update of a seq wins.
+		 * undeleted seqs that are not found (removed by vacuum) are added to missing.
+		 */
+		void
+		update_flags(std::vector<std::pair<int64_t, uint8_t> > &updates,
+					 std::vector<int64_t> *missing = NULL)
+		{
+			index_t *rec = m_memory_table.index;
+			index_t *end = m_memory_table.index + m_memory_table.count;
+			std::vector<std::pair<int64_t, uint8_t> >::const_iterator u;
+			
+			std::stable_sort(updates.begin(), updates.end(), update_less);
+			for (u = updates.begin(); u != updates.end(); ++u) {
+				if (u + 1 != updates.end() && (u + 1)->first == u->first) {
+					continue; // overwritten by a later commit
+				}
+				rec = std::lower_bound(rec, end, u->first, seq_less);
+				if (rec != end && rec->seq == u->first) {
+					rec->flag = u->second;
+					set_deleted(rec->index, u->second);
+				} else {
+					OTAMA_LOG_DEBUG("seq => %"PRId64" not found", u->first);
+					if (missing != NULL
+						&& (u->second & FLAG_DELETE) == 0
+						&& u->first <= get_last_no())
+					{
+						missing->push_back(u->first);
+					}
+				}
+			}
+		}
+		
+		/*
+		 * writes the live records and restore into new files in seq order,
+		 * then replaces the current files by rename.
+		 * other processes keep the old mapping until their next sync().
+		 * NOT_IMPLEMENTED on Windows, a mapped file can not be replaced.
+		 */
+		otama_status_t
+		vacuum(std::vector<record_t> &restore, int64_t *reclaimed_bytes)
+		{
+			return vacuum(restore, reclaimed_bytes, vacuum_copy_t());
+		}
+		
+		/*
+		 * rewrite(vec, index) is applied to the copy of the live row at index.
+		 * the vacuum lock is held for the whole run, so open() in another
+		 * process does not touch the files of a running vacuum.
+		 */
+		template <typename F>
+		otama_status_t
+		vacuum(std::vector<record_t> &restore, int64_t *reclaimed_bytes,
+			   const F &rewrite)
+		{
+#if OTAMA_WINDOWS
+			*reclaimed_bytes = 0;
+			return OTAMA_STATUS_NOT_IMPLEMENTED;
+#else
+			otama_mmap_lock_t *lock = NULL;
+			otama_status_t ret;
+			
+			*reclaimed_bytes = 0;
+			if (otama_mmap_lock(&lock, m_shm_dir.c_str(), vacuum_lock_name().c_str(), 1) != 0) {
+				OTAMA_LOG_ERROR("vacuum lock failed: %s", vacuum_lock_name().c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+			// the files of a vacuum that stopped are finished or dropped first
+			recover_vacuum_locked();
+			ret = vacuum_locked(restore, reclaimed_bytes, rewrite);
+			otama_mmap_unlock(&lock);
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			close();
+			++m_generation;
+			
+			return open();
+#endif
+		}
+		
+	private:
+		template <typename F>
+		otama_status_t
+		vacuum_locked(std::vector<record_t> &restore, int64_t *reclaimed_bytes,
+					  const F &rewrite)
+		{
+			const int64_t count = m_memory_table.count;
+			const int64_t nrestore = (int64_t)restore.size();
+			const std::string suffix = VACUUM_SUFFIX();
+			FixedStrage<T> tmp(m_shm_dir, m_prefix);
+			std::vector<int64_t> src;
+			int64_t i, j, k, new_count, old_bytes;
+			
+			std::sort(restore.begin(), restore.end(), record_less);
+			// src[j] >= 0: row of this strage, src[j] < 0: restore[-src[j] - 1]
+			src.reserve((size_t)(count + nrestore));
+			for (i = k = 0; i < count || k < nrestore;) {
+				if (i < count && (m_memory_table.index[i].flag & FLAG_DELETE)) {
+					++i;
+				} else if (k == nrestore
+						   || (i < count && m_memory_table.index[i].seq < restore[k].seq))
+				{
+					src.push_back(i++);
+				} else if (i < count && m_memory_table.index[i].seq == restore[k].seq) {
+					++k;
+				} else {
+					src.push_back(-(k++) - 1);
+				}
+			}
+			new_count = (int64_t)src.size();
+			
+			tmp.metadata_name(metadata_name() + suffix);
+			tmp.index_name(index_name() + suffix);
+			tmp.vector_name(vector_name() + suffix);
+			tmp.deleted_name(deleted_name() + suffix);
+			tmp.set_growth(m_growth);
+			if (tmp.create() != OTAMA_STATUS_OK
+				|| tmp.open() != OTAMA_STATUS_OK
+				|| tmp.extend(new_count) != OTAMA_STATUS_OK)
+			{
+				tmp.close();
+				tmp.unlink_files();
+				unlink_companions();
+				return OTAMA_STATUS_SYSERROR;
+			}
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+			for (j = 0; j < new_count; ++j) {
+				index_t *rec = &tmp.m_memory_table.index[j];
+				
+				if (src[j] >= 0) {
+					*rec = m_memory_table.index[src[j]];
+					tmp.m_memory_table.vec[j] = m_memory_table.vec[src[j]];
+					rewrite(tmp.m_memory_table.vec[j], src[j]);
+				} else {
+					const record_t &r = restore[(size_t)(-src[j] - 1)];
+					rec->seq = r.seq;
+					rec->id = r.id;
+					rec->flag = 0;
+					tmp.m_memory_table.vec[j] = r.vec;
+				}
+				rec->index = j;
+			}
+			tmp.set_count(new_count);
+			tmp.set_last_no(get_last_no());
+			tmp.set_last_commit_no(get_last_commit_no());
+			tmp.sync();
+			
+			old_bytes = file_bytes();
+			*reclaimed_bytes = old_bytes - tmp.file_bytes();
+			tmp.close();
+			
+			// the new files and the companions are complete and synced
+			if (otama_mmap_create(m_shm_dir.c_str(), vacuum_commit_name().c_str(),
+								  sizeof(int64_t)) != 0)
+			{
+				otama_mmap_unlink(m_shm_dir.c_str(), vacuum_commit_name().c_str());
+				tmp.unlink_files();
+				unlink_companions();
+				return OTAMA_STATUS_SYSERROR;
+			}
+			// metadata last, a new open() never sees the new metadata with old rows
+			if (otama_mmap_rename(m_shm_dir.c_str(), tmp.vector_name().c_str(),
+								  vector_name().c_str()) != 0)
+			{
+				otama_mmap_unlink(m_shm_dir.c_str(), vacuum_commit_name().c_str());
+				tmp.unlink_files();
+				unlink_companions();
+				return OTAMA_STATUS_SYSERROR;
+			}
+			// committed, the next open() finishes the renames
+			if (rename_companions() != 0
+				|| otama_mmap_rename(m_shm_dir.c_str(), tmp.index_name().c_str(),
+									 index_name().c_str()) != 0
+				|| otama_mmap_rename(m_shm_dir.c_str(), tmp.deleted_name().c_str(),
+									 deleted_name().c_str()) != 0
+				|| otama_mmap_rename(m_shm_dir.c_str(), tmp.metadata_name().c_str(),
+									 metadata_name().c_str()) != 0)
+			{
+				OTAMA_LOG_ERROR("vacuum stopped after renaming %s, the rest is left in %s*",
+								vector_name().c_str(), suffix.c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+			otama_mmap_unlink(m_shm_dir.c_str(), vacuum_commit_name().c_str());
+			// tell the readers of the old files to reopen
+			m_memory_table.metadata->count_max = 0;
+			otama_mmap_sync(m_shm.metadata);
+			
+			return OTAMA_STATUS_OK;
+		}
+		
+	public:
+		
 		otama_status_t
 		load(const otama_id_t *id,
 			 uint64_t seq,
@@ -397,6 +927,7 @@ namespace otama
 			m_memory_table.index[i].seq = seq;
 			m_memory_table.index[i].flag = 0;
 			m_memory_table.index[i].id = *id;
+			set_deleted(i, 0);
 			m_memory_table.vec[i] = *vec;
 			
 			return true;
@@ -412,6 +943,7 @@ namespace otama
 			m_memory_table.index[i].index = i;
 			m_memory_table.index[i].seq = seq;
 			m_memory_table.index[i].flag = 0;
+			set_deleted(i, 0);
 			otama_id_hexstr2bin(&(m_memory_table.index[i].id), id);
 			m_memory_table.vec[i] = *vec;
 			
@@ -448,21 +980,70 @@ namespace otama
 			return m_memory_table.metadata->count_max;
 		}
 
+		/* OTAMA_MMAP_* flags, applied on the next open() */
+		inline void
+		set_advice(int flags)
+		{
+			m_advice = flags;
+		}
+		
+		/* reads the vector file in the background on each open() */
+		inline void
+		set_warmup(bool warmup)
+		{
+			m_warmup = warmup;
+		}
+		
+		/* -1 when unknown */
+		int64_t
+		resident_bytes(void)
+		{
+			int64_t index, vec, deleted;
+			
+			if (m_memory_table.metadata == NULL) {
+				return 0;
+			}
+			index = otama_mmap_resident(m_shm.index);
+			vec = otama_mmap_resident(m_shm.vec);
+			deleted = otama_mmap_resident(m_shm.deleted);
+			if (index < 0 || vec < 0 || deleted < 0) {
+				return -1;
+			}
+			return index + vec + deleted;
+		}
+		
+		/* grows count_max by m_growth times (DEFAULT_COUNT_MAX steps when <= 1) */
+		inline void
+		set_growth(double growth)
+		{
+			m_growth = growth;
+		}
+		
+		/* makes room for index s with one remap */
 		otama_status_t
 		extend(int64_t s)
 		{
-			otama_status_t ret;
-			while (s >= count_max()) {
-				OTAMA_LOG_DEBUG("count exceed. count_max=%"PRId64,
-								count_max());
-				ret = extend();
-				if (ret != OTAMA_STATUS_OK) {
-					return ret;
-				}
+			int64_t count = count_max();
+			
+			if (s < count) {
+				return OTAMA_STATUS_OK;
 			}
-			return OTAMA_STATUS_OK;
+			while (s >= count) {
+				count = NV_MAX(count + DEFAULT_COUNT_MAX, (int64_t)(count * m_growth));
+			}
+			OTAMA_LOG_DEBUG("count exceed. count_max=%"PRId64" => %"PRId64,
+							count_max(), count);
+			
+			return resize(count);
 		}
 
+		/* incremented when the rows were moved by vacuum() or unlink() */
+		inline int64_t
+		generation(void)
+		{
+			return m_generation;
+		}
+		
 		inline const T
 		*vec(void)
 		{
@@ -475,12 +1056,31 @@ namespace otama
 			return &m_memory_table.vec[index];
 		}
 
+		/* bit i is set when the record at i has FLAG_DELETE */
+		inline const uint64_t *
+		deleted(void)
+		{
+			return m_memory_table.deleted;
+		}
+		
 		inline uint8_t
 		flag_at(int64_t index)
 		{
 			return m_memory_table.index[index].flag;
 		}
 		
+		inline bool
+		deleted_at(int64_t index)
+		{
+			return (m_memory_table.index[index].flag & FLAG_DELETE) != 0;
+		}
+		
+		inline int64_t
+		seq_at(int64_t index)
+		{
+			return m_memory_table.index[index].seq;
+		}
+		
 		inline const otama_id_t *
 		id_at(int64_t index)
 		{
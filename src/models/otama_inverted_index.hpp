@@ -23,6 +23,8 @@
 
 #include "otama_variant.h"
 #include "otama_result.h"
+#include "otama_log.h"
+#include "otama_posting_codec.hpp"
 #include <string>
 #include <vector>
 #include <functional>
@@ -57,6 +59,7 @@ namespace otama
 		std::string m_data_dir;
 		std::string m_prefix;
 		int m_hit_threshold;
+		posting_codec_e m_posting_codec;
 		WeightFunction *m_weight_func;
 		
 		static inline void
@@ -106,6 +109,7 @@ namespace otama
 			
 			m_data_dir = ".";
 			m_hit_threshold = HIT_THRESHOLD;
+			m_posting_codec = POSTING_CODEC_VBYTE;
 			
 			driver = otama_variant_hash_at(options, "driver");
 			if (OTAMA_VARIANT_IS_HASH(driver)) {
@@ -121,6 +125,17 @@ namespace otama
 						m_hit_threshold = 1;
 					}
 				}
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver,
+																		 "posting_codec")))
+				{
+					const char *s = otama_variant_to_string(value);
+					posting_codec_e codec = PostingCodec::parse(s);
+					if (codec != POSTING_CODEC_MAX) {
+						m_posting_codec = codec;
+					} else {
+						OTAMA_LOG_NOTICE("invalid posting_codec `%s'", s);
+					}
+				}
 			}
 		}
 		void weight_func(WeightFunction *func) { m_weight_func = func; }
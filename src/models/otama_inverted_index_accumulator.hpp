@@ -0,0 +1,224 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2013 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_config.h"
+#ifndef OTAMA_INVERTED_INDEX_ACCUMULATOR_HPP
+#define OTAMA_INVERTED_INDEX_ACCUMULATOR_HPP
+
+#include "nv_core.h"
+#include <vector>
+#include <algorithm>
+#include <inttypes.h>
+
+namespace otama
+{
+	/*
+	 * sums the term weights of the postings of a query per record no.
+	 * the no range of the postings is split into blocks that the threads
+	 * take in turn. a block is summed into a dense array indexed by
+	 * no - begin of the block, or into a hash table when its postings
+	 * are sparse, so the postings are never sorted.
+	 */
+	class InvertedIndexAccumulator
+	{
+	public:
+		typedef std::vector<int64_t> posting_t;
+		typedef struct {
+			int64_t no;
+			float w;
+		} hit_t;
+
+	private:
+		static const int BLOCKS_PER_THREAD = 4;
+		// dense while the length of a block <= DENSE_RATIO * postings
+		static const int DENSE_RATIO = 8;
+
+		typedef struct {
+			int64_t no;
+			float w;
+			int32_t count;
+		} slot_t;
+
+		typedef struct {
+			std::vector<float> w;
+			std::vector<int32_t> count;
+			std::vector<slot_t> table;
+			std::vector<std::pair<size_t, size_t> > ranges;
+			std::vector<hit_t> hits;
+		} buffer_t;
+
+		static inline uint64_t
+		slot_hash(int64_t no)
+		{
+			return (uint64_t)no * 0x9e3779b97f4a7c15ULL;
+		}
+
+		static void
+		accumulate_dense(buffer_t &buf,
+						 const std::vector<posting_t> &postings,
+						 const std::vector<float> &weights,
+						 int hit_threshold,
+						 int64_t begin, int64_t end)
+		{
+			const size_t len = (size_t)(end - begin);
+			size_t t, i;
+
+			buf.w.assign(len, 0.0f);
+			buf.count.assign(len, 0);
+			for (t = 0; t < postings.size(); ++t) {
+				const int64_t *nos = postings[t].empty() ? NULL : &postings[t][0];
+				const float w = weights[t];
+				for (i = buf.ranges[t].first; i < buf.ranges[t].second; ++i) {
+					const size_t k = (size_t)(nos[i] - begin);
+					buf.w[k] += w;
+					buf.count[k] += 1;
+				}
+			}
+			for (i = 0; i < len; ++i) {
+				if (buf.count[i] > hit_threshold) {
+					hit_t hit;
+					hit.no = begin + (int64_t)i;
+					hit.w = buf.w[i];
+					buf.hits.push_back(hit);
+				}
+			}
+		}
+
+		static void
+		accumulate_hash(buffer_t &buf,
+						const std::vector<posting_t> &postings,
+						const std::vector<float> &weights,
+						int hit_threshold,
+						size_t npostings)
+		{
+			size_t capacity = 16;
+			int shift = 60;
+			size_t t, i;
+			slot_t empty;
+
+			while (capacity < npostings * 2) {
+				capacity <<= 1;
+				--shift;
+			}
+			empty.no = 0;
+			empty.w = 0.0f;
+			empty.count = 0;
+			buf.table.assign(capacity, empty);
+			for (t = 0; t < postings.size(); ++t) {
+				const int64_t *nos = postings[t].empty() ? NULL : &postings[t][0];
+				const float w = weights[t];
+				for (i = buf.ranges[t].first; i < buf.ranges[t].second; ++i) {
+					const int64_t no = nos[i];
+					size_t k = (size_t)(slot_hash(no) >> shift);
+
+					while (buf.table[k].count != 0 && buf.table[k].no != no) {
+						k = (k + 1) & (capacity - 1);
+					}
+					buf.table[k].no = no;
+					buf.table[k].w += w;
+					buf.table[k].count += 1;
+				}
+			}
+			for (i = 0; i < capacity; ++i) {
+				if (buf.table[i].count > hit_threshold) {
+					hit_t hit;
+					hit.no = buf.table[i].no;
+					hit.w = buf.table[i].w;
+					buf.hits.push_back(hit);
+				}
+			}
+		}
+
+	public:
+		/*
+		 * postings: the sorted nos of each term of the query.
+		 * weights: the weight of each term.
+		 * hits: the nos that are hit by more than hit_threshold terms.
+		 */
+		static void
+		accumulate(const std::vector<posting_t> &postings,
+				   const std::vector<float> &weights,
+				   int hit_threshold,
+				   std::vector<hit_t> &hits)
+		{
+			const int num_threads = nv_omp_procs();
+			std::vector<buffer_t> buffers(num_threads);
+			int64_t lo = 0, hi = -1;
+			int64_t len, block_len;
+			int nblocks, b, i;
+			size_t t;
+
+			hits.clear();
+			for (t = 0; t < postings.size(); ++t) {
+				if (postings[t].empty()) {
+					continue;
+				}
+				if (lo > hi) {
+					lo = postings[t].front();
+					hi = postings[t].back();
+				} else {
+					lo = NV_MIN(lo, postings[t].front());
+					hi = NV_MAX(hi, postings[t].back());
+				}
+			}
+			if (lo > hi) {
+				return;
+			}
+			len = hi - lo + 1;
+			nblocks = (int)NV_MIN((int64_t)num_threads * BLOCKS_PER_THREAD, len);
+			block_len = (len + nblocks - 1) / nblocks;
+			nblocks = (int)((len + block_len - 1) / block_len);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 1)
+#endif
+			for (b = 0; b < nblocks; ++b) {
+				buffer_t &buf = buffers[nv_omp_thread_id()];
+				const int64_t begin = lo + block_len * b;
+				const int64_t end = NV_MIN(begin + block_len, hi + 1);
+				size_t npostings = 0;
+				size_t j;
+
+				buf.ranges.resize(postings.size());
+				for (j = 0; j < postings.size(); ++j) {
+					const posting_t &nos = postings[j];
+					buf.ranges[j].first = (size_t)(std::lower_bound(nos.begin(), nos.end(), begin)
+												   - nos.begin());
+					buf.ranges[j].second = (size_t)(std::lower_bound(nos.begin() + buf.ranges[j].first,
+																	 nos.end(), end)
+													- nos.begin());
+					npostings += buf.ranges[j].second - buf.ranges[j].first;
+				}
+				if (npostings == 0) {
+					continue;
+				}
+				if (end - begin <= (int64_t)npostings * DENSE_RATIO) {
+					accumulate_dense(buf, postings, weights, hit_threshold, begin, end);
+				} else {
+					accumulate_hash(buf, postings, weights, hit_threshold, npostings);
+				}
+			}
+			for (i = 0; i < num_threads; ++i) {
+				hits.insert(hits.end(), buffers[i].hits.begin(), buffers[i].hits.end());
+			}
+		}
+	};
+}
+
+#endif
@@ -22,6 +22,8 @@
 #include "otama_log.h"
 #include "otama_dbi.h"
 #include "otama_omp_lock.hpp"
+#include "otama_mmap.h"
+#include "otama_util.h"
 #include "otama_inverted_index_bucket.hpp"
 #include <string>
 #include <queue>
@@ -30,17 +32,345 @@
 #include <map>
 #include <algorithm>
 #include <inttypes.h>
+#include <errno.h>
+#include <string.h>
 
 using namespace otama;
 
 InvertedIndexBucket::InvertedIndexBucket(otama_variant_t *options)
 	: InvertedIndex(options)
 {
+	otama_variant_t *driver, *value;
+	
 #ifdef _OPENMP
 	omp_init_nest_lock(&m_lock);
 #endif
 	m_last_commit_no = -1;
 	m_last_no = -1;
+	m_snapshot = false;
+	m_snapshot_interval = SNAPSHOT_INTERVAL;
+	m_snapshot_count = 0;
+	m_snapshot_shm = NULL;
+	m_snapshot_header = NULL;
+	
+	driver = otama_variant_hash_at(options, "driver");
+	if (OTAMA_VARIANT_IS_HASH(driver)) {
+		if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "snapshot"))) {
+			m_snapshot = otama_variant_to_bool(value);
+		}
+		if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "snapshot_interval"))) {
+			m_snapshot_interval = NV_MAX(otama_variant_to_int(value), 1);
+		}
+	}
+	OTAMA_LOG_DEBUG("driver[snapshot] => %s, driver[snapshot_interval] => %"PRId64,
+					m_snapshot ? "true" : "false", m_snapshot_interval);
+}
+
+std::string
+InvertedIndexBucket::snapshot_name(void)
+{
+	return m_prefix + "_bucket.snapshot";
+}
+
+void
+InvertedIndexBucket::close_snapshot(void)
+{
+	if (m_snapshot_shm) {
+		otama_mmap_close(&m_snapshot_shm);
+	}
+	m_snapshot_shm = NULL;
+	m_snapshot_header = NULL;
+}
+
+/*
+ * the sections of header are in the order of write_snapshot() and
+ * end in a file of file_size bytes. a truncated file is not mapped.
+ */
+bool
+InvertedIndexBucket::snapshot_header_valid(const snapshot_header_t *header,
+										   int64_t file_size)
+{
+	return header->nrecords >= 0 && header->nhashes >= 0
+		&& header->records_offset == (int64_t)sizeof(*header)
+		&& header->postings_offset == header->records_offset
+		+ header->nrecords * (int64_t)sizeof(snapshot_record_t)
+		&& header->hashes_offset >= header->postings_offset
+		&& header->len == header->hashes_offset
+		+ header->nhashes * (int64_t)sizeof(snapshot_hash_t)
+		&& file_size >= header->len;
+}
+
+/* maps len bytes of the snapshot, when the file has them */
+otama_status_t
+InvertedIndexBucket::map_snapshot(int64_t len)
+{
+	const std::string name = snapshot_name();
+	const std::string path = m_data_dir + "/" + name;
+	
+	close_snapshot();
+	if (otama_file_size(path.c_str()) < len) {
+		OTAMA_LOG_ERROR("%s: shorter than %"PRId64" bytes", path.c_str(), len);
+		return OTAMA_STATUS_SYSERROR;
+	}
+	if (otama_mmap_open(&m_snapshot_shm, m_data_dir.c_str(), name.c_str(), len) != 0) {
+		return OTAMA_STATUS_SYSERROR;
+	}
+	m_snapshot_header = (const snapshot_header_t *)otama_mmap_mem(m_snapshot_shm);
+	
+	return OTAMA_STATUS_OK;
+}
+
+/* the snapshot of an other version or a broken one is ignored */
+otama_status_t
+InvertedIndexBucket::load_snapshot(void)
+{
+	const std::string name = snapshot_name();
+	const std::string path = m_data_dir + "/" + name;
+	const int64_t file_size = otama_file_size(path.c_str());
+	const snapshot_record_t *records;
+	snapshot_header_t header;
+	int64_t i;
+	long t = nv_clock();
+	
+	close_snapshot();
+	if (file_size < 0) {
+		return OTAMA_STATUS_NODATA;
+	}
+	if (file_size < (int64_t)sizeof(header)) {
+		OTAMA_LOG_NOTICE("%s: truncated snapshot. ignored", path.c_str());
+		return OTAMA_STATUS_NODATA;
+	}
+	if (otama_mmap_open(&m_snapshot_shm, m_data_dir.c_str(), name.c_str(),
+						sizeof(header)) != 0)
+	{
+		return OTAMA_STATUS_NODATA;
+	}
+	memcpy(&header, otama_mmap_mem(m_snapshot_shm), sizeof(header));
+	otama_mmap_close(&m_snapshot_shm);
+	if (memcmp(header.magic, "OTAMABKT", sizeof(header.magic)) != 0
+		|| header.version != SNAPSHOT_VERSION
+		|| header.codec < 0 || header.codec >= POSTING_CODEC_MAX
+		|| !snapshot_header_valid(&header, file_size))
+	{
+		OTAMA_LOG_NOTICE("%s: unknown snapshot. ignored", path.c_str());
+		return OTAMA_STATUS_NODATA;
+	}
+	if (map_snapshot(header.len) != OTAMA_STATUS_OK) {
+		return OTAMA_STATUS_SYSERROR;
+	}
+	records = (const snapshot_record_t *)((const uint8_t *)m_snapshot_header
+										  + header.records_offset);
+	for (i = 0; i < header.nrecords; ++i) {
+		m_metadata.insert(metadata_t::value_type(records[i].no, records[i].rec));
+	}
+	m_last_no = header.last_no;
+	m_last_commit_no = header.last_commit_no;
+	m_snapshot_count = 0;
+	
+	OTAMA_LOG_DEBUG("load_snapshot: %"PRId64" records, %"PRId64" hashes, %ldms",
+					header.nrecords, header.nhashes, nv_clock() - t);
+	
+	return OTAMA_STATUS_OK;
+}
+
+bool
+InvertedIndexBucket::snapshot_posting(uint32_t hash, const uint8_t **data, size_t *len)
+{
+	const snapshot_hash_t *hashes;
+	const uint8_t *base;
+	int64_t lo, hi;
+	
+	if (m_snapshot_header == NULL) {
+		return false;
+	}
+	base = (const uint8_t *)m_snapshot_header;
+	hashes = (const snapshot_hash_t *)(base + m_snapshot_header->hashes_offset);
+	lo = 0;
+	hi = m_snapshot_header->nhashes;
+	while (lo < hi) {
+		int64_t mid = lo + (hi - lo) / 2;
+		if (hashes[mid].hash < hash) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == m_snapshot_header->nhashes || hashes[lo].hash != hash) {
+		return false;
+	}
+	*data = base + m_snapshot_header->postings_offset + hashes[lo].offset;
+	if (lo + 1 < m_snapshot_header->nhashes) {
+		*len = (size_t)(hashes[lo + 1].offset - hashes[lo].offset);
+	} else {
+		*len = (size_t)(m_snapshot_header->hashes_offset
+						- m_snapshot_header->postings_offset - hashes[lo].offset);
+	}
+	return true;
+}
+
+void
+InvertedIndexBucket::decode_posting(uint32_t hash, std::vector<int64_t> &nos)
+{
+	const uint8_t *data;
+	size_t len;
+	VariableByteCodeVector *list;
+	
+	nos.clear();
+	if (snapshot_posting(hash, &data, &len)) {
+		int64_t last_no = 0;
+		PostingCodec::decode((posting_codec_e)m_snapshot_header->codec,
+							 data, len, last_no, nos);
+	}
+	if ((list = m_inverted_index.find(hash)) != NULL) {
+		list->decode_append(nos);
+	}
+}
+
+/*
+ * writes the snapshot to a temporary file that replaces the old one.
+ * the postings that are not changed are copied as they are.
+ */
+otama_status_t
+InvertedIndexBucket::write_snapshot(void)
+{
+	const std::string name = snapshot_name();
+	const std::string tmp_name = name + ".tmp";
+	const std::string path = m_data_dir + "/" + tmp_name;
+	const bool copy = m_snapshot_header != NULL
+		&& m_snapshot_header->codec == (int32_t)m_posting_codec;
+	std::vector<snapshot_hash_t> hashes;
+	std::vector<uint32_t> old_hashes, new_hashes;
+	std::vector<int64_t> nos;
+	std::vector<uint8_t> postings;
+	snapshot_header_t header;
+	metadata_t::const_iterator rec;
+	size_t i, j;
+	int64_t offset = 0, old_len;
+	long t = nv_clock();
+	FILE *fp;
+	bool ng = false;
+	
+	if (m_snapshot_header) {
+		const snapshot_hash_t *p = (const snapshot_hash_t *)
+			((const uint8_t *)m_snapshot_header + m_snapshot_header->hashes_offset);
+		old_hashes.resize((size_t)m_snapshot_header->nhashes);
+		for (i = 0; i < old_hashes.size(); ++i) {
+			old_hashes[i] = p[i].hash;
+		}
+	}
+	m_inverted_index.hashes(new_hashes);
+	// the sorted union of the hashes of the snapshot and the memory
+	for (i = 0, j = 0; i < old_hashes.size() || j < new_hashes.size();) {
+		snapshot_hash_t h;
+		
+		memset(&h, 0, sizeof(h));
+		if (j == new_hashes.size() || (i < old_hashes.size() && old_hashes[i] < new_hashes[j])) {
+			h.hash = old_hashes[i++];
+		} else {
+			h.hash = new_hashes[j];
+			if (i < old_hashes.size() && old_hashes[i] == new_hashes[j]) {
+				++i;
+			}
+			++j;
+		}
+		hashes.push_back(h);
+	}
+	
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "OTAMABKT", sizeof(header.magic));
+	header.version = SNAPSHOT_VERSION;
+	header.codec = (int32_t)m_posting_codec;
+	header.last_no = m_last_no;
+	header.last_commit_no = m_last_commit_no;
+	header.nrecords = (int64_t)m_metadata.size();
+	header.nhashes = (int64_t)hashes.size();
+	header.records_offset = (int64_t)sizeof(header);
+	header.postings_offset = header.records_offset
+		+ header.nrecords * (int64_t)sizeof(snapshot_record_t);
+	
+	if ((fp = fopen(path.c_str(), "wb")) == NULL) {
+		OTAMA_LOG_ERROR("%s: %s", path.c_str(), strerror(errno));
+		return OTAMA_STATUS_SYSERROR;
+	}
+	ng |= fwrite(&header, sizeof(header), 1, fp) != 1;
+	for (rec = m_metadata.begin(); rec != m_metadata.end() && !ng; ++rec) {
+		snapshot_record_t r;
+		
+		memset(&r, 0, sizeof(r));
+		r.no = rec->first;
+		r.rec = rec->second;
+		ng |= fwrite(&r, sizeof(r), 1, fp) != 1;
+	}
+	for (i = 0; i < hashes.size() && !ng; ++i) {
+		const uint32_t hash = hashes[i].hash;
+		const uint8_t *data;
+		size_t len;
+		
+		hashes[i].offset = offset;
+		if (copy && m_inverted_index.find(hash) == NULL
+			&& snapshot_posting(hash, &data, &len))
+		{
+			ng |= fwrite(data, 1, len, fp) != len;
+			offset += (int64_t)len;
+		} else {
+			int64_t last_no = 0;
+			
+			decode_posting(hash, nos);
+			postings.clear();
+			if (!nos.empty()) {
+				PostingCodec::encode(m_posting_codec, &nos[0], nos.size(), last_no, postings);
+				ng |= fwrite(&postings[0], 1, postings.size(), fp) != postings.size();
+			}
+			offset += (int64_t)postings.size();
+		}
+	}
+	// the offsets are known after the postings
+	header.hashes_offset = header.postings_offset + offset;
+	header.len = header.hashes_offset + header.nhashes * (int64_t)sizeof(snapshot_hash_t);
+	if (!ng && !hashes.empty()) {
+		ng |= fwrite(&hashes[0], sizeof(snapshot_hash_t), hashes.size(), fp) != hashes.size();
+	}
+	if (!ng) {
+		ng |= fseek(fp, 0, SEEK_SET) != 0;
+		ng |= fwrite(&header, sizeof(header), 1, fp) != 1;
+	}
+	// the new file is on the disk before it replaces the old one
+	ng |= otama_fsync(fp) != 0;
+	ng |= fclose(fp) != 0;
+	if (ng) {
+		OTAMA_LOG_ERROR("%s: %s", path.c_str(), strerror(errno));
+		remove(path.c_str());
+		return OTAMA_STATUS_SYSERROR;
+	}
+	if (otama_fsync_dir(m_data_dir.c_str()) != 0) {
+		OTAMA_LOG_ERROR("%s: %s", m_data_dir.c_str(), strerror(errno));
+		remove(path.c_str());
+		return OTAMA_STATUS_SYSERROR;
+	}
+	
+	// the old snapshot is not mapped while it is replaced
+	old_len = m_snapshot_header ? m_snapshot_header->len : 0;
+	close_snapshot();
+	if (otama_mmap_rename(m_data_dir.c_str(), tmp_name.c_str(), name.c_str()) != 0) {
+		remove(path.c_str());
+		if (old_len > 0) {
+			map_snapshot(old_len);
+		}
+		return OTAMA_STATUS_SYSERROR;
+	}
+	if (otama_fsync_dir(m_data_dir.c_str()) != 0) {
+		OTAMA_LOG_NOTICE("%s: %s", m_data_dir.c_str(), strerror(errno));
+	}
+	if (map_snapshot(header.len) != OTAMA_STATUS_OK) {
+		return OTAMA_STATUS_SYSERROR;
+	}
+	m_inverted_index.clear();
+	m_snapshot_count = 0;
+	
+	OTAMA_LOG_DEBUG("write_snapshot: %"PRId64" records, %"PRId64" hashes, %ldms",
+					header.nrecords, header.nhashes, nv_clock() - t);
+	
+	return OTAMA_STATUS_OK;
 }
 
 void
@@ -73,13 +403,22 @@ InvertedIndexBucket::clear(void)
 	m_inverted_index.clear();
 	m_last_commit_no = -1;
 	m_last_no = -1;
+	m_snapshot_count = 0;
+	if (m_snapshot) {
+		close_snapshot();
+		otama_mmap_unlink(m_data_dir.c_str(), snapshot_name().c_str());
+	}
 	
 	return OTAMA_STATUS_OK;
 }
 
+/* a checkpoint */
 otama_status_t
 InvertedIndexBucket::vacuum(void)
 {
+	if (m_snapshot) {
+		return write_snapshot();
+	}
 	return OTAMA_STATUS_OK;
 }
 
@@ -88,6 +427,14 @@ InvertedIndexBucket::open(void)
 {
 	m_metadata.clear();
 	m_inverted_index.clear();
+	m_last_commit_no = -1;
+	m_last_no = -1;
+	if (m_snapshot) {
+		// the records after the snapshot are pulled again
+		if (load_snapshot() == OTAMA_STATUS_SYSERROR) {
+			return OTAMA_STATUS_SYSERROR;
+		}
+	}
 	
 	return OTAMA_STATUS_OK;
 }
@@ -95,14 +442,24 @@ InvertedIndexBucket::open(void)
 otama_status_t
 InvertedIndexBucket::close(void)
 {
+	otama_status_t ret = OTAMA_STATUS_OK;
+	
+	if (m_snapshot && (m_snapshot_count > 0
+					   || (m_snapshot_header
+						   && m_snapshot_header->last_commit_no != m_last_commit_no)))
+	{
+		ret = write_snapshot();
+	}
+	close_snapshot();
 	m_metadata.clear();
 	m_inverted_index.clear();
 
-	return OTAMA_STATUS_OK;
+	return ret;
 }
 
 InvertedIndexBucket::~InvertedIndexBucket()
 {
+	close_snapshot();
 }
 
 int64_t
@@ -146,18 +503,18 @@ InvertedIndexBucket::set(int64_t no,
 
 	ret = m_metadata.insert(metadata_t::value_type(no, rec));
 	if (ret.second) {
-		if (vec.size()) {
-			// sorted
-			if (m_inverted_index.size() <= vec.back()) {
-				m_inverted_index.resize(vec.back() + 1);
-			}
+		++m_snapshot_count;
+		// the lists are added before the parallel loop, insert() moves them
+		for (i = 0; i < (int)vec.size(); ++i) {
+			m_inverted_index.insert(vec[i], m_posting_codec);
 		}
 #ifdef _OPENMP
 #pragma omp parallel for
 #endif
 		for (i = 0; i < (int)vec.size(); ++i) {
-			NV_ASSERT(m_inverted_index.size() > vec[i]);
-			m_inverted_index[vec[i]].push_back(no);
+			VariableByteCodeVector *list = m_inverted_index.find(vec[i]);
+			NV_ASSERT(list != NULL);
+			list->push_back(no);
 		}
 	}
 	
@@ -173,97 +530,45 @@ InvertedIndexBucket::search(
 	int l, result_max, i;
 	long t;
 	int num_threads  = nv_omp_procs();
-	std::vector<std::vector<similarity_temp_t> > hits;
-	size_t c;
+	std::vector<InvertedIndexAccumulator::posting_t> postings(vec.size());
+	std::vector<float> weights(vec.size());
+	std::vector<InvertedIndexAccumulator::hit_t> hits;
+	size_t npostings = 0;
 	topn_t topn;
 	
 	if (n < 1) {
 		return OTAMA_STATUS_INVALID_ARGUMENTS;
 	}
-	hits.resize(num_threads);
 	t = nv_clock();
-	c = (size_t)count();
-	hits[0].reserve(c * 3);
-	for (i = 1; i < num_threads; ++i) {
-		hits[i].reserve(c * 3 / num_threads);
-	}
 	
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 32)
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 32) reduction(+:npostings)
 #endif
 	for (i = 0; i < (int)vec.size(); ++i) {
-		int thread_id = nv_omp_thread_id();
 		uint32_t hash = vec[i];
-		std::vector<similarity_temp_t> &hit = hits[thread_id];
-		if (m_inverted_index.size() > hash) {
-			std::vector<int64_t> nos;
-			std::vector<int64_t>::const_iterator j;
-			
-			m_inverted_index[hash].decode(nos);
-			for (j = nos.begin(); j != nos.end(); ++j) {
-				similarity_temp_t hi;
-				hi.no = *j;
-				hi.w = (*m_weight_func)(hash);
-				hi.w *= hi.w;
-				hit.push_back(hi);
-			}
-		}
-	}
-	for (i = 1; i < num_threads; ++i) {
-		std::copy(hits[i].begin(), hits[i].end(), std::back_inserter(hits[0]));
+		float w = (*m_weight_func)(hash);
+		
+		weights[i] = w * w;
+		decode_posting(hash, postings[i]);
+		npostings += postings[i].size();
 	}
-	
 	OTAMA_LOG_DEBUG("search: inverted index search: %zd, %ldms",
-					hits[0].size(), nv_clock() - t);
+					npostings, nv_clock() - t);
 	t = nv_clock();
 	
-	std::sort(hits[0].begin(), hits[0].end());
-	OTAMA_LOG_DEBUG("search: sort:  %ldms", nv_clock() - t);
+	InvertedIndexAccumulator::accumulate(postings, weights, m_hit_threshold, hits);
+	OTAMA_LOG_DEBUG("search: accumulate: %zd, %ldms", hits.size(), nv_clock() - t);
 	t = nv_clock();
 	
-	if (hits[0].size() > 0) {
-		int64_t no = hits[0][0].no;
-		float w = 0.0f;
+	if (hits.size() > 0) {
 		float query_norm = norm(vec);
-		int count = 0;
-		std::vector<similarity_temp_t>::const_iterator j;
+		std::vector<InvertedIndexAccumulator::hit_t>::const_iterator j;
 		
-		for (j = hits[0].begin(); j != hits[0].end(); ++j)
-		{
-			if (j->no == no) {
-				w += j->w;
-				++count;
-			} else {
-				if (count > m_hit_threshold) {
-					metadata_t::const_iterator rec = m_metadata.find(no);
-					if (rec != m_metadata.end()) {
-						if ((rec->second.flag & FLAG_DELETE) == 0) {
-							float similarity = w / (query_norm * rec->second.norm);
-							if (n > (int)topn.size()) {
-								similarity_result_t t;
-								memcpy(&t.id, &rec->second.id, sizeof(t.id));
-								t.similarity = similarity;
-								topn.push(t);
-							} else if (topn.top().similarity < similarity) {
-								similarity_result_t t;
-								memcpy(&t.id, &rec->second.id, sizeof(t.id));
-								t.similarity = similarity;
-								topn.push(t);
-								topn.pop();
-							}
-						}
-					}
-				}
-				no = j->no;
-				w = j->w;
-				count = 1;
-			}
-		}
-		if (count > m_hit_threshold) {
-			metadata_t::const_iterator rec = m_metadata.find(no);
+		for (j = hits.begin(); j != hits.end(); ++j) {
+			metadata_t::const_iterator rec = m_metadata.find(j->no);
 			if (rec != m_metadata.end()) {
 				if ((rec->second.flag & FLAG_DELETE) == 0) {
-					float similarity = w / (query_norm * rec->second.norm);
+					float similarity = j->w / (query_norm * rec->second.norm);
 					if (n > (int)topn.size()) {
 						similarity_result_t t;
 						memcpy(&t.id, &rec->second.id, sizeof(t.id));
@@ -304,6 +609,9 @@ InvertedIndexBucket::count(void)
 bool
 InvertedIndexBucket::sync(void)
 {
+	if (m_snapshot && m_snapshot_count >= m_snapshot_interval) {
+		return write_snapshot() == OTAMA_STATUS_OK;
+	}
 	return true;
 }
 
@@ -316,8 +624,9 @@ InvertedIndexBucket::update_count(void)
 int64_t
 InvertedIndexBucket::hash_count(uint32_t hash)
 {
-	if (m_inverted_index.size() > hash) {
-		return m_inverted_index[hash].count();
-	}
-	return 0;
+	std::vector<int64_t> nos;
+	
+	decode_posting(hash, nos);
+	
+	return (int64_t)nos.size();
 }
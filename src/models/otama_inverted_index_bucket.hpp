@@ -30,8 +30,11 @@
 #endif
 
 #include "nv_core.h"
+#include "otama_mmap.h"
 #include "otama_variable_byte_code_vector.hpp"
+#include "otama_posting_hash_table.hpp"
 #include "otama_inverted_index.hpp"
+#include "otama_inverted_index_accumulator.hpp"
 #include <string>
 #include <queue>
 #include <algorithm>
@@ -57,12 +60,60 @@ namespace otama
 #else
 		typedef std::map<int64_t, metadata_record_t> metadata_t;
 #endif
-		typedef std::vector<VariableByteCodeVector> inverted_index_t;
+		typedef PostingHashTable inverted_index_t;
+		
+		/*
+		 * the snapshot file is
+		 * [header][records][postings of the codec][hashes, sorted].
+		 * the postings of a hash are from its offset to the offset of
+		 * the next hash. the nos set after the snapshot are in
+		 * m_inverted_index.
+		 */
+		static const int32_t SNAPSHOT_VERSION = 1;
+		static const int64_t SNAPSHOT_INTERVAL = 100000;
+		typedef struct {
+			char magic[8];
+			int32_t version;
+			int32_t codec;
+			int64_t len;
+			int64_t last_no;
+			int64_t last_commit_no;
+			int64_t nrecords;
+			int64_t nhashes;
+			int64_t records_offset;
+			int64_t hashes_offset;
+			int64_t postings_offset;
+		} snapshot_header_t;
+		typedef struct {
+			int64_t no;
+			metadata_record_t rec;
+		} snapshot_record_t;
+		typedef struct {
+			uint32_t hash;
+			uint32_t reserved;
+			int64_t offset;
+		} snapshot_hash_t;
 		
 		metadata_t m_metadata;
 		inverted_index_t m_inverted_index;
 		int64_t m_last_commit_no;
 		int64_t m_last_no;
+		
+		bool m_snapshot;
+		int64_t m_snapshot_interval;
+		int64_t m_snapshot_count;
+		otama_mmap_t *m_snapshot_shm;
+		const snapshot_header_t *m_snapshot_header;
+		
+		std::string snapshot_name(void);
+		static bool snapshot_header_valid(const snapshot_header_t *header,
+										  int64_t file_size);
+		otama_status_t map_snapshot(int64_t len);
+		otama_status_t load_snapshot(void);
+		otama_status_t write_snapshot(void);
+		void close_snapshot(void);
+		bool snapshot_posting(uint32_t hash, const uint8_t **data, size_t *len);
+		void decode_posting(uint32_t hash, std::vector<int64_t> &nos);
 
 		typedef struct similarity_result {
 			otama_id_t id;
@@ -75,17 +126,6 @@ namespace otama
 			}
 		} similarity_result_t;
 		
-		typedef struct similarity_temp {
-			int64_t no;
-			float w;
-			
-			inline bool
-			operator <(const struct similarity_temp &rhs) const
-			{
-				return no < rhs.no;
-			}
-		} similarity_temp_t;
-		
 		typedef std::priority_queue<similarity_result_t, std::vector<similarity_result_t> > topn_t;
 		
 	public:
@@ -63,6 +63,414 @@ InvertedIndexLevelDB::inverted_index_file_name(void)
 	return m_data_dir + '/' + m_prefix + "_inverted_index.ldb";
 }
 		
+static inline void
+posting_block_key(uint8_t *key, uint32_t hash, int32_t block_no)
+{
+	// big endian, the blocks of a hash are adjacent in the db
+	key[0] = 'B';
+	key[1] = (uint8_t)(hash >> 24);
+	key[2] = (uint8_t)(hash >> 16);
+	key[3] = (uint8_t)(hash >> 8);
+	key[4] = (uint8_t)hash;
+	key[5] = (uint8_t)(block_no >> 24);
+	key[6] = (uint8_t)(block_no >> 16);
+	key[7] = (uint8_t)(block_no >> 8);
+	key[8] = (uint8_t)block_no;
+}
+
+/* the longest head of vbc that is not over limit and ends at a code */
+static inline size_t
+vbc_split(const uint8_t *vbc, size_t len, size_t limit)
+{
+	size_t i;
+	
+	if (len <= limit) {
+		return len;
+	}
+	for (i = limit; i > 0; --i) {
+		if ((vbc[i - 1] & 0x80) == 0) {
+			return i;
+		}
+	}
+	return 0;
+}
+
+static inline int32_t
+vbc_blocks(const uint8_t *vbc, size_t len, size_t block_size)
+{
+	int32_t nblocks = 0;
+	
+	while (len > 0) {
+		size_t n = vbc_split(vbc, len, block_size);
+		if (n == 0) {
+			n = len;
+		}
+		vbc += n;
+		len -= n;
+		++nblocks;
+	}
+	return nblocks;
+}
+
+void
+InvertedIndexLevelDB::get_posting_tail(uint32_t hash, posting_tail_t *tail)
+{
+	const uint64_t tail_key = (uint64_t)hash << 32;
+	size_t sp = 0;
+	void *value = m_inverted_index.get(&tail_key, sizeof(tail_key), &sp);
+	
+	memset(tail, 0, sizeof(*tail));
+	if (value != NULL) {
+		if (sp == sizeof(*tail)) {
+			memcpy(tail, value, sizeof(*tail));
+		} else if (sp == sizeof(int64_t) + sizeof(int32_t) * 2) {
+			// older index, no blocks are sealed
+			memcpy(tail, value, sp);
+		} else if (sp == sizeof(int64_t)) {
+			// older index, the list has no blocks
+			memcpy(&tail->last_no, value, sizeof(int64_t));
+		}
+		m_inverted_index.free_value(value);
+	}
+}
+
+void
+InvertedIndexLevelDB::set_posting_tail(uint32_t hash, const posting_tail_t *tail,
+									   posting_batch_t &batch)
+{
+	const uint64_t tail_key = (uint64_t)hash << 32;
+	
+	batch.batch.set(&tail_key, sizeof(tail_key), tail, sizeof(*tail));
+}
+
+/* the block written to batch, or the block in the db */
+bool
+InvertedIndexLevelDB::get_posting_block(uint32_t hash, int32_t block_no,
+										const posting_batch_t &batch,
+										std::vector<uint8_t> &block)
+{
+	std::map<int32_t, std::vector<uint8_t> >::const_iterator i = batch.blocks.find(block_no);
+	uint8_t key[POSTING_BLOCK_KEY_LEN];
+	uint8_t *vs;
+	size_t sp = 0;
+	
+	if (i != batch.blocks.end()) {
+		block = i->second;
+		return true;
+	}
+	posting_block_key(key, hash, block_no);
+	if ((vs = (uint8_t *)m_inverted_index.get(key, sizeof(key), &sp)) == NULL) {
+		OTAMA_LOG_ERROR("posting block not found(%u, %d)", hash, block_no);
+		return false;
+	}
+	block.assign(vs, vs + sp);
+	m_inverted_index.free_value(vs);
+	
+	return true;
+}
+
+void
+InvertedIndexLevelDB::set_posting_block(uint32_t hash, int32_t block_no,
+										const uint8_t *block, size_t len,
+										posting_batch_t &batch)
+{
+	uint8_t key[POSTING_BLOCK_KEY_LEN];
+	
+	posting_block_key(key, hash, block_no);
+	batch.batch.set(key, sizeof(key), block, len);
+	batch.blocks[block_no].assign(block, block + len);
+}
+
+bool
+InvertedIndexLevelDB::write_posting_batch(posting_batch_t &batch)
+{
+	if (!m_inverted_index.write(batch.batch)) {
+		OTAMA_LOG_ERROR("%s", m_inverted_index.error_message().c_str());
+		return false;
+	}
+	return true;
+}
+
+bool
+InvertedIndexLevelDB::read_posting(uint32_t hash, std::vector<uint8_t> &vbc)
+{
+	posting_tail_t tail;
+	uint8_t *vs;
+	size_t sp = 0;
+	int32_t b;
+	
+	vbc.clear();
+	if ((vs = (uint8_t *)m_inverted_index.get(&hash, sizeof(hash), &sp)) != NULL) {
+		vbc.insert(vbc.end(), vs, vs + sp);
+		m_inverted_index.free_value(vs);
+	}
+	get_posting_tail(hash, &tail);
+	for (b = 0; b < tail.nblocks; ++b) {
+		uint8_t key[POSTING_BLOCK_KEY_LEN];
+		
+		posting_block_key(key, hash, b);
+		if ((vs = (uint8_t *)m_inverted_index.get(key, sizeof(key), &sp)) == NULL) {
+			return false;
+		}
+		vbc.insert(vbc.end(), vs, vs + sp);
+		m_inverted_index.free_value(vs);
+	}
+	return true;
+}
+
+void
+InvertedIndexLevelDB::write_posting_blocks(uint32_t hash, posting_tail_t *tail,
+										   const uint8_t *vbc, size_t len,
+										   posting_batch_t &batch)
+{
+	while (len > 0) {
+		size_t n = vbc_split(vbc, len, POSTING_BLOCK_SIZE);
+		
+		if (n == 0) {
+			n = len;
+		}
+		set_posting_block(hash, tail->nblocks, vbc, n, batch);
+		tail->nblocks += 1;
+		tail->tail_len = (int32_t)n;
+		vbc += n;
+		len -= n;
+	}
+}
+
+/*
+ * rewrites the tail block only, the rest goes to new blocks.
+ * the blocks and the tail are written at once.
+ */
+bool
+InvertedIndexLevelDB::append_posting(uint32_t hash, const uint8_t *vbc, size_t len,
+									 int64_t last_no)
+{
+	posting_tail_t tail;
+	posting_batch_t batch;
+	
+	get_posting_tail(hash, &tail);
+	if (len > 0 && tail.nblocks > tail.nsealed
+		&& (size_t)tail.tail_len < POSTING_BLOCK_SIZE)
+	{
+		size_t n = vbc_split(vbc, len, POSTING_BLOCK_SIZE - tail.tail_len);
+		if (n > 0) {
+			std::vector<uint8_t> block;
+			
+			if (!get_posting_block(hash, tail.nblocks - 1, batch, block)) {
+				return false;
+			}
+			block.insert(block.end(), vbc, vbc + n);
+			set_posting_block(hash, tail.nblocks - 1, block.data(), block.size(), batch);
+			tail.tail_len = (int32_t)block.size();
+			vbc += n;
+			len -= n;
+		}
+	}
+	write_posting_blocks(hash, &tail, vbc, len, batch);
+	if (m_posting_codec != POSTING_CODEC_VBYTE && tail.nblocks - tail.nsealed > 1) {
+		if (!seal_posting_blocks(hash, &tail, batch)) {
+			return false;
+		}
+	}
+	tail.last_no = last_no;
+	set_posting_tail(hash, &tail, batch);
+	
+	return write_posting_batch(batch);
+}
+
+/* packs the full vbyte blocks, all but the tail block */
+bool
+InvertedIndexLevelDB::seal_posting_blocks(uint32_t hash, posting_tail_t *tail,
+										  posting_batch_t &batch)
+{
+	while (tail->nsealed < tail->nblocks - 1) {
+		std::vector<int64_t> nos;
+		std::vector<uint8_t> vbc, block;
+		int64_t last_no = 0;
+		
+		if (!get_posting_block(hash, tail->nsealed, batch, vbc)) {
+			return false;
+		}
+		// the codes are deltas, so the block is packed from 0
+		PostingCodec::vbyte_decode(vbc.data(), vbc.size(), last_no, nos);
+		last_no = 0;
+		PostingCodec::encode(m_posting_codec, nos.data(), nos.size(), last_no, block);
+		set_posting_block(hash, tail->nsealed, block.data(), block.size(), batch);
+		tail->nsealed += 1;
+	}
+	return true;
+}
+
+void
+InvertedIndexLevelDB::write_sealed_blocks(uint32_t hash, posting_tail_t *tail,
+										  const std::vector<int64_t> &nos,
+										  posting_batch_t &batch)
+{
+	std::vector<uint8_t> block, packed;
+	int64_t last_no = 0;
+	size_t i;
+	
+	for (i = 0; i < nos.size(); i += PostingCodec::BLOCK_LEN) {
+		packed.clear();
+		PostingCodec::encode(m_posting_codec, &nos[i],
+							 NV_MIN(nos.size() - i, (size_t)PostingCodec::BLOCK_LEN),
+							 last_no, packed);
+		if (!block.empty() && block.size() + packed.size() > POSTING_BLOCK_SIZE) {
+			set_posting_block(hash, tail->nblocks, block.data(), block.size(), batch);
+			tail->nblocks += 1;
+			block.clear();
+		}
+		block.insert(block.end(), packed.begin(), packed.end());
+	}
+	if (!block.empty()) {
+		set_posting_block(hash, tail->nblocks, block.data(), block.size(), batch);
+		tail->nblocks += 1;
+	}
+	// the next nos go to a new vbyte block
+	tail->nsealed = tail->nblocks;
+	tail->tail_len = 0;
+}
+
+/*
+ * the list of an older index and underfull blocks are packed into full blocks.
+ * force: the list is rewritten with the posting codec.
+ * the new blocks, the tail and the removes are written at once.
+ */
+bool
+InvertedIndexLevelDB::rewrite_posting(uint32_t hash, bool force)
+{
+	posting_tail_t tail, new_tail;
+	posting_batch_t batch;
+	std::vector<int64_t> nos;
+	size_t sp = 0;
+	uint8_t *vs;
+	bool legacy = false;
+	int32_t b;
+	
+	if ((vs = (uint8_t *)m_inverted_index.get(&hash, sizeof(hash), &sp)) != NULL) {
+		legacy = true;
+		m_inverted_index.free_value(vs);
+	}
+	get_posting_tail(hash, &tail);
+	if (!legacy && !force) {
+		if (m_posting_codec == POSTING_CODEC_VBYTE) {
+			std::vector<uint8_t> vbc;
+			
+			if (tail.nblocks <= 1 || tail.nsealed > 0) {
+				return true;
+			}
+			if (!read_posting(hash, vbc)) {
+				OTAMA_LOG_ERROR("posting block not found(%u)", hash);
+				return false;
+			}
+			if (tail.nblocks == vbc_blocks(vbc.data(), vbc.size(), POSTING_BLOCK_SIZE)) {
+				return true;
+			}
+		} else if (tail.nblocks - tail.nsealed <= 1) {
+			return true;
+		}
+	}
+	decode_vbc(hash, nos);
+	memset(&new_tail, 0, sizeof(new_tail));
+	new_tail.last_no = tail.last_no;
+	if (m_posting_codec == POSTING_CODEC_VBYTE) {
+		std::vector<uint8_t> vbc;
+		int64_t last_no = 0;
+		
+		PostingCodec::encode(m_posting_codec, nos.data(), nos.size(), last_no, vbc);
+		write_posting_blocks(hash, &new_tail, vbc.data(), vbc.size(), batch);
+	} else {
+		write_sealed_blocks(hash, &new_tail, nos, batch);
+	}
+	set_posting_tail(hash, &new_tail, batch);
+	for (b = new_tail.nblocks; b < tail.nblocks; ++b) {
+		uint8_t key[POSTING_BLOCK_KEY_LEN];
+		
+		posting_block_key(key, hash, b);
+		batch.batch.remove(key, sizeof(key));
+	}
+	if (legacy) {
+		batch.batch.remove(&hash, sizeof(hash));
+	}
+	return write_posting_batch(batch);
+}
+
+otama_status_t
+InvertedIndexLevelDB::vacuum_posting(void)
+{
+	std::vector<std::string> keys;
+	std::vector<std::string>::const_iterator i;
+	otama_status_t ret = OTAMA_STATUS_OK;
+	int8_t verify_index_value = 0;
+	long t = nv_clock();
+	const bool force = get_posting_codec() != m_posting_codec;
+	
+	if (!m_metadata.set_sync("_VERIFY_INDEX", 13,
+							 &verify_index_value,
+							 sizeof(verify_index_value))) 
+	{
+		return OTAMA_STATUS_SYSERROR;
+	}
+	// every hash has a tail record
+	m_inverted_index.keys(sizeof(uint64_t), keys);
+	for (i = keys.begin(); i != keys.end(); ++i) {
+		uint64_t tail_key;
+		
+		memcpy(&tail_key, i->data(), sizeof(tail_key));
+		if (!rewrite_posting((uint32_t)(tail_key >> 32), force)) {
+			ret = OTAMA_STATUS_SYSERROR;
+			break;
+		}
+	}
+	if (ret == OTAMA_STATUS_OK && force) {
+		if (!set_posting_codec(m_posting_codec)) {
+			ret = OTAMA_STATUS_SYSERROR;
+		}
+	}
+	if (ret == OTAMA_STATUS_OK) {
+		verify_index_value = 1;
+		if (!m_metadata.set_sync("_VERIFY_INDEX", 13,
+								 &verify_index_value,
+								 sizeof(verify_index_value))) 
+		{
+			ret = OTAMA_STATUS_SYSERROR;
+		}
+	}
+	OTAMA_LOG_DEBUG("vacuum_posting: %zd hashes, %ldms", keys.size(), nv_clock() - t);
+	
+	return ret;
+}
+
+/* the codec of the index, the indexes without the tag are vbyte */
+posting_codec_e
+InvertedIndexLevelDB::get_posting_codec(void)
+{
+	posting_codec_e codec = POSTING_CODEC_VBYTE;
+	size_t sp = 0;
+	int8_t *value = (int8_t *)m_metadata.get("_POSTING_CODEC", 14, &sp);
+	
+	if (value != NULL) {
+		if (sp == sizeof(int8_t) && *value >= 0 && *value < POSTING_CODEC_MAX) {
+			codec = (posting_codec_e)*value;
+		}
+		m_metadata.free_value(value);
+	}
+	return codec;
+}
+
+bool
+InvertedIndexLevelDB::set_posting_codec(posting_codec_e codec)
+{
+	int8_t value = (int8_t)codec;
+	
+	if (!m_metadata.set_sync("_POSTING_CODEC", 14, &value, sizeof(value))) {
+		OTAMA_LOG_ERROR("%s: %s\n", m_metadata.path().c_str(),
+						m_metadata.error_message().c_str());
+		return false;
+	}
+	return true;
+}
+
 otama_status_t
 InvertedIndexLevelDB::set_vbc(int64_t no, const sparse_vec_t &vec)
 {
@@ -71,24 +479,14 @@ InvertedIndexLevelDB::set_vbc(int64_t no, const sparse_vec_t &vec)
 	
 	for (i = vec.begin(); i != vec.end(); ++i) {
 		uint32_t hash = *i;
-		const uint64_t last_no_key = (uint64_t)hash << 32;
-		bool bret;
-		int64_t last_no;
-		int64_t *last_no_ptr;
+		posting_tail_t tail;
 		uint64_t a;
 		std::vector<uint8_t> append_value;
-		size_t sp;
 		
-		last_no_ptr = (int64_t *)m_inverted_index.get(&last_no_key, sizeof(last_no_key), &sp);
-		if (last_no_ptr) {
-			last_no = *last_no_ptr;
-			m_inverted_index.free_value(last_no_ptr);
-		} else {
-			last_no = 0;
-		}
-		NV_ASSERT(last_no < no);
+		get_posting_tail(hash, &tail);
+		NV_ASSERT(tail.last_no < no);
 		
-		a = no - last_no;
+		a = no - tail.last_no;
 		while (a) {
 			uint8_t v = (a & 0x7f);
 			a >>= 7;
@@ -97,16 +495,7 @@ InvertedIndexLevelDB::set_vbc(int64_t no, const sparse_vec_t &vec)
 			}
 			append_value.push_back(v);
 		}
-		bret = m_inverted_index.append(&hash, append_value.data(), append_value.size());
-		if (!bret) {
-			OTAMA_LOG_ERROR("%s", m_inverted_index.error_message().c_str());
-			ret = OTAMA_STATUS_SYSERROR;
-			break;
-		}
-		bret = m_inverted_index.replace(&last_no_key, sizeof(last_no_key),
-										&no, sizeof(no));
-		if (!bret) {
-			OTAMA_LOG_ERROR("%s", m_inverted_index.error_message().c_str());
+		if (!append_posting(hash, append_value.data(), append_value.size(), no)) {
 			ret = OTAMA_STATUS_SYSERROR;
 			break;
 		}
@@ -118,31 +507,30 @@ InvertedIndexLevelDB::set_vbc(int64_t no, const sparse_vec_t &vec)
 void
 InvertedIndexLevelDB::decode_vbc(uint32_t hash, std::vector<int64_t> &vec)
 {
-	static const int s_t[8] = { 0, 7, 14, 21, 28, 35, 42, 49 };
+	posting_tail_t tail;
+	int64_t last_no = 0;
 	uint8_t *vs;
 	size_t sp = 0;
+	int32_t b;
+	
 	vec.clear();
 	if ((vs = (uint8_t *)m_inverted_index.get(&hash, sizeof(hash), &sp)) != NULL) {
-		const size_t n = sp / sizeof(uint8_t);
-		int64_t a = 0;
-		int64_t last_no = 0;
-		int j = 0;
-		size_t i;
+		PostingCodec::vbyte_decode(vs, sp, last_no, vec);
+		m_inverted_index.free_value(vs);
+	}
+	get_posting_tail(hash, &tail);
+	for (b = 0; b < tail.nblocks; ++b) {
+		uint8_t key[POSTING_BLOCK_KEY_LEN];
 		
-		for (i = 0; i < n; ++i) {
-			const uint8_t v = vs[i];
-			if ((v & 0x80) != 0) {
-				a |= ((int64_t)(v & 0x7f) << s_t[j]);
-				++j;
+		posting_block_key(key, hash, b);
+		if ((vs = (uint8_t *)m_inverted_index.get(key, sizeof(key), &sp)) != NULL) {
+			if (b < tail.nsealed) {
+				PostingCodec::decode_blocks(vs, sp, last_no, vec);
 			} else {
-				int64_t no = last_no + (((int64_t)v << s_t[j]) | a);
-				vec.push_back(no);
-				last_no = no;
-				j = 0;
-				a = 0;
+				PostingCodec::vbyte_decode(vs, sp, last_no, vec);
 			}
+			m_inverted_index.free_value(vs);
 		}
-		m_inverted_index.free_value(vs);
 	}
 }
 		
@@ -161,20 +549,11 @@ InvertedIndexLevelDB::init_index_buffer(index_buffer_t &index_buffer,
 			uint32_t hash = *j;
 			last_no_buffer_t::const_iterator no = last_no_buffer.find(hash);
 			if (no == last_no_buffer.end()) {
-				const uint64_t last_no_key = (uint64_t)hash << 32;
-				int64_t last_no;
-				int64_t *last_no_ptr;
-				size_t sp = 0;
+				posting_tail_t tail;
 				
-				last_no_ptr = (int64_t *)m_inverted_index.get(&last_no_key, sizeof(last_no_key), &sp);
-				if (last_no_ptr != NULL) {
-					last_no = *last_no_ptr;
-					m_inverted_index.free_value(last_no_ptr);
-				} else {
-					last_no = 0;
-				}
+				get_posting_tail(hash, &tail);
 				std::vector<uint8_t> empty_rec;
-				last_no_buffer.insert(std::make_pair(hash, last_no));
+				last_no_buffer.insert(std::make_pair(hash, tail.last_no));
 				index_buffer.insert(std::make_pair(hash, empty_rec));
 			}
 		}
@@ -238,26 +617,15 @@ InvertedIndexLevelDB::write_index_buffer(const index_buffer_t &index_buffer,
 			
 	for (i = index_buffer.begin(); i != index_buffer.end(); ++i) {
 		uint32_t hash = i->first;
-		const uint64_t last_no_key = (uint64_t)hash << 32;
-				
 		last_no_buffer_t::const_iterator last_no = last_no_buffer.find(hash);
 				
 		NV_ASSERT(last_no != last_no_buffer.end());
 				
-		bret = m_inverted_index.append(&hash,
-									   i->second.data(),
-									   i->second.size());
+		bret = append_posting(hash,
+							  i->second.data(),
+							  i->second.size(),
+							  last_no->second);
 		if (!bret) {
-			OTAMA_LOG_ERROR("%s", m_inverted_index.error_message().c_str());
-			ret = OTAMA_STATUS_SYSERROR;
-			break;
-		}
-		bret = m_inverted_index.replace(&last_no_key,
-										sizeof(last_no_key),
-										&last_no->second,
-										sizeof(&last_no->second));
-		if (!bret) {
-			OTAMA_LOG_ERROR("%s", m_inverted_index.error_message().c_str());
 			ret = OTAMA_STATUS_SYSERROR;
 			break;
 		}
@@ -408,6 +776,15 @@ InvertedIndexLevelDB::open(void)
 		m_metadata.clear();
 		m_ids.clear();
 	}
+	if (get_last_no() < 0) {
+		if (!set_posting_codec(m_posting_codec)) {
+			return OTAMA_STATUS_SYSERROR;
+		}
+	} else if (get_posting_codec() != m_posting_codec) {
+		OTAMA_LOG_NOTICE("the posting lists are `%s'. vacuum converts them to `%s'",
+						 PostingCodec::name(get_posting_codec()),
+						 PostingCodec::name(m_posting_codec));
+	}
 	if (!setup()) {
 		ret = OTAMA_STATUS_SYSERROR;
 	}
@@ -431,6 +808,9 @@ InvertedIndexLevelDB::clear(void)
 	m_inverted_index.clear();
 	m_metadata.clear();
 	m_ids.clear();
+	if (!set_posting_codec(m_posting_codec)) {
+		return OTAMA_STATUS_SYSERROR;
+	}
 			
 	return OTAMA_STATUS_OK;
 }
@@ -438,6 +818,11 @@ InvertedIndexLevelDB::clear(void)
 otama_status_t
 InvertedIndexLevelDB::vacuum(void)
 {
+	otama_status_t ret = vacuum_posting();
+	
+	if (ret != OTAMA_STATUS_OK) {
+		return ret;
+	}
 	if (!m_ids.vacuum()) {
 		return OTAMA_STATUS_SYSERROR;
 	}
@@ -451,11 +836,6 @@ InvertedIndexLevelDB::vacuum(void)
 	return OTAMA_STATUS_OK;
 }
 
-typedef struct {
-	int64_t no;
-	float w;
-} hit_tmp_t;
-
 otama_status_t
 InvertedIndexLevelDB::search(otama_result_t **results, int n,
 							 const sparse_vec_t &vec)
@@ -463,86 +843,41 @@ InvertedIndexLevelDB::search(otama_result_t **results, int n,
 	int l, result_max, i;
 	long t;
 	int num_threads  = nv_omp_procs();
-	std::vector<std::vector<similarity_temp_t> >hits;
-	size_t c;
+	std::vector<InvertedIndexAccumulator::posting_t> postings(vec.size());
+	std::vector<float> weights(vec.size());
+	std::vector<InvertedIndexAccumulator::hit_t> hit_tmp;
+	size_t npostings = 0;
 	std::vector<topn_t> topn;
 
 	if (n < 1) {
 		return OTAMA_STATUS_INVALID_ARGUMENTS;
 	}
 	topn.resize(num_threads);
-	hits.resize(num_threads);
-			
-	t = nv_clock();
-	c = count();
-	hits[0].reserve(1 + c * 3);
-	for (i = 1; i < num_threads; ++i) {
-		hits[i].reserve(1 + (c * 3 / num_threads));
-	}
 	
+	t = nv_clock();
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 4)
+#pragma omp parallel for num_threads(num_threads) schedule(dynamic, 4) reduction(+:npostings)
 #endif
 	for (i = 0; i < (int)vec.size(); ++i) {
-		int thread_id = nv_omp_thread_id();
-		std::vector<similarity_temp_t> &hit = hits[thread_id];
 		uint32_t h = vec[i];
-		std::vector<int64_t> v;
-		int j;
+		float w = (*m_weight_func)(h);
 		
-		decode_vbc(h, v);
-		for (j = 0; j < (int)v.size(); ++j) {
-			similarity_temp_t hi;
-			hi.no = v[j];
-			hi.w = (*m_weight_func)(h);
-			hi.w *= hi.w;
-			hit.push_back(hi);
-		}
+		weights[i] = w * w;
+		decode_vbc(h, postings[i]);
+		npostings += postings[i].size();
 	}
-	for (i = 1; i < num_threads; ++i) {
-		std::copy(hits[i].begin(), hits[i].end(), std::back_inserter(hits[0]));
-	}
-			
 	OTAMA_LOG_DEBUG("search: inverted index search: %zd, %ldms",
-					hits[0].size(), nv_clock() - t);
+					npostings, nv_clock() - t);
 	t = nv_clock();
 	
-	std::sort(hits[0].begin(), hits[0].end());
-	OTAMA_LOG_DEBUG("search: sort:  %ldms", nv_clock() - t);
+	InvertedIndexAccumulator::accumulate(postings, weights, m_hit_threshold, hit_tmp);
+	OTAMA_LOG_DEBUG("search: accumulate: %zd, %ldms", hit_tmp.size(), nv_clock() - t);
 	t = nv_clock();
 	
-	if (hits[0].size() > 0) {
-		int64_t no = hits[0][0].no;
-		float w = 0.0f;
+	if (hit_tmp.size() > 0) {
 		float query_norm = norm(vec);
-		int count = 0;
-		std::vector<hit_tmp_t> hit_tmp;
 		bool has_error = false;
-				
-		for (std::vector<similarity_temp_t>::const_iterator j = hits[0].begin();
-			 j != hits[0].end(); ++j)
-		{
-			if (j->no == no) {
-				w += j->w;
-				++count;
-			} else {
-				if (count > m_hit_threshold) {
-					hit_tmp_t tmp;
-					tmp.no = no;
-					tmp.w = w;
-					hit_tmp.push_back(tmp);
-				}
-				no = j->no;
-				w = j->w;
-				count = 1;
-			}
-		}
-		if (count > m_hit_threshold) {
-			hit_tmp_t tmp;
-			tmp.no = no;
-			tmp.w = w;
-			hit_tmp.push_back(tmp);
-		}
+		
 #ifdef _OPENMP
 #pragma omp parallel for num_threads(num_threads) shared(has_error) schedule(dynamic, 16)
 #endif
@@ -23,6 +23,7 @@
 #define OTAMA_INVERTED_INDEX_LEVELDB_HPP
 
 #include "otama_inverted_index.hpp"
+#include "otama_inverted_index_accumulator.hpp"
 #include "otama_leveldb.hpp"
 #include <string>
 #include <queue>
@@ -38,6 +39,8 @@ namespace otama
 	{
 	protected:
 		static const int COUNT_TOPN_MIN = 128;
+		static const size_t POSTING_BLOCK_SIZE = 4096;
+		static const size_t POSTING_BLOCK_KEY_LEN = 9;
 		bool m_preheat_cache;
 		LevelDB<int64_t, InvertedIndex::metadata_record_t, 16 * 1048576, 0> m_metadata;
 		LevelDB<int64_t, otama_id_t, 16 * 1048576, 0> m_ids;
@@ -55,15 +58,32 @@ namespace otama
 			}
 		} similarity_result_t;
 		
-		typedef struct similarity_temp {
-			int64_t no;
-			float w;
-			inline bool
-			operator <(const struct similarity_temp &rhs) const
-			{
-				return no < rhs.no;
-			}
-		} similarity_temp_t;
+		/*
+		 * a posting list is stored as blocks of POSTING_BLOCK_SIZE bytes,
+		 * keyed by (hash, block_no). the tail record (key: hash << 32)
+		 * holds the last no and the number of blocks.
+		 * the first nsealed blocks are packed by the posting codec,
+		 * the others are vbyte codes.
+		 * the lists of older indexes (key: hash) are read before the blocks
+		 * and are converted by vacuum().
+		 */
+		typedef struct {
+			int64_t last_no;
+			int32_t nblocks;
+			int32_t tail_len;
+			int32_t nsealed;
+			int32_t reserved;
+		} posting_tail_t;
+		
+		/*
+		 * the writes to a list, its blocks, tail and removes go to the db
+		 * in one write. an unlocked search never sees a tail that does not
+		 * match its blocks. blocks holds the blocks written so far.
+		 */
+		typedef struct {
+			LevelDBWriteBatch batch;
+			std::map<int32_t, std::vector<uint8_t> > blocks;
+		} posting_batch_t;
 		
 		typedef std::map<uint32_t, std::vector<uint8_t> > index_buffer_t;
 		typedef std::map<uint32_t, int64_t > last_no_buffer_t;
@@ -74,6 +94,31 @@ namespace otama
 		std::string inverted_index_file_name(void);
 		otama_status_t set_vbc(int64_t no, const sparse_vec_t &vec);
 		void decode_vbc(uint32_t hash, std::vector<int64_t> &vec);
+		void get_posting_tail(uint32_t hash, posting_tail_t *tail);
+		void set_posting_tail(uint32_t hash, const posting_tail_t *tail,
+							  posting_batch_t &batch);
+		bool get_posting_block(uint32_t hash, int32_t block_no,
+							   const posting_batch_t &batch,
+							   std::vector<uint8_t> &block);
+		void set_posting_block(uint32_t hash, int32_t block_no,
+							   const uint8_t *block, size_t len,
+							   posting_batch_t &batch);
+		bool write_posting_batch(posting_batch_t &batch);
+		bool read_posting(uint32_t hash, std::vector<uint8_t> &vbc);
+		bool append_posting(uint32_t hash, const uint8_t *vbc, size_t len,
+							int64_t last_no);
+		void write_posting_blocks(uint32_t hash, posting_tail_t *tail,
+								  const uint8_t *vbc, size_t len,
+								  posting_batch_t &batch);
+		bool seal_posting_blocks(uint32_t hash, posting_tail_t *tail,
+								 posting_batch_t &batch);
+		void write_sealed_blocks(uint32_t hash, posting_tail_t *tail,
+								 const std::vector<int64_t> &nos,
+								 posting_batch_t &batch);
+		bool rewrite_posting(uint32_t hash, bool force);
+		otama_status_t vacuum_posting(void);
+		posting_codec_e get_posting_codec(void);
+		bool set_posting_codec(posting_codec_e codec);
 		void init_index_buffer(index_buffer_t &index_buffer,
 							   last_no_buffer_t &last_no_buffer,
 							   const batch_records_t &records);
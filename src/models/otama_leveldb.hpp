@@ -23,6 +23,7 @@
 #define OTAMA_LEVELDB_HPP
 #include <sys/types.h>
 #include <string>
+#include <vector>
 #include <inttypes.h>
 #include "leveldb/c.h"
 #include "leveldb/cache.h"
@@ -32,6 +33,54 @@
 
 namespace otama
 {
+	/* puts and deletes that LevelDB::write() applies at once */
+	class LevelDBWriteBatch
+	{
+	private:
+		leveldb_writebatch_t *m_batch;
+
+		LevelDBWriteBatch(const LevelDBWriteBatch &);
+		LevelDBWriteBatch &operator=(const LevelDBWriteBatch &);
+		
+	public:
+		LevelDBWriteBatch(void)
+		{
+			m_batch = leveldb_writebatch_create();
+		}
+		
+		~LevelDBWriteBatch()
+		{
+			leveldb_writebatch_destroy(m_batch);
+		}
+		
+		inline void
+		set(const void *key, size_t key_len,
+			const void *value, size_t value_len)
+		{
+			leveldb_writebatch_put(m_batch,
+								   (const char *)key, key_len,
+								   (const char *)value, value_len);
+		}
+		
+		inline void
+		remove(const void *key, size_t key_len)
+		{
+			leveldb_writebatch_delete(m_batch, (const char *)key, key_len);
+		}
+		
+		inline void
+		clear(void)
+		{
+			leveldb_writebatch_clear(m_batch);
+		}
+		
+		inline leveldb_writebatch_t *
+		batch(void)
+		{
+			return m_batch;
+		}
+	};
+	
 	template<class KEY_TYPE, class VALUE_TYPE,
 			 size_t READ_CACHE_SIZE,
 			 size_t WRITE_CACHE_SIZE>
@@ -294,6 +343,62 @@ namespace otama
 			return append(key, value, 1);
 		}
 		
+		inline bool
+		remove(const void *key, size_t key_len)
+		{
+			assert(m_db != NULL);
+			char *errptr = NULL;
+			
+			leveldb_delete(m_db, m_wopt, (const char *)key, key_len, &errptr);
+			if (errptr != NULL) {
+				set_error(errptr);
+				free_value(errptr);
+				return false;
+			}
+			return true;
+		}
+		
+		/* applies all the writes of batch or none of them */
+		inline bool
+		write(LevelDBWriteBatch &batch)
+		{
+			assert(m_db != NULL);
+			char *errptr = NULL;
+			
+			leveldb_write(m_db, m_wopt, batch.batch(), &errptr);
+			if (errptr != NULL) {
+				set_error(errptr);
+				free_value(errptr);
+				return false;
+			}
+			return true;
+		}
+		
+		/* all keys of key_len bytes */
+		void
+		keys(size_t key_len, std::vector<std::string> &keys)
+		{
+			assert(m_db != NULL);
+			leveldb_readoptions_t *ropt = leveldb_readoptions_create();
+			leveldb_iterator_t *iter;
+			
+			leveldb_readoptions_set_fill_cache(ropt, 0);
+			iter = leveldb_create_iterator(m_db, ropt);
+			keys.clear();
+			for (leveldb_iter_seek_to_first(iter);
+				 leveldb_iter_valid(iter);
+				 leveldb_iter_next(iter))
+			{
+				size_t len = 0;
+				const char *key = leveldb_iter_key(iter, &len);
+				if (len == key_len) {
+					keys.push_back(std::string(key, len));
+				}
+			}
+			leveldb_iter_destroy(iter);
+			leveldb_readoptions_destroy(ropt);
+		}
+		
 		inline bool
 		replace(const void *key, size_t key_len, const void *value, size_t value_len)
 		{
@@ -27,9 +27,10 @@
 
 namespace otama
 {
-	template<nv_lmca_feature_e F, typename C>
+	template<nv_lmca_feature_e F, typename C,
+			 typename S = FixedStrage<typename nv_lmca_ctx<F, C>::vector_t> >
 	class LMCAFixedDriver:
-		public FixedDriver<typename nv_lmca_ctx<F, C>::vector_t>
+		public FixedDriver<typename nv_lmca_ctx<F, C>::vector_t, S>
 	{
 	protected:
 		typedef nv_lmca_ctx<F, C> T;
@@ -186,20 +187,17 @@ namespace otama
 			otama_result_set_id(results, i, id);
 		}
 
-		virtual otama_status_t
-		feature_search(otama_result_t **results, int n,
-					   const FT *query,
-					   otama_variant_t *options)
+		void
+		search_options(otama_variant_t *options,
+					   typename T::color_method_e &color_method,
+					   float &color_weight,
+					   float &color_threshold)
 		{
-			const int first_n = n * 2;
-			nv_lmca_result_t *first_results = nv_alloc_type(nv_lmca_result_t, first_n);
-			int nresult = 0;
-			int i, j, results_size;
 			otama_variant_t *value;
-			float color_weight = m_color_weight;
-			float color_threshold = m_color_threshold;
-			typename T::color_method_e color_method = m_color_method;
-
+			
+			color_weight = m_color_weight;
+			color_threshold = m_color_threshold;
+			color_method = m_color_method;
 			if (OTAMA_VARIANT_IS_HASH(options)) {
 				value = otama_variant_hash_at(options, "color_method");
 				if (!OTAMA_VARIANT_IS_NULL(value)) {
@@ -219,32 +217,79 @@ namespace otama
 					color_weight = otama_variant_to_float(value);
 				}
 			}
+		}
+		
+		void
+		set_results(otama_result_t *results, int n,
+					nv_lmca_result_t *first_results, int nresult)
+		{
+			int i, results_size;
+			
+			results_size = 0;
+			for (i = 0; i < nresult && i < n; ++i) {
+				set_result(results, results_size++,
+						   FixedDriver<FT, S>::m_mmap->id_at(first_results[i].index),
+						   first_results[i].similarity);
+			}
+			otama_result_set_count(results, results_size);
+		}
+		
+		virtual otama_status_t
+		feature_search(otama_result_t **results, int n,
+					   const FT *query,
+					   otama_variant_t *options)
+		{
+			nv_lmca_result_t *first_results = nv_alloc_type(nv_lmca_result_t, n);
+			int nresult = 0;
+			float color_weight;
+			float color_threshold;
+			typename T::color_method_e color_method;
+			
+			search_options(options, color_method, color_weight, color_threshold);
 			this->sync();
 			*results = otama_result_alloc(n);
-			nresult = m_ctx->search(first_results, first_n,
-									FixedDriver<FT>::m_mmap->vec(),
-									FixedDriver<FT>::m_mmap->count(),
+			nresult = m_ctx->search(first_results, n,
+									FixedDriver<FT, S>::m_mmap->vec(),
+									FixedDriver<FT, S>::m_mmap->count(),
 									query,
 									color_method,
 									color_weight,
-									color_threshold);
-			for (j = i = 0; j < nresult; ++j) {
-				if ((FixedDriver<FT>::m_mmap->flag_at(first_results[j].index) &
-					 this->FLAG_DELETE) == 0)
-				{
-					first_results[i] = first_results[j];
-					++i;
-				}
+									color_threshold,
+									FixedDriver<FT, S>::m_mmap->deleted());
+			set_results(*results, n, first_results, nresult);
+			nv_free(first_results);
+			
+			return OTAMA_STATUS_OK;
+		}
+		
+		virtual otama_status_t
+		feature_search_batch(otama_result_t **results, int n,
+							 const FT **queries, int nq,
+							 otama_variant_t **options)
+		{
+			nv_lmca_result_t *first_results = nv_alloc_type(nv_lmca_result_t, n * nq);
+			std::vector<nv_lmca_result_t *> first_results_q(nq);
+			std::vector<int> nresults(nq);
+			std::vector<float> color_weight(nq);
+			std::vector<float> color_threshold(nq);
+			std::vector<typename T::color_method_e> color_method(nq);
+			int q;
+			
+			for (q = 0; q < nq; ++q) {
+				first_results_q[q] = first_results + (int64_t)n * q;
+				search_options(options[q], color_method[q], color_weight[q], color_threshold[q]);
 			}
-			nresult = i;
-			results_size = 0;
-			for (i = 0; i < nresult && i < n; ++i) {
-				set_result(*results, results_size++,
-						   FixedDriver<FT>::m_mmap->id_at(first_results[i].index),
-						   first_results[i].similarity);
+			this->sync();
+			T::search_batch(&first_results_q[0], &nresults[0], n,
+							FixedDriver<FT, S>::m_mmap->vec(),
+							FixedDriver<FT, S>::m_mmap->count(),
+							queries, nq,
+							&color_method[0], &color_weight[0], &color_threshold[0],
+							FixedDriver<FT, S>::m_mmap->deleted());
+			for (q = 0; q < nq; ++q) {
+				results[q] = otama_result_alloc(n);
+				set_results(results[q], n, first_results_q[q], nresults[q]);
 			}
-			otama_result_set_count(*results, results_size);
-			
 			nv_free(first_results);
 			
 			return OTAMA_STATUS_OK;
@@ -272,7 +317,7 @@ namespace otama
 		}
 		
 		LMCAFixedDriver(otama_variant_t *options)
-		: FixedDriver<FT>(options),
+		: FixedDriver<FT, S>(options),
 		  m_color_threshold(0.0f), m_color_method(T::COLOR_METHOD_LINEAR)
 		{
 			otama_variant_t *driver, *value;
@@ -342,7 +387,7 @@ namespace otama
 		open(void)
 		{
 			otama_status_t ret;
-			ret = FixedDriver<FT>::open();
+			ret = FixedDriver<FT, S>::open();
 			if (ret != OTAMA_STATUS_OK) {
 				return ret;
 			}
@@ -385,7 +430,7 @@ namespace otama
 		set(const std::string &key, otama_variant_t *value)
 		{
 #ifdef _OPENMP
-			OMPLock lock(FixedDriver<FT>::m_lock);
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
 #endif
 			OTAMA_LOG_DEBUG("set key: %s\n", key.c_str());
 			
@@ -393,7 +438,7 @@ namespace otama
 				m_color_weight = otama_variant_to_float(value);
 				return OTAMA_STATUS_OK;
 			}
-			return FixedDriver<FT>::set(key, value);
+			return FixedDriver<FT, S>::set(key, value);
 		}
 		
 		virtual otama_status_t
@@ -401,27 +446,27 @@ namespace otama
 			otama_variant_t *value)
 		{
 #ifdef _OPENMP
-			OMPLock lock(FixedDriver<FT>::m_lock);
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
 #endif
 			if (key == "color_weight") {
 				otama_variant_set_float(value, m_color_weight);
 				return OTAMA_STATUS_OK;
 			}
-			return FixedDriver<FT>::get(key, value);
+			return FixedDriver<FT, S>::get(key, value);
 		}
 		
 		virtual otama_status_t
 		unset(const std::string &key)
 		{
 #ifdef _OPENMP
-			OMPLock lock(FixedDriver<FT>::m_lock);
+			OMPLock lock(FixedDriver<FT, S>::m_lock);
 #endif
 			OTAMA_LOG_DEBUG("unset key: %s\n", key.c_str());
 			if (key == "color_weight") {
 				m_color_weight = DEFAULT_COLOR_WEIGHT();
 				return OTAMA_STATUS_OK;
 			}
-			return FixedDriver<FT>::unset(key);
+			return FixedDriver<FT, S>::unset(key);
 		}
 	};
 }
@@ -0,0 +1,202 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_config.h"
+#ifndef OTAMA_LMCA_HNSW_FIXED_DRIVER_HPP
+#define OTAMA_LMCA_HNSW_FIXED_DRIVER_HPP
+
+#include "otama_lmca_fixed_driver.hpp"
+#include "otama_lmca_hnsw_strage.hpp"
+#include "nv_lmca_hnsw.hpp"
+#include <string>
+
+namespace otama
+{
+	/*
+	 * LMCA search over the HNSW graph of the records.
+	 * a larger ef finds more of the results of LMCAFixedDriver.
+	 */
+	template<nv_lmca_feature_e F, typename C>
+	class LMCAHNSWFixedDriver:
+		public LMCAFixedDriver<F, C, LMCAHNSWStrage<nv_lmca_hnsw<F, C> > >
+	{
+	protected:
+		typedef nv_lmca_ctx<F, C> T;
+		typedef typename T::vector_t FT;
+		typedef nv_lmca_hnsw<F, C> IT;
+		typedef LMCAFixedDriver<F, C, LMCAHNSWStrage<IT> > B;
+
+		static inline int DEFAULT_EF() { return 64; }
+
+		int m_m;
+		int m_ef_construction;
+		int m_ef;
+		IT *m_hnsw;
+
+		int
+		search_ef(otama_variant_t *options)
+		{
+			otama_variant_t *value;
+
+			if (OTAMA_VARIANT_IS_HASH(options)
+				&& !OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(options, "ef")))
+			{
+				return (int)otama_variant_to_int(value);
+			}
+			return m_ef;
+		}
+
+		virtual otama_status_t
+		feature_search(otama_result_t **results, int n,
+					   const FT *query,
+					   otama_variant_t *options)
+		{
+			nv_lmca_result_t *first_results = nv_alloc_type(nv_lmca_result_t, n);
+			int nresult = 0;
+			float color_weight;
+			float color_threshold;
+			typename T::color_method_e color_method;
+
+			this->search_options(options, color_method, color_weight, color_threshold);
+			this->sync();
+			*results = otama_result_alloc(n);
+			nresult = m_hnsw->search(first_results, n,
+									 this->m_mmap->vec(),
+									 this->m_mmap->count(),
+									 this->m_mmap->graph(),
+									 query,
+									 color_method,
+									 color_weight,
+									 color_threshold,
+									 this->m_mmap->deleted(),
+									 search_ef(options));
+			this->set_results(*results, n, first_results, nresult);
+			nv_free(first_results);
+
+			return OTAMA_STATUS_OK;
+		}
+
+		/* the walk of the graph differs per query */
+		virtual otama_status_t
+		feature_search_batch(otama_result_t **results, int n,
+							 const FT **queries, int nq,
+							 otama_variant_t **options)
+		{
+			int q;
+
+			for (q = 0; q < nq; ++q) {
+				otama_status_t ret = feature_search(&results[q], n, queries[q], options[q]);
+				if (ret != OTAMA_STATUS_OK) {
+					return ret;
+				}
+			}
+			return OTAMA_STATUS_OK;
+		}
+
+	public:
+		virtual std::string
+		name(void)
+		{
+			return B::name() + "_hnsw";
+		}
+
+		LMCAHNSWFixedDriver(otama_variant_t *options)
+			: B(options)
+		{
+			otama_variant_t *driver, *value;
+
+			m_m = IT::DEFAULT_M;
+			m_ef_construction = IT::DEFAULT_EF_CONSTRUCTION;
+			m_ef = DEFAULT_EF();
+			driver = otama_variant_hash_at(options, "driver");
+			if (OTAMA_VARIANT_IS_HASH(driver)) {
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "hnsw_m"))) {
+					m_m = NV_MAX((int)otama_variant_to_int(value), 2);
+				}
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "ef_construction"))) {
+					m_ef_construction = NV_MAX((int)otama_variant_to_int(value), 1);
+				}
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "ef"))) {
+					m_ef = (int)otama_variant_to_int(value);
+				}
+			}
+			OTAMA_LOG_DEBUG("driver[hnsw_m] => %d", m_m);
+			OTAMA_LOG_DEBUG("driver[ef_construction] => %d", m_ef_construction);
+			OTAMA_LOG_DEBUG("driver[ef] => %d", m_ef);
+			m_hnsw = new IT;
+		}
+
+		~LMCAHNSWFixedDriver()
+		{
+			delete m_hnsw;
+		}
+
+		otama_status_t
+		open(void)
+		{
+			otama_status_t ret = B::open();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			return this->m_mmap->set_hnsw(m_hnsw, m_m, m_ef_construction);
+		}
+
+		virtual otama_status_t
+		set(const std::string &key, otama_variant_t *value)
+		{
+			if (key == "ef") {
+#ifdef _OPENMP
+				OMPLock lock(this->m_lock);
+#endif
+				m_ef = (int)otama_variant_to_int(value);
+				return OTAMA_STATUS_OK;
+			}
+			return B::set(key, value);
+		}
+
+		virtual otama_status_t
+		get(const std::string &key,
+			otama_variant_t *value)
+		{
+			if (key == "ef") {
+#ifdef _OPENMP
+				OMPLock lock(this->m_lock);
+#endif
+				otama_variant_set_int(value, m_ef);
+				return OTAMA_STATUS_OK;
+			}
+			return B::get(key, value);
+		}
+
+		virtual otama_status_t
+		unset(const std::string &key)
+		{
+			if (key == "ef") {
+#ifdef _OPENMP
+				OMPLock lock(this->m_lock);
+#endif
+				m_ef = DEFAULT_EF();
+				return OTAMA_STATUS_OK;
+			}
+			return B::unset(key);
+		}
+	};
+}
+
+#endif
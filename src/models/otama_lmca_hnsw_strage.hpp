@@ -0,0 +1,554 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_config.h"
+#ifndef OTAMA_LMCA_HNSW_STRAGE_HPP
+#define OTAMA_LMCA_HNSW_STRAGE_HPP
+
+#include "nv_core.h"
+#include "otama_log.h"
+#include "otama_mmap.h"
+#include "otama_fixed_strage.hpp"
+#include "nv_lmca_hnsw.hpp"
+#include <string>
+#include <vector>
+
+namespace otama
+{
+	/*
+	 * FixedStrage<H::vector_t> with the HNSW graph of the rows.
+	 * the graph is kept in three files next to the rows
+	 * (_hnsw_metadata, _hnsw_nodes, _hnsw_upper).
+	 * the rows of a pull are added to the graph by set_count(),
+	 * the graph is built again after vacuum().
+	 * a graph that is missing or being built again is not used,
+	 * the search falls back to the scan of the rows.
+	 */
+	template<class H>
+	class LMCAHNSWStrage
+	{
+	private:
+		typedef typename H::vector_t FT;
+
+		static const int64_t DEFAULT_COUNT_MAX = 10000;
+
+		typedef struct {
+			int64_t count_max;  /* nodes, 0 when the files were replaced */
+			int64_t upper_max;  /* int32 of the upper links */
+			nv_lmca_hnsw_header_t header;
+		} metadata_t;
+
+		typedef struct {
+			otama_mmap_t *metadata;
+			otama_mmap_t *nodes;
+			otama_mmap_t *upper;
+		} shm_t;
+
+		FixedStrage<FT> m_rows;
+		std::string m_dir;
+		std::string m_metadata_name, m_nodes_name, m_upper_name;
+		shm_t m_shm;
+		metadata_t *m_metadata;
+		nv_lmca_hnsw_graph_t m_graph;
+		H *m_hnsw;
+		int m_m;
+		int m_ef_construction;
+		double m_growth;
+
+		inline size_t
+		nodes_len(const metadata_t *metadata)
+		{
+			return sizeof(int32_t) * (size_t)(H::node_stride(metadata->header.m)
+											  * metadata->count_max);
+		}
+
+		inline size_t
+		upper_len(const metadata_t *metadata)
+		{
+			return sizeof(int32_t) * (size_t)NV_MAX(metadata->upper_max, (int64_t)1);
+		}
+
+		otama_status_t
+		create_graph(void)
+		{
+			otama_mmap_t *metadata_shm;
+			metadata_t *metadata;
+			int ret;
+
+			ret = otama_mmap_create(m_dir.c_str(), m_metadata_name.c_str(), sizeof(metadata_t));
+			if (ret != 0) {
+				OTAMA_LOG_ERROR("shm_create: %s", m_metadata_name.c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+			ret = otama_mmap_open(&metadata_shm, m_dir.c_str(), m_metadata_name.c_str(),
+								  sizeof(metadata_t));
+			if (ret != 0) {
+				OTAMA_LOG_ERROR("shm_open failed: %s", m_metadata_name.c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+			metadata = (metadata_t *)otama_mmap_mem(metadata_shm);
+			metadata->count_max = DEFAULT_COUNT_MAX;
+			metadata->upper_max = DEFAULT_COUNT_MAX;
+			H::init(&metadata->header, m_m);
+
+			ret = otama_mmap_create(m_dir.c_str(), m_nodes_name.c_str(), nodes_len(metadata));
+			ret |= otama_mmap_create(m_dir.c_str(), m_upper_name.c_str(), upper_len(metadata));
+			otama_mmap_sync(metadata_shm);
+			otama_mmap_close(&metadata_shm);
+			if (ret != 0) {
+				OTAMA_LOG_ERROR("shm_create: %s", m_nodes_name.c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+
+			return OTAMA_STATUS_OK;
+		}
+
+		otama_status_t
+		open_graph(void)
+		{
+			int ret;
+
+			ret = otama_mmap_open(&m_shm.metadata, m_dir.c_str(), m_metadata_name.c_str(),
+								  sizeof(metadata_t));
+			if (ret != 0) {
+				return OTAMA_STATUS_SYSERROR;
+			}
+			m_metadata = (metadata_t *)otama_mmap_mem(m_shm.metadata);
+			if (m_metadata->count_max == 0) {
+				// replaced, the new graph is not renamed yet
+				close_graph();
+				return OTAMA_STATUS_SYSERROR;
+			}
+			ret = otama_mmap_open(&m_shm.nodes, m_dir.c_str(), m_nodes_name.c_str(),
+								  nodes_len(m_metadata));
+			ret |= otama_mmap_open(&m_shm.upper, m_dir.c_str(), m_upper_name.c_str(),
+								   upper_len(m_metadata));
+			if (ret != 0) {
+				close_graph();
+				OTAMA_LOG_ERROR("shm_open failed: %s", m_nodes_name.c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+			m_graph.header = &m_metadata->header;
+			m_graph.nodes = (int32_t *)otama_mmap_mem(m_shm.nodes);
+			m_graph.upper = (int32_t *)otama_mmap_mem(m_shm.upper);
+
+			return OTAMA_STATUS_OK;
+		}
+
+		void
+		close_graph(void)
+		{
+			if (m_shm.nodes) {
+				otama_mmap_close(&m_shm.nodes);
+			}
+			if (m_shm.upper) {
+				otama_mmap_close(&m_shm.upper);
+			}
+			if (m_shm.metadata) {
+				otama_mmap_close(&m_shm.metadata);
+			}
+			m_metadata = NULL;
+			memset(&m_graph, 0, sizeof(m_graph));
+		}
+
+		void
+		sync_graph(void)
+		{
+			if (m_shm.metadata) {
+				otama_mmap_sync(m_shm.nodes);
+				otama_mmap_sync(m_shm.upper);
+				otama_mmap_sync(m_shm.metadata);
+			}
+		}
+
+		/* tells the readers of the current files to reopen */
+		void
+		invalidate_graph(void)
+		{
+			if (m_metadata) {
+				m_metadata->count_max = 0;
+				otama_mmap_sync(m_shm.metadata);
+			}
+			close_graph();
+		}
+
+		void
+		unlink_graph_files(void)
+		{
+			otama_mmap_unlink(m_dir.c_str(), m_metadata_name.c_str());
+			otama_mmap_unlink(m_dir.c_str(), m_nodes_name.c_str());
+			otama_mmap_unlink(m_dir.c_str(), m_upper_name.c_str());
+		}
+
+		/* room for count nodes and upper int32 of upper links */
+		otama_status_t
+		extend_graph(int64_t count, int64_t upper)
+		{
+			int64_t count_max = m_metadata->count_max;
+			int64_t upper_max = m_metadata->upper_max;
+			int ret = 0;
+
+			if (count > count_max) {
+				while (count > count_max) {
+					count_max = NV_MAX(count_max + DEFAULT_COUNT_MAX, (int64_t)(count_max * m_growth));
+				}
+				ret |= otama_mmap_extend(&m_shm.nodes, (int64_t)sizeof(int32_t)
+										 * H::node_stride(m_metadata->header.m) * count_max);
+			}
+			if (upper > upper_max) {
+				while (upper > upper_max) {
+					upper_max = NV_MAX(upper_max + DEFAULT_COUNT_MAX, (int64_t)(upper_max * m_growth));
+				}
+				ret |= otama_mmap_extend(&m_shm.upper, (int64_t)sizeof(int32_t) * upper_max);
+			}
+			if (ret != 0) {
+				return OTAMA_STATUS_SYSERROR;
+			}
+			m_metadata->count_max = count_max;
+			m_metadata->upper_max = upper_max;
+			m_graph.nodes = (int32_t *)otama_mmap_mem(m_shm.nodes);
+			m_graph.upper = (int32_t *)otama_mmap_mem(m_shm.upper);
+
+			return OTAMA_STATUS_OK;
+		}
+
+		/* adds the rows up to count to the graph */
+		otama_status_t
+		add_rows(int64_t count)
+		{
+			nv_lmca_hnsw_header_t *header;
+			otama_status_t ret;
+
+			if (m_metadata == NULL || m_hnsw == NULL) {
+				return OTAMA_STATUS_OK;
+			}
+			header = &m_metadata->header;
+			if (header->count >= count) {
+				return OTAMA_STATUS_OK;
+			}
+			ret = extend_graph(count, header->upper_len
+							   + H::upper_len(header->count, count, header->m));
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			m_hnsw->add(&m_graph, m_rows.vec(), count, m_ef_construction);
+			sync_graph();
+
+			return OTAMA_STATUS_OK;
+		}
+
+		/* a new graph of all rows, replaced by rename */
+		otama_status_t
+		rebuild_graph(void)
+		{
+			const std::string suffix = ".vacuum";
+			const std::string metadata_name = m_metadata_name;
+			const std::string nodes_name = m_nodes_name;
+			const std::string upper_name = m_upper_name;
+			otama_status_t ret;
+			int ng;
+
+			invalidate_graph();
+			m_metadata_name += suffix;
+			m_nodes_name += suffix;
+			m_upper_name += suffix;
+			ret = create_graph();
+			if (ret == OTAMA_STATUS_OK) {
+				ret = open_graph();
+			}
+			if (ret == OTAMA_STATUS_OK) {
+				ret = add_rows(m_rows.count());
+			}
+			close_graph();
+			if (ret != OTAMA_STATUS_OK) {
+				unlink_graph_files();
+			}
+			m_metadata_name = metadata_name;
+			m_nodes_name = nodes_name;
+			m_upper_name = upper_name;
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			// metadata last
+			ng = otama_mmap_rename(m_dir.c_str(), (nodes_name + suffix).c_str(), nodes_name.c_str());
+			ng |= otama_mmap_rename(m_dir.c_str(), (upper_name + suffix).c_str(), upper_name.c_str());
+			ng |= otama_mmap_rename(m_dir.c_str(), (metadata_name + suffix).c_str(), metadata_name.c_str());
+			if (ng != 0) {
+				return OTAMA_STATUS_SYSERROR;
+			}
+
+			return open_graph();
+		}
+
+	public:
+		static inline double DEFAULT_GROWTH() { return FixedStrage<FT>::DEFAULT_GROWTH(); }
+
+		typedef typename FixedStrage<FT>::record_t record_t;
+
+		LMCAHNSWStrage(const std::string &dir,
+					   const std::string &prefix = "m")
+			: m_rows(dir, prefix), m_dir(dir)
+		{
+			m_metadata_name = prefix + "_hnsw_metadata";
+			m_nodes_name = prefix + "_hnsw_nodes";
+			m_upper_name = prefix + "_hnsw_upper";
+			m_metadata = NULL;
+			m_hnsw = NULL;
+			m_m = H::DEFAULT_M;
+			m_ef_construction = H::DEFAULT_EF_CONSTRUCTION;
+			m_growth = DEFAULT_GROWTH();
+			memset(&m_shm, 0, sizeof(m_shm));
+			memset(&m_graph, 0, sizeof(m_graph));
+		}
+
+		virtual
+		~LMCAHNSWStrage()
+		{
+			close();
+		}
+
+		/*
+		 * the driver sets the graph parameters after open().
+		 * m is used for a new graph, a graph keeps the m it was built with.
+		 */
+		otama_status_t
+		set_hnsw(H *hnsw, int m, int ef_construction)
+		{
+			m_hnsw = hnsw;
+			m_m = m;
+			m_ef_construction = ef_construction;
+			if (m_metadata == NULL) {
+				otama_status_t ret = create_graph();
+				if (ret != OTAMA_STATUS_OK) {
+					return ret;
+				}
+				return open_graph();
+			}
+			return OTAMA_STATUS_OK;
+		}
+
+		otama_status_t
+		create(void)
+		{
+			return m_rows.create();
+		}
+
+		/* the graph is created by set_hnsw() when it is missing */
+		otama_status_t
+		open(void)
+		{
+			otama_status_t ret = m_rows.open();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			open_graph();
+
+			return OTAMA_STATUS_OK;
+		}
+
+		bool
+		is_active(void)
+		{
+			return m_rows.is_active();
+		}
+
+		otama_status_t
+		close(void)
+		{
+			close_graph();
+			return m_rows.close();
+		}
+
+		otama_status_t
+		sync(void)
+		{
+			otama_status_t ret = m_rows.sync();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			sync_graph();
+			if (m_metadata == NULL || m_metadata->count_max == 0) {
+				close_graph();
+				open_graph();
+			} else if ((size_t)otama_mmap_len(m_shm.nodes) != nodes_len(m_metadata)
+					   || (size_t)otama_mmap_len(m_shm.upper) != upper_len(m_metadata))
+			{
+				// extended
+				close_graph();
+				open_graph();
+			}
+
+			return OTAMA_STATUS_OK;
+		}
+
+		otama_status_t
+		unlink(void)
+		{
+			otama_status_t ret;
+
+			invalidate_graph();
+			unlink_graph_files();
+			ret = m_rows.unlink();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			ret = create_graph();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			return open_graph();
+		}
+
+		otama_status_t
+		vacuum(std::vector<record_t> &restore, int64_t *reclaimed_bytes)
+		{
+			int64_t graph_bytes = graph_file_bytes();
+			otama_status_t ret;
+
+			if (m_hnsw == NULL) {
+				return OTAMA_STATUS_ASSERTION_FAILURE;
+			}
+			// the rows are renumbered
+			invalidate_graph();
+			ret = m_rows.vacuum(restore, reclaimed_bytes);
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			ret = rebuild_graph();
+			*reclaimed_bytes += graph_bytes - graph_file_bytes();
+
+			return ret;
+		}
+
+		otama_status_t
+		load(const otama_id_t *id,
+			 uint64_t seq,
+			 FT *vec)
+		{
+			return m_rows.load(id, seq, vec);
+		}
+
+		bool
+		set(int64_t i,
+			int64_t seq,
+			const char *id,
+			uint8_t flag,
+			const FT *vec)
+		{
+			return m_rows.set(i, seq, id, flag, vec);
+		}
+
+		bool
+		set(int64_t i,
+			int64_t seq,
+			const otama_id_t *id,
+			uint8_t flag,
+			const FT *vec)
+		{
+			return m_rows.set(i, seq, id, flag, vec);
+		}
+
+		/* deleted rows stay in the graph and are skipped by the search */
+		void
+		update_flags(std::vector<std::pair<int64_t, uint8_t> > &updates,
+					 std::vector<int64_t> *missing = NULL)
+		{
+			m_rows.update_flags(updates, missing);
+		}
+
+		otama_status_t
+		extend(int64_t s)
+		{
+			return m_rows.extend(s);
+		}
+
+		int64_t count(void) { return m_rows.count(); }
+
+		/* the new rows are in the graph before they are counted */
+		void
+		set_count(int64_t count)
+		{
+			if (add_rows(count) != OTAMA_STATUS_OK) {
+				OTAMA_LOG_ERROR("%s", "failed to add the rows to the graph");
+			}
+			m_rows.set_count(count);
+		}
+		int64_t get_last_no(void) { return m_rows.get_last_no(); }
+		void set_last_no(int64_t no) { m_rows.set_last_no(no); }
+		int64_t get_last_commit_no(void) { return m_rows.get_last_commit_no(); }
+		void set_last_commit_no(int64_t no) { m_rows.set_last_commit_no(no); }
+		inline int64_t generation(void) { return m_rows.generation(); }
+
+		inline void
+		set_growth(double growth)
+		{
+			m_growth = growth;
+			m_rows.set_growth(growth);
+		}
+		inline void set_advice(int flags) { m_rows.set_advice(flags); }
+		inline void set_warmup(bool warmup) { m_rows.set_warmup(warmup); }
+
+		/* -1 when unknown */
+		int64_t
+		resident_bytes(void)
+		{
+			int64_t rows = m_rows.resident_bytes();
+			int64_t nodes, upper;
+
+			if (m_metadata == NULL) {
+				return rows;
+			}
+			nodes = otama_mmap_resident(m_shm.nodes);
+			upper = otama_mmap_resident(m_shm.upper);
+			if (rows < 0 || nodes < 0 || upper < 0) {
+				return -1;
+			}
+			return rows + nodes + upper;
+		}
+
+		inline int64_t
+		graph_file_bytes(void)
+		{
+			if (m_metadata == NULL) {
+				return 0;
+			}
+			return (int64_t)(nodes_len(m_metadata) + upper_len(m_metadata));
+		}
+
+		inline int64_t
+		file_bytes(void)
+		{
+			return m_rows.file_bytes() + graph_file_bytes();
+		}
+
+		/* NULL while the graph is missing */
+		inline const nv_lmca_hnsw_graph_t *
+		graph(void)
+		{
+			return m_metadata != NULL ? &m_graph : NULL;
+		}
+
+		inline const FT *vec(void) { return m_rows.vec(); }
+		inline const uint64_t *deleted(void) { return m_rows.deleted(); }
+		inline uint8_t flag_at(int64_t index) { return m_rows.flag_at(index); }
+		inline const otama_id_t *id_at(int64_t index) { return m_rows.id_at(index); }
+	};
+}
+
+#endif
@@ -0,0 +1,303 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_config.h"
+#ifndef OTAMA_LMCA_IVF_FIXED_DRIVER_HPP
+#define OTAMA_LMCA_IVF_FIXED_DRIVER_HPP
+
+#include "otama_lmca_fixed_driver.hpp"
+#include "otama_lmca_ivf_strage.hpp"
+#include "nv_lmca_ivf.hpp"
+#include <string>
+#include <vector>
+
+namespace otama
+{
+	/*
+	 * LMCA search over the nprobe lists nearest to the query.
+	 * nprobe <= 0 scans all lists, the results are the same as LMCAFixedDriver.
+	 */
+	template<nv_lmca_feature_e F, typename C>
+	class LMCAIVFFixedDriver:
+		public LMCAFixedDriver<F, C, LMCAIVFStrage<nv_lmca_ivf<F, C> > >
+	{
+	protected:
+		typedef nv_lmca_ctx<F, C> T;
+		typedef typename T::vector_t FT;
+		typedef nv_lmca_ivf<F, C> IT;
+		typedef LMCAFixedDriver<F, C, LMCAIVFStrage<IT> > B;
+		typedef typename IT::list_t list_t;
+
+		static inline int DEFAULT_NPROBE() { return 16; }
+
+		std::string m_ivf_file;
+		int m_nprobe;
+		IT *m_ivf;
+		/* the inverted lists of the first count rows, shared by the searches */
+		typedef struct {
+			std::vector<list_t> lists;
+			int64_t count;
+			int64_t generation;
+			int refs;
+		} lists_t;
+		lists_t *m_lists;
+
+		/* NULL when there are no lists of the current rows */
+		lists_t *
+		lists_acquire(void)
+		{
+#ifdef _OPENMP
+			OMPLock lock(this->m_lock);
+#endif
+			if (m_lists == NULL
+				|| m_lists->generation != this->m_mmap->generation()
+				|| m_lists->count > this->m_mmap->count())
+			{
+				return NULL;
+			}
+			++m_lists->refs;
+			return m_lists;
+		}
+
+		void
+		lists_release(lists_t *lists)
+		{
+#ifdef _OPENMP
+			OMPLock lock(this->m_lock);
+#endif
+			if (lists != NULL && --lists->refs == 0 && lists != m_lists) {
+				delete lists;
+			}
+		}
+
+		void
+		lists_replace(lists_t *lists)
+		{
+#ifdef _OPENMP
+			OMPLock lock(this->m_lock);
+#endif
+			lists_t *old = m_lists;
+
+			m_lists = lists;
+			if (old != NULL && old->refs == 0) {
+				delete old;
+			}
+		}
+
+		void
+		update_lists(void)
+		{
+			const int64_t generation = this->m_mmap->generation();
+			const int64_t count = this->m_mmap->count();
+			lists_t *old, *lists;
+
+			old = lists_acquire();
+			if (old != NULL && old->count == count) {
+				lists_release(old);
+				return;
+			}
+			// the searches keep scanning the old lists while the new ones are built
+			lists = new lists_t;
+			lists->generation = generation;
+			lists->refs = 0;
+			if (old != NULL) {
+				lists->lists = old->lists;
+				lists->count = old->count;
+			} else {
+				lists->lists.resize((size_t)m_ivf->nlist());
+				lists->count = 0;
+			}
+			lists_release(old);
+			lists->count = this->m_mmap->list_rows(lists->lists, lists->count);
+			lists_replace(lists);
+		}
+
+		int
+		search_nprobe(otama_variant_t *options)
+		{
+			otama_variant_t *value;
+
+			if (OTAMA_VARIANT_IS_HASH(options)
+				&& !OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(options, "nprobe")))
+			{
+				return (int)otama_variant_to_int(value);
+			}
+			return m_nprobe;
+		}
+
+		virtual otama_status_t
+		feature_search(otama_result_t **results, int n,
+					   const FT *query,
+					   otama_variant_t *options)
+		{
+			nv_lmca_result_t *first_results = nv_alloc_type(nv_lmca_result_t, n);
+			int nresult = 0;
+			float color_weight;
+			float color_threshold;
+			typename T::color_method_e color_method;
+			lists_t *lists;
+
+			this->search_options(options, color_method, color_weight, color_threshold);
+			this->sync();
+			lists = lists_acquire();
+			*results = otama_result_alloc(n);
+			if (lists != NULL && !lists->lists.empty()) {
+				nresult = m_ivf->search(first_results, n,
+										this->m_mmap->vec(),
+										&lists->lists[0],
+										query,
+										color_method,
+										color_weight,
+										color_threshold,
+										this->m_mmap->deleted(),
+										search_nprobe(options));
+			}
+			lists_release(lists);
+			this->set_results(*results, n, first_results, nresult);
+			nv_free(first_results);
+
+			return OTAMA_STATUS_OK;
+		}
+
+		/* the probed lists differ per query */
+		virtual otama_status_t
+		feature_search_batch(otama_result_t **results, int n,
+							 const FT **queries, int nq,
+							 otama_variant_t **options)
+		{
+			int q;
+
+			for (q = 0; q < nq; ++q) {
+				otama_status_t ret = feature_search(&results[q], n, queries[q], options[q]);
+				if (ret != OTAMA_STATUS_OK) {
+					return ret;
+				}
+			}
+			return OTAMA_STATUS_OK;
+		}
+
+	public:
+		virtual std::string
+		name(void)
+		{
+			return B::name() + "_ivf";
+		}
+
+		LMCAIVFFixedDriver(otama_variant_t *options)
+			: B(options)
+		{
+			otama_variant_t *driver, *value;
+
+			m_nprobe = DEFAULT_NPROBE();
+			driver = otama_variant_hash_at(options, "driver");
+			if (OTAMA_VARIANT_IS_HASH(driver)) {
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "ivf"))) {
+					m_ivf_file = otama_variant_to_string(value);
+				}
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "nprobe"))) {
+					m_nprobe = (int)otama_variant_to_int(value);
+				}
+			}
+			OTAMA_LOG_DEBUG("driver[ivf] => %s", m_ivf_file.c_str());
+			OTAMA_LOG_DEBUG("driver[nprobe] => %d", m_nprobe);
+			m_ivf = new IT;
+			m_lists = NULL;
+		}
+
+		~LMCAIVFFixedDriver()
+		{
+			delete m_lists;
+			delete m_ivf;
+		}
+
+		otama_status_t
+		open(void)
+		{
+			otama_status_t ret;
+
+			if (m_ivf_file.size() == 0) {
+				OTAMA_LOG_ERROR("%s", "ivf file is NULL");
+				return OTAMA_STATUS_INVALID_ARGUMENTS;
+			}
+			if (m_ivf->open(m_ivf_file.c_str()) != 0) {
+				OTAMA_LOG_ERROR("invalid ivf file: %s", m_ivf_file.c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+			ret = B::open();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			this->m_mmap->set_ivf(m_ivf);
+
+			return OTAMA_STATUS_OK;
+		}
+
+		virtual otama_status_t
+		sync(void)
+		{
+			otama_status_t ret = B::sync();
+			if (ret == OTAMA_STATUS_OK) {
+				update_lists();
+			}
+			return ret;
+		}
+
+		virtual otama_status_t
+		set(const std::string &key, otama_variant_t *value)
+		{
+			if (key == "nprobe") {
+#ifdef _OPENMP
+				OMPLock lock(this->m_lock);
+#endif
+				m_nprobe = (int)otama_variant_to_int(value);
+				return OTAMA_STATUS_OK;
+			}
+			return B::set(key, value);
+		}
+
+		virtual otama_status_t
+		get(const std::string &key,
+			otama_variant_t *value)
+		{
+			if (key == "nprobe") {
+#ifdef _OPENMP
+				OMPLock lock(this->m_lock);
+#endif
+				otama_variant_set_int(value, m_nprobe);
+				return OTAMA_STATUS_OK;
+			}
+			return B::get(key, value);
+		}
+
+		virtual otama_status_t
+		unset(const std::string &key)
+		{
+			if (key == "nprobe") {
+#ifdef _OPENMP
+				OMPLock lock(this->m_lock);
+#endif
+				m_nprobe = DEFAULT_NPROBE();
+				return OTAMA_STATUS_OK;
+			}
+			return B::unset(key);
+		}
+	};
+}
+
+#endif
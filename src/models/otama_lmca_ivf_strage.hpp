@@ -0,0 +1,445 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_config.h"
+#ifndef OTAMA_LMCA_IVF_STRAGE_HPP
+#define OTAMA_LMCA_IVF_STRAGE_HPP
+
+#include "nv_core.h"
+#include "otama_log.h"
+#include "otama_fixed_strage.hpp"
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace otama
+{
+	/*
+	 * FixedStrage<I::vector_t> with the inverted lists of I.
+	 * the list of each row is stored in a second FixedStrage at set(),
+	 * both strages get the same operations. its files are companions of
+	 * the rows, so vacuum() commits both in one rename. the lists of row
+	 * indexes are built in memory by list_rows(), the caller owns them.
+	 */
+	template<class I>
+	class LMCAIVFStrage
+	{
+	private:
+		typedef typename I::vector_t FT;
+		typedef typename I::list_t list_t;
+		typedef struct {
+			int32_t list;
+		} list_id_t;
+		typedef typename FixedStrage<FT>::record_t row_record_t;
+		typedef typename FixedStrage<list_id_t>::record_t list_id_record_t;
+
+		std::string m_shm_dir, m_prefix;
+		FixedStrage<FT> m_rows;
+		FixedStrage<list_id_t> m_list_ids;
+		const I *m_ivf;
+		int64_t m_rows_generation;
+
+		inline int32_t
+		list_of(const FT *vec)
+		{
+			return (int32_t)m_ivf->assign(vec);
+		}
+
+		static inline bool
+		record_less(const row_record_t &r1, const row_record_t &r2)
+		{
+			return r1.seq < r2.seq;
+		}
+
+		/*
+		 * writes the list ids of the rows of m_rows.vacuum(restore) into
+		 * the companion files, restore is sorted by seq.
+		 */
+		otama_status_t
+		vacuum_list_ids(const std::vector<row_record_t> &restore)
+		{
+			const std::string suffix = FixedStrage<FT>::VACUUM_SUFFIX();
+			const int64_t count = m_rows.count();
+			const int64_t list_count = m_list_ids.count();
+			const int64_t nrestore = (int64_t)restore.size();
+			const int nlist = m_ivf->nlist();
+			const list_id_t *list_ids = m_list_ids.vec();
+			FixedStrage<list_id_t> tmp(m_shm_dir, m_prefix);
+			std::vector<list_id_record_t> rows;
+			int64_t i, k, j;
+
+			// the same order as FixedStrage::vacuum(), a live row wins over a restored one
+			rows.reserve((size_t)(count + nrestore));
+			for (i = k = 0; i < count || k < nrestore;) {
+				list_id_record_t row;
+
+				if (i < count && m_rows.deleted_at(i)) {
+					++i;
+				} else if (k == nrestore
+						   || (i < count && m_rows.seq_at(i) < restore[k].seq))
+				{
+					row.seq = m_rows.seq_at(i);
+					row.id = *m_rows.id_at(i);
+					if (i < list_count && m_list_ids.seq_at(i) == row.seq
+						&& list_ids[i].list >= 0 && list_ids[i].list < nlist)
+					{
+						row.vec.list = list_ids[i].list;
+					} else {
+						row.vec.list = list_of(m_rows.vec_at(i));
+					}
+					rows.push_back(row);
+					++i;
+				} else if (i < count && m_rows.seq_at(i) == restore[k].seq) {
+					++k;
+				} else {
+					row.seq = restore[k].seq;
+					row.id = restore[k].id;
+					row.vec.list = list_of(&restore[k].vec);
+					rows.push_back(row);
+					++k;
+				}
+			}
+			tmp.metadata_name(m_list_ids.metadata_name() + suffix);
+			tmp.index_name(m_list_ids.index_name() + suffix);
+			tmp.vector_name(m_list_ids.vector_name() + suffix);
+			tmp.deleted_name(m_list_ids.deleted_name() + suffix);
+			if (tmp.create() != OTAMA_STATUS_OK
+				|| tmp.open() != OTAMA_STATUS_OK
+				|| tmp.extend((int64_t)rows.size()) != OTAMA_STATUS_OK)
+			{
+				tmp.close();
+				tmp.unlink_files();
+				return OTAMA_STATUS_SYSERROR;
+			}
+			for (j = 0; j < (int64_t)rows.size(); ++j) {
+				tmp.set(j, rows[(size_t)j].seq, &rows[(size_t)j].id, 0, &rows[(size_t)j].vec);
+			}
+			tmp.set_count((int64_t)rows.size());
+			tmp.set_last_no(m_rows.get_last_no());
+			tmp.set_last_commit_no(m_rows.get_last_commit_no());
+			tmp.sync();
+			tmp.close();
+
+			return OTAMA_STATUS_OK;
+		}
+
+		/* the rows were replaced by a vacuum() of this or another process */
+		otama_status_t
+		reopen_list_ids(void)
+		{
+			m_rows_generation = m_rows.generation();
+			m_list_ids.close();
+			return m_list_ids.open();
+		}
+
+	public:
+		static inline double DEFAULT_GROWTH() { return FixedStrage<FT>::DEFAULT_GROWTH(); }
+
+		typedef typename FixedStrage<FT>::record_t record_t;
+
+		LMCAIVFStrage(const std::string &dir,
+					  const std::string &prefix = "m")
+			: m_shm_dir(dir), m_prefix(prefix), m_rows(dir, prefix), m_list_ids(dir, prefix)
+		{
+			m_ivf = NULL;
+			m_rows_generation = -1;
+
+			m_list_ids.metadata_name(prefix + "_ivf_metadata");
+			m_list_ids.index_name(prefix + "_ivf_index");
+			m_list_ids.vector_name(prefix + "_ivf_vector");
+			m_list_ids.deleted_name(prefix + "_ivf_deleted");
+			// the new list ids of vacuum() are renamed with the new rows
+			m_rows.companion_name(m_list_ids.vector_name());
+			m_rows.companion_name(m_list_ids.index_name());
+			m_rows.companion_name(m_list_ids.deleted_name());
+			m_rows.companion_name(m_list_ids.metadata_name());
+		}
+
+		virtual
+		~LMCAIVFStrage()
+		{
+			close();
+		}
+
+		/* the driver sets the centroids before the first set() */
+		inline void set_ivf(const I *ivf) { m_ivf = ivf; }
+
+		otama_status_t
+		create(void)
+		{
+			otama_status_t ret = m_rows.create();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			return m_list_ids.create();
+		}
+
+		otama_status_t
+		open(void)
+		{
+			otama_status_t ret = m_rows.open();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			ret = m_list_ids.open();
+			if (ret != OTAMA_STATUS_OK) {
+				m_rows.close();
+			}
+			m_rows_generation = m_rows.generation();
+			return ret;
+		}
+
+		bool
+		is_active(void)
+		{
+			return m_rows.is_active() && m_list_ids.is_active();
+		}
+
+		otama_status_t
+		close(void)
+		{
+			m_list_ids.close();
+			return m_rows.close();
+		}
+
+		otama_status_t
+		sync(void)
+		{
+			otama_status_t ret = m_rows.sync();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			if (m_rows_generation != m_rows.generation()) {
+				return reopen_list_ids();
+			}
+			return m_list_ids.sync();
+		}
+
+		otama_status_t
+		unlink(void)
+		{
+			otama_status_t ret = m_rows.unlink();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			ret = m_list_ids.unlink();
+			m_rows_generation = m_rows.generation();
+			return ret;
+		}
+
+		/*
+		 * the new list ids are written first, m_rows.vacuum() renames
+		 * them with the new rows after its commit marker.
+		 */
+		otama_status_t
+		vacuum(std::vector<record_t> &restore, int64_t *reclaimed_bytes)
+		{
+			const int64_t list_ids_bytes = m_list_ids.file_bytes();
+			const std::string lock_name = m_list_ids.metadata_name()
+				+ FixedStrage<list_id_t>::VACUUM_LOCK_SUFFIX();
+			otama_mmap_lock_t *lock = NULL;
+			int64_t rows_bytes = 0;
+			otama_status_t ret;
+
+			*reclaimed_bytes = 0;
+			if (m_ivf == NULL) {
+				return OTAMA_STATUS_ASSERTION_FAILURE;
+			}
+#if OTAMA_WINDOWS
+			return OTAMA_STATUS_NOT_IMPLEMENTED;
+#else
+			// an open() of m_list_ids would take the new list ids for a failed vacuum
+			if (otama_mmap_lock(&lock, m_shm_dir.c_str(), lock_name.c_str(), 1) != 0) {
+				OTAMA_LOG_ERROR("%s: lock failed", lock_name.c_str());
+				return OTAMA_STATUS_SYSERROR;
+			}
+			std::sort(restore.begin(), restore.end(), record_less);
+			ret = vacuum_list_ids(restore);
+			if (ret == OTAMA_STATUS_OK) {
+				ret = m_rows.vacuum(restore, &rows_bytes);
+			}
+			otama_mmap_unlock(&lock);
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			ret = reopen_list_ids();
+			*reclaimed_bytes = rows_bytes + list_ids_bytes - m_list_ids.file_bytes();
+
+			return ret;
+#endif
+		}
+
+		otama_status_t
+		load(const otama_id_t *id,
+			 uint64_t seq,
+			 FT *vec)
+		{
+			return m_rows.load(id, seq, vec);
+		}
+
+		bool
+		set(int64_t i,
+			int64_t seq,
+			const char *id,
+			uint8_t flag,
+			const FT *vec)
+		{
+			list_id_t list_id;
+
+			if (m_ivf == NULL) {
+				return false;
+			}
+			list_id.list = list_of(vec);
+			return m_rows.set(i, seq, id, flag, vec)
+				&& m_list_ids.set(i, seq, id, flag, &list_id);
+		}
+
+		bool
+		set(int64_t i,
+			int64_t seq,
+			const otama_id_t *id,
+			uint8_t flag,
+			const FT *vec)
+		{
+			list_id_t list_id;
+
+			if (m_ivf == NULL) {
+				return false;
+			}
+			list_id.list = list_of(vec);
+			return m_rows.set(i, seq, id, flag, vec)
+				&& m_list_ids.set(i, seq, id, flag, &list_id);
+		}
+
+		void
+		update_flags(std::vector<std::pair<int64_t, uint8_t> > &updates,
+					 std::vector<int64_t> *missing = NULL)
+		{
+			m_rows.update_flags(updates, missing);
+			m_list_ids.update_flags(updates);
+		}
+
+		otama_status_t
+		extend(int64_t s)
+		{
+			otama_status_t ret = m_rows.extend(s);
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			return m_list_ids.extend(s);
+		}
+
+		int64_t count(void) { return m_rows.count(); }
+		void
+		set_count(int64_t count)
+		{
+			m_rows.set_count(count);
+			m_list_ids.set_count(count);
+		}
+		int64_t get_last_no(void) { return m_rows.get_last_no(); }
+		void
+		set_last_no(int64_t no)
+		{
+			m_rows.set_last_no(no);
+			m_list_ids.set_last_no(no);
+		}
+		int64_t get_last_commit_no(void) { return m_rows.get_last_commit_no(); }
+		void
+		set_last_commit_no(int64_t no)
+		{
+			m_rows.set_last_commit_no(no);
+			m_list_ids.set_last_commit_no(no);
+		}
+		inline int64_t generation(void) { return m_rows.generation(); }
+
+		inline void
+		set_growth(double growth)
+		{
+			m_rows.set_growth(growth);
+			m_list_ids.set_growth(growth);
+		}
+		inline void
+		set_advice(int flags)
+		{
+			m_rows.set_advice(flags);
+			m_list_ids.set_advice(flags);
+		}
+		inline void
+		set_warmup(bool warmup)
+		{
+			m_rows.set_warmup(warmup);
+		}
+
+		/* -1 when unknown */
+		int64_t
+		resident_bytes(void)
+		{
+			int64_t rows = m_rows.resident_bytes();
+			int64_t list_ids = m_list_ids.resident_bytes();
+
+			if (rows < 0 || list_ids < 0) {
+				return -1;
+			}
+			return rows + list_ids;
+		}
+
+		inline int64_t
+		file_bytes(void)
+		{
+			return m_rows.file_bytes() + m_list_ids.file_bytes();
+		}
+
+		/*
+		 * appends the rows [from, count()) to lists, which has nlist() lists.
+		 * returns the number of rows listed.
+		 */
+		int64_t
+		list_rows(std::vector<list_t> &lists, int64_t from)
+		{
+			const int nlist = (int)lists.size();
+			const int64_t count = m_rows.count();
+			const int64_t list_count = m_list_ids.count();
+			const list_id_t *list_ids = m_list_ids.vec();
+			int64_t i;
+
+			if (m_ivf == NULL || nlist == 0) {
+				return from;
+			}
+			for (i = from; i < count; ++i) {
+				int32_t list = -1;
+				if (i < list_count && m_list_ids.seq_at(i) == m_rows.seq_at(i)) {
+					list = list_ids[i].list;
+				}
+				if (list < 0 || list >= nlist) {
+					// not stored, not aligned with the rows or stored with other centroids
+					list = list_of(m_rows.vec_at(i));
+				}
+				lists[list].push_back(i);
+			}
+			return count;
+		}
+
+		inline const FT *vec(void) { return m_rows.vec(); }
+		inline const uint64_t *deleted(void) { return m_rows.deleted(); }
+		inline uint8_t flag_at(int64_t index) { return m_rows.flag_at(index); }
+		inline const otama_id_t *id_at(int64_t index) { return m_rows.id_at(index); }
+	};
+}
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_config.h"
+#ifndef OTAMA_LMCA_QUANT_FIXED_DRIVER_HPP
+#define OTAMA_LMCA_QUANT_FIXED_DRIVER_HPP
+
+#include "otama_lmca_fixed_driver.hpp"
+#include "otama_lmca_quant_strage.hpp"
+#include "nv_lmca_quant.hpp"
+#include <string>
+
+namespace otama
+{
+	/*
+	 * LMCA search over int8 or fp16 rows.
+	 * the best n * rerank_scale rows are scored again with the
+	 * float records, 0 returns the scores of the rows.
+	 */
+	template<nv_lmca_feature_e F, typename C, nv_lmca_quant_e Q>
+	class LMCAQuantFixedDriver:
+		public LMCAFixedDriver<F, C, LMCAQuantStrage<nv_lmca_quant<F, C, Q> > >
+	{
+	protected:
+		typedef nv_lmca_ctx<F, C> T;
+		typedef typename T::vector_t FT;
+		typedef nv_lmca_quant<F, C, Q> QT;
+		typedef LMCAFixedDriver<F, C, LMCAQuantStrage<QT> > B;
+
+		static inline int DEFAULT_RERANK_SCALE() { return Q == NV_LMCA_QUANT_INT8 ? 4 : 0; }
+
+		std::string m_scale_file;
+		std::string m_scale2_file;
+		int m_rerank_scale;
+		QT *m_quant;
+
+		int
+		search_rerank_n(int n, otama_variant_t *options)
+		{
+			otama_variant_t *value;
+			int rerank_scale = m_rerank_scale;
+
+			if (OTAMA_VARIANT_IS_HASH(options)
+				&& !OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(options, "rerank_scale")))
+			{
+				rerank_scale = (int)otama_variant_to_int(value);
+			}
+			return n * NV_MAX(rerank_scale, 0);
+		}
+
+		virtual otama_status_t
+		feature_search(otama_result_t **results, int n,
+					   const FT *query,
+					   otama_variant_t *options)
+		{
+			nv_lmca_result_t *first_results = nv_alloc_type(nv_lmca_result_t, n);
+			int nresult = 0;
+			float color_weight;
+			float color_threshold;
+			typename T::color_method_e color_method;
+
+			this->search_options(options, color_method, color_weight, color_threshold);
+			this->sync();
+			*results = otama_result_alloc(n);
+			nresult = m_quant->search(first_results, n,
+									  this->m_mmap->rows(),
+									  this->m_mmap->vec(),
+									  this->m_mmap->count(),
+									  query,
+									  color_method,
+									  color_weight,
+									  color_threshold,
+									  this->m_mmap->deleted(),
+									  search_rerank_n(n, options));
+			this->set_results(*results, n, first_results, nresult);
+			nv_free(first_results);
+
+			return OTAMA_STATUS_OK;
+		}
+
+		/* the rows are small, a scan per query */
+		virtual otama_status_t
+		feature_search_batch(otama_result_t **results, int n,
+							 const FT **queries, int nq,
+							 otama_variant_t **options)
+		{
+			int q;
+
+			for (q = 0; q < nq; ++q) {
+				otama_status_t ret = feature_search(&results[q], n, queries[q], options[q]);
+				if (ret != OTAMA_STATUS_OK) {
+					return ret;
+				}
+			}
+			return OTAMA_STATUS_OK;
+		}
+
+	public:
+		virtual std::string
+		name(void)
+		{
+			return B::name() + (Q == NV_LMCA_QUANT_INT8 ? "_int8" : "_fp16");
+		}
+
+		LMCAQuantFixedDriver(otama_variant_t *options)
+			: B(options)
+		{
+			otama_variant_t *driver, *value;
+
+			m_rerank_scale = DEFAULT_RERANK_SCALE();
+			driver = otama_variant_hash_at(options, "driver");
+			if (OTAMA_VARIANT_IS_HASH(driver)) {
+				value = otama_variant_hash_at(driver, "quant_scale");
+				if (!OTAMA_VARIANT_IS_NULL(value)) {
+					if (OTAMA_VARIANT_IS_ARRAY(value)) {
+						int64_t len = otama_variant_array_count(value);
+						if (len >= 1) {
+							m_scale_file = otama_variant_to_string(otama_variant_array_at(value, 0));
+						}
+						if (len >= 2) {
+							m_scale2_file = otama_variant_to_string(otama_variant_array_at(value, 1));
+						}
+					} else {
+						m_scale_file = otama_variant_to_string(value);
+					}
+				}
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "rerank_scale"))) {
+					m_rerank_scale = (int)otama_variant_to_int(value);
+				}
+			}
+			OTAMA_LOG_DEBUG("driver[rerank_scale] => %d", m_rerank_scale);
+			m_quant = new QT;
+		}
+
+		~LMCAQuantFixedDriver()
+		{
+			delete m_quant;
+		}
+
+		otama_status_t
+		open(void)
+		{
+			otama_status_t ret = B::open();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			if (Q == NV_LMCA_QUANT_INT8) {
+				if (m_scale_file.size() == 0) {
+					OTAMA_LOG_NOTICE("%s", "quant_scale is not set, the int8 range is +-1.0");
+				} else if (F == NV_LMCA_FEATURE_VLAD_HSV) {
+					if (m_scale2_file.size() == 0) {
+						OTAMA_LOG_ERROR("%s", "quant_scale[1] file is NULL");
+						return OTAMA_STATUS_INVALID_ARGUMENTS;
+					}
+					if (m_quant->open(m_scale_file.c_str(), m_scale2_file.c_str()) != 0) {
+						OTAMA_LOG_ERROR("invalid quant_scale file: %s, %s",
+										m_scale_file.c_str(), m_scale2_file.c_str());
+						return OTAMA_STATUS_SYSERROR;
+					}
+				} else {
+					if (m_quant->open(m_scale_file.c_str()) != 0) {
+						OTAMA_LOG_ERROR("invalid quant_scale file: %s", m_scale_file.c_str());
+						return OTAMA_STATUS_SYSERROR;
+					}
+				}
+			}
+			this->m_mmap->set_quantizer(m_quant);
+
+			return OTAMA_STATUS_OK;
+		}
+
+		virtual otama_status_t
+		set(const std::string &key, otama_variant_t *value)
+		{
+			if (key == "rerank_scale") {
+#ifdef _OPENMP
+				OMPLock lock(this->m_lock);
+#endif
+				m_rerank_scale = (int)otama_variant_to_int(value);
+				return OTAMA_STATUS_OK;
+			}
+			return B::set(key, value);
+		}
+
+		virtual otama_status_t
+		get(const std::string &key,
+			otama_variant_t *value)
+		{
+			if (key == "rerank_scale") {
+#ifdef _OPENMP
+				OMPLock lock(this->m_lock);
+#endif
+				otama_variant_set_int(value, m_rerank_scale);
+				return OTAMA_STATUS_OK;
+			}
+			return B::get(key, value);
+		}
+
+		virtual otama_status_t
+		unset(const std::string &key)
+		{
+			if (key == "rerank_scale") {
+#ifdef _OPENMP
+				OMPLock lock(this->m_lock);
+#endif
+				m_rerank_scale = DEFAULT_RERANK_SCALE();
+				return OTAMA_STATUS_OK;
+			}
+			return B::unset(key);
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,291 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_config.h"
+#ifndef OTAMA_LMCA_QUANT_STRAGE_HPP
+#define OTAMA_LMCA_QUANT_STRAGE_HPP
+
+#include "nv_core.h"
+#include "otama_log.h"
+#include "otama_fixed_strage.hpp"
+#include <string>
+#include <vector>
+
+namespace otama
+{
+	/*
+	 * FixedStrage<Q::vector_t> interface over quantized rows.
+	 * the rows are FixedStrage<Q::row_t> and the float records are
+	 * kept in a second FixedStrage for load() and the rerank of a search.
+	 * both strages get the same operations, so the row i of one is the
+	 * row i of the other.
+	 * the rows are quantized with the scale of the quantizer at set(),
+	 * a new scale needs the rows to be built again (drop_index and pull).
+	 */
+	template<class Q>
+	class LMCAQuantStrage
+	{
+	private:
+		typedef typename Q::vector_t FT;
+		typedef typename Q::row_t RT;
+
+		FixedStrage<RT> m_rows;
+		FixedStrage<FT> m_full;
+		const Q *m_quant;
+
+	public:
+		static inline double DEFAULT_GROWTH() { return FixedStrage<RT>::DEFAULT_GROWTH(); }
+
+		typedef typename FixedStrage<FT>::record_t record_t;
+
+		LMCAQuantStrage(const std::string &dir,
+						const std::string &prefix = "m")
+			: m_rows(dir, prefix), m_full(dir, prefix)
+		{
+			m_quant = NULL;
+
+			// not compatible with the files of FixedStrage<vector_t>
+			m_rows.metadata_name(prefix + "_quant_metadata");
+			m_rows.index_name(prefix + "_quant_index");
+			m_rows.vector_name(prefix + "_quant_vector");
+			m_rows.deleted_name(prefix + "_quant_deleted");
+		}
+
+		virtual
+		~LMCAQuantStrage()
+		{
+			close();
+		}
+
+		/* the driver sets the quantizer before the first set() */
+		inline void set_quantizer(const Q *quant) { m_quant = quant; }
+
+		otama_status_t
+		create(void)
+		{
+			otama_status_t ret = m_rows.create();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			return m_full.create();
+		}
+
+		otama_status_t
+		open(void)
+		{
+			otama_status_t ret = m_rows.open();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			ret = m_full.open();
+			if (ret != OTAMA_STATUS_OK) {
+				m_rows.close();
+			}
+			return ret;
+		}
+
+		bool
+		is_active(void)
+		{
+			return m_rows.is_active() && m_full.is_active();
+		}
+
+		otama_status_t
+		close(void)
+		{
+			m_full.close();
+			return m_rows.close();
+		}
+
+		otama_status_t
+		sync(void)
+		{
+			otama_status_t ret = m_rows.sync();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			return m_full.sync();
+		}
+
+		otama_status_t
+		unlink(void)
+		{
+			otama_status_t ret = m_rows.unlink();
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			return m_full.unlink();
+		}
+
+		otama_status_t
+		vacuum(std::vector<record_t> &restore, int64_t *reclaimed_bytes)
+		{
+			std::vector<typename FixedStrage<RT>::record_t> rows((size_t)restore.size());
+			int64_t full_bytes = 0, rows_bytes = 0;
+			otama_status_t ret;
+			size_t i;
+
+			if (m_quant == NULL) {
+				return OTAMA_STATUS_ASSERTION_FAILURE;
+			}
+			for (i = 0; i < restore.size(); ++i) {
+				rows[i].seq = restore[i].seq;
+				rows[i].id = restore[i].id;
+				m_quant->quantize(&rows[i].vec, &restore[i].vec);
+			}
+			ret = m_full.vacuum(restore, &full_bytes);
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			ret = m_rows.vacuum(rows, &rows_bytes);
+			*reclaimed_bytes = full_bytes + rows_bytes;
+
+			return ret;
+		}
+
+		otama_status_t
+		load(const otama_id_t *id,
+			 uint64_t seq,
+			 FT *vec)
+		{
+			return m_full.load(id, seq, vec);
+		}
+
+		bool
+		set(int64_t i,
+			int64_t seq,
+			const char *id,
+			uint8_t flag,
+			const FT *vec)
+		{
+			RT row;
+
+			if (m_quant == NULL) {
+				return false;
+			}
+			m_quant->quantize(&row, vec);
+			return m_full.set(i, seq, id, flag, vec)
+				&& m_rows.set(i, seq, id, flag, &row);
+		}
+
+		bool
+		set(int64_t i,
+			int64_t seq,
+			const otama_id_t *id,
+			uint8_t flag,
+			const FT *vec)
+		{
+			RT row;
+
+			if (m_quant == NULL) {
+				return false;
+			}
+			m_quant->quantize(&row, vec);
+			return m_full.set(i, seq, id, flag, vec)
+				&& m_rows.set(i, seq, id, flag, &row);
+		}
+
+		void
+		update_flags(std::vector<std::pair<int64_t, uint8_t> > &updates,
+					 std::vector<int64_t> *missing = NULL)
+		{
+			m_rows.update_flags(updates, missing);
+			m_full.update_flags(updates);
+		}
+
+		otama_status_t
+		extend(int64_t s)
+		{
+			otama_status_t ret = m_rows.extend(s);
+			if (ret != OTAMA_STATUS_OK) {
+				return ret;
+			}
+			return m_full.extend(s);
+		}
+
+		int64_t count(void) { return m_rows.count(); }
+		void
+		set_count(int64_t count)
+		{
+			m_rows.set_count(count);
+			m_full.set_count(count);
+		}
+		int64_t get_last_no(void) { return m_rows.get_last_no(); }
+		void
+		set_last_no(int64_t no)
+		{
+			m_rows.set_last_no(no);
+			m_full.set_last_no(no);
+		}
+		int64_t get_last_commit_no(void) { return m_rows.get_last_commit_no(); }
+		void
+		set_last_commit_no(int64_t no)
+		{
+			m_rows.set_last_commit_no(no);
+			m_full.set_last_commit_no(no);
+		}
+		inline int64_t generation(void) { return m_rows.generation(); }
+
+		inline void
+		set_growth(double growth)
+		{
+			m_rows.set_growth(growth);
+			m_full.set_growth(growth);
+		}
+		inline void
+		set_advice(int flags)
+		{
+			m_rows.set_advice(flags);
+			m_full.set_advice(flags);
+		}
+		/* only the rows are scanned */
+		inline void
+		set_warmup(bool warmup)
+		{
+			m_rows.set_warmup(warmup);
+		}
+
+		/* -1 when unknown */
+		int64_t
+		resident_bytes(void)
+		{
+			int64_t rows = m_rows.resident_bytes();
+			int64_t full = m_full.resident_bytes();
+
+			if (rows < 0 || full < 0) {
+				return -1;
+			}
+			return rows + full;
+		}
+
+		inline int64_t
+		file_bytes(void)
+		{
+			return m_rows.file_bytes() + m_full.file_bytes();
+		}
+
+		inline const RT *rows(void) { return m_rows.vec(); }
+		inline const FT *vec(void) { return m_full.vec(); }
+		inline const uint64_t *deleted(void) { return m_rows.deleted(); }
+		inline uint8_t flag_at(int64_t index) { return m_rows.flag_at(index); }
+		inline const otama_id_t *id_at(int64_t index) { return m_rows.id_at(index); }
+	};
+}
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OTAMA_NORM_PRUNING_HPP
+#define OTAMA_NORM_PRUNING_HPP
+
+#include <cfloat>
+#include <cstddef>
+
+namespace otama
+{
+	/* helpers of the norm-ordered block scans of bovw and boc/sboc */
+
+	/* records are visited in norm order, so the hardware prefetcher can not follow */
+	static const int NORM_PREFETCH = 4;
+
+	/* max of popcnt(a & b) / (|a||b|) where |b| in [norm_min, norm_max] */
+	static inline float
+	norm_bound(float query_norm, float norm_min, float norm_max)
+	{
+		if (query_norm == FLT_MAX || norm_min > norm_max) {
+			return 0.0f;
+		}
+		if (query_norm < norm_min) {
+			return query_norm / norm_min;
+		}
+		if (query_norm > norm_max) {
+			return norm_max / query_norm;
+		}
+		return 1.0f;
+	}
+
+	/* the cache lines of a record */
+	static inline void
+	norm_prefetch(const void *p, size_t len)
+	{
+#if defined(__GNUC__)
+		const char *c = (const char *)p;
+		size_t i;
+		for (i = 0; i < len; i += 64) {
+			__builtin_prefetch(c + i);
+		}
+#endif
+	}
+}
+
+#endif
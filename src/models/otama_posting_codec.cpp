@@ -0,0 +1,596 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2013 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_posting_codec.hpp"
+#include <string.h>
+
+#if (defined(__GNUC__) && defined(__x86_64__))
+#  define OTAMA_POSTING_CODEC_X86 1
+#  include <immintrin.h>
+#endif
+
+using namespace otama;
+
+/*
+ * a block is [type][n - 1][payload]
+ * BLOCK_VBYTE:        [uint16 len][vbyte codes]
+ * BLOCK_STREAM_VBYTE: [control (n + 3) / 4][data]
+ * BLOCK_PACKED:       [bit width][exceptions][(n * width + 7) / 8]
+ *                     [the positions of the exceptions][vbyte high bits]
+ * BLOCK_BITMAP:       [uint16 len][bit i: no = last_no + 1 + i]
+ */
+typedef enum {
+	BLOCK_VBYTE = 0,
+	BLOCK_STREAM_VBYTE = 1,
+	BLOCK_PACKED = 2,
+	BLOCK_BITMAP = 3
+} block_type_e;
+
+typedef size_t (*svb_decode_t)(const uint8_t *control, const uint8_t *data,
+							   const uint8_t *end, int n, uint32_t *deltas);
+
+static inline void
+put_u16(std::vector<uint8_t> &out, size_t v)
+{
+	out.push_back((uint8_t)(v & 0xff));
+	out.push_back((uint8_t)(v >> 8));
+}
+
+static inline size_t
+get_u16(const uint8_t *p)
+{
+	return (size_t)p[0] | ((size_t)p[1] << 8);
+}
+
+static inline int
+bit_width(uint32_t v)
+{
+	int b = 0;
+	while (v) {
+		++b;
+		v >>= 1;
+	}
+	return b;
+}
+
+static inline size_t
+svb_length(uint8_t control)
+{
+	return (size_t)(((control >> 0) & 3) + ((control >> 2) & 3)
+					+ ((control >> 4) & 3) + ((control >> 6) & 3) + 4);
+}
+
+static size_t
+svb_decode_scalar(const uint8_t *control, const uint8_t *data,
+				  const uint8_t *end, int n, uint32_t *deltas)
+{
+	const uint8_t *p = data;
+	int i;
+
+	for (i = 0; i < n; ++i) {
+		const int len = ((control[i / 4] >> ((i % 4) * 2)) & 3) + 1;
+		uint32_t v = 0;
+		int j;
+
+		for (j = 0; j < len; ++j) {
+			v |= (uint32_t)p[j] << (j * 8);
+		}
+		deltas[i] = v;
+		p += len;
+	}
+	return (size_t)(p - data);
+}
+
+#if OTAMA_POSTING_CODEC_X86
+
+/* the shuffle that spreads the bytes of 4 deltas to 4 uint32 */
+typedef struct {
+	uint8_t shuffle[256][16];
+	uint8_t length[256];
+
+	void
+	init(void)
+	{
+		int c, k, j;
+
+		for (c = 0; c < 256; ++c) {
+			int offset = 0;
+			for (k = 0; k < 4; ++k) {
+				const int len = ((c >> (k * 2)) & 3) + 1;
+				for (j = 0; j < 4; ++j) {
+					shuffle[c][k * 4 + j] = j < len ? (uint8_t)(offset + j) : 0x80;
+				}
+				offset += len;
+			}
+			length[c] = (uint8_t)offset;
+		}
+	}
+} svb_table_t;
+
+static svb_table_t s_svb_table;
+static int s_svb_table_init = (s_svb_table.init(), 1);
+
+__attribute__((target("ssse3")))
+static size_t
+svb_decode_ssse3(const uint8_t *control, const uint8_t *data,
+				 const uint8_t *end, int n, uint32_t *deltas)
+{
+	const uint8_t *p = data;
+	int g;
+
+	// 16 bytes are loaded for each 4 deltas
+	for (g = 0; g + 4 <= n && end - p >= 16; g += 4) {
+		const uint8_t c = control[g / 4];
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		v = _mm_shuffle_epi8(v, _mm_loadu_si128((const __m128i *)s_svb_table.shuffle[c]));
+		_mm_storeu_si128((__m128i *)(deltas + g), v);
+		p += s_svb_table.length[c];
+	}
+	if (g < n) {
+		p += svb_decode_scalar(control + g / 4, p, end, n - g, deltas + g);
+	}
+	return (size_t)(p - data);
+}
+#endif
+
+static svb_decode_t
+svb_decode_kernel(PostingCodec::kernel_e kernel)
+{
+	switch (kernel) {
+	case PostingCodec::KERNEL_SCALAR:
+		return svb_decode_scalar;
+#if OTAMA_POSTING_CODEC_X86
+	case PostingCodec::KERNEL_SSSE3:
+		__builtin_cpu_init();
+		if (s_svb_table_init && __builtin_cpu_supports("ssse3")) {
+			return svb_decode_ssse3;
+		}
+		break;
+#endif
+	default:
+		break;
+	}
+	return NULL;
+}
+
+static PostingCodec::kernel_e
+svb_best_kernel(void)
+{
+	int k;
+
+	for (k = PostingCodec::KERNEL_MAX - 1; k > PostingCodec::KERNEL_SCALAR; --k) {
+		if (svb_decode_kernel((PostingCodec::kernel_e)k) != NULL) {
+			return (PostingCodec::kernel_e)k;
+		}
+	}
+	return PostingCodec::KERNEL_SCALAR;
+}
+
+static PostingCodec::kernel_e s_kernel = svb_best_kernel();
+static svb_decode_t s_svb_decode = svb_decode_kernel(s_kernel);
+
+/*
+ * the bit width of the packed deltas that makes the block smallest.
+ * the deltas over the width are the exceptions (PFor).
+ */
+static size_t
+pfor_width(const uint64_t *deltas, int n, int *width)
+{
+	int hist[33] = { 0 };
+	size_t best_len = 0;
+	int b, w, i;
+
+	for (i = 0; i < n; ++i) {
+		hist[bit_width((uint32_t)deltas[i])] += 1;
+	}
+	*width = 32;
+	for (b = 32; b >= 0; --b) {
+		size_t len = ((size_t)n * b + 7) / 8;
+
+		for (w = b + 1; w <= 32; ++w) {
+			len += (size_t)hist[w] * (1 + (w - b + 6) / 7);
+		}
+		if (b == 32 || len <= best_len) {
+			best_len = len;
+			*width = b;
+		}
+	}
+	return best_len;
+}
+
+static inline void
+unpack(uint32_t *deltas, int n, int b, const uint8_t *data, const uint8_t *end)
+{
+	const uint64_t mask = (1ULL << b) - 1;
+	int i = 0;
+
+	if (b == 0) {
+		memset(deltas, 0, sizeof(uint32_t) * n);
+		return;
+	}
+	// 8 bytes are loaded for each delta
+	for (; i < n && end - (data + (size_t)i * b / 8) >= 8; ++i) {
+		const size_t bit = (size_t)i * b;
+		uint64_t w;
+
+		memcpy(&w, data + bit / 8, sizeof(w));
+		deltas[i] = (uint32_t)((w >> (bit % 8)) & mask);
+	}
+	for (; i < n; ++i) {
+		const size_t bit = (size_t)i * b;
+		const uint8_t *p = data + bit / 8;
+		uint64_t w = 0;
+		int j;
+
+		for (j = 0; j < 8 && p + j < end; ++j) {
+			w |= (uint64_t)p[j] << (j * 8);
+		}
+		deltas[i] = (uint32_t)((w >> (bit % 8)) & mask);
+	}
+}
+
+static void
+encode_block(posting_codec_e codec, const int64_t *nos, int n,
+			 int64_t &last_no, std::vector<uint8_t> &out)
+{
+	uint64_t deltas[PostingCodec::BLOCK_LEN];
+	uint64_t max_delta, min_delta;
+	int64_t no = last_no;
+	int i;
+
+	for (i = 0; i < n; ++i) {
+		NV_ASSERT(no <= nos[i]);
+		deltas[i] = (uint64_t)(nos[i] - no);
+		no = nos[i];
+	}
+	max_delta = min_delta = deltas[0];
+	for (i = 1; i < n; ++i) {
+		max_delta = NV_MAX(max_delta, deltas[i]);
+		min_delta = NV_MIN(min_delta, deltas[i]);
+	}
+	if (max_delta > 0xffffffffULL) {
+		std::vector<uint8_t> vbc;
+		int64_t vbc_no = last_no;
+
+		for (i = 0; i < n; ++i) {
+			PostingCodec::vbyte_push_back(vbc, vbc_no, nos[i]);
+		}
+		out.push_back(BLOCK_VBYTE);
+		out.push_back((uint8_t)(n - 1));
+		put_u16(out, vbc.size());
+		out.insert(out.end(), vbc.begin(), vbc.end());
+	} else if (codec == POSTING_CODEC_STREAM_VBYTE) {
+		const size_t control = out.size() + 2;
+
+		out.push_back(BLOCK_STREAM_VBYTE);
+		out.push_back((uint8_t)(n - 1));
+		out.resize(out.size() + (n + 3) / 4, 0);
+		for (i = 0; i < n; ++i) {
+			uint32_t v = (uint32_t)deltas[i];
+			int len = 1;
+
+			out.push_back((uint8_t)v);
+			while ((v >>= 8) != 0) {
+				out.push_back((uint8_t)v);
+				++len;
+			}
+			out[control + i / 4] |= (uint8_t)((len - 1) << ((i % 4) * 2));
+		}
+	} else {
+		int b;
+		const size_t packed_len = pfor_width(deltas, n, &b);
+		const uint64_t span = (uint64_t)(no - last_no);
+		const size_t bitmap_len = (size_t)((span + 7) / 8);
+
+		if (min_delta > 0 && bitmap_len <= 0xffff && bitmap_len < packed_len) {
+			const size_t bitmap = out.size() + 4;
+
+			out.push_back(BLOCK_BITMAP);
+			out.push_back((uint8_t)(n - 1));
+			put_u16(out, bitmap_len);
+			out.resize(out.size() + bitmap_len, 0);
+			for (i = 0; i < n; ++i) {
+				const uint64_t bit = (uint64_t)(nos[i] - last_no - 1);
+				out[bitmap + bit / 8] |= (uint8_t)(1 << (bit % 8));
+			}
+		} else {
+			const uint64_t mask = (1ULL << b) - 1;
+			size_t packed;
+			int nexc = 0;
+
+			out.push_back(BLOCK_PACKED);
+			out.push_back((uint8_t)(n - 1));
+			out.push_back((uint8_t)b);
+			out.push_back(0);
+			packed = out.size();
+			out.resize(out.size() + ((size_t)n * b + 7) / 8, 0);
+			for (i = 0; i < n; ++i) {
+				const size_t bit = (size_t)i * b;
+				uint64_t v = deltas[i] & mask;
+				int k;
+
+				for (k = 0; k < b + (int)(bit % 8); k += 8) {
+					out[packed + bit / 8 + k / 8] |= (uint8_t)((v << (bit % 8)) >> k);
+				}
+			}
+			// the exceptions: the positions, then the high bits
+			for (i = 0; i < n; ++i) {
+				if ((deltas[i] >> b) != 0) {
+					out.push_back((uint8_t)i);
+					++nexc;
+				}
+			}
+			for (i = 0; i < n; ++i) {
+				uint64_t high = deltas[i] >> b;
+				if (high != 0) {
+					while (high >= 0x80) {
+						out.push_back((uint8_t)((high & 0x7f) | 0x80));
+						high >>= 7;
+					}
+					out.push_back((uint8_t)high);
+				}
+			}
+			out[packed - 1] = (uint8_t)nexc;
+		}
+	}
+	last_no = no;
+}
+
+/* returns the bytes of the block, 0 when the block is broken */
+static size_t
+decode_block(const uint8_t *data, const uint8_t *end,
+			 int64_t &last_no, std::vector<int64_t> &nos)
+{
+	uint32_t deltas[PostingCodec::BLOCK_LEN];
+	const uint8_t *p = data + 2;
+	size_t base;
+	int64_t *out;
+	int64_t no;
+	int n, i;
+
+	if (end - data < 4) {
+		return 0;
+	}
+	n = (int)data[1] + 1;
+	switch (data[0]) {
+	case BLOCK_VBYTE: {
+		const size_t len = get_u16(p);
+		p += 2;
+		if ((size_t)(end - p) < len) {
+			return 0;
+		}
+		PostingCodec::vbyte_decode(p, len, last_no, nos);
+		return (size_t)(p + len - data);
+	}
+	case BLOCK_STREAM_VBYTE: {
+		const uint8_t *control = p;
+		size_t len = 0;
+
+		p += (n + 3) / 4;
+		if (p > end) {
+			return 0;
+		}
+		for (i = 0; i < (n + 3) / 4; ++i) {
+			len += svb_length(control[i]);
+		}
+		// the lengths of the unused deltas of the last control byte are 1
+		len -= (size_t)((4 - n % 4) % 4);
+		if ((size_t)(end - p) < len) {
+			return 0;
+		}
+		p += (*s_svb_decode)(control, p, end, n, deltas);
+		break;
+	}
+	case BLOCK_PACKED: {
+		const int b = p[0];
+		const int nexc = p[1];
+		const size_t len = ((size_t)n * b + 7) / 8;
+
+		p += 2;
+		if (b > 32 || (size_t)(end - p) < len + nexc) {
+			return 0;
+		}
+		unpack(deltas, n, b, p, end);
+		p += len;
+		if (nexc > 0) {
+			const uint8_t *pos = p;
+
+			p += nexc;
+			for (i = 0; i < nexc; ++i) {
+				uint32_t high = 0;
+				int shift = 0;
+
+				while (p < end && (*p & 0x80) != 0) {
+					high |= (uint32_t)(*p++ & 0x7f) << shift;
+					shift += 7;
+				}
+				if (p == end || pos[i] >= n) {
+					return 0;
+				}
+				high |= (uint32_t)(*p++) << shift;
+				deltas[pos[i]] |= high << b;
+			}
+		}
+		break;
+	}
+	case BLOCK_BITMAP: {
+		const size_t len = get_u16(p);
+		size_t j;
+		int k = 0;
+
+		p += 2;
+		if ((size_t)(end - p) < len) {
+			return 0;
+		}
+		base = nos.size();
+		nos.resize(base + n);
+		out = &nos[base];
+		for (j = 0; j < len; j += 8) {
+			uint64_t w = 0;
+			size_t m;
+
+			if (len - j >= 8) {
+				memcpy(&w, p + j, sizeof(w));
+			} else {
+				for (m = 0; j + m < len; ++m) {
+					w |= (uint64_t)p[j + m] << (m * 8);
+				}
+			}
+			while (w && k < n) {
+				out[k++] = last_no + 1 + (int64_t)(j * 8) + __builtin_ctzll(w);
+				w &= w - 1;
+			}
+		}
+		if (k != n) {
+			nos.resize(base + k);
+			return 0;
+		}
+		last_no = out[n - 1];
+		return (size_t)(p + len - data);
+	}
+	default:
+		return 0;
+	}
+	base = nos.size();
+	nos.resize(base + n);
+	out = &nos[base];
+	no = last_no;
+	for (i = 0; i < n; ++i) {
+		no += deltas[i];
+		out[i] = no;
+	}
+	last_no = no;
+
+	return (size_t)(p - data);
+}
+
+posting_codec_e
+PostingCodec::parse(const char *name)
+{
+	int c;
+
+	for (c = 0; c < POSTING_CODEC_MAX; ++c) {
+		if (strcmp(name, PostingCodec::name((posting_codec_e)c)) == 0) {
+			return (posting_codec_e)c;
+		}
+	}
+	return POSTING_CODEC_MAX;
+}
+
+const char *
+PostingCodec::name(posting_codec_e codec)
+{
+	static const char *s_names[POSTING_CODEC_MAX] = {
+		"vbyte", "stream_vbyte", "bp128"
+	};
+	if ((int)codec < 0 || codec >= POSTING_CODEC_MAX) {
+		return "unknown";
+	}
+	return s_names[codec];
+}
+
+bool
+PostingCodec::kernel_set(kernel_e kernel)
+{
+	svb_decode_t f = svb_decode_kernel(kernel);
+
+	if (f == NULL) {
+		return false;
+	}
+	s_kernel = kernel;
+	s_svb_decode = f;
+
+	return true;
+}
+
+PostingCodec::kernel_e
+PostingCodec::kernel(void)
+{
+	return s_kernel;
+}
+
+void
+PostingCodec::vbyte_decode(const uint8_t *vbc, size_t len,
+						   int64_t &last_no, std::vector<int64_t> &nos)
+{
+	static const int s_t[8] = { 0, 7, 14, 21, 28, 35, 42, 49 };
+	int64_t a = 0;
+	int j = 0;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		const uint8_t v = vbc[i];
+		if ((v & 0x80) != 0) {
+			a |= ((int64_t)(v & 0x7f) << s_t[j]);
+			++j;
+		} else {
+			int64_t no = last_no + (((int64_t)v << s_t[j]) | a);
+			nos.push_back(no);
+			last_no = no;
+			j = 0;
+			a = 0;
+		}
+	}
+}
+
+void
+PostingCodec::encode(posting_codec_e codec,
+					 const int64_t *nos, size_t n,
+					 int64_t &last_no, std::vector<uint8_t> &out)
+{
+	size_t i;
+
+	if (codec == POSTING_CODEC_VBYTE) {
+		for (i = 0; i < n; ++i) {
+			vbyte_push_back(out, last_no, nos[i]);
+		}
+		return;
+	}
+	for (i = 0; i < n; i += BLOCK_LEN) {
+		encode_block(codec, nos + i, (int)NV_MIN(n - i, (size_t)BLOCK_LEN), last_no, out);
+	}
+}
+
+void
+PostingCodec::decode(posting_codec_e codec,
+					 const uint8_t *data, size_t len,
+					 int64_t &last_no, std::vector<int64_t> &nos)
+{
+	if (codec == POSTING_CODEC_VBYTE) {
+		vbyte_decode(data, len, last_no, nos);
+	} else {
+		decode_blocks(data, len, last_no, nos);
+	}
+}
+
+void
+PostingCodec::decode_blocks(const uint8_t *data, size_t len,
+							int64_t &last_no, std::vector<int64_t> &nos)
+{
+	const uint8_t *end = data + len;
+
+	while (data < end) {
+		size_t n = decode_block(data, end, last_no, nos);
+		if (n == 0) {
+			NV_ASSERT(0);
+			break;
+		}
+		data += n;
+	}
+}
@@ -0,0 +1,106 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2013 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_config.h"
+#ifndef OTAMA_POSTING_CODEC_HPP
+#define OTAMA_POSTING_CODEC_HPP
+
+#include "nv_core.h"
+#include <vector>
+#include <inttypes.h>
+
+namespace otama
+{
+	/*
+	 * codecs of the sorted record nos of a posting list.
+	 * every codec stores the deltas from the previous no.
+	 *
+	 * VBYTE: the classic variable byte code, one code per no.
+	 * STREAM_VBYTE: blocks of 128 deltas, the lengths of 4 deltas
+	 *   in a control byte before the data (D. Lemire et al.),
+	 *   decoded with a SSSE3 shuffle when the CPU has it.
+	 * BP128: blocks of 128 deltas packed to the bit width of the
+	 *   largest one, or a bitmap of the nos when the block is dense.
+	 *
+	 * the blocks have a tag, so a list of blocks can be decoded
+	 * without knowing the codec that wrote it.
+	 */
+	typedef enum {
+		POSTING_CODEC_VBYTE = 0,
+		POSTING_CODEC_STREAM_VBYTE = 1,
+		POSTING_CODEC_BP128 = 2,
+		POSTING_CODEC_MAX
+	} posting_codec_e;
+
+	class PostingCodec
+	{
+	public:
+		static const int BLOCK_LEN = 128;
+
+		typedef enum {
+			KERNEL_SCALAR = 0,
+			KERNEL_SSSE3,
+			KERNEL_MAX
+		} kernel_e;
+
+		/* POSTING_CODEC_MAX when the name is unknown */
+		static posting_codec_e parse(const char *name);
+		static const char *name(posting_codec_e codec);
+
+		/* the Stream VByte decoder, best one by default */
+		static bool kernel_set(kernel_e kernel);
+		static kernel_e kernel(void);
+
+		static inline void
+		vbyte_push_back(std::vector<uint8_t> &out, int64_t &last_no, int64_t no)
+		{
+			uint64_t a = (uint64_t)(no - last_no);
+
+			NV_ASSERT(last_no <= no);
+			while (a >= 0x80) {
+				out.push_back((uint8_t)((a & 0x7f) | 0x80));
+				a >>= 7;
+			}
+			out.push_back((uint8_t)a);
+			last_no = no;
+		}
+
+		/* plain vbyte codes, without the block tag */
+		static void vbyte_decode(const uint8_t *vbc, size_t len,
+								 int64_t &last_no, std::vector<int64_t> &nos);
+
+		/*
+		 * appends nos to out as blocks of codec.
+		 * VBYTE appends plain vbyte codes.
+		 */
+		static void encode(posting_codec_e codec,
+						   const int64_t *nos, size_t n,
+						   int64_t &last_no, std::vector<uint8_t> &out);
+
+		/* appends the nos of the data written by encode(codec) to nos */
+		static void decode(posting_codec_e codec,
+						   const uint8_t *data, size_t len,
+						   int64_t &last_no, std::vector<int64_t> &nos);
+		/* the blocks of any codec but VBYTE */
+		static void decode_blocks(const uint8_t *data, size_t len,
+								  int64_t &last_no, std::vector<int64_t> &nos);
+	};
+}
+
+#endif
@@ -0,0 +1,181 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2013 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "otama_config.h"
+#ifndef OTAMA_POSTING_HASH_TABLE_HPP
+#define OTAMA_POSTING_HASH_TABLE_HPP
+
+#include "nv_core.h"
+#include "otama_variable_byte_code_vector.hpp"
+#include <vector>
+#include <algorithm>
+#include <inttypes.h>
+
+namespace otama
+{
+	/*
+	 * an open addressing (linear probing) table from a word hash to
+	 * its posting list. the slots hold the hash and the index of the
+	 * list, the lists are stored densely in the order of insertion,
+	 * so the memory is proportional to the number of used hashes,
+	 * not to the largest hash.
+	 * insert() may move the lists, the pointers of find() and insert()
+	 * are valid until the next insert().
+	 */
+	class PostingHashTable
+	{
+	protected:
+		static const int32_t EMPTY = -1;
+		static const size_t INITIAL_CAPACITY = 16;
+
+		typedef struct {
+			uint32_t hash;
+			int32_t index;
+		} slot_t;
+
+		std::vector<slot_t> m_slots;
+		std::vector<VariableByteCodeVector> m_lists;
+		int m_shift;
+
+		inline size_t
+		slot_index(uint32_t hash) const
+		{
+			return (size_t)((hash * 0x9e3779b9U) >> m_shift);
+		}
+
+		void
+		rehash(size_t capacity)
+		{
+			slot_t empty;
+			size_t i;
+
+			m_shift = 32;
+			for (i = 1; i < capacity; i <<= 1) {
+				--m_shift;
+			}
+			empty.hash = 0;
+			empty.index = EMPTY;
+			m_slots.assign((size_t)1 << (32 - m_shift), empty);
+		}
+
+		void
+		grow(size_t capacity)
+		{
+			std::vector<slot_t> old;
+			size_t i;
+
+			old.swap(m_slots);
+			rehash(capacity);
+			for (i = 0; i < old.size(); ++i) {
+				if (old[i].index != EMPTY) {
+					size_t k = slot_index(old[i].hash);
+					while (m_slots[k].index != EMPTY) {
+						k = (k + 1) & (m_slots.size() - 1);
+					}
+					m_slots[k] = old[i];
+				}
+			}
+		}
+
+	public:
+		PostingHashTable()
+		{
+			rehash(INITIAL_CAPACITY);
+		}
+
+		/* the lists of the hashes up to n, the load factor is 0.5 */
+		void
+		reserve(size_t n)
+		{
+			if (m_slots.size() < n * 2) {
+				grow(n * 2);
+			}
+			m_lists.reserve(n);
+		}
+
+		void
+		clear(void)
+		{
+			m_lists.clear();
+			rehash(INITIAL_CAPACITY);
+		}
+
+		inline size_t
+		size(void) const
+		{
+			return m_lists.size();
+		}
+
+		/* NULL when the hash has no list */
+		inline VariableByteCodeVector *
+		find(uint32_t hash)
+		{
+			size_t k = slot_index(hash);
+
+			while (m_slots[k].index != EMPTY) {
+				if (m_slots[k].hash == hash) {
+					return &m_lists[m_slots[k].index];
+				}
+				k = (k + 1) & (m_slots.size() - 1);
+			}
+			return NULL;
+		}
+
+		/* the list of the hash, an empty list of codec is added when it has no list */
+		VariableByteCodeVector *
+		insert(uint32_t hash, posting_codec_e codec)
+		{
+			size_t k;
+
+			if ((m_lists.size() + 1) * 2 > m_slots.size()) {
+				grow(m_slots.size() * 2);
+			}
+			k = slot_index(hash);
+			while (m_slots[k].index != EMPTY) {
+				if (m_slots[k].hash == hash) {
+					return &m_lists[m_slots[k].index];
+				}
+				k = (k + 1) & (m_slots.size() - 1);
+			}
+			m_slots[k].hash = hash;
+			m_slots[k].index = (int32_t)m_lists.size();
+			m_lists.push_back(VariableByteCodeVector(codec));
+
+			return &m_lists.back();
+		}
+
+		/* the hashes that have a list, sorted */
+		void
+		hashes(std::vector<uint32_t> &vec) const
+		{
+			size_t i;
+
+			vec.clear();
+			vec.reserve(m_lists.size());
+			for (i = 0; i < m_slots.size(); ++i) {
+				if (m_slots[i].index != EMPTY) {
+					vec.push_back(m_slots[i].hash);
+				}
+			}
+			std::sort(vec.begin(), vec.end());
+		}
+	};
+}
+
+#endif
@@ -29,6 +29,98 @@ namespace otama
 	class SBOCFixedDriver: public FixedDriver<nv_color_sboc_t>
 	{
 	protected:
+		/*
+		 * the norm index of the rows. a search holds a reference,
+		 * sync() builds a new one and swaps it under the lock,
+		 * the old one is freed by its last reader.
+		 */
+		typedef struct {
+			nv_color_boc_norm_index_t *index;
+			int64_t generation;
+			int refs;
+		} norm_index_t;
+		bool m_norm_pruning;
+		norm_index_t *m_norm_index;
+		
+		static void
+		norm_index_free(norm_index_t *norm_index)
+		{
+			if (norm_index != NULL) {
+				nv_color_boc_norm_index_free(&norm_index->index);
+				delete norm_index;
+			}
+		}
+		
+		/* NULL when there is no norm index of this generation */
+		norm_index_t *
+		norm_index_acquire(void)
+		{
+#ifdef _OPENMP
+			OMPLock lock(this->m_lock);
+#endif
+			if (m_norm_index == NULL || m_norm_index->generation != m_mmap->generation()) {
+				return NULL;
+			}
+			++m_norm_index->refs;
+			return m_norm_index;
+		}
+		
+		void
+		norm_index_release(norm_index_t *norm_index)
+		{
+#ifdef _OPENMP
+			OMPLock lock(this->m_lock);
+#endif
+			if (norm_index != NULL && --norm_index->refs == 0 && norm_index != m_norm_index) {
+				norm_index_free(norm_index);
+			}
+		}
+		
+		void
+		norm_index_replace(norm_index_t *norm_index)
+		{
+#ifdef _OPENMP
+			OMPLock lock(this->m_lock);
+#endif
+			norm_index_t *old = m_norm_index;
+			
+			m_norm_index = norm_index;
+			if (old != NULL && old->refs == 0) {
+				norm_index_free(old);
+			}
+		}
+		
+		void
+		update_norm_index(bool reset = false)
+		{
+			const int64_t generation = m_mmap->generation();
+			const int64_t count = m_mmap->count();
+			norm_index_t *old, *norm_index;
+			
+			if (!m_norm_pruning) {
+				return;
+			}
+			if (reset) {
+				norm_index_replace(NULL);
+			}
+			old = norm_index_acquire();
+			if (old != NULL && old->index->count == count) {
+				norm_index_release(old);
+				return;
+			}
+			// the searches keep walking the old one while the new one is built
+			norm_index = new norm_index_t;
+			norm_index->index = nv_color_boc_norm_index_alloc();
+			norm_index->generation = generation;
+			norm_index->refs = 0;
+			if (old != NULL && old->index->count < count) {
+				nv_color_boc_norm_index_copy(norm_index->index, old->index);
+			}
+			norm_index_release(old);
+			nv_color_sboc_norm_index_update(norm_index->index, m_mmap->vec(), count);
+			norm_index_replace(norm_index);
+		}
+		
 		virtual nv_color_sboc_t *
 		feature_new(void)
 		{
@@ -99,42 +191,70 @@ namespace otama
 			otama_result_set_id(results, i, id);
 		}
 
+		void
+		set_results(otama_result_t *results, int n,
+					nv_color_boc_result_t *first_results, int nresult)
+		{
+			int i, results_size;
+			
+			results_size = 0;
+			for (i = 0; i < nresult && i < n; ++i) {
+				set_result(results, results_size++,
+						   m_mmap->id_at(first_results[i].index),
+						   first_results[i].cosine);
+			}
+			otama_result_set_count(results, results_size);
+		}
+		
 		virtual otama_status_t
 		feature_search(otama_result_t **results, int n,
 							 const nv_color_sboc_t *query,
 							 otama_variant_t *options)
 		{
-			const int first_n = n * 16;
-			nv_color_boc_result_t *first_results = nv_alloc_type(nv_color_boc_result_t,
-																 first_n);
+			nv_color_boc_result_t *first_results = nv_alloc_type(nv_color_boc_result_t, n);
+			norm_index_t *norm_index;
 			int nresult = 0;
-			int i, j, results_size;
 
 			*results = otama_result_alloc(n);
 			
 			sync();
 			
-			nresult = nv_color_sboc_search(first_results, first_n,
-										   m_mmap->vec(), m_mmap->count(),
-										   query);
-			for (j = i = 0; j < nresult; ++j) {
-				if ((m_mmap->flag_at(first_results[j].index) &
-					 this->FLAG_DELETE) == 0)
-				{
-					first_results[i] = first_results[j];
-					++i;
-				}
-			}
-			nresult = i;
-			results_size = 0;
-			for (i = 0; i < nresult && i < n; ++i) {
-				set_result(*results, results_size++,
-						   m_mmap->id_at(first_results[i].index),
-						   first_results[i].cosine);
+			norm_index = norm_index_acquire();
+			nresult = nv_color_sboc_search_pruned(first_results, n,
+												  m_mmap->vec(), m_mmap->count(),
+												  query, norm_index ? norm_index->index : NULL,
+												  m_mmap->deleted());
+			norm_index_release(norm_index);
+			set_results(*results, n, first_results, nresult);
+			nv_free(first_results);			
+			
+			return OTAMA_STATUS_OK;
+		}
+		
+		virtual otama_status_t
+		feature_search_batch(otama_result_t **results, int n,
+							 const nv_color_sboc_t **queries, int nq,
+							 otama_variant_t **options)
+		{
+			nv_color_boc_result_t *first_results = nv_alloc_type(nv_color_boc_result_t,
+																 n * nq);
+			std::vector<nv_color_boc_result_t *> first_results_q(nq);
+			std::vector<int> nresults(nq);
+			int q;
+			
+			for (q = 0; q < nq; ++q) {
+				first_results_q[q] = first_results + (int64_t)n * q;
 			}
-			otama_result_set_count(*results, results_size);
+			sync();
 			
-			nv_free(first_results);			
+			nv_color_sboc_search_batch(&first_results_q[0], &nresults[0], n,
+									   m_mmap->vec(), m_mmap->count(),
+									   queries, nq, m_mmap->deleted());
+			for (q = 0; q < nq; ++q) {
+				results[q] = otama_result_alloc(n);
+				set_results(results[q], n, first_results_q[q], nresults[q]);
+			}
+			nv_free(first_results);
 			
 			return OTAMA_STATUS_OK;
 		}
@@ -152,6 +272,73 @@ namespace otama
 		SBOCFixedDriver(otama_variant_t *options)
 			: FixedDriver<nv_color_sboc_t>(options)
 		{
+			otama_variant_t *driver, *value;
+			m_norm_pruning = false;
+			m_norm_index = NULL;
+			
+			driver = otama_variant_hash_at(options, "driver");
+			if (OTAMA_VARIANT_IS_HASH(driver)) {
+				if (!OTAMA_VARIANT_IS_NULL(value = otama_variant_hash_at(driver, "norm_pruning"))) {
+					m_norm_pruning = otama_variant_to_bool(value) ? true : false;
+				}
+			}
+			OTAMA_LOG_DEBUG("driver[norm_pruning] => %d", m_norm_pruning ? 1 : 0);
+		}
+		
+		virtual
+		~SBOCFixedDriver()
+		{
+			norm_index_free(m_norm_index);
+		}
+		
+		virtual otama_status_t
+		sync(void)
+		{
+			otama_status_t ret = FixedDriver<nv_color_sboc_t>::sync();
+			
+			if (ret == OTAMA_STATUS_OK) {
+				// the index of rows moved by vacuum_index has another generation
+				update_norm_index();
+			}
+			return ret;
+		}
+		
+		virtual otama_status_t
+		drop_database(void)
+		{
+			otama_status_t ret;
+#ifdef _OPENMP
+			OMPLock lock(this->m_lock);
+#endif
+			ret = FixedDriver<nv_color_sboc_t>::drop_database();
+			update_norm_index(true);
+			return ret;
+		}
+		
+		virtual otama_status_t
+		drop_index(void)
+		{
+			otama_status_t ret;
+#ifdef _OPENMP
+			OMPLock lock(this->m_lock);
+#endif
+			ret = FixedDriver<nv_color_sboc_t>::drop_index();
+			update_norm_index(true);
+			return ret;
+		}
+		
+		virtual otama_status_t
+		vacuum_index(void)
+		{
+			otama_status_t ret;
+#ifdef _OPENMP
+			OMPLock lock(this->m_lock);
+#endif
+			ret = FixedDriver<nv_color_sboc_t>::vacuum_index();
+			if (ret == OTAMA_STATUS_OK) {
+				ret = sync();
+			}
+			return ret;
 		}
 	};
 }
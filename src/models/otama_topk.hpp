@@ -0,0 +1,172 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OTAMA_TOPK_HPP
+#define OTAMA_TOPK_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+
+namespace otama
+{
+	/*
+	 * bounded top-k of the scan results (T has KEY and index).
+	 * a heap over a fixed array with the worst result on top, ties are
+	 * broken by index as in better(), so the result does not depend on
+	 * the order of push(). threshold() is the lowest score that can
+	 * still enter (-FLT_MAX until k results are held), so most records
+	 * of a scan only cost one compare.
+	 */
+	template <typename T, float T::*KEY = &T::similarity>
+	class TopK
+	{
+	private:
+		std::vector<T> m_heap;
+		int m_k;
+		int m_size;
+		float m_threshold;
+
+		void
+		sift_down(const T &v)
+		{
+			int i = 0;
+
+			for (;;) {
+				int c = i * 2 + 1;
+				if (c >= m_size) {
+					break;
+				}
+				if (c + 1 < m_size && better(m_heap[c], m_heap[c + 1])) {
+					++c;
+				}
+				if (!better(v, m_heap[c])) {
+					break;
+				}
+				m_heap[i] = m_heap[c];
+				i = c;
+			}
+			m_heap[i] = v;
+		}
+
+		void
+		insert(const T &v)
+		{
+			if (m_size < m_k) {
+				int i = m_size++;
+
+				while (i > 0) {
+					int parent = (i - 1) / 2;
+					if (!better(m_heap[parent], v)) {
+						break;
+					}
+					m_heap[i] = m_heap[parent];
+					i = parent;
+				}
+				m_heap[i] = v;
+			} else if (m_k > 0 && better(v, m_heap[0])) {
+				sift_down(v);
+			}
+			if (m_k > 0 && m_size == m_k) {
+				m_threshold = m_heap[0].*KEY;
+			}
+		}
+
+	public:
+		/* best first, ties by index */
+		static inline bool
+		better(const T &a, const T &b)
+		{
+			return a.*KEY > b.*KEY || (a.*KEY == b.*KEY && a.index < b.index);
+		}
+
+		TopK(int k = 0)
+		{
+			reset(k);
+		}
+
+		void
+		reset(int k)
+		{
+			m_k = std::max(k, 0);
+			m_size = 0;
+			m_threshold = m_k > 0 ? -FLT_MAX : FLT_MAX;
+			m_heap.resize((size_t)m_k);
+		}
+
+		inline void
+		push(const T &v)
+		{
+			if (v.*KEY >= m_threshold) {
+				insert(v);
+			}
+		}
+
+		inline float threshold(void) const { return m_threshold; }
+		inline int size(void) const { return m_size; }
+		inline int k(void) const { return m_k; }
+		inline const T *data(void) const { return m_size > 0 ? &m_heap[0] : NULL; }
+
+		/* sorts the results best first. push() is not allowed until reset() */
+		int
+		finish(void)
+		{
+			std::sort(m_heap.begin(), m_heap.begin() + m_size, better);
+			m_threshold = FLT_MAX;
+			return m_size;
+		}
+	};
+
+	/*
+	 * k-way merge of the per thread selectors into out (best first).
+	 * the parts are finished. returns the number of results.
+	 */
+	template <typename P, typename T>
+	int
+	topk_merge(T *out, int k, P *parts, int n)
+	{
+		std::vector<int> pos((size_t)n, 0);
+		int count = 0;
+		int i;
+
+		for (i = 0; i < n; ++i) {
+			parts[i].finish();
+		}
+		while (count < k) {
+			int best = -1;
+
+			for (i = 0; i < n; ++i) {
+				if (pos[i] < parts[i].size()
+					&& (best < 0 || P::better(parts[i].data()[pos[i]],
+											  parts[best].data()[pos[best]])))
+				{
+					best = i;
+				}
+			}
+			if (best < 0) {
+				break;
+			}
+			out[count++] = parts[best].data()[pos[best]++];
+		}
+
+		return count;
+	}
+}
+
+#endif
@@ -21,6 +21,7 @@
 #include "nv_core.h"
 #ifndef OTAMA_VARIABLE_BYTE_CODE_VECTOR_HPP
 #define OTAMA_VARIABLE_BYTE_CODE_VECTOR_HPP
+#include "otama_posting_codec.hpp"
 #include <vector>
 
 namespace otama
@@ -77,11 +78,32 @@ namespace otama
 			m_data_size = 0;
 			m_data = (uint8_t *)nv_alloc_type(uint8_t, m_data_reserve_size);
 		}
+		inline void
+		append(const uint8_t *v, size_t n)
+		{
+			if (m_data_reserve_size < m_data_size + n) {
+				m_data_reserve_size = m_data_size + n + EXTEND_SIZE;
+				m_data = (uint8_t *)nv_realloc(m_data, m_data_reserve_size * sizeof(uint8_t));
+			}
+			memcpy(m_data + m_data_size, v, n * sizeof(uint8_t));
+			m_data_size += n;
+		}
+		inline void
+		truncate(size_t n)
+		{
+			NV_ASSERT(n <= m_data_size);
+			m_data_size = n;
+		}
 		inline size_t
 		size(void) const
 		{
 			return m_data_size;
 		}
+		inline const uint8_t *
+		data(void) const
+		{
+			return m_data;
+		}
 		inline size_t
 		at(size_t i) const
 		{
@@ -116,45 +138,82 @@ namespace otama
 	static inline void
 	vbc_decode(std::vector<int64_t> &vec, const VBCVector &vbc)
 	{
-		static const int s_t[8] = { 0, 7, 14, 21, 28, 35, 42, 49 };
-		size_t i;
-		size_t n = vbc.size();
-		int64_t a = 0;
 		int64_t last_no = 0;
-		int j = 0;
 		
 		vec.clear();
-		for (i = 0; i < n; ++i) {
-			uint8_t v = vbc.at(i);
-			if ((v & 0x80) != 0) {
-				a |= ((int64_t)(v & 0x7f) << s_t[j]);
-				++j;
-			} else {
-				int64_t no = last_no + (((int64_t)v << s_t[j]) | a);
-				vec.push_back(no);
-				last_no = no;
-				j = 0;
-				a = 0;
-			}
-		}
+		PostingCodec::vbyte_decode(vbc.data(), vbc.size(), last_no, vec);
 	}
 	
+	/*
+	 * the nos are appended as vbyte codes. with the other codecs,
+	 * every BLOCK_LEN nos of the tail are packed into a block of the codec.
+	 */
 	class VariableByteCodeVector {
 	private:
+		posting_codec_e m_codec;
 		int64_t m_last_no;
+		int64_t m_block_last_no;
+		size_t m_tail_offset;
+		int m_tail_count;
 		VBCVector m_vbc;
+		
+		void
+		pack_tail(void)
+		{
+			std::vector<int64_t> nos;
+			std::vector<uint8_t> block;
+			int64_t last_no = m_block_last_no;
+			
+			PostingCodec::vbyte_decode(m_vbc.data() + m_tail_offset,
+									   m_vbc.size() - m_tail_offset,
+									   last_no, nos);
+			last_no = m_block_last_no;
+			PostingCodec::encode(m_codec, &nos[0], nos.size(), last_no, block);
+			m_vbc.truncate(m_tail_offset);
+			m_vbc.append(&block[0], block.size());
+			m_tail_offset = m_vbc.size();
+			m_tail_count = 0;
+			m_block_last_no = last_no;
+		}
+		
 	public:
-		VariableByteCodeVector() { m_last_no = 0; }
+		VariableByteCodeVector(posting_codec_e codec = POSTING_CODEC_VBYTE)
+		{
+			m_codec = codec;
+			m_last_no = 0;
+			m_block_last_no = 0;
+			m_tail_offset = 0;
+			m_tail_count = 0;
+		}
 		
 		inline void
 		push_back(int64_t no)
 		{
 			vbc_push_back(m_vbc, m_last_no, no);
+			if (m_codec != POSTING_CODEC_VBYTE
+				&& ++m_tail_count == PostingCodec::BLOCK_LEN)
+			{
+				pack_tail();
+			}
 		}
 		inline void
 		decode(std::vector<int64_t> &vec)
 		{
-			vbc_decode(vec, m_vbc);
+			vec.clear();
+			decode_append(vec);
+		}
+		/* appends the nos to vec */
+		inline void
+		decode_append(std::vector<int64_t> &vec)
+		{
+			int64_t last_no = 0;
+			
+			if (m_tail_offset > 0) {
+				PostingCodec::decode_blocks(m_vbc.data(), m_tail_offset, last_no, vec);
+			}
+			PostingCodec::vbyte_decode(m_vbc.data() + m_tail_offset,
+									   m_vbc.size() - m_tail_offset,
+									   last_no, vec);
 		}
 		inline int64_t
 		count(void)
@@ -163,6 +222,11 @@ namespace otama
 			decode(vec);
 			return vec.size();
 		}
+		inline bool
+		empty(void) const
+		{
+			return m_vbc.size() == 0;
+		}
 	};
 }
 
@@ -23,7 +23,6 @@
 #include <vector>
 #include <set>
 #include <string>
-#include <queue>
 #include <algorithm>
 #include <functional>
 #ifdef HAVE_CONFIG
@@ -35,6 +34,10 @@
 #include "nv_ip.h"
 #include "nv_num.h"
 #include "nv_color_boc.h"
+#include "nv_bovw_popcnt.h"
+#include "otama_topk.hpp"
+#include "otama_norm_pruning.hpp"
+#include "otama_numa.h"
 
 typedef struct nv_bovw_result {
 	float similarity;
@@ -86,14 +89,67 @@ public:
 		NV_ALIGNED(C, boc, 16);
 	} dense_t;
 	typedef std::vector<uint32_t> sparse_t;
+	typedef C color_t;
+	
+	/* struct-of-arrays view of a database */
+	typedef struct {
+		const uint64_t *bovw; /* INT_BLOCKS per record */
+		const float *norm;
+		const C *boc;         /* not touched when color_weight == 0 */
+		const uint64_t *deleted; /* optional bitmap, records with a set bit are skipped */
+	} columns_t;
+	
+	/* sparse record: the sorted word ids are delta/VByte coded at offset of a blob */
+	typedef struct {
+		int64_t offset;
+		int32_t len; /* bytes */
+		float norm;
+		C boc;
+	} packed_t;
+	
+	/*
+	 * cascade record: a coarse signature, the words folded into COARSE_BIT bits
+	 * (id % COARSE_BIT), and the full dense_t copied at offset of a blob.
+	 */
+	static const int COARSE_BIT = NV_BOVW_BIT8K;
+	static const int COARSE_INT_BLOCKS = COARSE_BIT / 64;
+	typedef struct {
+		NV_ALIGNED(uint64_t, coarse[COARSE_INT_BLOCKS], 16);
+		int64_t offset;
+		int32_t len; /* bytes */
+		float norm;  /* of coarse */
+		C boc;
+	} cascade_t;
+	
+	/* records sorted by norm with per-block norm ranges,
+	 * used to skip blocks that can not enter the first stage top-k */
+	static const int NORM_BLOCK_SIZE = 1024;
+	typedef struct {
+		float norm_min;
+		float norm_max;
+	} norm_block_t;
+	typedef struct {
+		std::vector<int64_t> order;
+		std::vector<norm_block_t> blocks;
+	} norm_index_t;
 	
 private:
-	typedef std::priority_queue<nv_bovw_result_t, std::vector<nv_bovw_result_t>,
-								std::greater<std::vector<nv_bovw_result_t>::value_type> > topn_t;
+	typedef otama::TopK<nv_bovw_result_t> topn_t;
+	/*
+	 * idf^2 quantized into levels by quantile.
+	 * a word of level l weighs value[l] = delta[0] + ... + delta[l - 1].
+	 */
+	typedef struct {
+		std::vector<uint8_t> level; /* per word, 0: idf == 0 */
+		std::vector<float> value;   /* levels + 1 */
+		std::vector<float> delta;   /* levels */
+		float rms;                  /* sqrt(mean of idf^2) */
+	} idf_planes_t;
+	
 	static inline uint32_t BIT_INDEX(int n) { return n / 64; }
 	static inline uint32_t BIT_BIT(int n) { return n % 64; }
 	static inline float VQ_THRESH() { return 0.5f; }
-	static const int SEARCH_FIRST_SCALE = 10;
+	static const int BATCH_TILE_BYTES = 256 * 1024; /* about the size of L2 cache */
 	static const int KEYPOINT_M = N == NV_BOVW_BIT2K ? 640 : (N == NV_BOVW_BIT8K ? 768 : 1800);
 	static const int HKM_NN = 4;
 	nv_kmeans_tree_t *m_posi;
@@ -101,6 +157,11 @@ private:
 	nv_matrix_t *m_idf;
 	nv_keypoint_ctx_t *m_ctx;
 	size_t m_fit_area;
+	float m_sparse_query_th;
+	int m_idf_levels;
+	int m_first_scale;
+	idf_planes_t m_idf_planes;
+	const otama_numa_topology_t *m_numa;
 	
 	void
 	init_ctx(void)
@@ -145,17 +206,379 @@ private:
 		}
 	}
 	
+	static inline int
+	bit_ctz(uint64_t v)
+	{
+#if defined(__GNUC__)
+		return __builtin_ctzll(v);
+#else
+		int i = 0;
+		while ((v & 1) == 0) {
+			v >>= 1;
+			++i;
+		}
+		return i;
+#endif
+	}
+	inline float
+	idf_sum2(int block, uint64_t v)
+	{
+		const float *idf = &NV_MAT_V(m_idf, 0, block * 64);
+		float sum = 0.0f;
+		
+		while (v) {
+			float w = idf[bit_ctz(v)];
+			sum += w * w;
+			v &= v - 1;
+		}
+		return sum;
+	}
+	inline float
+	idf_dot(const std::vector<int> &a_blocks, const uint64_t *a, const uint64_t *b)
+	{
+		std::vector<int>::const_iterator i;
+		float dot = 0.0f;
+		
+		for (i = a_blocks.begin(); i != a_blocks.end(); ++i) {
+			uint64_t v = a[*i] & b[*i];
+			if (v) {
+				dot += idf_sum2(*i, v);
+			}
+		}
+		return dot;
+	}
+	static inline void
+	nonzero_blocks(std::vector<int> &blocks, const uint64_t *bovw)
+	{
+		int i;
+		
+		blocks.clear();
+		for (i = 0; i < INT_BLOCKS; ++i) {
+			if (bovw[i] != 0) {
+				blocks.push_back(i);
+			}
+		}
+	}
+	static inline float
+	idf_cosine(float dot, float a_norm, float b_norm)
+	{
+		return (a_norm > 0.0f && b_norm > 0.0f) ? dot / (a_norm * b_norm) : 0.0f;
+	}
+	
+	static inline float
+	bit_cosine(const uint64_t *a, float a_norm, const uint64_t *b, float b_norm)
+	{
+		uint64_t count = nv_bovw_and_popcnt(a, b, INT_BLOCKS);
+		
+		return 	(float)count / (a_norm * b_norm);
+	}
 	static inline float
 	bit_cosine(const dense_t *a, const dense_t *b)
+	{
+		return bit_cosine(a->bovw, a->norm, b->bovw, b->norm);
+	}
+	
+	static inline bool
+	is_deleted(const uint64_t *deleted, int64_t j)
+	{
+		return deleted != NULL && ((deleted[j >> 6] >> (j & 63)) & 1) != 0;
+	}
+	
+	/*
+	 * set words of a query. when less than sparse_th of the words are set,
+	 * records are scored by probing only those words instead of ANDing all of them.
+	 * with idf, plane l holds the words of level > l and the first stage
+	 * scores sum(delta[l] * popcnt(plane[l] & b)) instead of popcnt(query & b).
+	 */
+	static const int SPARSE_PREFETCH = 16;
+	class query_bits_t {
+	public:
+		std::vector<int> blocks;
+		bool sparse;
+		const idf_planes_t *idf;
+		std::vector<uint64_t> planes; /* INT_BLOCKS per level */
+		std::vector<std::vector<int> > plane_blocks;
+		float weight_norm;
+		
+		query_bits_t(const dense_t *query, float sparse_th,
+					 const idf_planes_t *idf_planes = NULL)
+		{
+			nonzero_blocks(blocks, query->bovw);
+			sparse = (float)blocks.size() < sparse_th * (float)INT_BLOCKS;
+			idf = idf_planes;
+			weight_norm = 0.0f;
+			if (idf != NULL) {
+				set_planes(query);
+			}
+		}
+		
+	private:
+		void
+		set_planes(const dense_t *query)
+		{
+			const int levels = (int)idf->delta.size();
+			std::vector<int>::const_iterator i;
+			float sum = 0.0f;
+			int l;
+			
+			planes.assign((size_t)levels * INT_BLOCKS, 0);
+			plane_blocks.resize((size_t)levels);
+			for (i = blocks.begin(); i != blocks.end(); ++i) {
+				uint64_t v = query->bovw[*i];
+				while (v) {
+					const int bit = bit_ctz(v);
+					const int level = idf->level[(size_t)(*i * 64 + bit)];
+					
+					for (l = 0; l < level; ++l) {
+						planes[(size_t)l * INT_BLOCKS + *i] |= (UINT64_C(1) << bit);
+					}
+					sum += idf->value[(size_t)level];
+					v &= v - 1;
+				}
+			}
+			for (l = 0; l < levels; ++l) {
+				nonzero_blocks(plane_blocks[(size_t)l], &planes[(size_t)l * INT_BLOCKS]);
+			}
+			weight_norm = sqrtf(sum) * idf->rms;
+		}
+	};
+	
+	static inline uint64_t
+	sparse_and_popcnt(const std::vector<int> &blocks, const uint64_t *a, const uint64_t *b)
+	{
+		const int n = (int)blocks.size();
+		const int *w = n > 0 ? &blocks[0] : NULL;
+		uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+		int i;
+		
+		for (i = 0; i + 4 <= n; i += 4) {
+#if defined(__GNUC__)
+			if (i + SPARSE_PREFETCH < n) {
+				__builtin_prefetch(b + w[i + SPARSE_PREFETCH]);
+			}
+#endif
+			c0 += NV_POPCNT_U64(a[w[i + 0]] & b[w[i + 0]]);
+			c1 += NV_POPCNT_U64(a[w[i + 1]] & b[w[i + 1]]);
+			c2 += NV_POPCNT_U64(a[w[i + 2]] & b[w[i + 2]]);
+			c3 += NV_POPCNT_U64(a[w[i + 3]] & b[w[i + 3]]);
+		}
+		for (; i < n; ++i) {
+			c0 += NV_POPCNT_U64(a[w[i]] & b[w[i]]);
+		}
+		
+		return c0 + c1 + c2 + c3;
+	}
+	
+	/* estimate of the idf cosine, |b|_idf ~ |b| * rms */
+	static inline float
+	plane_cosine(const query_bits_t &bits, const uint64_t *b, float b_norm)
+	{
+		const int levels = (int)bits.plane_blocks.size();
+		float dot = 0.0f;
+		int l;
+		
+		if (!(bits.weight_norm > 0.0f)) {
+			return 0.0f;
+		}
+		for (l = 0; l < levels; ++l) {
+			const uint64_t *plane = &bits.planes[(size_t)l * INT_BLOCKS];
+			uint64_t count = bits.sparse ?
+				sparse_and_popcnt(bits.plane_blocks[(size_t)l], plane, b) :
+				nv_bovw_and_popcnt(plane, b, INT_BLOCKS);
+			dot += bits.idf->delta[(size_t)l] * (float)count;
+		}
+		return dot / (bits.weight_norm * b_norm);
+	}
+	
+	static inline float
+	bit_cosine(const query_bits_t &bits, const dense_t *query,
+			   const uint64_t *b, float b_norm)
+	{
+		if (bits.idf != NULL) {
+			return plane_cosine(bits, b, b_norm);
+		}
+		if (bits.sparse) {
+			return (float)sparse_and_popcnt(bits.blocks, query->bovw, b) / (query->norm * b_norm);
+		}
+		return bit_cosine(query->bovw, query->norm, b, b_norm);
+	}
+	
+	class dense_db_t {
+	private:
+		const dense_t *m_db;
+		const uint64_t *m_deleted;
+	public:
+		dense_db_t(const dense_t *db, const uint64_t *deleted): m_db(db), m_deleted(deleted) {}
+		inline const uint64_t *bovw(int64_t j) const { return m_db[j].bovw; }
+		inline float norm(int64_t j) const { return m_db[j].norm; }
+		inline const C *boc(int64_t j) const { return &m_db[j].boc; }
+		inline bool skip(int64_t j) const { return is_deleted(m_deleted, j); }
+	};
+	class columns_db_t {
+	private:
+		const columns_t &m_db;
+	public:
+		columns_db_t(const columns_t &db): m_db(db) {}
+		inline const uint64_t *bovw(int64_t j) const { return &m_db.bovw[j * INT_BLOCKS]; }
+		inline float norm(int64_t j) const { return m_db.norm[j]; }
+		inline const C *boc(int64_t j) const { return &m_db.boc[j]; }
+		inline bool skip(int64_t j) const { return is_deleted(m_db.deleted, j); }
+	};
+	
+	static inline uint32_t
+	vbyte_next(const uint8_t *&p)
+	{
+		uint32_t v = 0;
+		int shift = 0;
+		uint8_t c;
+		
+		do {
+			c = *p++;
+			v |= (uint32_t)(c & 0x7f) << shift;
+			shift += 7;
+		} while (c & 0x80);
+		
+		return v;
+	}
+	class packed_db_t {
+	private:
+		const packed_t *m_db;
+		const uint8_t *m_blob;
+		const uint64_t *m_deleted;
+	public:
+		packed_db_t(const packed_t *db, const uint8_t *blob, const uint64_t *deleted)
+			: m_db(db), m_blob(blob), m_deleted(deleted) {}
+		inline const uint8_t *begin(int64_t j) const { return m_blob + m_db[j].offset; }
+		inline const uint8_t *end(int64_t j) const { return m_blob + m_db[j].offset + m_db[j].len; }
+		inline float norm(int64_t j) const { return m_db[j].norm; }
+		inline const C *boc(int64_t j) const { return &m_db[j].boc; }
+		inline bool skip(int64_t j) const { return is_deleted(m_deleted, j); }
+	};
+	
+	class cascade_db_t {
+	private:
+		const cascade_t *m_db;
+		const uint8_t *m_blob;
+		const uint64_t *m_deleted;
+	public:
+		cascade_db_t(const cascade_t *db, const uint8_t *blob, const uint64_t *deleted)
+			: m_db(db), m_blob(blob), m_deleted(deleted) {}
+		inline const dense_t *full(int64_t j) const { return (const dense_t *)(m_blob + m_db[j].offset); }
+		inline const uint64_t *coarse(int64_t j) const { return m_db[j].coarse; }
+		inline float coarse_norm(int64_t j) const { return m_db[j].norm; }
+		inline const uint64_t *bovw(int64_t j) const { return full(j)->bovw; }
+		inline float norm(int64_t j) const { return full(j)->norm; }
+		inline const C *boc(int64_t j) const { return &m_db[j].boc; }
+		inline bool skip(int64_t j) const { return is_deleted(m_deleted, j); }
+	};
+	
+	static inline void
+	fold(uint64_t *coarse, const uint64_t *bovw)
 	{
 		int i;
-		uint64_t count = 0;
 		
+		memset(coarse, 0, sizeof(uint64_t) * COARSE_INT_BLOCKS);
 		for (i = 0; i < INT_BLOCKS; ++i) {
-			count += NV_POPCNT_U64(a->bovw[i] & b->bovw[i]);
+			coarse[i % COARSE_INT_BLOCKS] |= bovw[i];
 		}
+	}
+	static inline float
+	coarse_norm(const uint64_t *coarse)
+	{
+		uint64_t popcnt = nv_bovw_and_popcnt(coarse, coarse, COARSE_INT_BLOCKS);
+		return popcnt == 0 ? FLT_MAX : sqrtf((float)popcnt);
+	}
+	
+	/* scoring of a record, bitset databases */
+	template <typename DB>
+	static inline float
+	row_cosine(const DB &db, int64_t j, const dense_t *query, const query_bits_t &bits)
+	{
+		return bit_cosine(bits, query, db.bovw(j), db.norm(j));
+	}
+	template <typename DB>
+	static inline void
+	row_prefetch(const DB &db, int64_t j)
+	{
+		prefetch_bovw(db.bovw(j));
+	}
+	template <typename DB>
+	inline float
+	row_idf_dot(const DB &db, int64_t j, const std::vector<int> &query_blocks, const dense_t *query)
+	{
+		return idf_dot(query_blocks, query->bovw, db.bovw(j));
+	}
+	template <typename DB>
+	inline float
+	row_idf_norm(const DB &db, int64_t j)
+	{
+		return idf_norm(db.bovw(j));
+	}
+	
+	/* packed databases: the coded ids are intersected with the query bitset */
+	static inline float
+	row_cosine(const packed_db_t &db, int64_t j, const dense_t *query, const query_bits_t &bits)
+	{
+		const uint8_t *p = db.begin(j), *end = db.end(j);
+		uint32_t id = 0;
+		uint64_t count = 0;
 		
-		return 	(float)count / (a->norm * b->norm);
+		if (bits.idf != NULL) {
+			float dot = 0.0f;
+			
+			if (!(bits.weight_norm > 0.0f)) {
+				return 0.0f;
+			}
+			while (p < end) {
+				id += vbyte_next(p);
+				if ((query->bovw[BIT_INDEX(id)] >> BIT_BIT(id)) & 1) {
+					dot += bits.idf->value[bits.idf->level[id]];
+				}
+			}
+			return dot / (bits.weight_norm * db.norm(j));
+		}
+		while (p < end) {
+			id += vbyte_next(p);
+			count += (query->bovw[BIT_INDEX(id)] >> BIT_BIT(id)) & 1;
+		}
+		return (float)count / (query->norm * db.norm(j));
+	}
+	static inline void
+	row_prefetch(const packed_db_t &db, int64_t j)
+	{
+#if defined(__GNUC__)
+		__builtin_prefetch(db.begin(j));
+#endif
+	}
+	inline float
+	row_idf_dot(const packed_db_t &db, int64_t j, const std::vector<int> &query_blocks, const dense_t *query)
+	{
+		const uint8_t *p = db.begin(j), *end = db.end(j);
+		const float *idf = &NV_MAT_V(m_idf, 0, 0);
+		uint32_t id = 0;
+		float dot = 0.0f;
+		
+		while (p < end) {
+			id += vbyte_next(p);
+			if ((query->bovw[BIT_INDEX(id)] >> BIT_BIT(id)) & 1) {
+				dot += idf[id] * idf[id];
+			}
+		}
+		return dot;
+	}
+	inline float
+	row_idf_norm(const packed_db_t &db, int64_t j)
+	{
+		const uint8_t *p = db.begin(j), *end = db.end(j);
+		const float *idf = &NV_MAT_V(m_idf, 0, 0);
+		uint32_t id = 0;
+		float sum = 0.0f;
+		
+		while (p < end) {
+			id += vbyte_next(p);
+			sum += idf[id] * idf[id];
+		}
+		return sqrtf(sum);
 	}
 	static inline void
 	color(nv_color_boc_t *boc, const nv_matrix_t *image)
@@ -333,7 +756,13 @@ private:
 	}
 	
 public:
-	nv_bovw_ctx(): m_posi(0), m_nega(0), m_idf(0), m_ctx(0), m_fit_area(0) {}
+	static inline float DEFAULT_SPARSE_QUERY_TH() { return 0.25f; }
+	static const int MAX_IDF_LEVELS = 4;
+	static const int DEFAULT_FIRST_SCALE = 10;
+	
+	nv_bovw_ctx(): m_posi(0), m_nega(0), m_idf(0), m_ctx(0), m_fit_area(0),
+		m_sparse_query_th(DEFAULT_SPARSE_QUERY_TH()),
+		m_idf_levels(0), m_first_scale(DEFAULT_FIRST_SCALE), m_numa(NULL) {}
 	~nv_bovw_ctx() { close(); }
 
 	void
@@ -342,6 +771,36 @@ public:
 		m_fit_area = area_size;
 	}
 	
+	/* 0: always AND all words */
+	void
+	set_sparse_query_th(float th)
+	{
+		m_sparse_query_th = th;
+	}
+	
+	/* 0: the first stage is the bit cosine, 1..MAX_IDF_LEVELS: idf weighted */
+	void
+	set_idf_levels(int levels)
+	{
+		m_idf_levels = NV_MAX(0, NV_MIN(levels, MAX_IDF_LEVELS));
+		quantize_idf();
+	}
+	
+	/* the first stage keeps max(k, 10) * scale candidates for the rerank */
+	void
+	set_first_scale(int scale)
+	{
+		m_first_scale = NV_MAX(1, scale);
+	}
+	
+	/* the partitioned scan pins its threads to these nodes, NULL: no pinning.
+	 * topology must outlive the searches */
+	void
+	set_numa_topology(const otama_numa_topology_t *topology)
+	{
+		m_numa = topology;
+	}
+	
 	int
 	open(void)
 	{
@@ -629,27 +1088,304 @@ public:
 		return 0;
 	}
 
+private:
+	class norm_less {
+	private:
+		const dense_t *m_db;
+	public:
+		norm_less(const dense_t *db): m_db(db) {}
+		inline bool
+		operator()(int64_t a, int64_t b) const
+		{
+			return m_db[a].norm < m_db[b].norm
+				|| (m_db[a].norm == m_db[b].norm && a < b);
+		}
+	};
+	
+	static inline void
+	prefetch_bovw(const uint64_t *bovw)
+	{
+		otama::norm_prefetch(bovw, INT_BLOCKS * sizeof(uint64_t));
+	}
+	
+	template <typename DB>
+	static inline float
+	first_similarity(const DB &db, int64_t j, const dense_t *query,
+					 const query_bits_t &bits, float color_weight)
+	{
+		if (color_weight > 0.0f) {
+			return (1.0f - color_weight) * row_cosine(db, j, query, bits)
+				+ color_weight * color_similarity(&query->boc, db.boc(j));
+		}
+		return row_cosine(db, j, query, bits);
+	}
+	
+	void
+	quantize_idf(void)
+	{
+		std::vector<float> w2;
+		int i, l;
+		
+		m_idf_planes.level.clear();
+		m_idf_planes.value.clear();
+		m_idf_planes.delta.clear();
+		if (m_idf_levels == 0 || m_idf == NULL) {
+			return;
+		}
+		for (i = 0; i < BIT; ++i) {
+			float w = NV_MAT_V(m_idf, 0, i);
+			if (w > 0.0f) {
+				w2.push_back(w * w);
+			}
+		}
+		if (w2.empty()) {
+			return;
+		}
+		std::sort(w2.begin(), w2.end());
+		m_idf_planes.level.assign(BIT, 0);
+		m_idf_planes.value.assign(m_idf_levels + 1, 0.0f);
+		m_idf_planes.delta.assign(m_idf_levels, 0.0f);
+		m_idf_planes.rms = 0.0f;
+		for (l = 1; l <= m_idf_levels; ++l) {
+			const size_t begin = w2.size() * (l - 1) / m_idf_levels;
+			const size_t end = w2.size() * l / m_idf_levels;
+			double sum = 0.0;
+			size_t j;
+			
+			for (j = begin; j < end; ++j) {
+				sum += w2[j];
+			}
+			m_idf_planes.value[l] = end > begin ?
+				(float)(sum / (end - begin)) : m_idf_planes.value[l - 1];
+			m_idf_planes.delta[l - 1] = m_idf_planes.value[l] - m_idf_planes.value[l - 1];
+			m_idf_planes.rms += (float)sum;
+		}
+		m_idf_planes.rms = sqrtf(m_idf_planes.rms / (float)w2.size());
+		for (i = 0; i < BIT; ++i) {
+			float w = NV_MAT_V(m_idf, 0, i);
+			if (w > 0.0f) {
+				/* upper bound of the quantile */
+				l = (int)(std::upper_bound(w2.begin(), w2.end(), w * w) - w2.begin());
+				m_idf_planes.level[i] = (uint8_t)NV_MAX(1, (l * m_idf_levels + (int)w2.size() - 1) / (int)w2.size());
+			}
+		}
+	}
+	
+	inline const idf_planes_t *
+	first_idf(void)
+	{
+		return m_idf_planes.delta.empty() ? NULL : &m_idf_planes;
+	}
+	
+	inline int
+	first_k(int k)
+	{
+		return NV_MAX(k, 10) * m_first_scale;
+	}
+	
+	template <typename DB>
+	void
+	search_first_pruned(std::vector<topn_t> &topn_first,
+						const DB &db, int64_t ndb,
+						const dense_t *query,
+						float color_weight,
+						const norm_index_t &norm_index)
+	{
+		const int64_t nblocks = (int64_t)norm_index.blocks.size();
+		const float bovw_weight = 1.0f - color_weight;
+		const query_bits_t bits(query, m_sparse_query_th, first_idf());
+		std::vector<std::pair<float, int64_t> > block_order((size_t)nblocks);
+		int64_t j;
+		
+		/* the most similar blocks first, so that the thresholds grow quickly */
+		for (j = 0; j < nblocks; ++j) {
+			const norm_block_t &block = norm_index.blocks[(size_t)j];
+			float bound = bovw_weight * otama::norm_bound(query->norm, block.norm_min, block.norm_max);
+			if (color_weight > 0.0f) {
+				bound += color_weight;
+			}
+			/* margin for rounding error of the norms */
+			block_order[(size_t)j].first = bound * (1.0f + 1.0e-4f) + 1.0e-6f;
+			block_order[(size_t)j].second = j;
+		}
+		std::sort(block_order.begin(), block_order.end(),
+				  std::greater<std::pair<float, int64_t> >());
+#ifdef _OPENMP
+#pragma omp parallel for num_threads((int)topn_first.size()) schedule(dynamic, 1)
+#endif
+		for (j = 0; j < nblocks; ++j) {
+			int_fast8_t thread_idx = nv_omp_thread_id();
+			const int64_t begin = block_order[(size_t)j].second * NORM_BLOCK_SIZE;
+			const int64_t end = NV_MIN(begin + NORM_BLOCK_SIZE, ndb);
+			int64_t i;
+			
+			if (block_order[(size_t)j].first < topn_first[thread_idx].threshold()) {
+				continue;
+			}
+			for (i = begin; i < end; ++i) {
+				const int64_t index = norm_index.order[(size_t)i];
+				nv_bovw_result_t new_node;
+				
+				if (i + otama::NORM_PREFETCH < end) {
+					row_prefetch(db, norm_index.order[(size_t)i + otama::NORM_PREFETCH]);
+				}
+				if (db.skip(index)) {
+					continue;
+				}
+				new_node.similarity = first_similarity(db, index, query, bits, color_weight);
+				new_node.index = index;
+				topn_first[thread_idx].push(new_node);
+			}
+		}
+	}
+	
+	/*
+	 * one heap per partition thread, see numa_partition().
+	 * thread t runs on the node of its partition during the scan only
+	 */
+	template <typename DB>
+	void
+	search_first_partitioned(std::vector<topn_t> &topn_first,
+							 const DB &db, int64_t ndb,
+							 const dense_t *query,
+							 float color_weight,
+							 int partitions)
+	{
+		const int threads = (int)topn_first.size();
+		const int nodes = m_numa != NULL ? m_numa->nodes : 1;
+		const query_bits_t bits(query, m_sparse_query_th, first_idf());
+		int t;
+		
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(static, 1)
+#endif
+		for (t = 0; t < threads; ++t) {
+			int64_t begin, end, j;
+			const int node = numa_partition(t, threads, partitions, ndb, &begin, &end) % nodes;
+			const bool bound = nodes > 1 && otama_numa_bind_thread(m_numa, node) == 0;
+			
+			for (j = begin; j < end; ++j) {
+				nv_bovw_result_t new_node;
+				
+				if (db.skip(j)) {
+					continue;
+				}
+				new_node.similarity = first_similarity(db, j, query, bits, color_weight);
+				new_node.index = j;
+				topn_first[t].push(new_node);
+			}
+			if (bound) {
+				otama_numa_restore_thread(m_numa);
+			}
+		}
+	}
+	
+	/* the first stage of a cascade scores the coarse signatures */
+	template <typename DB>
+	static inline void
+	rescore_first(std::vector<nv_bovw_result_t> &topn_second, const DB &db,
+				  const dense_t *query, float color_weight)
+	{
+	}
+	static inline void
+	rescore_first(std::vector<nv_bovw_result_t> &topn_second, const cascade_db_t &db,
+				  const dense_t *query, float color_weight)
+	{
+		int64_t j;
+		
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+		for (j = 0; j < (int64_t)topn_second.size(); ++j) {
+			nv_bovw_result_t &ret = topn_second[(size_t)j];
+			const int64_t index = (int64_t)ret.index;
+			
+			ret.similarity = (1.0f - color_weight)
+				* bit_cosine(query->bovw, query->norm, db.bovw(index), db.norm(index))
+				+ color_weight * color_similarity(&query->boc, db.boc(index));
+		}
+	}
+	
+	/* merges the first stage heaps and reranks them */
+	template <typename DB>
 	int
-	search(nv_bovw_result_t *results, int k,
-		   const dense_t *db, int64_t ndb,
-		   const dense_t *query,
-		   nv_bovw_rerank_method_t rerank_method,
-		   float color_weight)
+	search_second(nv_bovw_result_t *results, int k, int k_first,
+				  topn_t *topn_first, int threads,
+				  const DB &db,
+				  const dense_t *query,
+				  nv_bovw_rerank_method_t rerank_method,
+				  float color_weight,
+				  const float *db_idf_norm)
+	{
+		int64_t j;
+		int jmax;
+		topn_t topn(k);
+		std::vector<nv_bovw_result_t> topn_second((size_t)NV_MAX(k_first, 1));
+		
+		topn_second.resize((size_t)otama::topk_merge(&topn_second[0], k_first,
+													 topn_first, threads));
+		switch (rerank_method) {
+		case NV_BOVW_RERANK_IDF:
+		{
+			std::vector<int> query_blocks;
+			const float query_norm = idf_norm(query->bovw);
+			
+			nonzero_blocks(query_blocks, query->bovw);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+			for (j = 0; j < (int64_t)topn_second.size(); ++j) {
+				nv_bovw_result_t &ret = topn_second[(size_t)j];
+				const int64_t index = (int64_t)ret.index;
+				const float data_norm = db_idf_norm != NULL ?
+					db_idf_norm[index] : row_idf_norm(db, index);
+				
+				ret.similarity = (1.0f - color_weight)
+					* idf_cosine(row_idf_dot(db, index, query_blocks, query),
+								 query_norm, data_norm)
+					+ color_weight * color_similarity(&query->boc, db.boc(index));
+			}
+		} break;
+		default:
+			rescore_first(topn_second, db, query, color_weight);
+			break;
+		}
+		for (j = 0; j < (int64_t)topn_second.size(); ++j) {
+			topn.push(topn_second[(size_t)j]);
+		}
+		jmax = topn.finish();
+		std::copy(topn.data(), topn.data() + jmax, results);
+		
+		return (int)jmax;
+	}
+
+	template <typename DB>
+	int
+	search_db(nv_bovw_result_t *results, int k,
+			  const DB &db, int64_t ndb,
+			  const dense_t *query,
+			  nv_bovw_rerank_method_t rerank_method,
+			  float color_weight,
+			  const float *db_idf_norm,
+			  const norm_index_t *norm_index,
+			  int partitions)
 	{
 		int64_t j;
-		int64_t jmax;
 		int_fast8_t threads = nv_omp_procs();
-		std::vector<topn_t> topn_first(threads);
-		std::vector<float> cosine_min(threads);
-		topn_t topn;
-		const int k_first = NV_MAX(k * SEARCH_FIRST_SCALE, 100);
+		const int k_first = first_k(k);
+		std::vector<topn_t> topn_first(threads, topn_t(k_first));
 		const float bovw_weight = 1.0f - color_weight;
-		std::vector<nv_bovw_result_t> topn_second;
+		const query_bits_t bits(query, m_sparse_query_th, first_idf());
 
-		for (j = 0; j < threads; ++j) {
-			cosine_min[j] = -FLT_MAX;
-		}
-		if (color_weight > 0.0f) {
+		if (norm_index != NULL && m_idf_levels == 0
+			&& (int64_t)norm_index->order.size() == ndb
+			&& 0.0f <= color_weight && color_weight <= 1.0f)
+		{
+			search_first_pruned(topn_first, db, ndb, query, color_weight, *norm_index);
+		} else if (partitions > 1) {
+			search_first_partitioned(topn_first, db, ndb, query, color_weight,
+									 NV_MIN(partitions, (int)threads));
+		} else if (color_weight > 0.0f) {
 #ifdef _OPENMP
 #pragma omp parallel for num_threads(threads)
 #endif
@@ -657,19 +1393,14 @@ public:
 				int_fast8_t thread_idx = nv_omp_thread_id();
 				nv_bovw_result_t new_node;
 				
+				if (db.skip(j)) {
+					continue;
+				}
 				new_node.similarity =
-					bovw_weight * bit_cosine(query, &db[j])
-					+ color_weight * color_similarity(&query->boc, &db[j].boc);
+					bovw_weight * row_cosine(db, j, query, bits)
+					+ color_weight * color_similarity(&query->boc, db.boc(j));
 				new_node.index = j;
-				
-				if (topn_first[thread_idx].size() < (unsigned int)k_first) {
-					topn_first[thread_idx].push(new_node);
-					cosine_min[thread_idx] = topn_first[thread_idx].top().similarity;
-				} else if (new_node.similarity > cosine_min[thread_idx]) {
-					topn_first[thread_idx].pop();
-					topn_first[thread_idx].push(new_node);
-					cosine_min[thread_idx] = topn_first[thread_idx].top().similarity;
-				}
+				topn_first[thread_idx].push(new_node);
 			}
 		} else {
 #ifdef _OPENMP
@@ -679,93 +1410,232 @@ public:
 				int_fast8_t thread_idx = nv_omp_thread_id();
 				nv_bovw_result_t new_node;
 				
-				new_node.similarity = bit_cosine(query, &db[j]);
-				new_node.index = j;
-		
-				if (topn_first[thread_idx].size() < (unsigned int)k_first) {
-					topn_first[thread_idx].push(new_node);
-					cosine_min[thread_idx] = topn_first[thread_idx].top().similarity;
-				} else if (new_node.similarity > cosine_min[thread_idx]) {
-					topn_first[thread_idx].pop();
-					topn_first[thread_idx].push(new_node);
-					cosine_min[thread_idx] = topn_first[thread_idx].top().similarity;
+				if (db.skip(j)) {
+					continue;
 				}
+				new_node.similarity = row_cosine(db, j, query, bits);
+				new_node.index = j;
+				topn_first[thread_idx].push(new_node);
 			}
 		}
 		
-		for (j = 1; j < threads; ++j) {
-			while (!topn_first[j].empty()) {
-				topn_first[0].push(topn_first[j].top());
-				topn_first[j].pop();
+		return search_second(results, k, k_first, &topn_first[0], threads,
+							 db, query, rerank_method, color_weight, db_idf_norm);
+	}
+	
+	int
+	search_cascade(nv_bovw_result_t *results, int k, int k_first,
+				   const cascade_db_t &db, int64_t ndb,
+				   const dense_t *query,
+				   nv_bovw_rerank_method_t rerank_method,
+				   float color_weight,
+				   const float *db_idf_norm)
+	{
+		int64_t j;
+		int_fast8_t threads = nv_omp_procs();
+		std::vector<topn_t> topn_first(threads, topn_t(k_first));
+		const float bovw_weight = 1.0f - color_weight;
+		NV_ALIGNED(uint64_t, coarse[COARSE_INT_BLOCKS], 16);
+		float norm;
+		
+		fold(coarse, query->bovw);
+		norm = coarse_norm(coarse);
+		
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads)
+#endif
+		for (j = 0; j < ndb; ++j) {
+			int_fast8_t thread_idx = nv_omp_thread_id();
+			nv_bovw_result_t new_node;
+			
+			if (db.skip(j)) {
+				continue;
 			}
+			new_node.similarity = (float)nv_bovw_and_popcnt(coarse, db.coarse(j), COARSE_INT_BLOCKS)
+				/ (norm * db.coarse_norm(j));
+			if (color_weight > 0.0f) {
+				new_node.similarity = bovw_weight * new_node.similarity
+					+ color_weight * color_similarity(&query->boc, db.boc(j));
+			}
+			new_node.index = j;
+			topn_first[thread_idx].push(new_node);
 		}
-		while (topn_first[0].size() > (unsigned int)k_first) {
-			topn_first[0].pop();
-		}
-		while (topn_first[0].size()) {
-			topn_second.push_back(topn_first[0].top());
-			topn_first[0].pop();
+		
+		return search_second(results, k, k_first, &topn_first[0], threads,
+							 db, query, rerank_method, color_weight, db_idf_norm);
+	}
+	
+	/* scans db once for nq queries, tile by tile */
+	template <typename DB>
+	void
+	search_batch_db(nv_bovw_result_t **results, int *nresults, int k,
+					const DB &db, int64_t ndb,
+					const dense_t **queries, int nq,
+					nv_bovw_rerank_method_t rerank_method,
+					const float *color_weight,
+					const float *db_idf_norm)
+	{
+		const int64_t tile = NV_MAX((int64_t)1, (int64_t)(BATCH_TILE_BYTES / sizeof(dense_t)));
+		const int64_t ntiles = (ndb + tile - 1) / tile;
+		const int k_first = first_k(k);
+		int_fast8_t threads = nv_omp_procs();
+		std::vector<topn_t> topn_first(threads * nq, topn_t(k_first));
+		std::vector<query_bits_t> bits;
+		int64_t t;
+		int q;
+		
+		for (q = 0; q < nq; ++q) {
+			bits.push_back(query_bits_t(queries[q], m_sparse_query_th, first_idf()));
 		}
-
-		switch (rerank_method) {
-		case NV_BOVW_RERANK_IDF:
-		{
-			nv_matrix_t *query_vec = nv_matrix_alloc(BIT, 1);
-
-			tfidf(query_vec, 0, query);
 #ifdef _OPENMP
-#pragma omp parallel for
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
 #endif
-			for (j = 0; j < (int64_t)topn_second.size(); ++j) {
-				nv_matrix_t *data_vec = nv_matrix_alloc(BIT, 1);
-				nv_bovw_result_t &ret = topn_second[(size_t)j];
-
-				tfidf(data_vec, 0, &db[ret.index]);
-				ret.similarity = (1.0f - color_weight) * nv_vector_dot(query_vec, 0, data_vec, 0)
-					+ color_weight * color_similarity(&query->boc, &db[ret.index].boc);
-				nv_matrix_free(&data_vec);
-			}
+		for (t = 0; t < ntiles; ++t) {
+			int_fast8_t thread_idx = nv_omp_thread_id();
+			const int64_t begin = t * tile;
+			const int64_t end = NV_MIN(begin + tile, ndb);
+			int i;
 			
-			cosine_min[0] = -FLT_MAX;
-			for (j = 0; j < (int64_t)topn_second.size(); ++j) {
-				nv_bovw_result_t ret = topn_second[(size_t)j];
-				if (topn.size() < (unsigned int)k) {
-					topn.push(ret);
-					cosine_min[0] = topn.top().similarity;
-				} else if (ret.similarity > cosine_min[0]) {
-					topn.pop();
-					topn.push(ret);
-					cosine_min[0] = topn.top().similarity;
-				}
-			}
-			nv_matrix_free(&query_vec);
-		} break;
-		default:
-			cosine_min[0] = -FLT_MAX;
-			for (j = 0; j < (int)topn_second.size(); ++j) {
-				nv_bovw_result_t &ret = topn_second[(size_t)j];
-				if (topn.size() < (unsigned int)k) {
-					topn.push(ret);
-					cosine_min[0] = topn.top().similarity;
-				} else if (ret.similarity > cosine_min[0]) {
-					topn.pop();
-					topn.push(ret);
-					cosine_min[0] = topn.top().similarity;
+			for (i = 0; i < nq; ++i) {
+				const int heap = i * threads + thread_idx;
+				int64_t j;
+				
+				for (j = begin; j < end; ++j) {
+					nv_bovw_result_t new_node;
+					
+					if (db.skip(j)) {
+						continue;
+					}
+					new_node.similarity = first_similarity(db, j, queries[i], bits[i], color_weight[i]);
+					new_node.index = j;
+					topn_first[heap].push(new_node);
 				}
 			}
-			break;
 		}
-		
-		j = 0; jmax = NV_MIN(k, ndb);
-		for (j = jmax - 1; j >= 0; --j) {
-			results[j] = topn.top();
-			results[j].similarity = results[j].similarity;
-			topn.pop();
+		for (q = 0; q < nq; ++q) {
+			nresults[q] = search_second(results[q], k, k_first,
+										&topn_first[q * threads], threads,
+										db, queries[q], rerank_method,
+										color_weight[q], db_idf_norm);
 		}
+	}
+
+public:
+	/*
+	 * rows of thread t when db is split into partitions (NUMA nodes).
+	 * threads [t0, t1) of a partition share its rows, t * partitions / threads
+	 * is the partition (node) of thread t. returns the partition.
+	 */
+	static inline int
+	numa_partition(int t, int threads, int partitions, int64_t ndb,
+				   int64_t *begin, int64_t *end)
+	{
+		const int p = t * partitions / threads;
+		const int t0 = (p * threads + partitions - 1) / partitions;
+		const int t1 = ((p + 1) * threads + partitions - 1) / partitions;
+		const int64_t p_begin = ndb * p / partitions;
+		const int64_t p_end = ndb * (p + 1) / partitions;
 		
-		return (int)jmax;
+		*begin = p_begin + (p_end - p_begin) * (t - t0) / (t1 - t0);
+		*end = p_begin + (p_end - p_begin) * (t - t0 + 1) / (t1 - t0);
+		
+		return p;
+	}
+	
+	/* partitions > 1: thread t only scans numa_partition(t) (not with norm_index) */
+	int
+	search(nv_bovw_result_t *results, int k,
+		   const dense_t *db, int64_t ndb,
+		   const dense_t *query,
+		   nv_bovw_rerank_method_t rerank_method,
+		   float color_weight,
+		   const float *db_idf_norm = NULL,
+		   const norm_index_t *norm_index = NULL,
+		   const uint64_t *deleted = NULL,
+		   int partitions = 1)
+	{
+		return search_db(results, k, dense_db_t(db, deleted), ndb, query,
+						 rerank_method, color_weight, db_idf_norm, norm_index,
+						 partitions);
+	}
+	
+	int
+	search(nv_bovw_result_t *results, int k,
+		   const columns_t &db, int64_t ndb,
+		   const dense_t *query,
+		   nv_bovw_rerank_method_t rerank_method,
+		   float color_weight,
+		   const float *db_idf_norm = NULL,
+		   const norm_index_t *norm_index = NULL,
+		   int partitions = 1)
+	{
+		return search_db(results, k, columns_db_t(db), ndb, query,
+						 rerank_method, color_weight, db_idf_norm, norm_index,
+						 partitions);
+	}
+
+	/* db[j] is coded at blob + db[j].offset, see pack() (no norm_index) */
+	int
+	search(nv_bovw_result_t *results, int k,
+		   const packed_t *db, const uint8_t *blob, int64_t ndb,
+		   const dense_t *query,
+		   nv_bovw_rerank_method_t rerank_method,
+		   float color_weight,
+		   const float *db_idf_norm = NULL,
+		   const uint64_t *deleted = NULL,
+		   int partitions = 1)
+	{
+		return search_db(results, k, packed_db_t(db, blob, deleted), ndb, query,
+						 rerank_method, color_weight, db_idf_norm, NULL,
+						 partitions);
 	}
 
+	/*
+	 * two-level cascade: all coarse signatures of db are scored, then the
+	 * best k_first (0: as the other searches, at most ndb) with the full records.
+	 */
+	int
+	search(nv_bovw_result_t *results, int k,
+		   const cascade_t *db, const uint8_t *blob, int64_t ndb,
+		   const dense_t *query,
+		   nv_bovw_rerank_method_t rerank_method,
+		   float color_weight,
+		   const float *db_idf_norm = NULL,
+		   const uint64_t *deleted = NULL,
+		   int k_first = 0)
+	{
+		k_first = k_first > 0 ? k_first : first_k(k);
+		k_first = NV_MAX(k, (int)NV_MIN((int64_t)k_first, ndb));
+		return search_cascade(results, k, k_first, cascade_db_t(db, blob, deleted), ndb,
+							  query, rerank_method, color_weight, db_idf_norm);
+	}
+
+	/* results[i] (k entries) and nresults[i] receive the top-k of queries[i] */
+	void
+	search_batch(nv_bovw_result_t **results, int *nresults, int k,
+				 const dense_t *db, int64_t ndb,
+				 const dense_t **queries, int nq,
+				 nv_bovw_rerank_method_t rerank_method,
+				 const float *color_weight,
+				 const float *db_idf_norm = NULL,
+				 const uint64_t *deleted = NULL)
+	{
+		search_batch_db(results, nresults, k, dense_db_t(db, deleted), ndb, queries, nq,
+						rerank_method, color_weight, db_idf_norm);
+	}
+	
+	void
+	search_batch(nv_bovw_result_t **results, int *nresults, int k,
+				 const columns_t &db, int64_t ndb,
+				 const dense_t **queries, int nq,
+				 nv_bovw_rerank_method_t rerank_method,
+				 const float *color_weight,
+				 const float *db_idf_norm = NULL)
+	{
+		search_batch_db(results, nresults, k, columns_db_t(db), ndb, queries, nq,
+						rerank_method, color_weight, db_idf_norm);
+	}
+	
 	static void
 	decode(nv_matrix_t *vec, int vec_j,
 		   const dense_t *bovw)
@@ -824,6 +1694,73 @@ public:
 		}
 	}
 
+	/*
+	 * codes the set words of bovw as VByte deltas into buf.
+	 * packed->offset is left to the caller.
+	 */
+	static void
+	pack(std::vector<uint8_t> &buf, packed_t *packed, const dense_t *bovw)
+	{
+		uint32_t last = 0;
+		int i;
+		
+		buf.clear();
+		for (i = 0; i < INT_BLOCKS; ++i) {
+			uint64_t v = bovw->bovw[i];
+			while (v) {
+				uint32_t id = (uint32_t)(i * 64 + bit_ctz(v));
+				uint32_t delta = id - last;
+				
+				while (delta >= 0x80) {
+					buf.push_back((uint8_t)(delta | 0x80));
+					delta >>= 7;
+				}
+				buf.push_back((uint8_t)delta);
+				last = id;
+				v &= v - 1;
+			}
+		}
+		packed->len = (int32_t)buf.size();
+		packed->norm = bovw->norm;
+		packed->boc = bovw->boc;
+	}
+	
+	/*
+	 * copies bovw into buf and folds it into cascade->coarse.
+	 * cascade->offset is left to the caller.
+	 */
+	static void
+	pack(std::vector<uint8_t> &buf, cascade_t *cascade, const dense_t *bovw)
+	{
+		buf.assign((const uint8_t *)bovw, (const uint8_t *)bovw + sizeof(dense_t));
+		fold(cascade->coarse, bovw->bovw);
+		cascade->len = (int32_t)sizeof(dense_t);
+		cascade->norm = coarse_norm(cascade->coarse);
+		cascade->boc = bovw->boc;
+	}
+	
+	static void
+	unpack(dense_t *bovw, const cascade_t *cascade, const uint8_t *blob)
+	{
+		memcpy(bovw, blob + cascade->offset, sizeof(dense_t));
+	}
+	
+	static void
+	unpack(dense_t *bovw, const packed_t *packed, const uint8_t *blob)
+	{
+		const uint8_t *p = blob + packed->offset;
+		const uint8_t *end = p + packed->len;
+		uint32_t id = 0;
+		
+		memset(bovw->bovw, 0, sizeof(bovw->bovw));
+		while (p < end) {
+			id += vbyte_next(p);
+			bovw->bovw[BIT_INDEX(id)] |= (1ULL << BIT_BIT(id));
+		}
+		bovw->norm = packed->norm;
+		bovw->boc = packed->boc;
+	}
+	
 	void
 	serialize(char *s, const dense_t *bovw)
 	{
@@ -938,6 +1875,13 @@ public:
 	void
 	tfidf(nv_matrix_t *idf, int idf_j,
 		  const dense_t *bovw)
+	{
+		tfidf(idf, idf_j, bovw->bovw);
+	}
+	
+	void
+	tfidf(nv_matrix_t *idf, int idf_j,
+		  const uint64_t *bovw)
 	{
 		int i;
 
@@ -947,7 +1891,7 @@ public:
 			uint64_t mask = 1;
 			
 			for (j = 0; j < 64; ++j) {
-				if (bovw->bovw[i] & mask) {
+				if (bovw[i] & mask) {
 					NV_MAT_V(idf, idf_j, i64 + j) = NV_MAT_V(m_idf, 0, i64 + j);
 				} else {
 					NV_MAT_V(idf, idf_j, i64 + j) = 0.0f;
@@ -984,20 +1928,81 @@ public:
 		const dense_t *bovw2,
 		float color_weight)
 	{
-		float similarity;
-		nv_matrix_t *idf1 = nv_matrix_alloc(N, 1);
-		nv_matrix_t *idf2 = nv_matrix_alloc(N, 1);
-
-		tfidf(idf1, 0, bovw1);
-		tfidf(idf2, 0, bovw2);
+		std::vector<int> blocks;
+		
+		nonzero_blocks(blocks, bovw1->bovw);
 		
-		similarity = (1.0f - color_weight) * nv_vector_dot(idf1, 0, idf2, 0)
+		return (1.0f - color_weight)
+			* idf_cosine(idf_dot(blocks, bovw1->bovw, bovw2->bovw),
+						 idf_norm(bovw1->bovw), idf_norm(bovw2->bovw))
 			+ color_weight * color_similarity(&bovw1->boc, &bovw2->boc);
+	}
+	
+	/* L2 norm of the tf-idf vector, cacheable per record */
+	float
+	idf_norm(const uint64_t *bovw)
+	{
+		int i;
+		float sum = 0.0f;
 		
-		nv_matrix_free(&idf1);
-		nv_matrix_free(&idf2);
+		for (i = 0; i < INT_BLOCKS; ++i) {
+			if (bovw[i] != 0) {
+				sum += idf_sum2(i, bovw[i]);
+			}
+		}
+		return sqrtf(sum);
+	}
+	
+	float
+	idf_norm(const dense_t *bovw)
+	{
+		return idf_norm(bovw->bovw);
+	}
+	
+	/* appends records [norm_index.order.size(), ndb) to the norm index */
+	static void
+	norm_index_update(norm_index_t &norm_index, const dense_t *db, int64_t ndb)
+	{
+		int64_t i, last_count = (int64_t)norm_index.order.size();
+		int64_t nblocks = (ndb + NORM_BLOCK_SIZE - 1) / NORM_BLOCK_SIZE;
 		
-		return similarity;
+		if (ndb < last_count) {
+			norm_index.order.clear();
+			last_count = 0;
+		}
+		if (ndb == last_count) {
+			return;
+		}
+		norm_index.order.resize((size_t)ndb);
+		norm_index.blocks.resize((size_t)nblocks);
+		for (i = last_count; i < ndb; ++i) {
+			norm_index.order[(size_t)i] = i;
+		}
+		std::sort(norm_index.order.begin() + last_count, norm_index.order.end(),
+				  norm_less(db));
+		std::inplace_merge(norm_index.order.begin(),
+						   norm_index.order.begin() + last_count,
+						   norm_index.order.end(),
+						   norm_less(db));
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+		for (i = 0; i < nblocks; ++i) {
+			norm_block_t &block = norm_index.blocks[(size_t)i];
+			const int64_t begin = i * NORM_BLOCK_SIZE;
+			const int64_t end = NV_MIN(begin + NORM_BLOCK_SIZE, ndb);
+			int64_t j;
+			
+			block.norm_min = FLT_MAX;
+			block.norm_max = 0.0f;
+			for (j = begin; j < end; ++j) {
+				float norm = db[norm_index.order[(size_t)j]].norm;
+				if (norm != FLT_MAX) {
+					block.norm_min = NV_MIN(block.norm_min, norm);
+					block.norm_max = NV_MAX(block.norm_max, norm);
+				}
+			}
+		}
 	}
 
 	void
@@ -1031,6 +2036,7 @@ public:
 			   uint64_t stopword_th = 0)
 	{
 		calc_idf(m_idf, 0, freq, freq_j, count, stopword_th);
+		quantize_idf();
 	}
 
 	float idf(int i)
@@ -19,6 +19,7 @@
 
 #include "nv_bovw.hpp"
 #include "nv_color_boc.h"
+#include "nv_bovw_popcnt.h"
 
 #define DATA_M     1000000
 #define TRIES      4
@@ -226,6 +227,204 @@ idf_benchmark(bovw::dense_t *db)
 	delete ctx;
 }
 
+void
+popcnt_benchmark(void)
+{
+	static const int bits[] = { NV_BOVW_BIT2K, NV_BOVW_BIT8K, NV_BOVW_BIT512K };
+	const int64_t buffer_blocks = 8 * 1048576; // 64MB
+	uint64_t *buffer;
+	uint64_t query[NV_BOVW_BIT512K / 64];
+	int64_t j;
+	int b, k;
+	
+	printf("\n---- %s\n", __FUNCTION__);
+	printf("- best kernel: %s\n",
+		   nv_bovw_popcnt_kernel_name(nv_bovw_popcnt_best_kernel()));
+	
+	buffer = nv_alloc_type(uint64_t, buffer_blocks);
+	for (j = 0; j < buffer_blocks; ++j) {
+		buffer[j] = ((uint64_t)nv_rand_index(0x7fffffff) << 32) | (uint64_t)nv_rand_index(0x7fffffff);
+	}
+	for (j = 0; j < NV_BOVW_BIT512K / 64; ++j) {
+		query[j] = ((uint64_t)nv_rand_index(0x7fffffff) << 32) | (uint64_t)nv_rand_index(0x7fffffff);
+	}
+	for (b = 0; b < (int)(sizeof(bits) / sizeof(bits[0])); ++b) {
+		const int n = bits[b] / 64;
+		const int64_t m = buffer_blocks / n;
+		uint64_t scalar_count = 0;
+		
+		for (k = 0; k < NV_BOVW_POPCNT_KERNEL_MAX; ++k) {
+			nv_bovw_and_popcnt_t func = nv_bovw_and_popcnt_kernel((nv_bovw_popcnt_kernel_e)k);
+			uint64_t count = 0;
+			long t;
+			int i;
+			
+			if (func == NULL) {
+				printf("%dbit %s: not supported\n", bits[b],
+					   nv_bovw_popcnt_kernel_name((nv_bovw_popcnt_kernel_e)k));
+				continue;
+			}
+			t = nv_clock();
+			for (i = 0; i < TRIES; ++i) {
+				for (j = 0; j < m; ++j) {
+					count += func(query, &buffer[j * n], n);
+				}
+			}
+			t = nv_clock() - t;
+			if (k == NV_BOVW_POPCNT_SCALAR) {
+				scalar_count = count;
+			}
+			printf("%dbit %s: %ldms, %.2fGB/s\n", bits[b],
+				   nv_bovw_popcnt_kernel_name((nv_bovw_popcnt_kernel_e)k), t,
+				   t > 0 ? (double)(m * n * 8) * TRIES / (t * 1.0e6) : 0.0);
+			NV_ASSERT(count == scalar_count);
+		}
+	}
+	nv_free(buffer);
+}
+
+void
+rerank_benchmark(const bovw::dense_t *db)
+{
+	const int candidates = 1000;
+	int j;
+	long t;
+	float sum;
+	nv_matrix_t *query_vec = nv_matrix_alloc(bovw::BIT, 1);
+	nv_matrix_t *data_vec = nv_matrix_alloc(bovw::BIT, 1);
+	bovw *ctx = new bovw();
+
+	ctx->open();
+
+	printf("\n---- %s\n", __FUNCTION__);
+
+	printf("dense tfidf: ");
+	t = nv_clock();
+	sum = 0.0f;
+	ctx->tfidf(query_vec, 0, &db[0]);
+	for (j = 0; j < candidates; ++j) {
+		ctx->tfidf(data_vec, 0, &db[j]);
+		sum += nv_vector_dot(query_vec, 0, data_vec, 0);
+	}
+	printf("%ldms (%f)\n", nv_clock() - t, sum);
+
+	printf("sparse idf: ");
+	t = nv_clock();
+	sum = 0.0f;
+	for (j = 0; j < candidates; ++j) {
+		sum += ctx->similarity_idf(&db[0], &db[j], 0.0f);
+	}
+	printf("%ldms (%f)\n", nv_clock() - t, sum);
+	
+	nv_matrix_free(&query_vec);
+	nv_matrix_free(&data_vec);
+	delete ctx;
+}
+
+void
+batch_benchmark(const bovw::dense_t *db)
+{
+	const int nq = 16;
+	int j;
+	long t;
+	nv_bovw_result_t *results = nv_alloc_type(nv_bovw_result_t, RESULT_M * nq);
+	nv_bovw_result_t *results_q[nq];
+	const bovw::dense_t *queries[nq];
+	float color_weight[nq];
+	int nresults[nq];
+	bovw *ctx = new bovw();
+
+	ctx->open();
+
+	printf("\n---- %s\n", __FUNCTION__);
+	for (j = 0; j < nq; ++j) {
+		results_q[j] = results + RESULT_M * j;
+		queries[j] = &db[NV_ROUND_INT(nv_rand() * (DATA_M - 1))];
+		color_weight[j] = 0.0f;
+	}
+	
+	printf("%d x search: ", nq);
+	t = nv_clock();
+	for (j = 0; j < nq; ++j) {
+		ctx->search(results_q[j], RESULT_M, db, DATA_M, queries[j],
+					NV_BOVW_RERANK_IDF, 0.0f);
+	}
+	printf("%ldms\n", nv_clock() - t);
+	
+	printf("search_batch(%d): ", nq);
+	t = nv_clock();
+	ctx->search_batch(results_q, nresults, RESULT_M, db, DATA_M, queries, nq,
+					  NV_BOVW_RERANK_IDF, color_weight);
+	printf("%ldms\n", nv_clock() - t);
+	
+	for (j = 0; j < nq; ++j) {
+		assert(results_q[j][0].index == (uint64_t)(queries[j] - db));
+	}
+	
+	nv_free(results);
+	delete ctx;
+}
+
+void
+numa_benchmark(const bovw::dense_t *db)
+{
+	static const int partitions[] = { 1, 2, 4 };
+	nv_bovw_result_t results[RESULT_M];
+	const double bytes = (double)sizeof(bovw::dense_t) * DATA_M;
+	int i, j;
+	bovw *ctx = new bovw();
+
+	ctx->open();
+
+	/* without pinned threads and placed pages this only simulates the nodes */
+	printf("\n---- %s\n", __FUNCTION__);
+	for (i = 0; i < (int)(sizeof(partitions) / sizeof(partitions[0])); ++i) {
+		long t = nv_clock();
+		
+		for (j = 0; j < TRIES; ++j) {
+			int query_j = NV_ROUND_INT(nv_rand() * (DATA_M - 1));
+			ctx->search(results, RESULT_M, db, DATA_M, &db[query_j],
+						NV_BOVW_RERANK_IDF, 0.0f, NULL, NULL, NULL, partitions[i]);
+			assert((uint64_t)query_j == results[0].index);
+		}
+		t = nv_clock() - t;
+		printf("%d partitions: %ldms, %.2fGB/s, %.2fGB/s per node\n",
+			   partitions[i], t,
+			   t > 0 ? bytes * TRIES / (t * 1.0e6) : 0.0,
+			   t > 0 ? bytes * TRIES / partitions[i] / (t * 1.0e6) : 0.0);
+	}
+	
+	delete ctx;
+}
+
+void
+sparse_query_benchmark(const bovw::dense_t *db)
+{
+	static const float ths[] = { 0.0f, bovw::DEFAULT_SPARSE_QUERY_TH() };
+	nv_bovw_result_t results[RESULT_M];
+	int i, j;
+	bovw *ctx = new bovw();
+
+	ctx->open();
+
+	printf("\n---- %s\n", __FUNCTION__);
+	for (i = 0; i < (int)(sizeof(ths) / sizeof(ths[0])); ++i) {
+		long t = nv_clock();
+		
+		ctx->set_sparse_query_th(ths[i]);
+		for (j = 0; j < TRIES; ++j) {
+			int query_j = NV_ROUND_INT(nv_rand() * (DATA_M - 1));
+			ctx->search(results, RESULT_M, db, DATA_M, &db[query_j],
+						NV_BOVW_RERANK_IDF, 0.0f);
+			assert((uint64_t)query_j == results[0].index);
+		}
+		printf("%s: %ldms\n", ths[i] > 0.0f ? "sparse query" : "dense query",
+			   nv_clock() - t);
+	}
+	
+	delete ctx;
+}
+
 void
 bovw_benchmark(void)
 {
@@ -249,6 +448,10 @@ bovw_benchmark(void)
 	search_benchmark(db);
 	serialize_benchmark(db);
 	idf_benchmark(db);
+	rerank_benchmark(db);
+	batch_benchmark(db);
+	sparse_query_benchmark(db);
+	numa_benchmark(db);
 	
 	nv_free(db);
 }
@@ -256,6 +459,7 @@ bovw_benchmark(void)
 int main(void)
 {
 	nv_setenv("NV_BOVW_PKGDATADIR", "./nvbovw");
+	popcnt_benchmark();
 	bovw_benchmark();
 	return 0;
 }
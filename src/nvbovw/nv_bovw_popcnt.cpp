@@ -0,0 +1,264 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nv_bovw_popcnt.h"
+
+#if (defined(__GNUC__) && defined(__x86_64__))
+#  define NV_BOVW_POPCNT_X86 1
+#  include <immintrin.h>
+#  if (defined(__clang__) && __clang_major__ >= 6) || (!defined(__clang__) && __GNUC__ >= 8)
+#    define NV_BOVW_POPCNT_X86_AVX512 1
+#  endif
+#endif
+
+static uint64_t
+nv_bovw_and_popcnt_scalar(const uint64_t *a, const uint64_t *b, int n)
+{
+	int i;
+	uint64_t count = 0;
+
+	for (i = 0; i < n; ++i) {
+		count += NV_POPCNT_U64(a[i] & b[i]);
+	}
+
+	return count;
+}
+
+#if NV_BOVW_POPCNT_X86
+
+__attribute__((target("popcnt")))
+static uint64_t
+nv_bovw_and_popcnt_sse42(const uint64_t *a, const uint64_t *b, int n)
+{
+	int i;
+	uint64_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		c0 += __builtin_popcountll(a[i + 0] & b[i + 0]);
+		c1 += __builtin_popcountll(a[i + 1] & b[i + 1]);
+		c2 += __builtin_popcountll(a[i + 2] & b[i + 2]);
+		c3 += __builtin_popcountll(a[i + 3] & b[i + 3]);
+	}
+	for (; i < n; ++i) {
+		c0 += __builtin_popcountll(a[i] & b[i]);
+	}
+
+	return c0 + c1 + c2 + c3;
+}
+
+/* Harley-Seal carry-save adder over 16 vectors (W. Mula et al.) */
+__attribute__((target("avx2")))
+static inline __m256i
+nv_bovw_popcnt256(__m256i v)
+{
+	const __m256i lookup = _mm256_setr_epi8(
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low_mask = _mm256_set1_epi8(0x0f);
+	__m256i lo = _mm256_and_si256(v, low_mask);
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+	__m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+								  _mm256_shuffle_epi8(lookup, hi));
+
+	return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline void
+nv_bovw_csa256(__m256i *h, __m256i *l, __m256i a, __m256i b, __m256i c)
+{
+	__m256i u = _mm256_xor_si256(a, b);
+	*h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+	*l = _mm256_xor_si256(u, c);
+}
+
+#define NV_BOVW_AND256(i) \
+	_mm256_and_si256(_mm256_loadu_si256((const __m256i *)(a) + (i)), \
+					 _mm256_loadu_si256((const __m256i *)(b) + (i)))
+
+__attribute__((target("avx2")))
+static uint64_t
+nv_bovw_and_popcnt_avx2(const uint64_t *a, const uint64_t *b, int n)
+{
+	const int nv = n / 4;
+	int i;
+	__m256i total = _mm256_setzero_si256();
+	__m256i ones = _mm256_setzero_si256();
+	__m256i twos = _mm256_setzero_si256();
+	__m256i fours = _mm256_setzero_si256();
+	__m256i eights = _mm256_setzero_si256();
+	__m256i sixteens = _mm256_setzero_si256();
+	__m256i twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+	uint64_t count;
+
+	for (i = 0; i + 16 <= nv; i += 16) {
+		nv_bovw_csa256(&twos_a, &ones, ones, NV_BOVW_AND256(i + 0), NV_BOVW_AND256(i + 1));
+		nv_bovw_csa256(&twos_b, &ones, ones, NV_BOVW_AND256(i + 2), NV_BOVW_AND256(i + 3));
+		nv_bovw_csa256(&fours_a, &twos, twos, twos_a, twos_b);
+		nv_bovw_csa256(&twos_a, &ones, ones, NV_BOVW_AND256(i + 4), NV_BOVW_AND256(i + 5));
+		nv_bovw_csa256(&twos_b, &ones, ones, NV_BOVW_AND256(i + 6), NV_BOVW_AND256(i + 7));
+		nv_bovw_csa256(&fours_b, &twos, twos, twos_a, twos_b);
+		nv_bovw_csa256(&eights_a, &fours, fours, fours_a, fours_b);
+		nv_bovw_csa256(&twos_a, &ones, ones, NV_BOVW_AND256(i + 8), NV_BOVW_AND256(i + 9));
+		nv_bovw_csa256(&twos_b, &ones, ones, NV_BOVW_AND256(i + 10), NV_BOVW_AND256(i + 11));
+		nv_bovw_csa256(&fours_a, &twos, twos, twos_a, twos_b);
+		nv_bovw_csa256(&twos_a, &ones, ones, NV_BOVW_AND256(i + 12), NV_BOVW_AND256(i + 13));
+		nv_bovw_csa256(&twos_b, &ones, ones, NV_BOVW_AND256(i + 14), NV_BOVW_AND256(i + 15));
+		nv_bovw_csa256(&fours_b, &twos, twos, twos_a, twos_b);
+		nv_bovw_csa256(&eights_b, &fours, fours, fours_a, fours_b);
+		nv_bovw_csa256(&sixteens, &eights, eights, eights_a, eights_b);
+
+		total = _mm256_add_epi64(total, nv_bovw_popcnt256(sixteens));
+	}
+	total = _mm256_slli_epi64(total, 4);
+	total = _mm256_add_epi64(total, _mm256_slli_epi64(nv_bovw_popcnt256(eights), 3));
+	total = _mm256_add_epi64(total, _mm256_slli_epi64(nv_bovw_popcnt256(fours), 2));
+	total = _mm256_add_epi64(total, _mm256_slli_epi64(nv_bovw_popcnt256(twos), 1));
+	total = _mm256_add_epi64(total, nv_bovw_popcnt256(ones));
+	for (; i < nv; ++i) {
+		total = _mm256_add_epi64(total, nv_bovw_popcnt256(NV_BOVW_AND256(i)));
+	}
+	count = (uint64_t)_mm256_extract_epi64(total, 0)
+		+ (uint64_t)_mm256_extract_epi64(total, 1)
+		+ (uint64_t)_mm256_extract_epi64(total, 2)
+		+ (uint64_t)_mm256_extract_epi64(total, 3);
+	for (i = nv * 4; i < n; ++i) {
+		count += __builtin_popcountll(a[i] & b[i]);
+	}
+
+	return count;
+}
+
+#undef NV_BOVW_AND256
+
+#if NV_BOVW_POPCNT_X86_AVX512
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static uint64_t
+nv_bovw_and_popcnt_avx512(const uint64_t *a, const uint64_t *b, int n)
+{
+	int i;
+	__m512i c0 = _mm512_setzero_si512();
+	__m512i c1 = _mm512_setzero_si512();
+	uint64_t lanes[8];
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m512i v0 = _mm512_and_si512(_mm512_loadu_si512(a + i),
+									  _mm512_loadu_si512(b + i));
+		__m512i v1 = _mm512_and_si512(_mm512_loadu_si512(a + i + 8),
+									  _mm512_loadu_si512(b + i + 8));
+		c0 = _mm512_add_epi64(c0, _mm512_popcnt_epi64(v0));
+		c1 = _mm512_add_epi64(c1, _mm512_popcnt_epi64(v1));
+	}
+	if (i < n) {
+		__mmask8 mask;
+		__m512i v;
+
+		if (i + 8 <= n) {
+			v = _mm512_and_si512(_mm512_loadu_si512(a + i),
+								 _mm512_loadu_si512(b + i));
+			c0 = _mm512_add_epi64(c0, _mm512_popcnt_epi64(v));
+			i += 8;
+		}
+		mask = (__mmask8)((1U << (n - i)) - 1U);
+		v = _mm512_and_si512(_mm512_maskz_loadu_epi64(mask, a + i),
+							 _mm512_maskz_loadu_epi64(mask, b + i));
+		c1 = _mm512_add_epi64(c1, _mm512_popcnt_epi64(v));
+	}
+
+	_mm512_storeu_si512(lanes, _mm512_add_epi64(c0, c1));
+
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3]
+		+ lanes[4] + lanes[5] + lanes[6] + lanes[7];
+}
+#endif
+
+#endif
+
+nv_bovw_and_popcnt_t
+nv_bovw_and_popcnt_kernel(nv_bovw_popcnt_kernel_e kernel)
+{
+	switch (kernel) {
+	case NV_BOVW_POPCNT_SCALAR:
+		return nv_bovw_and_popcnt_scalar;
+#if NV_BOVW_POPCNT_X86
+	case NV_BOVW_POPCNT_SSE42:
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("popcnt")) {
+			return nv_bovw_and_popcnt_sse42;
+		}
+		break;
+	case NV_BOVW_POPCNT_AVX2:
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			return nv_bovw_and_popcnt_avx2;
+		}
+		break;
+#if NV_BOVW_POPCNT_X86_AVX512
+	case NV_BOVW_POPCNT_AVX512:
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f")
+			&& __builtin_cpu_supports("avx512vpopcntdq"))
+		{
+			return nv_bovw_and_popcnt_avx512;
+		}
+		break;
+#endif
+#endif
+	default:
+		break;
+	}
+
+	return NULL;
+}
+
+nv_bovw_popcnt_kernel_e
+nv_bovw_popcnt_best_kernel(void)
+{
+	int k;
+
+	for (k = NV_BOVW_POPCNT_KERNEL_MAX - 1; k > NV_BOVW_POPCNT_SCALAR; --k) {
+		if (nv_bovw_and_popcnt_kernel((nv_bovw_popcnt_kernel_e)k) != NULL) {
+			return (nv_bovw_popcnt_kernel_e)k;
+		}
+	}
+
+	return NV_BOVW_POPCNT_SCALAR;
+}
+
+const char *
+nv_bovw_popcnt_kernel_name(nv_bovw_popcnt_kernel_e kernel)
+{
+	static const char *s_names[NV_BOVW_POPCNT_KERNEL_MAX] = {
+		"scalar", "sse4.2", "avx2", "avx512vpopcntdq"
+	};
+	if ((int)kernel < 0 || kernel >= NV_BOVW_POPCNT_KERNEL_MAX) {
+		return "unknown";
+	}
+	return s_names[kernel];
+}
+
+static uint64_t
+nv_bovw_and_popcnt_dispatch(const uint64_t *a, const uint64_t *b, int n)
+{
+	/* every thread resolves to the same pointer, so the race is benign */
+	nv_bovw_and_popcnt = nv_bovw_and_popcnt_kernel(nv_bovw_popcnt_best_kernel());
+	return nv_bovw_and_popcnt(a, b, n);
+}
+
+nv_bovw_and_popcnt_t nv_bovw_and_popcnt = nv_bovw_and_popcnt_dispatch;
@@ -0,0 +1,52 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NV_BOVW_POPCNT_H
+#define NV_BOVW_POPCNT_H
+
+#include "nv_core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* popcount(a & b) kernels, selected at runtime by CPUID */
+typedef enum {
+	NV_BOVW_POPCNT_SCALAR = 0,
+	NV_BOVW_POPCNT_SSE42,
+	NV_BOVW_POPCNT_AVX2,
+	NV_BOVW_POPCNT_AVX512,
+	NV_BOVW_POPCNT_KERNEL_MAX
+} nv_bovw_popcnt_kernel_e;
+
+typedef uint64_t (*nv_bovw_and_popcnt_t)(const uint64_t *a, const uint64_t *b, int n);
+
+/* dispatched to the best kernel on the first call */
+extern nv_bovw_and_popcnt_t nv_bovw_and_popcnt;
+
+/* returns NULL when the kernel is not supported on this host/compiler */
+nv_bovw_and_popcnt_t nv_bovw_and_popcnt_kernel(nv_bovw_popcnt_kernel_e kernel);
+nv_bovw_popcnt_kernel_e nv_bovw_popcnt_best_kernel(void);
+const char *nv_bovw_popcnt_kernel_name(nv_bovw_popcnt_kernel_e kernel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
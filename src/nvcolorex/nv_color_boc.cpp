@@ -22,33 +22,265 @@
 #include "nv_io.h"
 #include "nv_ml.h"
 #include "nv_color_boc.h"
+#include "otama_topk.hpp"
+#include "otama_norm_pruning.hpp"
 #include <vector>
-#include <queue>
 #include <functional>
+#include <algorithm>
+
+#if (defined(__GNUC__) && defined(__x86_64__))
+#  define NV_COLOR_BOC_X86 1
+#  include <immintrin.h>
+#endif
 
 extern "C" nv_matrix_t nv_color_boc_static;
 
 #define NV_COLOR_BOC_COLOR  64
 #define NV_COLOR_BOC_IMG_SIZE 512.0f
 
-static inline float
-similarity_ex(const nv_color_boc_t *a,
-		 const nv_color_boc_t *b)
+static const int nv_color_sboc_norm_e[4] = { 9 * 4, 13 * 4, 15 * 4, 16 * 4};
+static const float nv_color_sboc_w[4] = { 0.4f, 0.25f, 0.15f, 0.2f };
+#define NV_COLOR_SBOC_LEVEL (int)(sizeof(nv_color_sboc_norm_e) / sizeof(int))
+
+/*
+ * similarity kernels. w is the query side of the cosine,
+ * the level weights over the query norms (see prepare_query).
+ */
+typedef float (*boc_similarity_t)(const nv_color_boc_t *a, const float *w,
+								  const nv_color_boc_t *b);
+typedef float (*sboc_similarity_t)(const nv_color_sboc_t *a, const float *w,
+								   const nv_color_sboc_t *b);
+
+static float
+boc_similarity_scalar(const nv_color_boc_t *a, const float *w,
+					  const nv_color_boc_t *b)
 {
 	uint64_t popcnt =
 		NV_POPCNT_U64(a->color[0] & b->color[0]) +
 		NV_POPCNT_U64(a->color[1] & b->color[1]) +
 		NV_POPCNT_U64(a->color[2] & b->color[2]) +
 		NV_POPCNT_U64(a->color[3] & b->color[3]);
-		
-	return (float)popcnt / (a->norm * b->norm);
+	
+	return (float)popcnt * w[0] / b->norm;
+}
+
+static float
+sboc_similarity_scalar(const nv_color_sboc_t *a, const float *w,
+					   const nv_color_sboc_t *b)
+{
+	int i, j;
+	float similarity = 0.0f;
+	
+	for (j = 0, i = 0; j < NV_COLOR_SBOC_LEVEL; ++j) {
+		uint64_t popcnt = 0;
+		for (; i < nv_color_sboc_norm_e[j]; ++i) {
+			popcnt += NV_POPCNT_U64(a->color[i] & b->color[i]);
+		}
+		similarity += (float)popcnt * w[j] / b->norm[j];
+	}
+	
+	return similarity;
+}
+
+#if NV_COLOR_BOC_X86
+
+/* per byte popcount (pshufb lookup) */
+__attribute__((target("avx2")))
+static inline __m256i
+popcnt_epi8(__m256i v)
+{
+	const __m256i lookup = _mm256_setr_epi8(
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low_mask = _mm256_set1_epi8(0x0f);
+	__m256i lo = _mm256_and_si256(v, low_mask);
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+	
+	return _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+						   _mm256_shuffle_epi8(lookup, hi));
+}
+
+#define NV_COLOR_AND_POPCNT256(i) \
+	popcnt_epi8(_mm256_and_si256(_mm256_loadu_si256((const __m256i *)a->color + (i)), \
+								 _mm256_loadu_si256((const __m256i *)b->color + (i))))
+
+__attribute__((target("avx2")))
+static float
+boc_similarity_avx2(const nv_color_boc_t *a, const float *w,
+					const nv_color_boc_t *b)
+{
+	__m256i c = _mm256_sad_epu8(NV_COLOR_AND_POPCNT256(0), _mm256_setzero_si256());
+	__m128i s = _mm_add_epi64(_mm256_castsi256_si128(c), _mm256_extracti128_si256(c, 1));
+	
+	s = _mm_add_epi64(s, _mm_unpackhi_epi64(s, s));
+	
+	return (float)_mm_cvtsi128_si64(s) * w[0] / b->norm;
+}
+
+/* the 4 levels in one pass, then one multiply and divide for all levels */
+__attribute__((target("avx2")))
+static float
+sboc_similarity_avx2(const nv_color_sboc_t *a, const float *w,
+					 const nv_color_sboc_t *b)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i c0 = NV_COLOR_AND_POPCNT256(0);
+	__m256i c1, c2, c3, lo, hi, sum;
+	__m128i popcnt;
+	float level[4];
+	int i;
+	
+	/* the byte counters do not overflow, 9 vectors * 8 bits at most */
+	for (i = 1; i < 9; ++i) {
+		c0 = _mm256_add_epi8(c0, NV_COLOR_AND_POPCNT256(i));
+	}
+	c1 = _mm256_add_epi8(_mm256_add_epi8(NV_COLOR_AND_POPCNT256(9), NV_COLOR_AND_POPCNT256(10)),
+						 _mm256_add_epi8(NV_COLOR_AND_POPCNT256(11), NV_COLOR_AND_POPCNT256(12)));
+	c2 = _mm256_add_epi8(NV_COLOR_AND_POPCNT256(13), NV_COLOR_AND_POPCNT256(14));
+	c3 = NV_COLOR_AND_POPCNT256(15);
+	
+	/* 64bit lane sums of each level, interleaved into 32bit lanes 0..3 */
+	lo = _mm256_or_si256(_mm256_sad_epu8(c0, zero),
+						 _mm256_slli_epi64(_mm256_sad_epu8(c1, zero), 32));
+	hi = _mm256_or_si256(_mm256_sad_epu8(c2, zero),
+						 _mm256_slli_epi64(_mm256_sad_epu8(c3, zero), 32));
+	sum = _mm256_add_epi32(_mm256_unpacklo_epi64(lo, hi), _mm256_unpackhi_epi64(lo, hi));
+	popcnt = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	
+	_mm_storeu_ps(level, _mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(popcnt), _mm_loadu_ps(w)),
+									_mm_loadu_ps(b->norm)));
+	
+	/* same order as the scalar kernel */
+	return level[0] + level[1] + level[2] + level[3];
+}
+
+#undef NV_COLOR_AND_POPCNT256
+
+#endif
+
+static float boc_similarity_dispatch(const nv_color_boc_t *a, const float *w,
+									 const nv_color_boc_t *b);
+static float sboc_similarity_dispatch(const nv_color_sboc_t *a, const float *w,
+									  const nv_color_sboc_t *b);
+
+static boc_similarity_t boc_similarity = boc_similarity_dispatch;
+static sboc_similarity_t sboc_similarity = sboc_similarity_dispatch;
+
+int
+nv_color_boc_kernel_set(nv_color_boc_kernel_e kernel)
+{
+	switch (kernel) {
+	case NV_COLOR_BOC_KERNEL_SCALAR:
+		boc_similarity = boc_similarity_scalar;
+		sboc_similarity = sboc_similarity_scalar;
+		return 0;
+#if NV_COLOR_BOC_X86
+	case NV_COLOR_BOC_KERNEL_AVX2:
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) {
+			boc_similarity = boc_similarity_avx2;
+			sboc_similarity = sboc_similarity_avx2;
+			return 0;
+		}
+		break;
+#endif
+	default:
+		break;
+	}
+	
+	return -1;
+}
+
+nv_color_boc_kernel_e
+nv_color_boc_kernel_best(void)
+{
+#if NV_COLOR_BOC_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return NV_COLOR_BOC_KERNEL_AVX2;
+	}
+#endif
+	return NV_COLOR_BOC_KERNEL_SCALAR;
+}
+
+const char *
+nv_color_boc_kernel_name(nv_color_boc_kernel_e kernel)
+{
+	static const char *s_names[NV_COLOR_BOC_KERNEL_MAX] = {
+		"scalar", "avx2"
+	};
+	if ((int)kernel < 0 || kernel >= NV_COLOR_BOC_KERNEL_MAX) {
+		return "unknown";
+	}
+	return s_names[kernel];
+}
+
+/* every thread resolves to the same pointers, so the race is benign */
+static float
+boc_similarity_dispatch(const nv_color_boc_t *a, const float *w,
+						const nv_color_boc_t *b)
+{
+	nv_color_boc_kernel_set(nv_color_boc_kernel_best());
+	return boc_similarity(a, w, b);
+}
+
+static float
+sboc_similarity_dispatch(const nv_color_sboc_t *a, const float *w,
+						 const nv_color_sboc_t *b)
+{
+	nv_color_boc_kernel_set(nv_color_boc_kernel_best());
+	return sboc_similarity(a, w, b);
+}
+
+/* the query with the reciprocal norms, weights folded in */
+template<typename T>
+struct color_query {
+	const T *vec;
+	float w[4];
+};
+
+static inline void
+prepare_query(color_query<nv_color_boc_t> *q, const nv_color_boc_t *a)
+{
+	q->vec = a;
+	q->w[0] = 1.0f / a->norm;
+	q->w[1] = q->w[2] = q->w[3] = 0.0f;
+}
+
+static inline void
+prepare_query(color_query<nv_color_sboc_t> *q, const nv_color_sboc_t *a)
+{
+	int j;
+	
+	q->vec = a;
+	for (j = 0; j < NV_COLOR_SBOC_LEVEL; ++j) {
+		q->w[j] = nv_color_sboc_w[j] / a->norm[j];
+	}
+}
+
+static inline float
+similarity_ex(const color_query<nv_color_boc_t> &q,
+			  const nv_color_boc_t *b)
+{
+	return boc_similarity(q.vec, q.w, b);
+}
+
+static inline float
+similarity_ex(const color_query<nv_color_sboc_t> &q,
+			  const nv_color_sboc_t *b)
+{
+	return sboc_similarity(q.vec, q.w, b);
 }
 
 float
 nv_color_boc_similarity(const nv_color_boc_t *a,
 				   const nv_color_boc_t *b)
 {
-	return similarity_ex(a, b);
+	color_query<nv_color_boc_t> q;
+	
+	prepare_query(&q, a);
+	
+	return similarity_ex(q, b);
 }
 
 char *
@@ -173,35 +405,15 @@ nv_color_boc(nv_color_boc_t *boc,
 	nv_free(vq);
 }
 
-static const int nv_color_sboc_norm_e[4] = { 9 * 4, 13 * 4, 15 * 4, 16 * 4};
-static const float nv_color_sboc_w[4] = { 0.4f, 0.25f, 0.15f, 0.2f };
-#define NV_COLOR_SBOC_LEVEL (int)(sizeof(nv_color_sboc_norm_e) / sizeof(int))
-
-static inline float
-similarity_ex(const nv_color_sboc_t *a,
-		 const nv_color_sboc_t *b)
-{
-	int i, j;
-	float similarity = 0.0f;
-	
-	for (j = 0, i = 0; j < NV_COLOR_SBOC_LEVEL; ++j) {
-		uint64_t popcnt = 0;
-		for (; i < nv_color_sboc_norm_e[j]; ++i) {
-			popcnt += NV_POPCNT_U64(a->color[i] & b->color[i]);
-		}
-		if (popcnt > 0) {
-			similarity += ((float)popcnt / (a->norm[j] * b->norm[j])) * nv_color_sboc_w[j];
-		}
-	}
-	
-	return similarity;
-}
-
 float
 nv_color_sboc_similarity(const nv_color_sboc_t *a,
 					const nv_color_sboc_t *b)
 {
-	return similarity_ex(a, b);
+	color_query<nv_color_sboc_t> q;
+	
+	prepare_query(&q, a);
+	
+	return similarity_ex(q, b);
 }
 
 void
@@ -396,71 +608,324 @@ operator>(const nv_color_boc_result_t &d1,
 	return false;
 }
 
-typedef std::priority_queue<nv_color_boc_result_t, std::vector<nv_color_boc_result_t>,
-							std::greater<std::vector<nv_color_boc_result_t>::value_type> > nv_color_boc_topn_t;
+typedef otama::TopK<nv_color_boc_result_t, &nv_color_boc_result_t::cosine> nv_color_boc_topn_t;
+
+static inline int
+norm_levels(const nv_color_boc_t *a)
+{
+	return 1;
+}
+
+static inline float
+norm_at(const nv_color_boc_t *a, int level)
+{
+	return a->norm;
+}
+
+static inline float
+norm_weight(const nv_color_boc_t *a, int level)
+{
+	return 1.0f;
+}
+
+static inline int
+norm_levels(const nv_color_sboc_t *a)
+{
+	return NV_COLOR_SBOC_LEVEL;
+}
+
+static inline float
+norm_at(const nv_color_sboc_t *a, int level)
+{
+	return a->norm[level];
+}
+
+static inline float
+norm_weight(const nv_color_sboc_t *a, int level)
+{
+	return nv_color_sboc_w[level];
+}
+
+template<typename T>
+class norm_less {
+private:
+	const T *m_db;
+public:
+	norm_less(const T *db): m_db(db) {}
+	inline bool
+	operator()(int64_t a, int64_t b) const
+	{
+		float na = norm_at(&m_db[a], 0);
+		float nb = norm_at(&m_db[b], 0);
+		return na < nb || (na == nb && a < b);
+	}
+};
+
+template<typename T> static void
+norm_index_update(nv_color_boc_norm_index_t *index,
+				  const T *db, int64_t ndb)
+{
+	int64_t i, last_count = index->count;
+	int64_t nblocks = (ndb + NV_COLOR_BOC_NORM_BLOCK_SIZE - 1) / NV_COLOR_BOC_NORM_BLOCK_SIZE;
+	
+	if (ndb < last_count) {
+		last_count = 0;
+	}
+	if (ndb == last_count) {
+		index->count = ndb;
+		return;
+	}
+	if (ndb > index->capacity) {
+		int64_t capacity = NV_MAX(index->capacity * 2, ndb);
+		int64_t capacity_blocks = (capacity + NV_COLOR_BOC_NORM_BLOCK_SIZE - 1) / NV_COLOR_BOC_NORM_BLOCK_SIZE;
+		index->order = (int64_t *)nv_realloc(index->order, sizeof(int64_t) * capacity);
+		index->blocks = (nv_color_boc_norm_block_t *)nv_realloc(
+			index->blocks, sizeof(nv_color_boc_norm_block_t) * capacity_blocks);
+		index->capacity = capacity;
+	}
+	for (i = last_count; i < ndb; ++i) {
+		index->order[i] = i;
+	}
+	std::sort(index->order + last_count, index->order + ndb, norm_less<T>(db));
+	std::inplace_merge(index->order, index->order + last_count, index->order + ndb,
+					   norm_less<T>(db));
+	
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+	for (i = 0; i < nblocks; ++i) {
+		nv_color_boc_norm_block_t *block = &index->blocks[i];
+		const int64_t begin = i * NV_COLOR_BOC_NORM_BLOCK_SIZE;
+		const int64_t end = NV_MIN(begin + NV_COLOR_BOC_NORM_BLOCK_SIZE, ndb);
+		int64_t j;
+		int l;
+		
+		for (l = 0; l < 4; ++l) {
+			block->norm_min[l] = FLT_MAX;
+			block->norm_max[l] = 0.0f;
+		}
+		for (j = begin; j < end; ++j) {
+			const T *vec = &db[index->order[j]];
+			for (l = 0; l < norm_levels(vec); ++l) {
+				float norm = norm_at(vec, l);
+				if (norm != FLT_MAX) {
+					block->norm_min[l] = NV_MIN(block->norm_min[l], norm);
+					block->norm_max[l] = NV_MAX(block->norm_max[l], norm);
+				}
+			}
+		}
+	}
+	index->count = ndb;
+}
+
+template<typename T> static inline float
+similarity_bound(const T *query, const nv_color_boc_norm_block_t *block)
+{
+	float bound = 0.0f;
+	int l;
+	
+	for (l = 0; l < norm_levels(query); ++l) {
+		bound += norm_weight(query, l)
+			* otama::norm_bound(norm_at(query, l), block->norm_min[l], block->norm_max[l]);
+	}
+	/* margin for rounding error of the norms */
+	return bound * (1.0f + 1.0e-4f) + 1.0e-6f;
+}
+
+static inline bool
+is_deleted(const uint64_t *deleted, int64_t j)
+{
+	return deleted != NULL && ((deleted[j >> 6] >> (j & 63)) & 1) != 0;
+}
 
 template<typename T> static int
 search_ex(nv_color_boc_result_t *results, int k,
 		  const T *db, int64_t ndb,
-		  const T *query)
+		  const T *query,
+		  const nv_color_boc_norm_index_t *index,
+		  const uint64_t *deleted)
 {
 	int64_t j;
-	int64_t jmax;
 	int_fast8_t threads = nv_omp_procs();
-	nv_color_boc_topn_t topn;
-	std::vector<float> cosine_min(threads);
-	std::vector<nv_color_boc_topn_t> topn_temp(threads);
-	
-	for (j = 0; j < threads; ++j) {
-		cosine_min[j] = -FLT_MAX;
-	}
+	std::vector<nv_color_boc_topn_t> topn_temp(threads, nv_color_boc_topn_t(k));
+	color_query<T> q;
 	
+	prepare_query(&q, query);
+	if (index != NULL && index->count == ndb) {
+		const int64_t nblocks = (ndb + NV_COLOR_BOC_NORM_BLOCK_SIZE - 1) / NV_COLOR_BOC_NORM_BLOCK_SIZE;
+		std::vector<std::pair<float, int64_t> > block_order((size_t)nblocks);
+		
+		/* the most similar blocks first, so that the thresholds grow quickly */
+		for (j = 0; j < nblocks; ++j) {
+			block_order[(size_t)j].first = similarity_bound(query, &index->blocks[j]);
+			block_order[(size_t)j].second = j;
+		}
+		std::sort(block_order.begin(), block_order.end(),
+				  std::greater<std::pair<float, int64_t> >());
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+#endif
+		for (j = 0; j < nblocks; ++j) {
+			int_fast8_t thread_idx = nv_omp_thread_id();
+			const int64_t begin = block_order[(size_t)j].second * NV_COLOR_BOC_NORM_BLOCK_SIZE;
+			const int64_t end = NV_MIN(begin + NV_COLOR_BOC_NORM_BLOCK_SIZE, ndb);
+			int64_t i;
+			
+			if (block_order[(size_t)j].first < topn_temp[thread_idx].threshold()) {
+				continue;
+			}
+			for (i = begin; i < end; ++i) {
+				nv_color_boc_result_t new_node;
+				
+				if (i + otama::NORM_PREFETCH < end) {
+					otama::norm_prefetch(&db[index->order[i + otama::NORM_PREFETCH]], sizeof(T));
+				}
+				new_node.index = index->order[i];
+				if (is_deleted(deleted, (int64_t)new_node.index)) {
+					continue;
+				}
+				new_node.cosine = similarity_ex(q, &db[new_node.index]);
+				topn_temp[thread_idx].push(new_node);
+			}
+		}
+	} else {
 #ifdef _OPENMP
 #pragma omp parallel for num_threads(threads)
 #endif
-	for (j = 0; j < ndb; ++j) {
-		int_fast8_t thread_idx = nv_omp_thread_id();
-		nv_color_boc_result_t new_node;
-		
-		/* bit cosine */
-		new_node.cosine = similarity_ex(query, &db[j]);
-		new_node.index = j;
-		
-		if (topn_temp[thread_idx].size() < (unsigned int)k) {
-			topn_temp[thread_idx].push(new_node);
-			cosine_min[thread_idx] = topn_temp[thread_idx].top().cosine;
-		} else if (new_node.cosine > cosine_min[thread_idx]) {
-			topn_temp[thread_idx].pop();
+		for (j = 0; j < ndb; ++j) {
+			int_fast8_t thread_idx = nv_omp_thread_id();
+			nv_color_boc_result_t new_node;
+			
+			if (is_deleted(deleted, j)) {
+				continue;
+			}
+			/* bit cosine */
+			new_node.cosine = similarity_ex(q, &db[j]);
+			new_node.index = j;
 			topn_temp[thread_idx].push(new_node);
-			cosine_min[thread_idx] = topn_temp[thread_idx].top().cosine;
 		}
 	}
 	
-	for (j = 0; j < threads; ++j) {
-		while (!topn_temp[j].empty()) {
-			topn.push(topn_temp[j].top());
-			topn_temp[j].pop();
+	return otama::topk_merge(results, k, &topn_temp[0], threads);
+}
+
+/* scans db once for nq queries, tile by tile */
+template<typename T> static void
+search_batch_ex(nv_color_boc_result_t **results, int *nresults, int k,
+				const T *db, int64_t ndb,
+				const T **queries, int nq,
+				const uint64_t *deleted)
+{
+	const int64_t tile = NV_MAX((int64_t)1, (int64_t)(NV_COLOR_BOC_BATCH_TILE_BYTES / sizeof(T)));
+	const int64_t ntiles = (ndb + tile - 1) / tile;
+	int_fast8_t threads = nv_omp_procs();
+	std::vector<nv_color_boc_topn_t> topn_temp(threads * nq, nv_color_boc_topn_t(k));
+	std::vector<color_query<T> > prepared((size_t)nq);
+	int64_t t;
+	int q;
+	
+	for (q = 0; q < nq; ++q) {
+		prepare_query(&prepared[q], queries[q]);
+	}
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+#endif
+	for (t = 0; t < ntiles; ++t) {
+		int_fast8_t thread_idx = nv_omp_thread_id();
+		const int64_t begin = t * tile;
+		const int64_t end = NV_MIN(begin + tile, ndb);
+		int j;
+		
+		for (j = 0; j < nq; ++j) {
+			const int heap = j * threads + thread_idx;
+			int64_t i;
+			
+			for (i = begin; i < end; ++i) {
+				nv_color_boc_result_t new_node;
+				
+				if (is_deleted(deleted, i)) {
+					continue;
+				}
+				new_node.cosine = similarity_ex(prepared[j], &db[i]);
+				new_node.index = i;
+				topn_temp[heap].push(new_node);
+			}
 		}
 	}
-	while (topn.size() > (unsigned int)k) {
-		topn.pop();
+	for (q = 0; q < nq; ++q) {
+		nresults[q] = otama::topk_merge(results[q], k, &topn_temp[q * threads], threads);
 	}
-	jmax = NV_MIN(k, ndb);
-	for (j = jmax - 1; j >= 0; --j) {
-		results[j] = topn.top();
-		topn.pop();
+}
+
+nv_color_boc_norm_index_t *
+nv_color_boc_norm_index_alloc(void)
+{
+	nv_color_boc_norm_index_t *index = nv_alloc_type(nv_color_boc_norm_index_t, 1);
+	
+	index->count = 0;
+	index->capacity = 0;
+	index->order = NULL;
+	index->blocks = NULL;
+	
+	return index;
+}
+
+void
+nv_color_boc_norm_index_free(nv_color_boc_norm_index_t **index)
+{
+	if (index && *index) {
+		nv_free((*index)->order);
+		nv_free((*index)->blocks);
+		nv_free(*index);
+		*index = NULL;
 	}
+}
+
+void
+nv_color_boc_norm_index_clear(nv_color_boc_norm_index_t *index)
+{
+	index->count = 0;
+}
+
+void
+nv_color_boc_norm_index_copy(nv_color_boc_norm_index_t *dest,
+							 const nv_color_boc_norm_index_t *src)
+{
+	const int64_t nblocks = (src->count + NV_COLOR_BOC_NORM_BLOCK_SIZE - 1) / NV_COLOR_BOC_NORM_BLOCK_SIZE;
 	
-	return (int)jmax;
+	if (src->count > dest->capacity) {
+		dest->order = (int64_t *)nv_realloc(dest->order, sizeof(int64_t) * src->count);
+		dest->blocks = (nv_color_boc_norm_block_t *)nv_realloc(
+			dest->blocks, sizeof(nv_color_boc_norm_block_t) * nblocks);
+		dest->capacity = src->count;
+	}
+	if (src->count > 0) {
+		memcpy(dest->order, src->order, sizeof(int64_t) * src->count);
+		memcpy(dest->blocks, src->blocks, sizeof(nv_color_boc_norm_block_t) * nblocks);
+	}
+	dest->count = src->count;
 }
 
+void
+nv_color_sboc_norm_index_update(nv_color_boc_norm_index_t *index,
+								const nv_color_sboc_t *db, int64_t ndb)
+{
+	norm_index_update<nv_color_sboc_t>(index, db, ndb);
+}
+
+void
+nv_color_boc_norm_index_update(nv_color_boc_norm_index_t *index,
+							   const nv_color_boc_t *db, int64_t ndb)
+{
+	norm_index_update<nv_color_boc_t>(index, db, ndb);
+}
 
 int
 nv_color_sboc_search(nv_color_boc_result_t *results, int k,
 					 const nv_color_sboc_t *db, int64_t ndb,
 					 const nv_color_sboc_t *query)
 {
-	return search_ex<nv_color_sboc_t>(results, k, db, ndb, query);
+	return search_ex<nv_color_sboc_t>(results, k, db, ndb, query, NULL, NULL);
 }
 
 int
@@ -468,5 +933,43 @@ nv_color_boc_search(nv_color_boc_result_t *results, int k,
 					const nv_color_boc_t *db, int64_t ndb,
 					const nv_color_boc_t *query)
 {
-	return search_ex<nv_color_boc_t>(results, k, db, ndb, query);
+	return search_ex<nv_color_boc_t>(results, k, db, ndb, query, NULL, NULL);
+}
+
+int
+nv_color_sboc_search_pruned(nv_color_boc_result_t *results, int k,
+							const nv_color_sboc_t *db, int64_t ndb,
+							const nv_color_sboc_t *query,
+							const nv_color_boc_norm_index_t *index,
+							const uint64_t *deleted)
+{
+	return search_ex<nv_color_sboc_t>(results, k, db, ndb, query, index, deleted);
+}
+
+int
+nv_color_boc_search_pruned(nv_color_boc_result_t *results, int k,
+						   const nv_color_boc_t *db, int64_t ndb,
+						   const nv_color_boc_t *query,
+						   const nv_color_boc_norm_index_t *index,
+						   const uint64_t *deleted)
+{
+	return search_ex<nv_color_boc_t>(results, k, db, ndb, query, index, deleted);
+}
+
+void
+nv_color_sboc_search_batch(nv_color_boc_result_t **results, int *nresults, int k,
+						   const nv_color_sboc_t *db, int64_t ndb,
+						   const nv_color_sboc_t **queries, int nq,
+						   const uint64_t *deleted)
+{
+	search_batch_ex<nv_color_sboc_t>(results, nresults, k, db, ndb, queries, nq, deleted);
+}
+
+void
+nv_color_boc_search_batch(nv_color_boc_result_t **results, int *nresults, int k,
+						  const nv_color_boc_t *db, int64_t ndb,
+						  const nv_color_boc_t **queries, int nq,
+						  const uint64_t *deleted)
+{
+	search_batch_ex<nv_color_boc_t>(results, nresults, k, db, ndb, queries, nq, deleted);
 }
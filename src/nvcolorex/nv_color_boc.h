@@ -26,6 +26,18 @@
 extern "C" {
 #endif
 
+/* similarity kernels, selected at runtime by CPUID */
+typedef enum {
+	NV_COLOR_BOC_KERNEL_SCALAR = 0,
+	NV_COLOR_BOC_KERNEL_AVX2,
+	NV_COLOR_BOC_KERNEL_MAX
+} nv_color_boc_kernel_e;
+
+/* returns -1 when the kernel is not supported on this host/compiler */
+int nv_color_boc_kernel_set(nv_color_boc_kernel_e kernel);
+nv_color_boc_kernel_e nv_color_boc_kernel_best(void);
+const char *nv_color_boc_kernel_name(nv_color_boc_kernel_e kernel);
+
 #define NV_COLOR_BOC_INT_BLOCKS 4
 typedef struct {
 	uint64_t color[NV_COLOR_BOC_INT_BLOCKS];
@@ -63,6 +75,60 @@ int nv_color_boc_search(nv_color_boc_result_t *results, int k,
 						const nv_color_boc_t *db, int64_t ndb,
 						const nv_color_boc_t *query);
 
+/* records sorted by norm with per-block norm ranges.
+ * a block whose similarity upper bound is below the current k-th
+ * similarity is skipped, the results are same as the exact scan.
+ */
+#define NV_COLOR_BOC_NORM_BLOCK_SIZE 1024
+typedef struct {
+	float norm_min[4];
+	float norm_max[4];
+} nv_color_boc_norm_block_t;
+
+typedef struct {
+	int64_t count;
+	int64_t capacity;
+	int64_t *order;
+	nv_color_boc_norm_block_t *blocks;
+} nv_color_boc_norm_index_t;
+
+nv_color_boc_norm_index_t *nv_color_boc_norm_index_alloc(void);
+void nv_color_boc_norm_index_free(nv_color_boc_norm_index_t **index);
+void nv_color_boc_norm_index_clear(nv_color_boc_norm_index_t *index);
+void nv_color_boc_norm_index_copy(nv_color_boc_norm_index_t *dest,
+								  const nv_color_boc_norm_index_t *src);
+void nv_color_sboc_norm_index_update(nv_color_boc_norm_index_t *index,
+									 const nv_color_sboc_t *db, int64_t ndb);
+void nv_color_boc_norm_index_update(nv_color_boc_norm_index_t *index,
+									const nv_color_boc_t *db, int64_t ndb);
+
+/* index == NULL or index->count != ndb falls back to the exact scan.
+ * deleted is an optional bitmap (bit j of deleted[j / 64]),
+ * records with a set bit never enter the results.
+ */
+int nv_color_sboc_search_pruned(nv_color_boc_result_t *results, int k,
+								const nv_color_sboc_t *db, int64_t ndb,
+								const nv_color_sboc_t *query,
+								const nv_color_boc_norm_index_t *index,
+								const uint64_t *deleted);
+int nv_color_boc_search_pruned(nv_color_boc_result_t *results, int k,
+							   const nv_color_boc_t *db, int64_t ndb,
+							   const nv_color_boc_t *query,
+							   const nv_color_boc_norm_index_t *index,
+							   const uint64_t *deleted);
+
+/* scans db once for nq queries in cache-sized tiles.
+ * results[i] (k entries) and nresults[i] receive the top-k of queries[i].
+ */
+#define NV_COLOR_BOC_BATCH_TILE_BYTES (256 * 1024)
+void nv_color_sboc_search_batch(nv_color_boc_result_t **results, int *nresults, int k,
+								const nv_color_sboc_t *db, int64_t ndb,
+								const nv_color_sboc_t **queries, int nq,
+								const uint64_t *deleted);
+void nv_color_boc_search_batch(nv_color_boc_result_t **results, int *nresults, int k,
+							   const nv_color_boc_t *db, int64_t ndb,
+							   const nv_color_boc_t **queries, int nq,
+							   const uint64_t *deleted);
 	
 #ifdef __cplusplus
 }
@@ -21,11 +21,11 @@
 
 #include <string>
 #include <sstream>
-#include <queue>
 #include "nv_vlad.hpp"
 #include "nv_color_boc.h"
 #include "nv_color_vlad.h"
 #include "nv_color_hist.h"
+#include "otama_topk.hpp"
 
 typedef struct nv_lmca_result {
 	float similarity;
@@ -82,6 +82,8 @@ public:
 		COLOR_METHOD_LINEAR,
 		COLOR_METHOD_STEP
 	} color_method_e;
+	/* records scored together by distance_block */
+	static const int SEARCH_BLOCK = 8;
 	
 private:
 	nv_vlad_ctx<NV_VLAD_64> m_ctx;
@@ -95,36 +97,48 @@ private:
 		nv_matrix_free(&m_lmca2);
 	}
 
+	/* d += a * b */
+#if NV_ENABLE_AVX
+	static inline __m256
+	fmadd(__m256 a, __m256 b, __m256 d)
+	{
+#if defined(__FMA__)
+		return _mm256_fmadd_ps(a, b, d);
+#else
+		return _mm256_add_ps(_mm256_mul_ps(a, b), d);
+#endif
+	}
+#endif
+	
+	template <int DIM>
 	static float
-	distance(const float *v1,
-			 const float *v2)
+	distance_n(const float *v1,
+			   const float *v2)
 	{
 		int i;
 		NV_ALIGNED(float,  dist, 32);
 		
 #if NV_ENABLE_AVX
-		NV_ASSERT(LMCA_DIM % 8 == 0);
+		NV_ASSERT(DIM % 8 == 0);
 		__m256 u = _mm256_setzero_ps();
 		__m128 a;
 		
-		for (i = 0; i < LMCA_DIM; i += 8) {
-			__m256 x = _mm256_load_ps(&v1[i]);
-			__m256 h = _mm256_load_ps(&v2[i]);
-			x = _mm256_sub_ps(x, h);
-			x = _mm256_mul_ps(x, x);
-			h = _mm256_hadd_ps(x, x);
-			u = _mm256_add_ps(u, h);
+		for (i = 0; i < DIM; i += 8) {
+			__m256 x = _mm256_sub_ps(_mm256_load_ps(&v1[i]), _mm256_load_ps(&v2[i]));
+			u = fmadd(x, x, u);
 		}
+		/* same summation order as distance_block */
+		u = _mm256_hadd_ps(u, u);
 		u = _mm256_hadd_ps(u, u);
 		a = _mm_add_ps(_mm256_extractf128_ps(u, 0), _mm256_extractf128_ps(u, 1));
 		_mm_store_ss(&dist, a);
 		
 #elif NV_ENABLE_SSE
-		NV_ASSERT(LMCA_DIM % 4 == 0);
+		NV_ASSERT(DIM % 4 == 0);
 		__m128 u = _mm_setzero_ps();
 		NV_ALIGNED(float, mm[4], 16);
 		
-		for (i = 0; i < LMCA_DIM; i += 4) {
+		for (i = 0; i < DIM; i += 4) {
 			__m128 x = _mm_sub_ps(_mm_load_ps(&v1[i]), *(const __m128 *)&v2[i]);
 			u = _mm_add_ps(u, _mm_mul_ps(x, x));
 		}
@@ -133,13 +147,65 @@ private:
 		
 #else
 		dist = 0.0f;
-		for (i = 0; i < LMCA_DIM; ++i) {
+		for (i = 0; i < DIM; ++i) {
 			dist += (v1[i] - v2[i]) * (v1[i] - v2[i]);
 		}
 #endif
 		return dist;
 	}
 	
+public:
+	/* squared LMCA distance, v1 and v2 are aligned to 32 */
+	static float
+	distance(const float *v1,
+			 const float *v2)
+	{
+		return distance_n<LMCA_DIM>(v1, v2);
+	}
+	
+private:
+	/*
+	 * squared distances from q to SEARCH_BLOCK vectors at once.
+	 * each chunk of q is loaded once for the block and the 8 sums
+	 * are reduced together at the end.
+	 */
+	template <int DIM>
+	static inline void
+	distance_block(float *dist, const float *q, const float * const *x)
+	{
+#if NV_ENABLE_AVX
+		NV_ASSERT(DIM % 8 == 0);
+		__m256 u0 = _mm256_setzero_ps(), u1 = u0, u2 = u0, u3 = u0;
+		__m256 u4 = u0, u5 = u0, u6 = u0, u7 = u0;
+		__m256 t0, t1, t2, t3;
+		int i;
+		
+		for (i = 0; i < DIM; i += 8) {
+			const __m256 a = _mm256_load_ps(&q[i]);
+			__m256 d;
+			
+			d = _mm256_sub_ps(a, _mm256_load_ps(&x[0][i])); u0 = fmadd(d, d, u0);
+			d = _mm256_sub_ps(a, _mm256_load_ps(&x[1][i])); u1 = fmadd(d, d, u1);
+			d = _mm256_sub_ps(a, _mm256_load_ps(&x[2][i])); u2 = fmadd(d, d, u2);
+			d = _mm256_sub_ps(a, _mm256_load_ps(&x[3][i])); u3 = fmadd(d, d, u3);
+			d = _mm256_sub_ps(a, _mm256_load_ps(&x[4][i])); u4 = fmadd(d, d, u4);
+			d = _mm256_sub_ps(a, _mm256_load_ps(&x[5][i])); u5 = fmadd(d, d, u5);
+			d = _mm256_sub_ps(a, _mm256_load_ps(&x[6][i])); u6 = fmadd(d, d, u6);
+			d = _mm256_sub_ps(a, _mm256_load_ps(&x[7][i])); u7 = fmadd(d, d, u7);
+		}
+		t0 = _mm256_hadd_ps(_mm256_hadd_ps(u0, u1), _mm256_hadd_ps(u2, u3));
+		t1 = _mm256_hadd_ps(_mm256_hadd_ps(u4, u5), _mm256_hadd_ps(u6, u7));
+		t2 = _mm256_permute2f128_ps(t0, t1, 0x20);
+		t3 = _mm256_permute2f128_ps(t0, t1, 0x31);
+		_mm256_storeu_ps(dist, _mm256_add_ps(t2, t3));
+#else
+		int r;
+		for (r = 0; r < SEARCH_BLOCK; ++r) {
+			dist[r] = distance_n<DIM>(q, x[r]);
+		}
+#endif
+	}
+	
 public:	
 	nv_lmca_ctx(): m_lmca(0), m_lmca2(0) {}
 	~nv_lmca_ctx() { close(); }
@@ -445,13 +511,7 @@ public:
 	similarity(const nv_lmca_hsv_t *v1,
 			   const nv_lmca_hsv_t *v2)
 	{
-		float dist = 0.0f;
-		int i;
-		for (i = 0; i < NV_LMCA_HSV_DIM; ++i) {
-			float d = (v1->v[i] - v2->v[i]);
-			dist += d * d;
-		}
-		return 1.0f - sqrtf(dist) * 0.5f;
+		return 1.0f - sqrtf(distance_n<NV_LMCA_HSV_DIM>(v1->v, v2->v)) * 0.5f;
 	}
 	static inline float
 	similarity(const nv_lmca_colorcode_t *v1,
@@ -490,74 +550,263 @@ public:
 		}
 		return (1.0f - color_weight) * lmca_similarity + color_weight * color_similarity;
 	}
+	typedef otama::TopK<nv_lmca_result_t> topn_t;
+	/* records per tile of the batched scan, about the size of L2 cache */
+	static const int64_t BATCH_TILE = NV_MAX((int64_t)SEARCH_BLOCK,
+											 (int64_t)(256 * 1024 / sizeof(vector_t))
+											 / SEARCH_BLOCK * SEARCH_BLOCK);
+	/* records per task of the parallel scan */
+	static const int64_t SEARCH_CHUNK = SEARCH_BLOCK * 128;
+	
+	/* color_weight and method are resolved once per query,
+	 * the scan is instantiated for each mode.
+	 */
+	typedef enum {
+		SEARCH_LMCA,
+		SEARCH_COLOR,
+		SEARCH_LINEAR,
+		SEARCH_STEP
+	} search_mode_e;
+	
+	static inline search_mode_e
+	search_mode(color_method_e method, const float color_weight)
+	{
+		if (color_weight == 1.0f) {
+			return SEARCH_COLOR;
+		} else if (color_weight == 0.0f) {
+			return SEARCH_LMCA;
+		}
+		return method == COLOR_METHOD_STEP ? SEARCH_STEP : SEARCH_LINEAR;
+	}
+	
+	static inline void
+	color_similarity_block(float *sim, const nv_lmca_empty_color_t *query,
+						   const vector_t * const *x)
+	{
+		int r;
+		for (r = 0; r < SEARCH_BLOCK; ++r) {
+			sim[r] = 0.0f;
+		}
+	}
+	static inline void
+	color_similarity_block(float *sim, const nv_lmca_colorcode_t *query,
+						   const vector_t * const *x)
+	{
+		int r;
+		for (r = 0; r < SEARCH_BLOCK; ++r) {
+			sim[r] = similarity(&x[r]->color, query);
+		}
+	}
+	static inline void
+	color_similarity_block(float *sim, const nv_lmca_hsv_t *query,
+						   const vector_t * const *x)
+	{
+		const float *v[SEARCH_BLOCK];
+		int r;
+		
+		for (r = 0; r < SEARCH_BLOCK; ++r) {
+			v[r] = x[r]->color.v;
+		}
+		distance_block<NV_LMCA_HSV_DIM>(sim, query->v, v);
+		for (r = 0; r < SEARCH_BLOCK; ++r) {
+			sim[r] = 1.0f - sqrtf(sim[r]) * 0.5f;
+		}
+	}
+	
+	/* same values as similarity(x[r], query, ...) */
+	template <search_mode_e MODE>
+	static inline void
+	similarity_block(float *sim, const vector_t *query,
+					 const vector_t * const *x,
+					 const float color_weight,
+					 const float color_threshold)
+	{
+		NV_ALIGNED(float, color_sim[SEARCH_BLOCK], 32);
+		int r;
+		
+		if (MODE != SEARCH_COLOR) {
+			const float *v[SEARCH_BLOCK];
+			
+			for (r = 0; r < SEARCH_BLOCK; ++r) {
+				v[r] = x[r]->v;
+			}
+			distance_block<LMCA_DIM>(sim, query->v, v);
+			for (r = 0; r < SEARCH_BLOCK; ++r) {
+				sim[r] = 1.0f - sqrtf(sim[r]) * 0.5f;
+			}
+		}
+		if (MODE == SEARCH_LMCA) {
+			return;
+		}
+		color_similarity_block(MODE == SEARCH_COLOR ? sim : color_sim, &query->color, x);
+		if (MODE == SEARCH_COLOR) {
+			return;
+		}
+		for (r = 0; r < SEARCH_BLOCK; ++r) {
+			float c = color_sim[r];
+			if (MODE == SEARCH_STEP) {
+				c = color_threshold < c ? 1.0f : 0.0f;
+			}
+			sim[r] = (1.0f - color_weight) * sim[r] + color_weight * c;
+		}
+	}
+	
+	static inline void
+	similarity_block(float *sim, const vector_t *query,
+					 const vector_t * const *x,
+					 search_mode_e mode,
+					 const float color_weight,
+					 const float color_threshold)
+	{
+		switch (mode) {
+		case SEARCH_LMCA:
+			similarity_block<SEARCH_LMCA>(sim, query, x, color_weight, color_threshold);
+			break;
+		case SEARCH_COLOR:
+			similarity_block<SEARCH_COLOR>(sim, query, x, color_weight, color_threshold);
+			break;
+		case SEARCH_LINEAR:
+			similarity_block<SEARCH_LINEAR>(sim, query, x, color_weight, color_threshold);
+			break;
+		case SEARCH_STEP:
+			similarity_block<SEARCH_STEP>(sim, query, x, color_weight, color_threshold);
+			break;
+		}
+	}
+
+	/* bit i of deleted[i / 64] is set for deleted records */
+	static inline bool
+	is_deleted(const uint64_t *deleted, int64_t i)
+	{
+		return deleted != NULL && ((deleted[i >> 6] >> (i & 63)) & 1) != 0;
+	}
+	
+	template <search_mode_e MODE>
+	static void
+	scan(topn_t &topn,
+		 const vector_t *db, int64_t begin, int64_t end,
+		 const vector_t *query,
+		 const float color_weight,
+		 const float color_threshold,
+		 const uint64_t *deleted)
+	{
+		int64_t i;
+		
+		for (i = begin; i < end; i += SEARCH_BLOCK) {
+			const int count = (int)NV_MIN((int64_t)SEARCH_BLOCK, end - i);
+			const vector_t *x[SEARCH_BLOCK];
+			NV_ALIGNED(float, sim[SEARCH_BLOCK], 32);
+			int r;
+			
+			/* a short block repeats its last record */
+			for (r = 0; r < SEARCH_BLOCK; ++r) {
+				x[r] = &db[i + NV_MIN(r, count - 1)];
+			}
+			similarity_block<MODE>(sim, query, x, color_weight, color_threshold);
+			for (r = 0; r < count; ++r) {
+				nv_lmca_result_t new_node;
+				
+				if (is_deleted(deleted, i + r)) {
+					continue;
+				}
+				new_node.similarity = sim[r];
+				new_node.index = i + r;
+				topn.push(new_node);
+			}
+		}
+	}
+	
+	static void
+	scan(topn_t &topn, search_mode_e mode,
+		 const vector_t *db, int64_t begin, int64_t end,
+		 const vector_t *query,
+		 const float color_weight,
+		 const float color_threshold,
+		 const uint64_t *deleted)
+	{
+		switch (mode) {
+		case SEARCH_LMCA:
+			scan<SEARCH_LMCA>(topn, db, begin, end, query, color_weight, color_threshold, deleted);
+			break;
+		case SEARCH_COLOR:
+			scan<SEARCH_COLOR>(topn, db, begin, end, query, color_weight, color_threshold, deleted);
+			break;
+		case SEARCH_LINEAR:
+			scan<SEARCH_LINEAR>(topn, db, begin, end, query, color_weight, color_threshold, deleted);
+			break;
+		case SEARCH_STEP:
+			scan<SEARCH_STEP>(topn, db, begin, end, query, color_weight, color_threshold, deleted);
+			break;
+		}
+	}
+	
 	static int
 	search(nv_lmca_result_t *results, int n,
 		   const vector_t *db, int64_t ndb,
 		   const vector_t *query,
 		   color_method_e method,
 		   const float color_weight,
-		   const float color_threshold)
+		   const float color_threshold,
+		   const uint64_t *deleted = NULL)
 	{
-		typedef std::priority_queue<nv_lmca_result_t, std::vector<nv_lmca_result_t>,
-									std::greater<std::vector<nv_lmca_result_t>::value_type> > topn_t;
-		int64_t i, imax;
+		int64_t c;
+		const int64_t nchunks = (ndb + SEARCH_CHUNK - 1) / SEARCH_CHUNK;
+		const search_mode_e mode = search_mode(method, color_weight);
 		int threads = nv_omp_procs();
-		topn_t topn;
-		float *sim_min = nv_alloc_type(float, threads);
-		std::vector<topn_t> topn_temp(threads);
+		std::vector<topn_t> topn_temp(threads, topn_t(n));
 		
 #ifdef _OPENMP
-#pragma omp parallel for num_threads(threads)
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
 #endif
-		for (i = 0; i < ndb; ++i) {
+		for (c = 0; c < nchunks; ++c) {
 			int thread_idx = nv_omp_thread_id();
-			nv_lmca_result_t new_node;
+			const int64_t begin = c * SEARCH_CHUNK;
+			const int64_t end = NV_MIN(begin + SEARCH_CHUNK, ndb);
 			
-			if (color_weight == 1.0f) {
-				new_node.similarity = similarity(&db[i].color, &query->color);
-			} else if (color_weight == 0.0f) {
-				new_node.similarity = similarity(db[i].v, query->v);
-			} else {
-				float lmca_similarity = similarity(db[i].v, query->v);
-				float color_similarity = similarity(&db[i].color, &query->color);
-				if (method == COLOR_METHOD_STEP) {
-					if (color_threshold < color_similarity) {
-						color_similarity = 1.0f;
-					} else {
-						color_similarity = 0.0f;
-					}
-				}
-				new_node.similarity =
-					(1.0f - color_weight) * lmca_similarity
-					+ color_weight * color_similarity;
-			}
-			new_node.index = i;
-			if (topn_temp[thread_idx].size() < (unsigned int)n) {
-				topn_temp[thread_idx].push(new_node);
-				sim_min[thread_idx] = topn_temp[thread_idx].top().similarity;
-			} else if (new_node.similarity > sim_min[thread_idx]) {
-				topn_temp[thread_idx].pop();
-				topn_temp[thread_idx].push(new_node);
-				sim_min[thread_idx] = topn_temp[thread_idx].top().similarity;
-			}
+			scan(topn_temp[thread_idx], mode, db, begin, end, query,
+				 color_weight, color_threshold, deleted);
 		}
-		for (i = 0; i < threads; ++i) {
-			while (!topn_temp[i].empty()) {
-				topn.push(topn_temp[i].top());
-				topn_temp[i].pop();
-			}
+		
+		return otama::topk_merge(results, n, &topn_temp[0], threads);
+	}
+	
+	/* scans db once for nq queries, tile by tile */
+	static void
+	search_batch(nv_lmca_result_t **results, int *nresults, int n,
+				 const vector_t *db, int64_t ndb,
+				 const vector_t **queries, int nq,
+				 const color_method_e *method,
+				 const float *color_weight,
+				 const float *color_threshold,
+				 const uint64_t *deleted = NULL)
+	{
+		int64_t t;
+		const int64_t ntiles = (ndb + BATCH_TILE - 1) / BATCH_TILE;
+		int threads = nv_omp_procs();
+		int q;
+		std::vector<topn_t> topn_temp(threads * nq, topn_t(n));
+		std::vector<search_mode_e> mode(nq);
+		
+		for (q = 0; q < nq; ++q) {
+			mode[q] = search_mode(method[q], color_weight[q]);
 		}
-		while (topn.size() > (unsigned int)n) {
-			topn.pop();
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+#endif
+		for (t = 0; t < ntiles; ++t) {
+			int thread_idx = nv_omp_thread_id();
+			const int64_t begin = t * BATCH_TILE;
+			const int64_t end = NV_MIN(begin + BATCH_TILE, ndb);
+			int j;
+			
+			for (j = 0; j < nq; ++j) {
+				scan(topn_temp[j * threads + thread_idx], mode[j], db, begin, end, queries[j],
+					 color_weight[j], color_threshold[j], deleted);
+			}
 		}
-		imax = NV_MIN(n, ndb);
-		for (i = imax - 1; i >= 0; --i) {
-			results[i] = topn.top();
-			topn.pop();
+		for (q = 0; q < nq; ++q) {
+			nresults[q] = otama::topk_merge(results[q], n, &topn_temp[q * threads], threads);
 		}
-		nv_free(sim_min);
-		
-		return (int)imax;
 	}
 	
 	int
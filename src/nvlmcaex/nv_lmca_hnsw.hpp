@@ -0,0 +1,596 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NV_LMCA_HNSW_HPP
+#define NV_LMCA_HNSW_HPP
+
+#include "nv_lmca.hpp"
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* state of a graph, stored with the graph */
+typedef struct {
+	int64_t count;     /* rows 0 .. count - 1 are in the graph */
+	int64_t entry;     /* entry node, -1 when empty */
+	int64_t upper_len; /* used int32 of the upper links */
+	int32_t max_level;
+	int32_t m;         /* links per node at the upper levels, 2m at level 0 */
+} nv_lmca_hnsw_header_t;
+
+/* a node is followed by the 2m links of level 0 */
+typedef struct {
+	int64_t upper;     /* offset of the upper links, -1 at level 0 */
+	int32_t level;
+	int32_t count;     /* links at level 0 */
+} nv_lmca_hnsw_node_t;
+
+/*
+ * memory of a graph, allocated by the caller.
+ * nodes holds node_stride(m) int32 per row.
+ * upper holds level * (1 + m) int32 (count, links) per row of level >= 1.
+ */
+typedef struct {
+	nv_lmca_hnsw_header_t *header;
+	int32_t *nodes;
+	int32_t *upper;
+} nv_lmca_hnsw_graph_t;
+
+/*
+ * HNSW graph over the rows of nv_lmca_ctx<F, C>::vector_t.
+ * the node of row i is linked to the rows near by the LMCA distance,
+ * the color is applied to the ef nearest rows of a search.
+ * the rows are added in parallel, a link list is updated under
+ * the lock of its stripe. the links are int32, 2^31 rows at most.
+ */
+template<nv_lmca_feature_e F, typename C>
+class nv_lmca_hnsw
+{
+public:
+	typedef nv_lmca_ctx<F, C> ctx_t;
+	typedef typename ctx_t::vector_t vector_t;
+	typedef typename ctx_t::color_method_e color_method_e;
+	typedef typename ctx_t::search_mode_e search_mode_e;
+	typedef typename ctx_t::topn_t topn_t;
+
+	static const int DEFAULT_M = 16;
+	static const int DEFAULT_EF_CONSTRUCTION = 100;
+	static const int MAX_LEVEL = 16;
+	static const int NODE_HEAD = (int)(sizeof(nv_lmca_hnsw_node_t) / sizeof(int32_t));
+	static const int SEARCH_BLOCK = ctx_t::SEARCH_BLOCK;
+
+private:
+	static const int LOCK_STRIPES = 4096;
+
+	/* (distance, row) */
+	typedef std::pair<float, int64_t> cand_t;
+	typedef std::priority_queue<cand_t> max_heap_t;
+	typedef std::priority_queue<cand_t, std::vector<cand_t>, std::greater<cand_t> > min_heap_t;
+
+	/* rows seen by a search, open addressing */
+	class visited_t
+	{
+	private:
+		std::vector<int64_t> m_keys;
+		size_t m_size;
+
+		static inline size_t
+		hash(int64_t key)
+		{
+			uint64_t x = (uint64_t)key * UINT64_C(0x9E3779B97F4A7C15);
+			return (size_t)(x >> 32);
+		}
+
+		void
+		grow(void)
+		{
+			std::vector<int64_t> keys(m_keys.size() * 2, -1);
+			size_t i;
+
+			m_keys.swap(keys);
+			m_size = 0;
+			for (i = 0; i < keys.size(); ++i) {
+				if (keys[i] >= 0) {
+					insert(keys[i]);
+				}
+			}
+		}
+
+	public:
+		visited_t(): m_keys(1024, -1), m_size(0) {}
+
+		/* false when key is in the set */
+		inline bool
+		insert(int64_t key)
+		{
+			size_t mask, i;
+
+			if (m_size * 2 >= m_keys.size()) {
+				grow();
+			}
+			mask = m_keys.size() - 1;
+			for (i = hash(key) & mask; m_keys[i] >= 0; i = (i + 1) & mask) {
+				if (m_keys[i] == key) {
+					return false;
+				}
+			}
+			m_keys[i] = key;
+			++m_size;
+
+			return true;
+		}
+	};
+
+#ifdef _OPENMP
+	omp_lock_t m_entry_lock;
+	omp_lock_t m_locks[LOCK_STRIPES];
+
+	inline void lock(int64_t i) { omp_set_lock(&m_locks[i & (LOCK_STRIPES - 1)]); }
+	inline void unlock(int64_t i) { omp_unset_lock(&m_locks[i & (LOCK_STRIPES - 1)]); }
+	inline void lock_entry(void) { omp_set_lock(&m_entry_lock); }
+	inline void unlock_entry(void) { omp_unset_lock(&m_entry_lock); }
+#else
+	inline void lock(int64_t i) {}
+	inline void unlock(int64_t i) {}
+	inline void lock_entry(void) {}
+	inline void unlock_entry(void) {}
+#endif
+
+	static inline float
+	distance(const vector_t *a, const vector_t *b)
+	{
+		return ctx_t::distance(a->v, b->v);
+	}
+
+	static inline nv_lmca_hnsw_node_t *
+	node(const nv_lmca_hnsw_graph_t *graph, int64_t i)
+	{
+		return (nv_lmca_hnsw_node_t *)&graph->nodes[i * node_stride(graph->header->m)];
+	}
+
+	/* count and links of row i at level */
+	static inline int32_t *
+	link_list(const nv_lmca_hnsw_graph_t *graph, int64_t i, int level, int32_t **count)
+	{
+		nv_lmca_hnsw_node_t *p = node(graph, i);
+
+		if (level == 0) {
+			*count = &p->count;
+			return (int32_t *)p + NODE_HEAD;
+		} else {
+			int32_t *u = &graph->upper[p->upper + (int64_t)(level - 1) * (1 + graph->header->m)];
+			*count = u;
+			return u + 1;
+		}
+	}
+
+	static inline int
+	max_links(const nv_lmca_hnsw_graph_t *graph, int level)
+	{
+		return level == 0 ? graph->header->m * 2 : graph->header->m;
+	}
+
+	/*
+	 * copies the links of row i at level, ids >= limit are skipped.
+	 * link() rewrites a full list in place, so a reader without the lock
+	 * can get a mix of the old and the new links (or a link twice).
+	 * each entry is read once and checked against limit, a mixed list only
+	 * changes the candidates of the search.
+	 */
+	inline void
+	read_links(std::vector<int64_t> &links,
+			   const nv_lmca_hnsw_graph_t *graph, int64_t i, int level,
+			   int64_t limit, bool locked)
+	{
+		int32_t *count;
+		const int32_t *p;
+		int n, j;
+
+		if (locked) {
+			lock(i);
+		}
+		p = link_list(graph, i, level, &count);
+		n = *(const volatile int32_t *)count;
+		n = NV_MIN(NV_MAX(n, 0), max_links(graph, level));
+		links.clear();
+		for (j = 0; j < n; ++j) {
+			const int32_t id = ((const volatile int32_t *)p)[j];
+			if (id >= 0 && id < limit) {
+				links.push_back(id);
+			}
+		}
+		if (locked) {
+			unlock(i);
+		}
+	}
+
+	/* the nearest row at level from cur, ef = 1 */
+	inline int64_t
+	greedy(const nv_lmca_hnsw_graph_t *graph, const vector_t *db,
+		   const vector_t *query, int64_t cur, int level,
+		   int64_t limit, bool locked)
+	{
+		std::vector<int64_t> links;
+		float cur_dist = distance(query, &db[cur]);
+		bool changed = true;
+
+		while (changed) {
+			size_t j;
+
+			changed = false;
+			read_links(links, graph, cur, level, limit, locked);
+			for (j = 0; j < links.size(); ++j) {
+				float d = distance(query, &db[links[j]]);
+				if (d < cur_dist) {
+					cur_dist = d;
+					cur = links[j];
+					changed = true;
+				}
+			}
+		}
+		return cur;
+	}
+
+	/* the ef nearest rows at level from entry, nearest first */
+	inline void
+	search_layer(std::vector<cand_t> &result,
+				 const nv_lmca_hnsw_graph_t *graph, const vector_t *db,
+				 const vector_t *query, int64_t entry, int ef, int level,
+				 int64_t limit, bool locked)
+	{
+		visited_t visited;
+		min_heap_t candidates;
+		max_heap_t nearest;
+		std::vector<int64_t> links;
+		cand_t e(distance(query, &db[entry]), entry);
+
+		visited.insert(entry);
+		candidates.push(e);
+		nearest.push(e);
+		while (!candidates.empty()) {
+			const cand_t c = candidates.top();
+			size_t j;
+
+			if (c.first > nearest.top().first) {
+				break;
+			}
+			candidates.pop();
+			read_links(links, graph, c.second, level, limit, locked);
+			for (j = 0; j < links.size(); ++j) {
+				float d;
+
+				if (!visited.insert(links[j])) {
+					continue;
+				}
+				d = distance(query, &db[links[j]]);
+				if ((int)nearest.size() < ef || d < nearest.top().first) {
+					candidates.push(cand_t(d, links[j]));
+					nearest.push(cand_t(d, links[j]));
+					if ((int)nearest.size() > ef) {
+						nearest.pop();
+					}
+				}
+			}
+		}
+		result.resize(nearest.size());
+		for (size_t j = result.size(); j > 0; --j) {
+			result[j - 1] = nearest.top();
+			nearest.pop();
+		}
+	}
+
+	/*
+	 * at most m of the candidates (nearest first).
+	 * a candidate nearer to a selected row than to the base is dropped,
+	 * so the links spread out to the directions around the base.
+	 */
+	static inline void
+	select_neighbors(std::vector<int64_t> &selected,
+					 const vector_t *db,
+					 const std::vector<cand_t> &candidates, int m)
+	{
+		size_t i, j;
+
+		selected.clear();
+		for (i = 0; i < candidates.size() && (int)selected.size() < m; ++i) {
+			bool good = true;
+			for (j = 0; j < selected.size(); ++j) {
+				if (distance(&db[candidates[i].second], &db[selected[j]]) < candidates[i].first) {
+					good = false;
+					break;
+				}
+			}
+			if (good) {
+				selected.push_back(candidates[i].second);
+			}
+		}
+	}
+
+	/* adds i to the links of e at level, the full list is selected again */
+	inline void
+	link(const nv_lmca_hnsw_graph_t *graph, const vector_t *db,
+		 int64_t e, int64_t i, int level)
+	{
+		const int m_max = max_links(graph, level);
+		int32_t *count;
+		int32_t *p;
+
+		lock(e);
+		p = link_list(graph, e, level, &count);
+		if (*count < m_max) {
+			p[(*count)++] = (int32_t)i;
+		} else {
+			std::vector<cand_t> candidates;
+			std::vector<int64_t> selected;
+			int j;
+
+			candidates.push_back(cand_t(distance(&db[e], &db[i]), i));
+			for (j = 0; j < *count; ++j) {
+				candidates.push_back(cand_t(distance(&db[e], &db[p[j]]), p[j]));
+			}
+			std::sort(candidates.begin(), candidates.end());
+			select_neighbors(selected, db, candidates, m_max);
+			for (j = 0; j < (int)selected.size(); ++j) {
+				p[j] = (int32_t)selected[j];
+			}
+			*count = (int32_t)selected.size();
+		}
+		unlock(e);
+	}
+
+	/* the level of row i is taken from a hash of i, a new graph gets the same levels */
+	static inline int
+	level_of(int64_t i, int m)
+	{
+		uint64_t x = (uint64_t)i + UINT64_C(0x9E3779B97F4A7C15);
+		double u;
+
+		x = (x ^ (x >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+		x = (x ^ (x >> 27)) * UINT64_C(0x94D049BB133111EB);
+		x = x ^ (x >> 31);
+		u = ((double)(x >> 11) + 1.0) * (1.0 / 9007199254740992.0);
+
+		return NV_MIN((int)(-log(u) / log((double)m)), MAX_LEVEL);
+	}
+
+	void
+	insert(const nv_lmca_hnsw_graph_t *graph, const vector_t *db,
+		   int64_t i, int ef_construction, int64_t limit)
+	{
+		const vector_t *query = &db[i];
+		const int level = node(graph, i)->level;
+		std::vector<cand_t> nearest;
+		std::vector<int64_t> selected;
+		int64_t entry, cur;
+		int max_level, l;
+
+		lock_entry();
+		entry = graph->header->entry;
+		max_level = graph->header->max_level;
+		unlock_entry();
+
+		cur = entry;
+		for (l = max_level; l > level; --l) {
+			cur = greedy(graph, db, query, cur, l, limit, true);
+		}
+		for (l = NV_MIN(level, max_level); l >= 0; --l) {
+			int32_t *count;
+			int32_t *p;
+			size_t j;
+
+			search_layer(nearest, graph, db, query, cur, ef_construction, l, limit, true);
+			select_neighbors(selected, db, nearest, graph->header->m);
+			lock(i);
+			p = link_list(graph, i, l, &count);
+			for (j = 0; j < selected.size(); ++j) {
+				p[j] = (int32_t)selected[j];
+			}
+			*count = (int32_t)selected.size();
+			unlock(i);
+			for (j = 0; j < selected.size(); ++j) {
+				link(graph, db, selected[j], i, l);
+			}
+			cur = nearest[0].second;
+		}
+		if (level > max_level) {
+			lock_entry();
+			if (level > graph->header->max_level) {
+				graph->header->max_level = level;
+				graph->header->entry = i;
+			}
+			unlock_entry();
+		}
+	}
+
+public:
+	nv_lmca_hnsw()
+	{
+#ifdef _OPENMP
+		int i;
+		omp_init_lock(&m_entry_lock);
+		for (i = 0; i < LOCK_STRIPES; ++i) {
+			omp_init_lock(&m_locks[i]);
+		}
+#endif
+	}
+
+	~nv_lmca_hnsw()
+	{
+#ifdef _OPENMP
+		int i;
+		omp_destroy_lock(&m_entry_lock);
+		for (i = 0; i < LOCK_STRIPES; ++i) {
+			omp_destroy_lock(&m_locks[i]);
+		}
+#endif
+	}
+
+	/* int32 per node */
+	static inline int64_t node_stride(int m) { return NODE_HEAD + (int64_t)m * 2; }
+
+	/* int32 of the upper links of rows begin .. end - 1 */
+	static int64_t
+	upper_len(int64_t begin, int64_t end, int m)
+	{
+		int64_t len = 0;
+		int64_t i;
+
+		for (i = begin; i < end; ++i) {
+			len += (int64_t)level_of(i, m) * (1 + m);
+		}
+		return len;
+	}
+
+	static void
+	init(nv_lmca_hnsw_header_t *header, int m)
+	{
+		header->count = 0;
+		header->entry = -1;
+		header->upper_len = 0;
+		header->max_level = -1;
+		header->m = m;
+	}
+
+	/*
+	 * adds rows header->count .. end - 1 of db.
+	 * the graph has room for end nodes and upper_len(count, end, m) upper links.
+	 */
+	void
+	add(nv_lmca_hnsw_graph_t *graph, const vector_t *db,
+		int64_t end, int ef_construction)
+	{
+		nv_lmca_hnsw_header_t *header = graph->header;
+		const int m = header->m;
+		int64_t begin = header->count;
+		int64_t i;
+
+		if (begin >= end) {
+			return;
+		}
+		for (i = begin; i < end; ++i) {
+			nv_lmca_hnsw_node_t *p = node(graph, i);
+			p->level = level_of(i, m);
+			p->count = 0;
+			if (p->level > 0) {
+				int l;
+				p->upper = header->upper_len;
+				header->upper_len += (int64_t)p->level * (1 + m);
+				for (l = 1; l <= p->level; ++l) {
+					int32_t *count;
+					link_list(graph, i, l, &count);
+					*count = 0;
+				}
+			} else {
+				p->upper = -1;
+			}
+		}
+		if (header->entry < 0) {
+			header->entry = begin;
+			header->max_level = node(graph, begin)->level;
+			++begin;
+		}
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+		for (i = begin; i < end; ++i) {
+			insert(graph, db, i, ef_construction, end);
+		}
+		header->count = end;
+	}
+
+	/*
+	 * the n best rows of db[0 .. ndb - 1].
+	 * the graph is searched for the ef rows nearest by the LMCA distance,
+	 * the rows not in the graph yet are scanned.
+	 * color_weight = 1.0 and an empty graph scan all rows.
+	 */
+	int
+	search(nv_lmca_result_t *results, int n,
+		   const vector_t *db, int64_t ndb,
+		   const nv_lmca_hnsw_graph_t *graph,
+		   const vector_t *query,
+		   color_method_e method,
+		   const float color_weight,
+		   const float color_threshold,
+		   const uint64_t *deleted,
+		   int ef)
+	{
+		const search_mode_e mode = ctx_t::search_mode(method, color_weight);
+		const int64_t limit = graph != NULL ? NV_MIN(graph->header->count, ndb) : 0;
+		std::vector<cand_t> nearest;
+		topn_t topn(n);
+		int64_t entry;
+		int max_level, l;
+		size_t j;
+
+		if (mode == ctx_t::SEARCH_COLOR || limit == 0
+			|| (entry = graph->header->entry) < 0 || entry >= limit)
+		{
+			return ctx_t::search(results, n, db, ndb, query, method,
+								 color_weight, color_threshold, deleted);
+		}
+		max_level = graph->header->max_level;
+		for (l = max_level; l > 0; --l) {
+			entry = greedy(graph, db, query, entry, l, limit, false);
+		}
+		search_layer(nearest, graph, db, query, entry, NV_MAX(ef, n), 0, limit, false);
+
+		j = 0;
+		while (j < nearest.size()) {
+			const vector_t *x[SEARCH_BLOCK];
+			int64_t index[SEARCH_BLOCK];
+			NV_ALIGNED(float, sim[SEARCH_BLOCK], 32);
+			int count = 0, r;
+
+			for (; j < nearest.size() && count < SEARCH_BLOCK; ++j) {
+				if (!ctx_t::is_deleted(deleted, nearest[j].second)) {
+					index[count] = nearest[j].second;
+					x[count] = &db[nearest[j].second];
+					++count;
+				}
+			}
+			if (count == 0) {
+				break;
+			}
+			/* a short block repeats its last record */
+			for (r = count; r < SEARCH_BLOCK; ++r) {
+				x[r] = x[count - 1];
+			}
+			ctx_t::similarity_block(sim, query, x, mode, color_weight, color_threshold);
+			for (r = 0; r < count; ++r) {
+				nv_lmca_result_t new_node;
+
+				new_node.similarity = sim[r];
+				new_node.index = index[r];
+				topn.push(new_node);
+			}
+		}
+		if (limit < ndb) {
+			ctx_t::scan(topn, mode, db, limit, ndb, query,
+						color_weight, color_threshold, deleted);
+		}
+
+		return otama::topk_merge(results, n, &topn, 1);
+	}
+};
+
+#endif
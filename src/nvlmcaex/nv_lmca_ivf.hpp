@@ -0,0 +1,200 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NV_LMCA_IVF_HPP
+#define NV_LMCA_IVF_HPP
+
+#include "nv_lmca.hpp"
+#include <vector>
+#include <algorithm>
+
+/*
+ * inverted file over nv_lmca_ctx<F, C>::vector_t.
+ * the centroids are k-means of the LMCA vectors (nv_lmca_train -c).
+ * a record belongs to the list of its nearest centroid, a search
+ * scores the records of the nprobe lists nearest to the query.
+ * the color is not used for the lists.
+ */
+template<nv_lmca_feature_e F, typename C>
+class nv_lmca_ivf
+{
+public:
+	typedef nv_lmca_ctx<F, C> ctx_t;
+	typedef typename ctx_t::vector_t vector_t;
+	typedef typename ctx_t::color_method_e color_method_e;
+	typedef typename ctx_t::search_mode_e search_mode_e;
+	typedef typename ctx_t::topn_t topn_t;
+	/* row indexes of a list, ascending */
+	typedef std::vector<int64_t> list_t;
+
+	static const int LMCA_DIM = ctx_t::LMCA_DIM;
+	static const int SEARCH_BLOCK = ctx_t::SEARCH_BLOCK;
+
+private:
+	nv_matrix_t *m_centroids;
+
+	inline float
+	distance(int k, const float *v) const
+	{
+		float dist = 0.0f;
+		int i;
+
+		for (i = 0; i < LMCA_DIM; ++i) {
+			float d = NV_MAT_V(m_centroids, k, i) - v[i];
+			dist += d * d;
+		}
+		return dist;
+	}
+
+	static void
+	scan_list(topn_t &topn, search_mode_e mode,
+			  const vector_t *db, const list_t &list,
+			  const vector_t *query,
+			  const float color_weight,
+			  const float color_threshold,
+			  const uint64_t *deleted)
+	{
+		const int64_t len = (int64_t)list.size();
+		int64_t j = 0;
+
+		while (j < len) {
+			const vector_t *x[SEARCH_BLOCK];
+			int64_t index[SEARCH_BLOCK];
+			NV_ALIGNED(float, sim[SEARCH_BLOCK], 32);
+			int count = 0, r;
+
+			for (; j < len && count < SEARCH_BLOCK; ++j) {
+				if (!ctx_t::is_deleted(deleted, list[j])) {
+					index[count] = list[j];
+					x[count] = &db[list[j]];
+					++count;
+				}
+			}
+			if (count == 0) {
+				break;
+			}
+			/* a short block repeats its last record */
+			for (r = count; r < SEARCH_BLOCK; ++r) {
+				x[r] = x[count - 1];
+			}
+			ctx_t::similarity_block(sim, query, x, mode, color_weight, color_threshold);
+			for (r = 0; r < count; ++r) {
+				nv_lmca_result_t new_node;
+
+				new_node.similarity = sim[r];
+				new_node.index = index[r];
+				topn.push(new_node);
+			}
+		}
+	}
+
+public:
+	nv_lmca_ivf(): m_centroids(NULL) {}
+	~nv_lmca_ivf() { nv_matrix_free(&m_centroids); }
+
+	/* centroid_file is a nlist x LMCA_DIM matrix */
+	int
+	open(const char *centroid_file)
+	{
+		nv_matrix_free(&m_centroids);
+		m_centroids = nv_load_matrix(centroid_file);
+		if (m_centroids == NULL) {
+			return -1;
+		}
+		if (m_centroids->n != LMCA_DIM || m_centroids->m < 1) {
+			nv_matrix_free(&m_centroids);
+			return -1;
+		}
+		return 0;
+	}
+
+	inline bool is_open(void) const { return m_centroids != NULL; }
+	inline int nlist(void) const { return m_centroids != NULL ? m_centroids->m : 0; }
+
+	/* the list of vec */
+	int
+	assign(const vector_t *vec) const
+	{
+		float min_dist = FLT_MAX;
+		int k, min_k = 0;
+
+		for (k = 0; k < m_centroids->m; ++k) {
+			float dist = distance(k, vec->v);
+			if (dist < min_dist) {
+				min_dist = dist;
+				min_k = k;
+			}
+		}
+		return min_k;
+	}
+
+	/* the nprobe lists nearest to vec, all lists when nprobe <= 0 */
+	void
+	probe(std::vector<int> &lists, int nprobe, const vector_t *vec) const
+	{
+		std::vector<std::pair<float, int> > dist((size_t)m_centroids->m);
+		int k;
+
+		if (nprobe <= 0 || nprobe > m_centroids->m) {
+			nprobe = m_centroids->m;
+		}
+		for (k = 0; k < m_centroids->m; ++k) {
+			dist[k].first = distance(k, vec->v);
+			dist[k].second = k;
+		}
+		std::partial_sort(dist.begin(), dist.begin() + nprobe, dist.end());
+		lists.resize((size_t)nprobe);
+		for (k = 0; k < nprobe; ++k) {
+			lists[k] = dist[k].second;
+		}
+	}
+
+	/* lists[k] holds the rows of db in the list k */
+	int
+	search(nv_lmca_result_t *results, int n,
+		   const vector_t *db, const list_t *lists,
+		   const vector_t *query,
+		   color_method_e method,
+		   const float color_weight,
+		   const float color_threshold,
+		   const uint64_t *deleted = NULL,
+		   int nprobe = 0) const
+	{
+		const search_mode_e mode = ctx_t::search_mode(method, color_weight);
+		int threads = nv_omp_procs();
+		std::vector<topn_t> topn_temp(threads, topn_t(n));
+		std::vector<int> probes;
+		int i, nprobes;
+
+		probe(probes, nprobe, query);
+		nprobes = (int)probes.size();
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+#endif
+		for (i = 0; i < nprobes; ++i) {
+			int thread_idx = nv_omp_thread_id();
+			scan_list(topn_temp[thread_idx], mode, db, lists[probes[i]], query,
+					  color_weight, color_threshold, deleted);
+		}
+
+		return otama::topk_merge(results, n, &topn_temp[0], threads);
+	}
+};
+
+#endif
@@ -0,0 +1,520 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NV_LMCA_QUANT_HPP
+#define NV_LMCA_QUANT_HPP
+
+#include "nv_lmca.hpp"
+#include <vector>
+#if defined(__AVX2__) || defined(__F16C__)
+#  include <immintrin.h>
+#endif
+
+typedef enum {
+	NV_LMCA_QUANT_INT8,
+	NV_LMCA_QUANT_FP16
+} nv_lmca_quant_e;
+
+/* IEEE 754 half precision, round to nearest even */
+static inline uint16_t
+nv_lmca_float_to_half(float f)
+{
+#if defined(__F16C__)
+	return (uint16_t)_cvtss_sh(f, 0);
+#else
+	uint32_t x, sign, mant, h, rem;
+	int exp;
+
+	memcpy(&x, &f, sizeof(x));
+	sign = (x >> 16) & 0x8000;
+	exp = (int)((x >> 23) & 0xff);
+	mant = x & 0x7fffff;
+	if (exp == 0xff) {
+		return (uint16_t)(sign | 0x7c00 | (mant ? 0x200 : 0));
+	}
+	exp = exp - 127 + 15;
+	if (exp >= 31) {
+		return (uint16_t)(sign | 0x7c00);
+	}
+	if (exp <= 0) {
+		int shift;
+
+		if (exp < -10) {
+			return (uint16_t)sign;
+		}
+		mant |= 0x800000;
+		shift = 14 - exp;
+		h = mant >> shift;
+		rem = mant & ((1U << shift) - 1);
+		if (rem > (1U << (shift - 1)) || (rem == (1U << (shift - 1)) && (h & 1))) {
+			++h;
+		}
+		return (uint16_t)(sign | h);
+	}
+	h = ((uint32_t)exp << 10) | (mant >> 13);
+	rem = mant & 0x1fff;
+	/* a carry into the exponent is the correct rounding */
+	if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) {
+		++h;
+	}
+	return (uint16_t)(sign | h);
+#endif
+}
+
+static inline float
+nv_lmca_half_to_float(uint16_t h)
+{
+#if defined(__F16C__)
+	return _cvtsh_ss(h);
+#else
+	uint32_t sign = ((uint32_t)h & 0x8000) << 16;
+	uint32_t exp = (h >> 10) & 0x1f;
+	uint32_t mant = h & 0x3ff;
+	uint32_t x;
+	float f;
+
+	if (exp == 0) {
+		f = (float)mant * (1.0f / 16777216.0f);
+		return sign ? -f : f;
+	} else if (exp == 31) {
+		x = sign | 0x7f800000 | (mant << 13) | (mant ? 0x400000 : 0);
+	} else {
+		x = sign | ((exp + 112) << 23) | (mant << 13);
+	}
+	memcpy(&f, &x, sizeof(f));
+
+	return f;
+#endif
+}
+
+template<nv_lmca_quant_e Q> struct nv_lmca_quant_code;
+template<> struct nv_lmca_quant_code<NV_LMCA_QUANT_INT8> { typedef int8_t type; };
+template<> struct nv_lmca_quant_code<NV_LMCA_QUANT_FP16> { typedef uint16_t type; };
+
+/* the hsv color is quantized with the vector, the colorcode is stored as is */
+template<typename C> struct nv_lmca_quant_color
+{
+	static const int DIM = 0;
+	typedef C color_t;
+};
+template<> struct nv_lmca_quant_color<nv_lmca_hsv_t>
+{
+	static const int DIM = NV_LMCA_HSV_DIM;
+	typedef nv_lmca_empty_color_t color_t;
+};
+
+/*
+ * compact rows of nv_lmca_ctx<F, C>::vector_t.
+ * int8 codes are v[i] / step[i] where step[i] is the largest |v[i]|
+ * of the training data (nv_lmca_train -s) over 127, fp16 codes are
+ * the halves of v[i]. the query stays in float, the distances are
+ * computed between the float query and the decoded rows.
+ */
+template<nv_lmca_feature_e F, typename C, nv_lmca_quant_e Q>
+class nv_lmca_quant
+{
+public:
+	typedef nv_lmca_ctx<F, C> ctx_t;
+	typedef typename ctx_t::vector_t vector_t;
+	typedef typename ctx_t::color_method_e color_method_e;
+	typedef typename ctx_t::search_mode_e search_mode_e;
+	typedef typename ctx_t::topn_t topn_t;
+	typedef typename nv_lmca_quant_code<Q>::type code_t;
+
+	static const int LMCA_DIM = ctx_t::LMCA_DIM;
+	static const int COLOR_DIM = nv_lmca_quant_color<C>::DIM;
+	static const int DIM = LMCA_DIM + COLOR_DIM;
+	static const int SEARCH_BLOCK = ctx_t::SEARCH_BLOCK;
+	static const int64_t SEARCH_CHUNK = ctx_t::SEARCH_CHUNK;
+	static const int INT8_MAX_CODE = 127;
+
+	typedef struct {
+		NV_ALIGNED(code_t, v[DIM], 16);
+		typename nv_lmca_quant_color<C>::color_t color;
+	} row_t;
+
+	typedef struct {
+		NV_ALIGNED(float, v[DIM], 32);
+		const vector_t *vec;
+	} query_t;
+
+private:
+	/* heap allocated, the kernels do not assume the alignment */
+	float m_step[DIM];
+
+#if defined(__AVX2__) || defined(__F16C__)
+	static inline __m256
+	fmadd(__m256 a, __m256 b, __m256 d)
+	{
+#if defined(__FMA__)
+		return _mm256_fmadd_ps(a, b, d);
+#else
+		return _mm256_add_ps(_mm256_mul_ps(a, b), d);
+#endif
+	}
+	static inline float
+	hsum(__m256 u)
+	{
+		float dist;
+
+		u = _mm256_hadd_ps(u, u);
+		u = _mm256_hadd_ps(u, u);
+		_mm_store_ss(&dist, _mm_add_ps(_mm256_extractf128_ps(u, 0),
+									   _mm256_extractf128_ps(u, 1)));
+		return dist;
+	}
+#endif
+
+	/* squared distance between q and the decoded codes of c */
+	template <int N>
+	static inline float
+	distance_n(const float *q, const int8_t *c, const float *step)
+	{
+		int i;
+#if defined(__AVX2__)
+		NV_ASSERT(N % 8 == 0);
+		__m256 u = _mm256_setzero_ps();
+
+		for (i = 0; i < N; i += 8) {
+			__m256 x = _mm256_cvtepi32_ps(
+				_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)&c[i])));
+			__m256 d = _mm256_sub_ps(_mm256_load_ps(&q[i]),
+									 _mm256_mul_ps(x, _mm256_loadu_ps(&step[i])));
+			u = fmadd(d, d, u);
+		}
+		return hsum(u);
+#else
+		float dist = 0.0f;
+		for (i = 0; i < N; ++i) {
+			float d = q[i] - (float)c[i] * step[i];
+			dist += d * d;
+		}
+		return dist;
+#endif
+	}
+
+	template <int N>
+	static inline float
+	distance_n(const float *q, const uint16_t *c, const float *step)
+	{
+		int i;
+#if defined(__F16C__)
+		NV_ASSERT(N % 8 == 0);
+		__m256 u = _mm256_setzero_ps();
+
+		for (i = 0; i < N; i += 8) {
+			__m256 x = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)&c[i]));
+			__m256 d = _mm256_sub_ps(_mm256_load_ps(&q[i]), x);
+			u = fmadd(d, d, u);
+		}
+		return hsum(u);
+#else
+		float dist = 0.0f;
+		for (i = 0; i < N; ++i) {
+			float d = q[i] - nv_lmca_half_to_float(c[i]);
+			dist += d * d;
+		}
+		return dist;
+#endif
+	}
+
+	inline code_t
+	encode(float v, int i) const
+	{
+		if (Q == NV_LMCA_QUANT_INT8) {
+			const int max_code = INT8_MAX_CODE;
+			int c = (int)floorf(v / m_step[i] + 0.5f);
+			return (code_t)NV_MAX(-max_code, NV_MIN(max_code, c));
+		}
+		return (code_t)nv_lmca_float_to_half(v);
+	}
+
+	void quantize_color(row_t *row, const nv_lmca_empty_color_t *color) const {}
+	void
+	quantize_color(row_t *row, const nv_lmca_colorcode_t *color) const
+	{
+		row->color = *color;
+	}
+	void
+	quantize_color(row_t *row, const nv_lmca_hsv_t *color) const
+	{
+		int i;
+		for (i = 0; i < COLOR_DIM; ++i) {
+			row->v[LMCA_DIM + i] = encode(color->v[i], LMCA_DIM + i);
+		}
+	}
+
+	inline float
+	color_similarity(const row_t *row, const query_t *query,
+					 const nv_lmca_empty_color_t *color) const
+	{
+		return 0.0f;
+	}
+	inline float
+	color_similarity(const row_t *row, const query_t *query,
+					 const nv_lmca_colorcode_t *color) const
+	{
+		return ctx_t::similarity(&row->color, color);
+	}
+	inline float
+	color_similarity(const row_t *row, const query_t *query,
+					 const nv_lmca_hsv_t *color) const
+	{
+		return 1.0f - sqrtf(distance_n<COLOR_DIM>(&query->v[LMCA_DIM],
+												  &row->v[LMCA_DIM],
+												  &m_step[LMCA_DIM])) * 0.5f;
+	}
+
+	/* same mixing as nv_lmca_ctx::similarity_block */
+	template <search_mode_e MODE>
+	inline float
+	similarity(const row_t *row, const query_t *query,
+			   const float color_weight,
+			   const float color_threshold) const
+	{
+		float sim = 0.0f, c;
+
+		if (MODE != ctx_t::SEARCH_COLOR) {
+			sim = 1.0f - sqrtf(distance_n<LMCA_DIM>(query->v, row->v, m_step)) * 0.5f;
+		}
+		if (MODE == ctx_t::SEARCH_LMCA) {
+			return sim;
+		}
+		c = color_similarity(row, query, &query->vec->color);
+		if (MODE == ctx_t::SEARCH_COLOR) {
+			return c;
+		}
+		if (MODE == ctx_t::SEARCH_STEP) {
+			c = color_threshold < c ? 1.0f : 0.0f;
+		}
+		return (1.0f - color_weight) * sim + color_weight * c;
+	}
+
+	template <search_mode_e MODE>
+	void
+	scan(topn_t &topn,
+		 const row_t *rows, int64_t begin, int64_t end,
+		 const query_t *query,
+		 const float color_weight,
+		 const float color_threshold,
+		 const uint64_t *deleted) const
+	{
+		int64_t i;
+
+		for (i = begin; i < end; ++i) {
+			nv_lmca_result_t new_node;
+
+			if (ctx_t::is_deleted(deleted, i)) {
+				continue;
+			}
+			new_node.similarity = similarity<MODE>(&rows[i], query,
+												   color_weight, color_threshold);
+			new_node.index = i;
+			topn.push(new_node);
+		}
+	}
+
+	void
+	scan(topn_t &topn, search_mode_e mode,
+		 const row_t *rows, int64_t begin, int64_t end,
+		 const query_t *query,
+		 const float color_weight,
+		 const float color_threshold,
+		 const uint64_t *deleted) const
+	{
+		switch (mode) {
+		case ctx_t::SEARCH_LMCA:
+			scan<ctx_t::SEARCH_LMCA>(topn, rows, begin, end, query, color_weight, color_threshold, deleted);
+			break;
+		case ctx_t::SEARCH_COLOR:
+			scan<ctx_t::SEARCH_COLOR>(topn, rows, begin, end, query, color_weight, color_threshold, deleted);
+			break;
+		case ctx_t::SEARCH_LINEAR:
+			scan<ctx_t::SEARCH_LINEAR>(topn, rows, begin, end, query, color_weight, color_threshold, deleted);
+			break;
+		case ctx_t::SEARCH_STEP:
+			scan<ctx_t::SEARCH_STEP>(topn, rows, begin, end, query, color_weight, color_threshold, deleted);
+			break;
+		}
+	}
+
+	/* scores the candidates with the float records */
+	static int
+	rerank(nv_lmca_result_t *results, int n,
+		   const nv_lmca_result_t *candidates, int ncandidates,
+		   const vector_t *db,
+		   const vector_t *query,
+		   search_mode_e mode,
+		   const float color_weight,
+		   const float color_threshold)
+	{
+		topn_t topn(n);
+		int j;
+
+		for (j = 0; j < ncandidates; j += SEARCH_BLOCK) {
+			const int count = NV_MIN((int)SEARCH_BLOCK, ncandidates - j);
+			const vector_t *x[SEARCH_BLOCK];
+			NV_ALIGNED(float, sim[SEARCH_BLOCK], 32);
+			int r;
+
+			for (r = 0; r < SEARCH_BLOCK; ++r) {
+				x[r] = &db[candidates[j + NV_MIN(r, count - 1)].index];
+			}
+			ctx_t::similarity_block(sim, query, x, mode, color_weight, color_threshold);
+			for (r = 0; r < count; ++r) {
+				nv_lmca_result_t new_node;
+
+				new_node.similarity = sim[r];
+				new_node.index = candidates[j + r].index;
+				topn.push(new_node);
+			}
+		}
+		return otama::topk_merge(results, n, &topn, 1);
+	}
+
+	int
+	load_scale(const char *file, int offset, int dim)
+	{
+		nv_matrix_t *scale = nv_load_matrix(file);
+		int i;
+
+		if (scale == NULL) {
+			return -1;
+		}
+		if (scale->n != dim || scale->m != 1) {
+			nv_matrix_free(&scale);
+			return -1;
+		}
+		for (i = 0; i < dim; ++i) {
+			set_scale(offset + i, NV_MAT_V(scale, 0, i));
+		}
+		nv_matrix_free(&scale);
+
+		return 0;
+	}
+
+public:
+	/* without a scale file the range is +-1, the bound of the unit vectors */
+	nv_lmca_quant()
+	{
+		int i;
+		for (i = 0; i < DIM; ++i) {
+			m_step[i] = 1.0f / INT8_MAX_CODE;
+		}
+	}
+
+	/* scale_file is a 1 x LMCA_DIM matrix of the largest |v[i]| */
+	int
+	open(const char *scale_file)
+	{
+		return load_scale(scale_file, 0, LMCA_DIM);
+	}
+
+	int
+	open(const char *scale_file, const char *color_scale_file)
+	{
+		if (load_scale(scale_file, 0, LMCA_DIM) != 0) {
+			return -1;
+		}
+		if (COLOR_DIM > 0) {
+			return load_scale(color_scale_file, LMCA_DIM, COLOR_DIM);
+		}
+		return 0;
+	}
+
+	/* max_abs is the largest |v[i]|, i < LMCA_DIM + COLOR_DIM */
+	void
+	set_scale(int i, float max_abs)
+	{
+		m_step[i] = (max_abs > 0.0f ? max_abs : 1.0f) / INT8_MAX_CODE;
+	}
+
+	void
+	quantize(row_t *row, const vector_t *vec) const
+	{
+		int i;
+
+		memset(row, 0, sizeof(*row));
+		for (i = 0; i < LMCA_DIM; ++i) {
+			row->v[i] = encode(vec->v[i], i);
+		}
+		quantize_color(row, &vec->color);
+	}
+
+	void
+	prepare_query(query_t *query, const vector_t *vec) const
+	{
+		const float *color = (const float *)&vec->color;
+		int i;
+
+		memcpy(query->v, vec->v, sizeof(float) * LMCA_DIM);
+		for (i = 0; i < COLOR_DIM; ++i) {
+			query->v[LMCA_DIM + i] = color[i];
+		}
+		query->vec = vec;
+	}
+
+	/*
+	 * scans the rows. with db and rerank_n > n, the best rerank_n
+	 * rows are scored again with the float records of db.
+	 */
+	int
+	search(nv_lmca_result_t *results, int n,
+		   const row_t *rows, const vector_t *db, int64_t ndb,
+		   const vector_t *vec,
+		   color_method_e method,
+		   const float color_weight,
+		   const float color_threshold,
+		   const uint64_t *deleted = NULL,
+		   int rerank_n = 0) const
+	{
+		int64_t c;
+		const int64_t nchunks = (ndb + SEARCH_CHUNK - 1) / SEARCH_CHUNK;
+		const search_mode_e mode = ctx_t::search_mode(method, color_weight);
+		const bool exact = (db != NULL && rerank_n > n);
+		const int first_n = exact ? rerank_n : n;
+		int threads = nv_omp_procs();
+		std::vector<topn_t> topn_temp(threads, topn_t(first_n));
+		query_t query;
+
+		prepare_query(&query, vec);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 1)
+#endif
+		for (c = 0; c < nchunks; ++c) {
+			int thread_idx = nv_omp_thread_id();
+			const int64_t begin = c * SEARCH_CHUNK;
+			const int64_t end = NV_MIN(begin + SEARCH_CHUNK, ndb);
+
+			scan(topn_temp[thread_idx], mode, rows, begin, end, &query,
+				 color_weight, color_threshold, deleted);
+		}
+		if (exact) {
+			std::vector<nv_lmca_result_t> candidates(first_n);
+			int ncandidates = otama::topk_merge(&candidates[0], first_n,
+												&topn_temp[0], threads);
+
+			return rerank(results, n, &candidates[0], ncandidates, db, vec,
+						  mode, color_weight, color_threshold);
+		}
+		return otama::topk_merge(results, n, &topn_temp[0], threads);
+	}
+};
+
+#endif
@@ -33,6 +33,8 @@
 #define DEFAULT_PUSH_HSV 0.45f
 #define DEFAULT_PUSH_VLAD 0.3f
 #define DEFAULT_PUSH_VLADHSV 0.3f
+#define DEFAULT_NLIST 1024
+#define KMEANS_STEP 60
 
 static void
 print_usage(void)
@@ -42,6 +44,8 @@ print_usage(void)
 		   "    -e (vlad|hsv|vladhsv) extract mode\n"
 		   "    -t (vlad|hsv|vladhsv|vq) training mode\n"
 		   "    -v (vlad|hsv|vladhsv) validation mode\n"
+		   "    -s (vlad|hsv|vladhsv) int8 scale mode\n"
+		   "    -c (vlad|hsv|vladhsv) ivf centroid mode\n"
 		   " extract mode options\n"
 		   "    -x     use flip image (2x data)\n"
 		   "    -q s   path to the codebook_file(input)\n"
@@ -63,7 +67,16 @@ print_usage(void)
 		   " validation mode options\n"
 		   "    -k n   kNN closet size (default: 20)\n"
 		   "    -l s   path to the lmca_file (input)\n"
-		   "    -f s   path to the data_file(input)\n",
+		   "    -f s   path to the data_file(input)\n"
+		   " int8 scale mode options\n"
+		   "    -l s   path to the lmca_file (input)\n"
+		   "    -f s   path to the data_file (input)\n"
+		   "    -o s   path to the scale_file (output)\n"
+		   " ivf centroid mode options\n"
+		   "    -n n   number of lists (default: 1024)\n"
+		   "    -l s   path to the lmca_file (input)\n"
+		   "    -f s   path to the data_file (input)\n"
+		   "    -o s   path to the ivf_file (output)\n",
 		   name
 		);
 }
@@ -181,11 +194,74 @@ knn_validation(const nv_matrix_t *l,
 	nv_matrix_free(&data_lmca);
 }
 
+/* the largest |v[i]| of the normalized projections, the range of the int8 codes */
+static nv_matrix_t *
+quant_scale(const nv_matrix_t *l,
+			const nv_matrix_t *data)
+{
+	nv_matrix_t *data_lmca = nv_matrix_alloc(l->m, data->m);
+	nv_matrix_t *scale = nv_matrix_alloc(l->m, 1);
+	int i, j;
+	
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif	
+	for (i = 0; i < data->m; ++i) {
+		nv_lmca_projection(data_lmca, i, l, data, i);
+		nv_vector_normalize(data_lmca, i);
+	}
+	nv_matrix_zero(scale);
+	for (i = 0; i < data_lmca->m; ++i) {
+		for (j = 0; j < data_lmca->n; ++j) {
+			NV_MAT_V(scale, 0, j) = NV_MAX(NV_MAT_V(scale, 0, j),
+										   fabsf(NV_MAT_V(data_lmca, i, j)));
+		}
+	}
+	nv_matrix_free(&data_lmca);
+	
+	return scale;
+}
+
+/* k-means of the normalized projections, the lists of nv_lmca_ivf */
+static nv_matrix_t *
+ivf_centroids(const nv_matrix_t *l,
+			  const nv_matrix_t *data,
+			  int nlist)
+{
+	nv_matrix_t *data_lmca = nv_matrix_alloc(l->m, data->m);
+	nv_matrix_t *centroids = nv_matrix_alloc(l->m, nlist);
+	nv_matrix_t *count = nv_matrix_alloc(1, nlist);
+	nv_matrix_t *labels = nv_matrix_alloc(1, data->m);
+	int i;
+	
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif	
+	for (i = 0; i < data->m; ++i) {
+		nv_lmca_projection(data_lmca, i, l, data, i);
+		nv_vector_normalize(data_lmca, i);
+	}
+	nv_matrix_zero(centroids);
+	nv_matrix_zero(count);
+	nv_matrix_zero(labels);
+	
+	nv_kmeans_progress(1);
+	nv_kmeans(centroids, count, labels, data_lmca, nlist, KMEANS_STEP);
+	
+	nv_matrix_free(&data_lmca);
+	nv_matrix_free(&count);
+	nv_matrix_free(&labels);
+	
+	return centroids;
+}
+
 typedef enum {
 	UNKNOWN = 0,
 	TRAIN = 1,
 	EXTRACT = 2,
-	VALIDATION = 3
+	VALIDATION = 3,
+	SCALE = 4,
+	IVF = 5
 } mode_e;
 
 template<nv_lmca_feature_e T, typename C> int
@@ -343,6 +419,68 @@ lmca_main(mode_e mode, const char *vq_file,
 		nv_matrix_free(&l);
 		break;
 	}
+	case SCALE:
+	{
+		nv_matrix_t *mats[2];
+		nv_matrix_t *scale;
+		int len = 2;
+		const char *scale_file = _metric_file[0] != '\0' ? _metric_file : "lmca_scale.mat";
+		
+		if (l == NULL) {
+			fprintf(stderr, "error: missing lmca file (-l)\n");
+			return -1;
+		}
+		if (nv_load_matrix_array_bin(data_file, mats, &len) != 0 || len != 2) {
+			fprintf(stderr, "%s: invalid matrix size\n", data_file);
+			return -1;
+		}
+		data = mats[0];
+		labels = mats[1];
+		if (data->n != nv_lmca_ctx<T, C>::RAW_DIM) {
+			nv_matrix_free(&data);
+			nv_matrix_free(&labels);
+			fprintf(stderr, "%s: invalid data file\n", data_file);
+			return -1;
+		}
+		scale = quant_scale(l, data);
+		nv_save_matrix_text(scale_file, scale);
+		nv_matrix_free(&scale);
+		nv_matrix_free(&data);
+		nv_matrix_free(&labels);
+		nv_matrix_free(&l);
+		break;
+	}
+	case IVF:
+	{
+		nv_matrix_t *mats[2];
+		nv_matrix_t *centroids;
+		int len = 2;
+		const char *ivf_file = _metric_file[0] != '\0' ? _metric_file : "lmca_ivf.mat";
+		
+		if (l == NULL) {
+			fprintf(stderr, "error: missing lmca file (-l)\n");
+			return -1;
+		}
+		if (nv_load_matrix_array_bin(data_file, mats, &len) != 0 || len != 2) {
+			fprintf(stderr, "%s: invalid matrix size\n", data_file);
+			return -1;
+		}
+		data = mats[0];
+		labels = mats[1];
+		if (data->n != nv_lmca_ctx<T, C>::RAW_DIM) {
+			nv_matrix_free(&data);
+			nv_matrix_free(&labels);
+			fprintf(stderr, "%s: invalid data file\n", data_file);
+			return -1;
+		}
+		centroids = ivf_centroids(l, data, NV_MIN(data->m, k_n));
+		nv_save_matrix_text(ivf_file, centroids);
+		nv_matrix_free(&centroids);
+		nv_matrix_free(&data);
+		nv_matrix_free(&labels);
+		nv_matrix_free(&l);
+		break;
+	}
 	default:
 		print_usage();
 		return -1;
@@ -399,7 +537,7 @@ main(int argc, char** argv)
 	char metric_file[8192] = {0};
 	bool flip = false;
 	
-	while ((opt = nv_getopt(argc, argv, "e:t:hk:m:d:n:i:r:l:q:xf:o:v:")) != -1) {
+	while ((opt = nv_getopt(argc, argv, "e:t:hk:m:d:n:i:r:l:q:xf:o:v:s:c:")) != -1) {
 		switch (opt) {
 		case 'f':
 			strncpy(data_file, nv_getopt_optarg, sizeof(data_file) - 1);
@@ -443,6 +581,14 @@ main(int argc, char** argv)
 			mode = VALIDATION;
 			strncpy(feature, nv_getopt_optarg, sizeof(feature) -1);
 			break;
+		case 's':
+			mode = SCALE;
+			strncpy(feature, nv_getopt_optarg, sizeof(feature) -1);
+			break;
+		case 'c':
+			mode = IVF;
+			strncpy(feature, nv_getopt_optarg, sizeof(feature) -1);
+			break;
 		case 'q':
 			strncpy(vq_file, nv_getopt_optarg, sizeof(vq_file) -1);
 			break;
@@ -465,6 +611,9 @@ main(int argc, char** argv)
 		}
 		filelist = argv[0];
 	}
+	if (mode == IVF && n < 0) {
+		n = DEFAULT_NLIST;
+	}
 	if (nv_strcasecmp(feature, "vlad") == 0) {
 		if (push_weight < 0.0) {
 			push_weight = DEFAULT_PUSH_VLAD;
@@ -0,0 +1,128 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nv_core.h"
+#include "nv_color_boc.h"
+#include <vector>
+
+#define DATA_M  200000
+#define QUERY_N 100
+#define K       20
+
+// from nv_color_boc.cpp
+static const int nv_color_sboc_norm_e[4] = { 9 * 4, 13 * 4, 15 * 4, 16 * 4};
+
+static uint64_t
+rand_bits(float p)
+{
+	uint64_t v = 0;
+	int i;
+
+	for (i = 0; i < 64; ++i) {
+		if (nv_rand() < p) {
+			v |= (1ULL << i);
+		}
+	}
+	return v;
+}
+
+static void
+make_data(nv_color_sboc_t *sboc, nv_color_boc_t *boc, int64_t n)
+{
+	int64_t j;
+
+	for (j = 0; j < n; ++j) {
+		float p = nv_rand() * 0.3f;
+		uint64_t popcnt;
+		int i, l;
+
+		for (i = 0; i < NV_COLOR_SBOC_INT_BLOCKS; ++i) {
+			sboc[j].color[i] = rand_bits(p);
+		}
+		for (l = 0, i = 0; l < 4; ++l) {
+			popcnt = 0;
+			for (; i < nv_color_sboc_norm_e[l]; ++i) {
+				popcnt += NV_POPCNT_U64(sboc[j].color[i]);
+			}
+			sboc[j].norm[l] = popcnt == 0 ? FLT_MAX : sqrtf((float)popcnt);
+		}
+		popcnt = 0;
+		for (i = 0; i < NV_COLOR_BOC_INT_BLOCKS; ++i) {
+			boc[j].color[i] = sboc[j].color[i];
+			popcnt += NV_POPCNT_U64(boc[j].color[i]);
+		}
+		boc[j].norm = popcnt == 0 ? FLT_MAX : sqrtf((float)popcnt);
+	}
+}
+
+template <typename T, typename F> static long
+benchmark(nv_color_boc_result_t *results, F search,
+		  const T *db, int64_t n)
+{
+	long t = nv_clock();
+	int q;
+
+	for (q = 0; q < QUERY_N; ++q) {
+		search(&results[q * K], K, db, n, &db[q * 1000]);
+	}
+	return nv_clock() - t;
+}
+
+int
+main(void)
+{
+	std::vector<nv_color_sboc_t> sboc(DATA_M);
+	std::vector<nv_color_boc_t> boc(DATA_M);
+	std::vector<nv_color_boc_result_t> sboc_base(QUERY_N * K), boc_base(QUERY_N * K);
+	int k;
+
+	make_data(&sboc[0], &boc[0], DATA_M);
+
+	printf("%d records, %d queries, best kernel: %s\n", DATA_M, QUERY_N,
+		   nv_color_boc_kernel_name(nv_color_boc_kernel_best()));
+	printf("%8s %12s %12s\n", "kernel", "sboc", "boc");
+	for (k = 0; k < NV_COLOR_BOC_KERNEL_MAX; ++k) {
+		std::vector<nv_color_boc_result_t> sboc_results(QUERY_N * K), boc_results(QUERY_N * K);
+		long t_sboc, t_boc;
+		int i;
+
+		if (nv_color_boc_kernel_set((nv_color_boc_kernel_e)k) != 0) {
+			printf("%8s %12s %12s\n", nv_color_boc_kernel_name((nv_color_boc_kernel_e)k),
+				   "-", "-");
+			continue;
+		}
+		t_sboc = benchmark(&sboc_results[0], nv_color_sboc_search, &sboc[0], DATA_M);
+		t_boc = benchmark(&boc_results[0], nv_color_boc_search, &boc[0], DATA_M);
+		if (k == NV_COLOR_BOC_KERNEL_SCALAR) {
+			sboc_base = sboc_results;
+			boc_base = boc_results;
+		}
+		/* every kernel returns the same results */
+		for (i = 0; i < QUERY_N * K; ++i) {
+			NV_ASSERT(sboc_base[i].index == sboc_results[i].index);
+			NV_ASSERT(sboc_base[i].cosine == sboc_results[i].cosine);
+			NV_ASSERT(boc_base[i].index == boc_results[i].index);
+			NV_ASSERT(boc_base[i].cosine == boc_results[i].cosine);
+		}
+		printf("%8s %10ldms %10ldms\n", nv_color_boc_kernel_name((nv_color_boc_kernel_e)k),
+			   t_sboc, t_boc);
+	}
+
+	return 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nv_core.h"
+#include "nv_ml.h"
+#include "nv_io.h"
+#include "nv_lmca_hnsw.hpp"
+#include <vector>
+#include <set>
+
+/*
+ * nv_lmca_hnsw_benchmark
+ *     synthetic records
+ * nv_lmca_hnsw_benchmark lmca_vlad.mat vlad_data.matb
+ *     records of nv_lmca_train -e vlad (e.g. the ukbench images)
+ */
+
+#define DATA_M    200000
+#define CLUSTER_N 2000
+#define QUERY_N   200
+#define K         20
+
+typedef nv_lmca_ctx<NV_LMCA_FEATURE_VLAD, nv_lmca_empty_color_t> ctx_t;
+typedef nv_lmca_hnsw<NV_LMCA_FEATURE_VLAD, nv_lmca_empty_color_t> hnsw_t;
+typedef ctx_t::vector_t vector_t;
+
+static void
+normalize(float *v, int n)
+{
+	float norm = 0.0f;
+	int i;
+
+	for (i = 0; i < n; ++i) {
+		norm += v[i] * v[i];
+	}
+	norm = sqrtf(norm);
+	for (i = 0; i < n; ++i) {
+		v[i] /= norm;
+	}
+}
+
+/* records around CLUSTER_N centers, the queries are noisy records */
+static int64_t
+make_data(vector_t **db, vector_t *queries)
+{
+	std::vector<float> centers(CLUSTER_N * ctx_t::LMCA_DIM);
+	int64_t j;
+	int i;
+
+	nv_aligned_malloc((void **)db, 32, sizeof(vector_t) * DATA_M);
+	for (i = 0; i < CLUSTER_N * ctx_t::LMCA_DIM; ++i) {
+		centers[i] = nv_rand() - 0.5f;
+	}
+	for (j = 0; j < DATA_M; ++j) {
+		const float *c = &centers[(j % CLUSTER_N) * ctx_t::LMCA_DIM];
+		for (i = 0; i < ctx_t::LMCA_DIM; ++i) {
+			(*db)[j].v[i] = c[i] + (nv_rand() - 0.5f) * 0.4f;
+		}
+		normalize((*db)[j].v, ctx_t::LMCA_DIM);
+	}
+	for (j = 0; j < QUERY_N; ++j) {
+		const vector_t *r = &(*db)[j * (DATA_M / QUERY_N)];
+		for (i = 0; i < ctx_t::LMCA_DIM; ++i) {
+			queries[j].v[i] = r->v[i] + (nv_rand() - 0.5f) * 0.1f;
+		}
+		normalize(queries[j].v, ctx_t::LMCA_DIM);
+	}
+	return DATA_M;
+}
+
+/* the LMCA projections of a data file, the queries are records of it */
+static int64_t
+load_data(vector_t **db, vector_t *queries,
+		  const char *lmca_file, const char *data_file)
+{
+	nv_matrix_t *mats[2];
+	nv_matrix_t *l, *data, *data_lmca;
+	int len = 2;
+	int64_t j;
+	int i;
+
+	l = nv_load_matrix(lmca_file);
+	if (l == NULL || l->m != ctx_t::LMCA_DIM || l->n != ctx_t::RAW_DIM) {
+		fprintf(stderr, "%s: invalid lmca file\n", lmca_file);
+		return -1;
+	}
+	if (nv_load_matrix_array_bin(data_file, mats, &len) != 0 || len != 2
+		|| mats[0]->n != ctx_t::RAW_DIM || mats[0]->m < QUERY_N)
+	{
+		fprintf(stderr, "%s: invalid data file\n", data_file);
+		return -1;
+	}
+	data = mats[0];
+	data_lmca = nv_matrix_alloc(l->m, data->m);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+	for (i = 0; i < data->m; ++i) {
+		nv_lmca_projection(data_lmca, i, l, data, i);
+		nv_vector_normalize(data_lmca, i);
+	}
+	nv_aligned_malloc((void **)db, 32, sizeof(vector_t) * data->m);
+	for (j = 0; j < data->m; ++j) {
+		memcpy((*db)[j].v, &NV_MAT_V(data_lmca, j, 0), sizeof(float) * ctx_t::LMCA_DIM);
+	}
+	for (j = 0; j < QUERY_N; ++j) {
+		queries[j] = (*db)[j * (data->m / QUERY_N)];
+	}
+	j = data->m;
+	nv_matrix_free(&data_lmca);
+	nv_matrix_free(&mats[0]);
+	nv_matrix_free(&mats[1]);
+	nv_matrix_free(&l);
+
+	return j;
+}
+
+static float
+recall(const std::vector<nv_lmca_result_t> &base,
+	   const std::vector<nv_lmca_result_t> &results)
+{
+	int hit = 0;
+	int q, i;
+
+	for (q = 0; q < QUERY_N; ++q) {
+		std::set<uint64_t> truth;
+		for (i = 0; i < K; ++i) {
+			truth.insert(base[q * K + i].index);
+		}
+		for (i = 0; i < K; ++i) {
+			hit += (int)truth.count(results[q * K + i].index);
+		}
+	}
+	return (float)hit / (QUERY_N * K);
+}
+
+static inline double
+qps(long t)
+{
+	return QUERY_N * 1000.0 / (double)NV_MAX(t, 1L);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int efs[] = { 16, 32, 64, 128, 256 };
+	vector_t *db, *queries;
+	std::vector<nv_lmca_result_t> base(QUERY_N * K);
+	std::vector<int32_t> nodes, upper;
+	nv_lmca_hnsw_header_t header;
+	nv_lmca_hnsw_graph_t graph;
+	hnsw_t *hnsw = new hnsw_t;
+	int64_t ndb;
+	long t;
+	int q, i;
+
+	nv_aligned_malloc((void **)&queries, 32, sizeof(vector_t) * QUERY_N);
+	if (argc == 3) {
+		ndb = load_data(&db, queries, argv[1], argv[2]);
+	} else {
+		ndb = make_data(&db, queries);
+	}
+	if (ndb < 0) {
+		return -1;
+	}
+
+	hnsw_t::init(&header, hnsw_t::DEFAULT_M);
+	nodes.resize((size_t)(hnsw_t::node_stride(header.m) * ndb));
+	upper.resize((size_t)(hnsw_t::upper_len(0, ndb, header.m) + 1));
+	graph.header = &header;
+	graph.nodes = &nodes[0];
+	graph.upper = &upper[0];
+	t = nv_clock();
+	hnsw->add(&graph, db, ndb, hnsw_t::DEFAULT_EF_CONSTRUCTION);
+	t = nv_clock() - t;
+
+	printf("%"PRId64" records, %d queries, recall@%d against the scan\n", ndb, QUERY_N, K);
+	printf("build: %ldms, m=%d, ef_construction=%d, max_level=%d\n",
+		   t, header.m, hnsw_t::DEFAULT_EF_CONSTRUCTION, header.max_level);
+	printf("%8s %10s %10s %8s\n", "ef", "time", "qps", "recall");
+
+	t = nv_clock();
+	for (q = 0; q < QUERY_N; ++q) {
+		ctx_t::search(&base[q * K], K, db, ndb, &queries[q],
+					  ctx_t::COLOR_METHOD_LINEAR, 0.0f, 0.0f);
+	}
+	t = nv_clock() - t;
+	printf("%8s %8ldms %10.1f %8.4f\n", "scan", t, qps(t), 1.0f);
+
+	for (i = 0; i < (int)(sizeof(efs) / sizeof(efs[0])); ++i) {
+		std::vector<nv_lmca_result_t> results(QUERY_N * K);
+
+		t = nv_clock();
+		for (q = 0; q < QUERY_N; ++q) {
+			hnsw->search(&results[q * K], K, db, ndb, &graph, &queries[q],
+						 ctx_t::COLOR_METHOD_LINEAR, 0.0f, 0.0f, NULL, efs[i]);
+		}
+		t = nv_clock() - t;
+		printf("%8d %8ldms %10.1f %8.4f\n", efs[i], t, qps(t), recall(base, results));
+	}
+
+	delete hnsw;
+	nv_aligned_free(queries);
+	nv_aligned_free(db);
+
+	return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nv_core.h"
+#include "nv_lmca_quant.hpp"
+#include <vector>
+#include <set>
+
+#define DATA_M    200000
+#define CLUSTER_N 2000
+#define QUERY_N   100
+#define K         20
+
+typedef nv_lmca_ctx<NV_LMCA_FEATURE_VLAD, nv_lmca_empty_color_t> ctx_t;
+typedef ctx_t::vector_t vector_t;
+
+static void
+normalize(float *v, int n)
+{
+	float norm = 0.0f;
+	int i;
+
+	for (i = 0; i < n; ++i) {
+		norm += v[i] * v[i];
+	}
+	norm = sqrtf(norm);
+	for (i = 0; i < n; ++i) {
+		v[i] /= norm;
+	}
+}
+
+/* records around CLUSTER_N centers, the queries are noisy records */
+static void
+make_data(vector_t *db, vector_t *queries)
+{
+	std::vector<float> centers(CLUSTER_N * ctx_t::LMCA_DIM);
+	int64_t j;
+	int i;
+
+	for (i = 0; i < CLUSTER_N * ctx_t::LMCA_DIM; ++i) {
+		centers[i] = nv_rand() - 0.5f;
+	}
+	for (j = 0; j < DATA_M; ++j) {
+		const float *c = &centers[(j % CLUSTER_N) * ctx_t::LMCA_DIM];
+		for (i = 0; i < ctx_t::LMCA_DIM; ++i) {
+			db[j].v[i] = c[i] + (nv_rand() - 0.5f) * 0.4f;
+		}
+		normalize(db[j].v, ctx_t::LMCA_DIM);
+	}
+	for (j = 0; j < QUERY_N; ++j) {
+		const vector_t *r = &db[j * (DATA_M / QUERY_N)];
+		for (i = 0; i < ctx_t::LMCA_DIM; ++i) {
+			queries[j].v[i] = r->v[i] + (nv_rand() - 0.5f) * 0.1f;
+		}
+		normalize(queries[j].v, ctx_t::LMCA_DIM);
+	}
+}
+
+static float
+recall(const std::vector<nv_lmca_result_t> &base,
+	   const std::vector<nv_lmca_result_t> &results)
+{
+	int hit = 0;
+	int q, i;
+
+	for (q = 0; q < QUERY_N; ++q) {
+		std::set<uint64_t> truth;
+		for (i = 0; i < K; ++i) {
+			truth.insert(base[q * K + i].index);
+		}
+		for (i = 0; i < K; ++i) {
+			hit += (int)truth.count(results[q * K + i].index);
+		}
+	}
+	return (float)hit / (QUERY_N * K);
+}
+
+template <nv_lmca_quant_e Q>
+static void
+benchmark(const char *name,
+		  const vector_t *db, const vector_t *queries,
+		  const std::vector<nv_lmca_result_t> &base)
+{
+	typedef nv_lmca_quant<NV_LMCA_FEATURE_VLAD, nv_lmca_empty_color_t, Q> quant_t;
+	static const int rerank_scales[] = { 0, 2, 4, 8 };
+	typename quant_t::row_t *rows;
+	quant_t quant;
+	int64_t j;
+	int i;
+
+	nv_aligned_malloc((void **)&rows, 32, sizeof(typename quant_t::row_t) * DATA_M);
+	for (i = 0; i < ctx_t::LMCA_DIM; ++i) {
+		float max_abs = 0.0f;
+		for (j = 0; j < DATA_M; ++j) {
+			max_abs = NV_MAX(max_abs, fabsf(db[j].v[i]));
+		}
+		quant.set_scale(i, max_abs);
+	}
+	for (j = 0; j < DATA_M; ++j) {
+		quant.quantize(&rows[j], &db[j]);
+	}
+	for (i = 0; i < (int)(sizeof(rerank_scales) / sizeof(rerank_scales[0])); ++i) {
+		std::vector<nv_lmca_result_t> results(QUERY_N * K);
+		long t = nv_clock();
+		int q;
+
+		for (q = 0; q < QUERY_N; ++q) {
+			quant.search(&results[q * K], K, rows, db, DATA_M, &queries[q],
+						 ctx_t::COLOR_METHOD_LINEAR, 0.0f, 0.0f, NULL,
+						 K * rerank_scales[i]);
+		}
+		t = nv_clock() - t;
+		printf("%8s %8d %8zdB %10ldms %8.4f\n", name, rerank_scales[i],
+			   sizeof(typename quant_t::row_t), t, recall(base, results));
+	}
+	nv_aligned_free(rows);
+}
+
+int
+main(void)
+{
+	vector_t *db, *queries;
+	std::vector<nv_lmca_result_t> base(QUERY_N * K);
+	long t_base;
+	int q;
+
+	nv_aligned_malloc((void **)&db, 32, sizeof(vector_t) * DATA_M);
+	nv_aligned_malloc((void **)&queries, 32, sizeof(vector_t) * QUERY_N);
+	make_data(db, queries);
+
+	printf("%d records, %d queries, recall@%d against the float scan\n", DATA_M, QUERY_N, K);
+	printf("%8s %8s %9s %12s %8s\n", "rows", "rerank", "row size", "time", "recall");
+
+	t_base = nv_clock();
+	for (q = 0; q < QUERY_N; ++q) {
+		ctx_t::search(&base[q * K], K, db, DATA_M, &queries[q],
+					  ctx_t::COLOR_METHOD_LINEAR, 0.0f, 0.0f);
+	}
+	t_base = nv_clock() - t_base;
+	printf("%8s %8s %8zdB %10ldms %8.4f\n", "float", "-", sizeof(vector_t), t_base, 1.0f);
+
+	benchmark<NV_LMCA_QUANT_INT8>("int8", db, queries, base);
+	benchmark<NV_LMCA_QUANT_FP16>("fp16", db, queries, base);
+
+	nv_aligned_free(queries);
+	nv_aligned_free(db);
+
+	return 0;
+}
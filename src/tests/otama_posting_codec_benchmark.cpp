@@ -0,0 +1,182 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nv_core.h"
+#include "nv_bovw.hpp"
+#include "otama_posting_codec.hpp"
+#include <vector>
+#include <string>
+
+/*
+ * otama_posting_codec_benchmark
+ *     synthetic postings
+ * otama_posting_codec_benchmark image_list.txt
+ *     the postings of the bovw512k words of the images (e.g. ukbench),
+ *     the same lists as the id driver
+ */
+
+#define DATA_M   50000
+#define WORD_MIN 100
+#define WORD_MAX 500
+#define REPEAT   10
+
+using namespace otama;
+
+typedef nv_bovw_ctx<NV_BOVW_BIT512K, nv_bovw_dummy_color_t> bovw_t;
+typedef std::vector<std::vector<int64_t> > postings_t;
+
+/* the words of a record are drawn from a Zipf-like distribution */
+static void
+make_postings(postings_t &postings)
+{
+	const float log_v = logf((float)NV_BOVW_BIT512K);
+	int64_t no;
+	int i;
+
+	postings.resize(NV_BOVW_BIT512K);
+	for (no = 1; no <= DATA_M; ++no) {
+		const int n = WORD_MIN + (int)(nv_rand() * (WORD_MAX - WORD_MIN));
+		for (i = 0; i < n; ++i) {
+			const uint32_t w = (uint32_t)expf(nv_rand() * log_v) - 1;
+			std::vector<int64_t> &nos = postings[NV_MIN(w, (uint32_t)NV_BOVW_BIT512K - 1)];
+			if (nos.empty() || nos.back() != no) {
+				nos.push_back(no);
+			}
+		}
+	}
+}
+
+static int
+load_postings(postings_t &postings, const char *list_file)
+{
+	std::vector<std::string> files;
+	std::vector<bovw_t::sparse_t> vecs;
+	bovw_t ctx;
+	char line[8192];
+	FILE *fp;
+	int i;
+
+	if ((fp = fopen(list_file, "r")) == NULL) {
+		fprintf(stderr, "%s: cannot open\n", list_file);
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		size_t len = strlen(line);
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+			line[--len] = '\0';
+		}
+		if (len > 0) {
+			files.push_back(line);
+		}
+	}
+	fclose(fp);
+	if (ctx.open() != 0) {
+		fprintf(stderr, "bovw512k: cannot open\n");
+		return -1;
+	}
+	vecs.resize(files.size());
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+	for (i = 0; i < (int)files.size(); ++i) {
+		if (ctx.extract(vecs[i], files[i].c_str()) != 0) {
+			fprintf(stderr, "%s: cannot extract\n", files[i].c_str());
+		}
+	}
+	// the nos of the records start at 1
+	postings.resize(NV_BOVW_BIT512K);
+	for (i = 0; i < (int)vecs.size(); ++i) {
+		bovw_t::sparse_t::const_iterator w;
+		for (w = vecs[i].begin(); w != vecs[i].end(); ++w) {
+			postings[*w].push_back(i + 1);
+		}
+	}
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	postings_t postings;
+	std::vector<std::vector<uint8_t> > encoded(NV_BOVW_BIT512K);
+	std::vector<int64_t> nos;
+	int64_t total = 0, base_len = 0;
+	size_t w;
+	int c, k;
+
+	if (argc == 2) {
+		if (load_postings(postings, argv[1]) != 0) {
+			return -1;
+		}
+	} else {
+		make_postings(postings);
+	}
+	for (w = 0; w < postings.size(); ++w) {
+		total += (int64_t)postings[w].size();
+	}
+	printf("%"PRId64" postings, decode %d times\n", total, REPEAT);
+	printf("%14s %8s %12s %8s %10s %12s\n",
+		   "codec", "kernel", "bytes", "ratio", "time", "Mnos/s");
+
+	for (c = 0; c < POSTING_CODEC_MAX; ++c) {
+		const posting_codec_e codec = (posting_codec_e)c;
+		int64_t len = 0;
+
+		for (w = 0; w < postings.size(); ++w) {
+			int64_t last_no = 0;
+			encoded[w].clear();
+			if (!postings[w].empty()) {
+				PostingCodec::encode(codec, &postings[w][0], postings[w].size(),
+									 last_no, encoded[w]);
+			}
+			len += (int64_t)encoded[w].size();
+		}
+		if (codec == POSTING_CODEC_VBYTE) {
+			base_len = len;
+		}
+		for (k = 0; k < PostingCodec::KERNEL_MAX; ++k) {
+			long t;
+			int r;
+
+			// the kernel is of stream_vbyte
+			if ((k != PostingCodec::KERNEL_SCALAR && codec != POSTING_CODEC_STREAM_VBYTE)
+				|| !PostingCodec::kernel_set((PostingCodec::kernel_e)k))
+			{
+				continue;
+			}
+			t = nv_clock();
+			for (r = 0; r < REPEAT; ++r) {
+				for (w = 0; w < postings.size(); ++w) {
+					int64_t last_no = 0;
+					nos.clear();
+					PostingCodec::decode(codec, encoded[w].empty() ? NULL : &encoded[w][0],
+										 encoded[w].size(), last_no, nos);
+				}
+			}
+			t = nv_clock() - t;
+			printf("%14s %8s %12"PRId64" %8.3f %8ldms %12.1f\n",
+				   PostingCodec::name(codec),
+				   k == PostingCodec::KERNEL_SCALAR ? "scalar" : "ssse3",
+				   len, (double)len / base_len, t,
+				   (double)total * REPEAT / 1000.0 / NV_MAX(t, 1L));
+		}
+	}
+
+	return 0;
+}
@@ -69,24 +69,47 @@ int main(void)
 #endif
 	otama_test_variant();
 #if !OTAMA_MSVC
+	otama_test_topk();
+	otama_test_fixed_strage();
+	otama_test_accumulator();
+	otama_test_posting_codec();
+	otama_test_bucket();
 	otama_test_dbi();
 	otama_test_vlad();
+	otama_test_lmca();
 	otama_test_bovw();
 #endif
 #if OTAMA_WITH_SQLITE3
 	otama_test_api(OTAMA_TEST_CONFIG_DIR "/sim.yaml");
 	otama_test_api(OTAMA_TEST_CONFIG_DIR "/id.yaml");
+	otama_test_api(OTAMA_TEST_CONFIG_DIR "/id_bp128.yaml");
 	otama_test_api(OTAMA_TEST_CONFIG_DIR "/color.yaml");
 	otama_test_api(OTAMA_TEST_CONFIG_DIR "/bovw2k.yaml");
 	otama_test_api(OTAMA_TEST_CONFIG_DIR "/bovw2k_sboc.yaml");	
 	otama_test_api(OTAMA_TEST_CONFIG_DIR "/bovw8k.yaml");
+	otama_test_api(OTAMA_TEST_CONFIG_DIR "/bovw8k_columnar.yaml");
+	otama_test_api(OTAMA_TEST_CONFIG_DIR "/bovw8k_norm_pruning.yaml");
+	otama_test_api(OTAMA_TEST_CONFIG_DIR "/bovw8k_numa.yaml");
+	otama_test_api(OTAMA_TEST_CONFIG_DIR "/bovw8k_idf_planes.yaml");
 	otama_test_api(OTAMA_TEST_CONFIG_DIR "/bovw512k_iv.yaml");
+	otama_test_api(OTAMA_TEST_CONFIG_DIR "/bovw512k_iv_snapshot.yaml");
+	otama_test_api(OTAMA_TEST_CONFIG_DIR "/bovw512k_vsplit3_iv.yaml");
+	otama_test_api(OTAMA_TEST_CONFIG_DIR "/bovw512k_packed.yaml");
+	otama_test_api(OTAMA_TEST_CONFIG_DIR "/bovw512k_cascade.yaml");
 	otama_test_api(OTAMA_TEST_CONFIG_DIR "/sboc.yaml");
+	otama_test_api(OTAMA_TEST_CONFIG_DIR "/sboc_norm_pruning.yaml");
 	otama_test_api(OTAMA_TEST_CONFIG_DIR "/lmca_vlad.yaml");
 	otama_test_api(OTAMA_TEST_CONFIG_DIR "/lmca_hsv.yaml");
 	otama_test_api(OTAMA_TEST_CONFIG_DIR "/lmca_vladhsv.yaml");
 	otama_test_api(OTAMA_TEST_CONFIG_DIR "/lmca_vlad_hsv.yaml");
 	otama_test_api(OTAMA_TEST_CONFIG_DIR "/lmca_vlad_colorcode.yaml");
+	otama_test_api(OTAMA_TEST_CONFIG_DIR "/lmca_vlad_int8.yaml");
+	otama_test_api(OTAMA_TEST_CONFIG_DIR "/lmca_vlad_hsv_fp16.yaml");
+	otama_test_api(OTAMA_TEST_CONFIG_DIR "/lmca_vlad_hnsw.yaml");
+#if !OTAMA_MSVC
+	otama_test_lmca_ivf_centroids("./data/lmca_vlad_ivf.mat");
+	otama_test_api(OTAMA_TEST_CONFIG_DIR "/lmca_vlad_ivf.yaml");
+#endif
 #endif
 #if (OTAMA_WITH_LEVELDB && OTAMA_WITH_SQLITE3)
 	otama_test_api(OTAMA_TEST_CONFIG_DIR "/bovw512k_iv_ldb.yaml");
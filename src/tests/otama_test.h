@@ -40,6 +40,13 @@ void otama_test_cluster(const char *config1, const char *config2);
 void otama_test_dbi(void);
 void otama_test_variant(void);
 void otama_test_kvs(void);
+void otama_test_topk(void);
+void otama_test_lmca(void);
+void otama_test_lmca_ivf_centroids(const char *file);
+void otama_test_fixed_strage(void);
+void otama_test_accumulator(void);
+void otama_test_posting_codec(void);
+void otama_test_bucket(void);
 
 #ifdef __cplusplus
 }
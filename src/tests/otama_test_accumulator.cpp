@@ -0,0 +1,196 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2013 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#undef NDEBUG
+
+#include "otama_test.h"
+#include "nv_core.h"
+#include "otama_inverted_index_accumulator.hpp"
+#include <vector>
+#include <algorithm>
+
+typedef otama::InvertedIndexAccumulator accumulator_t;
+
+typedef struct {
+	int64_t no;
+	size_t term;
+} accumulator_test_posting_t;
+
+static bool
+accumulator_test_posting_less(const accumulator_test_posting_t &a,
+							  const accumulator_test_posting_t &b)
+{
+	return a.no < b.no;
+}
+
+static bool
+accumulator_test_hit_less(const accumulator_t::hit_t &a,
+						  const accumulator_t::hit_t &b)
+{
+	return a.no < b.no;
+}
+
+/*
+ * sorts every posting by no and sums the runs.
+ * a stable sort keeps the terms of a no in order, so the sums are added
+ * in the order of accumulate() and must be the same floats.
+ */
+static void
+accumulator_test_reference(const std::vector<accumulator_t::posting_t> &postings,
+						   const std::vector<float> &weights,
+						   int hit_threshold,
+						   std::vector<accumulator_t::hit_t> &hits)
+{
+	std::vector<accumulator_test_posting_t> all;
+	size_t t, i, j;
+
+	for (t = 0; t < postings.size(); ++t) {
+		for (i = 0; i < postings[t].size(); ++i) {
+			accumulator_test_posting_t p;
+			p.no = postings[t][i];
+			p.term = t;
+			all.push_back(p);
+		}
+	}
+	std::stable_sort(all.begin(), all.end(), accumulator_test_posting_less);
+	hits.clear();
+	for (i = 0; i < all.size(); i = j) {
+		accumulator_t::hit_t hit;
+		int count = 0;
+
+		hit.no = all[i].no;
+		hit.w = 0.0f;
+		for (j = i; j < all.size() && all[j].no == all[i].no; ++j) {
+			hit.w += weights[all[j].term];
+			++count;
+		}
+		if (count > hit_threshold) {
+			hits.push_back(hit);
+		}
+	}
+}
+
+static void
+accumulator_test_check(const std::vector<accumulator_t::posting_t> &postings,
+					   const std::vector<float> &weights)
+{
+	static const int hit_thresholds[] = { 0, 1, 3 };
+	std::vector<accumulator_t::hit_t> hits, expected;
+	size_t h, i;
+
+	for (h = 0; h < sizeof(hit_thresholds) / sizeof(hit_thresholds[0]); ++h) {
+		accumulator_t::accumulate(postings, weights, hit_thresholds[h], hits);
+		accumulator_test_reference(postings, weights, hit_thresholds[h], expected);
+		std::sort(hits.begin(), hits.end(), accumulator_test_hit_less);
+		NV_ASSERT(hits.size() == expected.size());
+		for (i = 0; i < hits.size(); ++i) {
+			NV_ASSERT(hits[i].no == expected[i].no);
+			NV_ASSERT(hits[i].w == expected[i].w);
+		}
+	}
+}
+
+/* each term takes a no of pool with probability 1/2 */
+static void
+accumulator_test_postings(std::vector<accumulator_t::posting_t> &postings,
+						  std::vector<float> &weights,
+						  const std::vector<int64_t> &pool,
+						  int nterms)
+{
+	int t;
+	size_t i;
+
+	postings.assign(nterms, accumulator_t::posting_t());
+	weights.resize(nterms);
+	for (t = 0; t < nterms; ++t) {
+		for (i = 0; i < pool.size(); ++i) {
+			if (nv_rand() < 0.5f) {
+				postings[t].push_back(pool[i]);
+			}
+		}
+		weights[t] = nv_rand() + 0.1f;
+	}
+}
+
+/* every no of [first, first + len) */
+static void
+otama_test_accumulator_dense(void)
+{
+	std::vector<accumulator_t::posting_t> postings;
+	std::vector<float> weights;
+	std::vector<int64_t> pool;
+	int64_t no;
+
+	OTAMA_TEST_NAME;
+
+	for (no = 100; no < 100 + 5000; ++no) {
+		pool.push_back(no);
+	}
+	accumulator_test_postings(postings, weights, pool, 10);
+	accumulator_test_check(postings, weights);
+}
+
+/*
+ * gaps of 9 to 4096 between the nos, a block is longer than
+ * DENSE_RATIO * its postings, so accumulate_hash() sums it.
+ */
+static void
+otama_test_accumulator_sparse(void)
+{
+	std::vector<accumulator_t::posting_t> postings;
+	std::vector<float> weights;
+	std::vector<int64_t> pool;
+	int64_t no = 7;
+	int i;
+
+	OTAMA_TEST_NAME;
+
+	for (i = 0; i < 5000; ++i) {
+		pool.push_back(no);
+		no += 9 + nv_rand_index(4096);
+	}
+	accumulator_test_postings(postings, weights, pool, 6);
+	accumulator_test_check(postings, weights);
+
+	/* a dense head and a sparse tail, both paths in one query */
+	pool.clear();
+	for (no = 0; no < 2000; ++no) {
+		pool.push_back(no);
+	}
+	for (i = 0; i < 2000; ++i) {
+		no += 9 + nv_rand_index(4096);
+		pool.push_back(no);
+	}
+	accumulator_test_postings(postings, weights, pool, 6);
+	accumulator_test_check(postings, weights);
+
+	/* empty postings */
+	postings[0].clear();
+	postings[3].clear();
+	accumulator_test_check(postings, weights);
+	postings.assign(postings.size(), accumulator_t::posting_t());
+	accumulator_test_check(postings, weights);
+}
+
+void
+otama_test_accumulator(void)
+{
+	otama_test_accumulator_dense();
+	otama_test_accumulator_sparse();
+}
@@ -163,6 +163,93 @@ test_vacuum_index(const char *config)
 	otama_close(&otama);
 }
 
+static void
+test_remove_vacuum_index(const char *config)
+{
+	otama_id_t id1, id2;
+	otama_t *otama;
+	otama_result_t *results;
+	otama_status_t ret;
+	otama_variant_pool_t *pool;
+	otama_variant_t *value;
+	int64_t blob_bytes = -1;
+	
+	OTAMA_TEST_NAME;
+	drop_create(config);
+	
+	pool = otama_variant_pool_alloc();
+	value = otama_variant_new(pool);
+	NV_ASSERT(otama_open(&otama, config) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_insert_file(otama, &id1, OTAMA_TEST_IMG) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_insert_file(otama, &id2, OTAMA_TEST_IMG_NEGA) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_remove(otama, &id1) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_pull(otama) == OTAMA_STATUS_OK);
+	/* packed drivers only */
+	if (otama_get(otama, "blob_bytes", value) == OTAMA_STATUS_OK) {
+		blob_bytes = otama_variant_to_int(value);
+	}
+	ret = otama_vacuum_index(otama);
+	NV_ASSERT(ret == OTAMA_STATUS_OK || ret == OTAMA_STATUS_NOT_IMPLEMENTED);
+	if (ret == OTAMA_STATUS_OK && blob_bytes > 0) {
+		/* the record of id1 is removed from the blob */
+		NV_ASSERT(otama_get(otama, "blob_bytes", value) == OTAMA_STATUS_OK);
+		NV_ASSERT(otama_variant_to_int(value) < blob_bytes);
+	}
+	otama_variant_pool_free(&pool);
+	
+	NV_ASSERT(otama_search_file(otama, &results, 10, OTAMA_TEST_IMG_NEGA) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_result_count(results) == 1);
+	NV_ASSERT(memcmp(otama_result_id(results, 0), &id2, sizeof(id2)) == 0);
+	otama_result_free(&results);
+	
+	/* insert again after vacuum, the fixed drivers restore the record at the next vacuum */
+	NV_ASSERT(otama_insert_file(otama, &id1, OTAMA_TEST_IMG) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_pull(otama) == OTAMA_STATUS_OK);
+	ret = otama_vacuum_index(otama);
+	NV_ASSERT(ret == OTAMA_STATUS_OK || ret == OTAMA_STATUS_NOT_IMPLEMENTED);
+	NV_ASSERT(otama_search_file(otama, &results, 10, OTAMA_TEST_IMG) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_result_count(results) == 2);
+	NV_ASSERT(memcmp(otama_result_id(results, 0), &id1, sizeof(id1)) == 0);
+	otama_result_free(&results);
+	
+	otama_close(&otama);
+}
+
+static void
+test_mmap_advice(const char *config)
+{
+	otama_t *otama;
+	otama_id_t id;
+	otama_variant_pool_t *pool;
+	otama_variant_t *opt, *driver, *value;
+	otama_result_t *results;
+	
+	OTAMA_TEST_NAME;
+	drop_create(config);
+	
+	pool = otama_variant_pool_alloc();
+	opt = otama_yaml_read_file(config, pool);
+	NV_ASSERT(opt != NULL);
+	driver = otama_variant_hash_at(opt, "driver");
+	otama_variant_set_int(otama_variant_hash_at(driver, "mmap_populate"), 1);
+	otama_variant_set_int(otama_variant_hash_at(driver, "mmap_willneed"), 1);
+	otama_variant_set_int(otama_variant_hash_at(driver, "mmap_warmup"), 1);
+	
+	NV_ASSERT(otama_open_opt(&otama, opt) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_insert_file(otama, &id, OTAMA_TEST_IMG) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_pull(otama) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_search_file(otama, &results, 10, OTAMA_TEST_IMG) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_result_count(results) == 1);
+	otama_result_free(&results);
+	
+	/* fixed drivers only. not implemented when the platform can not tell */
+	value = otama_variant_new(pool);
+	if (otama_get(otama, "resident_bytes", value) == OTAMA_STATUS_OK) {
+		NV_ASSERT(otama_variant_to_int(value) >= 0);
+	}
+	otama_close(&otama);
+	otama_variant_pool_free(&pool);
+}
 
 static void
 test_white(const char *config)
@@ -447,6 +534,105 @@ test_id_insert_search_remove_search(const char *config)
 	otama_close(&otama);
 }
 
+static void
+test_search_batch(const char *config)
+{
+	static const char *files[2] = { OTAMA_TEST_IMG, OTAMA_TEST_IMG_NEGA };
+	otama_id_t id1, id2;
+	otama_t *otama;
+	otama_result_t *results;
+	otama_result_t *batch_results[2];
+	otama_variant_pool_t *pool;
+	otama_variant_t *queries[2];
+	int i, j;
+	
+	OTAMA_TEST_NAME;
+	drop_create(config);
+	
+	NV_ASSERT(otama_open(&otama, config) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_insert_file(otama, &id1, OTAMA_TEST_IMG) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_insert_file(otama, &id2, OTAMA_TEST_IMG_NEGA) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_pull(otama) == OTAMA_STATUS_OK);
+	
+	pool = otama_variant_pool_alloc();
+	for (i = 0; i < 2; ++i) {
+		queries[i] = otama_variant_new(pool);
+		otama_variant_set_hash(queries[i]);
+		otama_variant_set_string(otama_variant_hash_at(queries[i], "file"), files[i]);
+	}
+	NV_ASSERT(otama_search_batch(otama, batch_results, 10, queries, 2) == OTAMA_STATUS_OK);
+	for (i = 0; i < 2; ++i) {
+		NV_ASSERT(otama_search_file(otama, &results, 10, files[i]) == OTAMA_STATUS_OK);
+		NV_ASSERT(otama_result_count(batch_results[i]) == otama_result_count(results));
+		for (j = 0; j < otama_result_count(results); ++j) {
+			NV_ASSERT(memcmp(otama_result_id(batch_results[i], j),
+							 otama_result_id(results, j), sizeof(otama_id_t)) == 0);
+		}
+		otama_result_free(&results);
+		otama_result_free(&batch_results[i]);
+	}
+	
+	NV_ASSERT(otama_remove(otama, &id1) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_pull(otama) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_search_batch(otama, batch_results, 10, queries, 2) == OTAMA_STATUS_OK);
+	for (i = 0; i < 2; ++i) {
+		NV_ASSERT(otama_result_count(batch_results[i]) == 1);
+		NV_ASSERT(memcmp(otama_result_id(batch_results[i], 0), &id2, sizeof(id2)) == 0);
+		otama_result_free(&batch_results[i]);
+	}
+	otama_variant_pool_free(&pool);
+	
+	otama_close(&otama);
+}
+
+static void
+test_remove_search_n(const char *config)
+{
+	static const char *files[5] = {
+		OTAMA_TEST_IMG, OTAMA_TEST_IMG_NEGA, OTAMA_TEST_IMG_ROTATE,
+		OTAMA_TEST_IMG_SCALE, OTAMA_TEST_IMG_AFFINE
+	};
+	otama_id_t ids[5];
+	otama_t *otama;
+	otama_result_t *results;
+	int i, n, live;
+	
+	OTAMA_TEST_NAME;
+	drop_create(config);
+	
+	NV_ASSERT(otama_open(&otama, config) == OTAMA_STATUS_OK);
+	for (i = 0; i < 5; ++i) {
+		NV_ASSERT(otama_insert_file(otama, &ids[i], files[i]) == OTAMA_STATUS_OK);
+	}
+	NV_ASSERT(otama_pull(otama) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_search_file(otama, &results, 5, OTAMA_TEST_IMG) == OTAMA_STATUS_OK);
+	/* the hits that are not removed below */
+	live = 0;
+	for (i = 0; i < otama_result_count(results); ++i) {
+		if (memcmp(otama_result_id(results, i), &ids[0], sizeof(otama_id_t)) != 0
+			&& memcmp(otama_result_id(results, i), &ids[3], sizeof(otama_id_t)) != 0)
+		{
+			++live;
+		}
+	}
+	otama_result_free(&results);
+	
+	/* deleted records must not take the place of live records */
+	NV_ASSERT(otama_remove(otama, &ids[0]) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_remove(otama, &ids[3]) == OTAMA_STATUS_OK);
+	NV_ASSERT(otama_pull(otama) == OTAMA_STATUS_OK);
+	for (n = 2; n <= 5; n += 3) {
+		NV_ASSERT(otama_search_file(otama, &results, n, OTAMA_TEST_IMG) == OTAMA_STATUS_OK);
+		NV_ASSERT(otama_result_count(results) == NV_MIN(n, live));
+		for (i = 0; i < otama_result_count(results); ++i) {
+			NV_ASSERT(memcmp(otama_result_id(results, i), &ids[0], sizeof(otama_id_t)) != 0);
+			NV_ASSERT(memcmp(otama_result_id(results, i), &ids[3], sizeof(otama_id_t)) != 0);
+		}
+		otama_result_free(&results);
+	}
+	
+	otama_close(&otama);
+}
 
 void
 otama_test_api(const char *config)
@@ -461,10 +647,14 @@ otama_test_api(const char *config)
 	test_insert_pull(config);
 	test_drop_index(config);
 	test_vacuum_index(config);
+	test_remove_vacuum_index(config);
 	test_file_insert_search_remove_search(config);
 	test_error(config);
 	test_data_insert_search_remove_search(config);
 	test_string_insert_search_remove_search(config);
 	test_id_insert_search_remove_search(config);
 	test_raw_insert_search_remove_search(config);
+	test_search_batch(config);
+	test_remove_search_n(config);
+	test_mmap_advice(config);
 }
@@ -22,6 +22,7 @@
 #include "otama_test.h"
 #include "nv_core.h"
 #include "nv_bovw.hpp"
+#include "nv_bovw_popcnt.h"
 #include <vector>
 #include <algorithm>
 
@@ -149,6 +150,21 @@ otama_test_bovw_tpl(void)
 	NV_ASSERT(OTAMA_TEST_EQ0(
 				  ctx->similarity(&bovw1, &bovw2, NV_BOVW_RERANK_IDF, 0.0f) -
 				  svec_similarity<T>(svec1, svec2)));
+	{
+		nv_matrix_t *idf1 = nv_matrix_alloc(T::BIT, 1);
+		nv_matrix_t *idf2 = nv_matrix_alloc(T::BIT, 1);
+		
+		ctx->tfidf(idf1, 0, &bovw1);
+		ctx->tfidf(idf2, 0, &bovw2);
+		printf("%f == %f\n",
+			   ctx->similarity(&bovw1, &bovw2, NV_BOVW_RERANK_IDF, 0.0f),
+			   nv_vector_dot(idf1, 0, idf2, 0));
+		NV_ASSERT(OTAMA_TEST_EQ0(
+					  ctx->similarity(&bovw1, &bovw2, NV_BOVW_RERANK_IDF, 0.0f) -
+					  nv_vector_dot(idf1, 0, idf2, 0)));
+		nv_matrix_free(&idf1);
+		nv_matrix_free(&idf2);
+	}
 
 	delete ctx;
 }
@@ -251,11 +267,653 @@ otama_test_bovw_svec_tpl(void)
 	delete ctx;
 }
 
+static void
+otama_test_bovw_popcnt(void)
+{
+	static const int ns[] = {
+		1, 3, 4, 7, 8, 15, 16, 17, 63, 64, 65,
+		NV_BOVW_BIT2K / 64, NV_BOVW_BIT8K / 64, NV_BOVW_BIT512K / 64
+	};
+	const int len = NV_BOVW_BIT512K / 64 + 8;
+	nv_bovw_and_popcnt_t scalar = nv_bovw_and_popcnt_kernel(NV_BOVW_POPCNT_SCALAR);
+	uint64_t *a = nv_alloc_type(uint64_t, len);
+	uint64_t *b = nv_alloc_type(uint64_t, len);
+	int i, j, k, offset;
+	
+	OTAMA_TEST_NAME;
+	
+	for (i = 0; i < len; ++i) {
+		a[i] = ((uint64_t)nv_rand_index(0x7fffffff) << 33) ^ (uint64_t)nv_rand_index(0x7fffffff);
+		b[i] = ((uint64_t)nv_rand_index(0x7fffffff) << 33) ^ (uint64_t)nv_rand_index(0x7fffffff);
+	}
+	a[0] = b[0] = ~0ULL;
+	
+	NV_ASSERT(scalar != NULL);
+	NV_ASSERT(nv_bovw_and_popcnt_kernel(nv_bovw_popcnt_best_kernel()) != NULL);
+	printf("best kernel: %s\n", nv_bovw_popcnt_kernel_name(nv_bovw_popcnt_best_kernel()));
+	
+	for (k = 0; k < NV_BOVW_POPCNT_KERNEL_MAX; ++k) {
+		nv_bovw_and_popcnt_t func = nv_bovw_and_popcnt_kernel((nv_bovw_popcnt_kernel_e)k);
+		if (func == NULL) {
+			printf("%s: skip\n", nv_bovw_popcnt_kernel_name((nv_bovw_popcnt_kernel_e)k));
+			continue;
+		}
+		for (j = 0; j < (int)(sizeof(ns) / sizeof(ns[0])); ++j) {
+			for (offset = 0; offset < 3; ++offset) {
+				NV_ASSERT(func(a + offset, b + offset, ns[j])
+						  == scalar(a + offset, b + offset, ns[j]));
+			}
+		}
+	}
+	NV_ASSERT(nv_bovw_and_popcnt(a, b, NV_BOVW_BIT8K / 64)
+			  == scalar(a, b, NV_BOVW_BIT8K / 64));
+	
+	nv_free(a);
+	nv_free(b);
+}
+
+static uint64_t
+otama_test_rand_bits(int density)
+{
+	uint64_t v = 0;
+	int i;
+	
+	for (i = 0; i < 64; ++i) {
+		if (nv_rand_index(100) < density) {
+			v |= (1ULL << i);
+		}
+	}
+	return v;
+}
+
+template<typename T>
+static void
+otama_test_bovw_norm_pruning_tpl(void)
+{
+	static const float color_weights[] = { 0.0f, 0.2f };
+	const int64_t ndb = T::NORM_BLOCK_SIZE * 5 + 123;
+	const int k = 10;
+	typename T::dense_t *db;
+	typename T::norm_index_t norm_index;
+	nv_bovw_result_t *results1 = nv_alloc_type(nv_bovw_result_t, k);
+	nv_bovw_result_t *results2 = nv_alloc_type(nv_bovw_result_t, k);
+	T *ctx = new T;
+	int64_t i;
+	int j, q, c;
+	
+	nv_aligned_malloc((void **)&db, 16, sizeof(typename T::dense_t) * ndb);
+	memset(db, 0, sizeof(typename T::dense_t) * ndb);
+	for (i = 0; i < ndb; ++i) {
+		int density = nv_rand_index(20);
+		uint64_t popcnt = 0;
+		char *s;
+		for (j = 0; j < T::INT_BLOCKS; ++j) {
+			db[i].bovw[j] = otama_test_rand_bits(density);
+			popcnt += NV_POPCNT_U64(db[i].bovw[j]);
+		}
+		db[i].norm = popcnt == 0 ? FLT_MAX : sqrtf((float)popcnt);
+		for (j = 0; j < NV_COLOR_SBOC_INT_BLOCKS; ++j) {
+			db[i].boc.color[j] = otama_test_rand_bits(density);
+		}
+		s = nv_color_sboc_serialize(&db[i].boc);
+		NV_ASSERT(nv_color_sboc_deserialize(&db[i].boc, s) == 0);
+		nv_free(s);
+	}
+	/* incremental */
+	T::norm_index_update(norm_index, db, ndb / 2);
+	T::norm_index_update(norm_index, db, ndb);
+	NV_ASSERT((int64_t)norm_index.order.size() == ndb);
+	for (i = 1; i < ndb; ++i) {
+		NV_ASSERT(db[norm_index.order[i - 1]].norm <= db[norm_index.order[i]].norm);
+	}
+	
+	for (c = 0; c < (int)(sizeof(color_weights) / sizeof(color_weights[0])); ++c) {
+		for (q = 0; q < 10; ++q) {
+			const typename T::dense_t *query = &db[nv_rand_index((int)ndb)];
+			int n1 = ctx->search(results1, k, db, ndb, query,
+								 NV_BOVW_RERANK_NONE, color_weights[c]);
+			int n2 = ctx->search(results2, k, db, ndb, query,
+								 NV_BOVW_RERANK_NONE, color_weights[c],
+								 NULL, &norm_index);
+			NV_ASSERT(n1 == n2);
+			for (j = 0; j < n1; ++j) {
+				NV_ASSERT(results1[j].similarity == results2[j].similarity);
+			}
+		}
+	}
+	
+	nv_aligned_free(db);
+	nv_free(results1);
+	nv_free(results2);
+	delete ctx;
+}
+
+/* the sparse query path (less than sparse_query_th of the words set) scores as the dense one */
+template<typename T>
+static void
+otama_test_bovw_sparse_query_tpl(void)
+{
+	static const float color_weights[] = { 0.0f, 0.2f };
+	static const int idf_levels[] = { 0, 2 };
+	const int64_t ndb = 1000;
+	const int k = 20;
+	const int nq = 4;
+	typename T::dense_t *db;
+	typename T::dense_t *queries;
+	const typename T::dense_t *query_ptrs[nq];
+	nv_bovw_result_t *results1 = nv_alloc_type(nv_bovw_result_t, k);
+	nv_bovw_result_t *results2 = nv_alloc_type(nv_bovw_result_t, k);
+	nv_bovw_result_t *batch1[nq], *batch2[nq];
+	int nbatch1[nq], nbatch2[nq];
+	T *sparse = new T;
+	T *dense = new T;
+	int64_t i;
+	int j, q, c, l;
+	
+	nv_aligned_malloc((void **)&db, 16, sizeof(typename T::dense_t) * ndb);
+	nv_aligned_malloc((void **)&queries, 16, sizeof(typename T::dense_t) * nq);
+	memset(db, 0, sizeof(typename T::dense_t) * ndb);
+	memset(queries, 0, sizeof(typename T::dense_t) * nq);
+	for (i = 0; i < ndb; ++i) {
+		int density = nv_rand_index(20);
+		uint64_t popcnt = 0;
+		char *s;
+		for (j = 0; j < T::INT_BLOCKS; ++j) {
+			db[i].bovw[j] = otama_test_rand_bits(density);
+			popcnt += NV_POPCNT_U64(db[i].bovw[j]);
+		}
+		db[i].norm = popcnt == 0 ? FLT_MAX : sqrtf((float)popcnt);
+		for (j = 0; j < NV_COLOR_SBOC_INT_BLOCKS; ++j) {
+			db[i].boc.color[j] = otama_test_rand_bits(density + 1);
+		}
+		s = nv_color_sboc_serialize(&db[i].boc);
+		NV_ASSERT(nv_color_sboc_deserialize(&db[i].boc, s) == 0);
+		nv_free(s);
+	}
+	/* 1 .. INT_BLOCKS / 8 words set, below the default 0.25 */
+	for (q = 0; q < nq; ++q) {
+		const int words = 1 + nv_rand_index(NV_MAX(1, T::INT_BLOCKS / 8));
+		uint64_t popcnt = 0;
+		for (j = 0; j < words; ++j) {
+			queries[q].bovw[nv_rand_index(T::INT_BLOCKS)] |= otama_test_rand_bits(30) | 1;
+		}
+		for (j = 0; j < T::INT_BLOCKS; ++j) {
+			popcnt += NV_POPCNT_U64(queries[q].bovw[j]);
+		}
+		queries[q].norm = sqrtf((float)popcnt);
+		queries[q].boc = db[q].boc;
+		query_ptrs[q] = &queries[q];
+		batch1[q] = nv_alloc_type(nv_bovw_result_t, k);
+		batch2[q] = nv_alloc_type(nv_bovw_result_t, k);
+	}
+	NV_ASSERT(sparse->open() == 0);
+	NV_ASSERT(dense->open() == 0);
+	dense->set_sparse_query_th(0.0f);
+	
+	for (l = 0; l < (int)(sizeof(idf_levels) / sizeof(idf_levels[0])); ++l) {
+		sparse->set_idf_levels(idf_levels[l]);
+		dense->set_idf_levels(idf_levels[l]);
+		for (c = 0; c < (int)(sizeof(color_weights) / sizeof(color_weights[0])); ++c) {
+			float cw[nq];
+			for (q = 0; q < nq; ++q) {
+				int n1 = sparse->search(results1, k, db, ndb, &queries[q],
+										NV_BOVW_RERANK_NONE, color_weights[c]);
+				int n2 = dense->search(results2, k, db, ndb, &queries[q],
+									   NV_BOVW_RERANK_NONE, color_weights[c]);
+				NV_ASSERT(n1 == n2);
+				for (j = 0; j < n1; ++j) {
+					NV_ASSERT(results1[j].similarity == results2[j].similarity);
+				}
+				/* partitioned scan */
+				n1 = sparse->search(results1, k, db, ndb, &queries[q],
+									NV_BOVW_RERANK_NONE, color_weights[c],
+									NULL, NULL, NULL, 2);
+				NV_ASSERT(n1 == n2);
+				for (j = 0; j < n1; ++j) {
+					NV_ASSERT(results1[j].similarity == results2[j].similarity);
+				}
+				cw[q] = color_weights[c];
+			}
+			sparse->search_batch(batch1, nbatch1, k, db, ndb, query_ptrs, nq,
+								 NV_BOVW_RERANK_NONE, cw);
+			dense->search_batch(batch2, nbatch2, k, db, ndb, query_ptrs, nq,
+								NV_BOVW_RERANK_NONE, cw);
+			for (q = 0; q < nq; ++q) {
+				NV_ASSERT(nbatch1[q] == nbatch2[q]);
+				for (j = 0; j < nbatch1[q]; ++j) {
+					NV_ASSERT(batch1[q][j].similarity == batch2[q][j].similarity);
+				}
+			}
+		}
+	}
+	
+	for (q = 0; q < nq; ++q) {
+		nv_free(batch1[q]);
+		nv_free(batch2[q]);
+	}
+	nv_aligned_free(db);
+	nv_aligned_free(queries);
+	nv_free(results1);
+	nv_free(results2);
+	delete sparse;
+	delete dense;
+}
+
+/* a record of words drawn from a zipf distribution */
+template<typename T>
+static void
+otama_test_bovw_zipf(typename T::dense_t *bovw, const std::vector<float> &cdf, int words,
+					 const typename T::dense_t *base = NULL)
+{
+	uint64_t popcnt = 0;
+	int i;
+	
+	memset(bovw->bovw, 0, sizeof(bovw->bovw));
+	if (base != NULL) {
+		/* 60% of the words of base */
+		for (i = 0; i < T::BIT; ++i) {
+			if (((base->bovw[i / 64] >> (i % 64)) & 1) && nv_rand_index(100) < 60) {
+				bovw->bovw[i / 64] |= (1ULL << (i % 64));
+			}
+		}
+	}
+	for (i = 0; i < words; ++i) {
+		const int w = (int)(std::lower_bound(cdf.begin(), cdf.end(), nv_rand() * cdf.back())
+							- cdf.begin());
+		bovw->bovw[w / 64] |= (1ULL << (w % 64));
+	}
+	for (i = 0; i < T::INT_BLOCKS; ++i) {
+		popcnt += NV_POPCNT_U64(bovw->bovw[i]);
+	}
+	bovw->norm = popcnt == 0 ? FLT_MAX : sqrtf((float)popcnt);
+}
+
+/*
+ * the idf planes of the first stage (idf_levels). with a flat idf they score
+ * as the bit cosine, with the idf of zipf words they find more of the exact
+ * idf top-k than the bit cosine does.
+ */
+template<typename T>
+static void
+otama_test_bovw_idf_planes_tpl(void)
+{
+	const int64_t ndb = 2000;
+	const int k = 10;
+	const int nq = 50;
+	const int words = 120;
+	std::vector<float> cdf(T::BIT);
+	typename T::dense_t *db, *queries;
+	nv_bovw_result_t *exact = nv_alloc_type(nv_bovw_result_t, k);
+	nv_bovw_result_t *results1 = nv_alloc_type(nv_bovw_result_t, k);
+	nv_bovw_result_t *results2 = nv_alloc_type(nv_bovw_result_t, k);
+	nv_matrix_t *freq = nv_matrix_alloc(T::BIT, 1);
+	int hits1 = 0, hits2 = 0;
+	T *ctx = new T;
+	int64_t i;
+	int j, q, n1, n2;
+	
+	cdf[0] = 1.0f;
+	for (j = 1; j < T::BIT; ++j) {
+		cdf[j] = cdf[j - 1] + 1.0f / (float)(j + 1);
+	}
+	nv_aligned_malloc((void **)&db, 16, sizeof(typename T::dense_t) * ndb);
+	nv_aligned_malloc((void **)&queries, 16, sizeof(typename T::dense_t) * nq);
+	memset(db, 0, sizeof(typename T::dense_t) * ndb);
+	memset(queries, 0, sizeof(typename T::dense_t) * nq);
+	for (i = 0; i < ndb; ++i) {
+		otama_test_bovw_zipf<T>(&db[i], cdf, words);
+	}
+	for (q = 0; q < nq; ++q) {
+		otama_test_bovw_zipf<T>(&queries[q], cdf, words / 2, &db[nv_rand_index((int)ndb)]);
+	}
+	NV_ASSERT(ctx->open() == 0);
+	
+	/* flat idf: all words of the query are on the top plane */
+	for (j = 0; j < T::BIT; ++j) {
+		NV_MAT_V(freq, 0, j) = (float)(ndb / 2);
+	}
+	ctx->update_idf(freq, 0, ndb);
+	for (q = 0; q < nq; ++q) {
+		ctx->set_idf_levels(0);
+		n1 = ctx->search(results1, k, db, ndb, &queries[q], NV_BOVW_RERANK_NONE, 0.0f);
+		ctx->set_idf_levels(4);
+		n2 = ctx->search(results2, k, db, ndb, &queries[q], NV_BOVW_RERANK_NONE, 0.0f);
+		NV_ASSERT(n1 == n2);
+		for (j = 0; j < n1; ++j) {
+			NV_ASSERT(fabsf(results1[j].similarity - results2[j].similarity) < 1.0e-5f);
+		}
+	}
+	
+	/* idf of db, recall@k against the idf rerank of all records */
+	nv_matrix_zero(freq);
+	for (i = 0; i < ndb; ++i) {
+		for (j = 0; j < T::BIT; ++j) {
+			if ((db[i].bovw[j / 64] >> (j % 64)) & 1) {
+				NV_MAT_V(freq, 0, j) += 1.0f;
+			}
+		}
+	}
+	ctx->update_idf(freq, 0, ndb);
+	for (q = 0; q < nq; ++q) {
+		int ne, l;
+		
+		ctx->set_idf_levels(0);
+		ctx->set_first_scale((int)(ndb / k));
+		ne = ctx->search(exact, k, db, ndb, &queries[q], NV_BOVW_RERANK_IDF, 0.0f);
+		ctx->set_first_scale(T::DEFAULT_FIRST_SCALE);
+		n1 = ctx->search(results1, k, db, ndb, &queries[q], NV_BOVW_RERANK_IDF, 0.0f);
+		ctx->set_idf_levels(4);
+		n2 = ctx->search(results2, k, db, ndb, &queries[q], NV_BOVW_RERANK_IDF, 0.0f);
+		for (j = 0; j < ne; ++j) {
+			for (l = 0; l < n1; ++l) {
+				if (results1[l].index == exact[j].index) {
+					++hits1;
+				}
+			}
+			for (l = 0; l < n2; ++l) {
+				if (results2[l].index == exact[j].index) {
+					++hits2;
+				}
+			}
+		}
+	}
+	NV_ASSERT(hits2 > hits1);
+	NV_ASSERT(hits2 >= nq * k * 6 / 10);
+	
+	nv_matrix_free(&freq);
+	nv_aligned_free(db);
+	nv_aligned_free(queries);
+	nv_free(exact);
+	nv_free(results1);
+	nv_free(results2);
+	delete ctx;
+}
+
+/* pack()/unpack() round trip, and the packed and cascade rows search as the dense ones */
+template<typename T>
+static void
+otama_test_bovw_pack_tpl(void)
+{
+	static const float color_weights[] = { 0.0f, 0.2f };
+	const int64_t ndb = 200;
+	const int k = 20;
+	typename T::dense_t *db, *bovw;
+	std::vector<typename T::packed_t> packed(ndb);
+	std::vector<typename T::cascade_t> cascade(ndb);
+	std::vector<uint8_t> packed_blob, cascade_blob, buf;
+	nv_bovw_result_t *results1 = nv_alloc_type(nv_bovw_result_t, k);
+	nv_bovw_result_t *results2 = nv_alloc_type(nv_bovw_result_t, k);
+	T *ctx = new T;
+	int64_t i;
+	int j, q, c;
+	
+	nv_aligned_malloc((void **)&db, 16, sizeof(typename T::dense_t) * ndb);
+	nv_aligned_malloc((void **)&bovw, 16, sizeof(typename T::dense_t));
+	memset(db, 0, sizeof(typename T::dense_t) * ndb);
+	for (i = 0; i < ndb; ++i) {
+		/* 0: empty, 1: all words set */
+		int density = i == 0 ? 0 : (i == 1 ? 100 : nv_rand_index(5));
+		uint64_t popcnt = 0;
+		char *s;
+		for (j = 0; j < T::INT_BLOCKS; ++j) {
+			db[i].bovw[j] = otama_test_rand_bits(density);
+			popcnt += NV_POPCNT_U64(db[i].bovw[j]);
+		}
+		db[i].norm = popcnt == 0 ? FLT_MAX : sqrtf((float)popcnt);
+		for (j = 0; j < NV_COLOR_SBOC_INT_BLOCKS; ++j) {
+			db[i].boc.color[j] = otama_test_rand_bits(nv_rand_index(20) + 1);
+		}
+		s = nv_color_sboc_serialize(&db[i].boc);
+		NV_ASSERT(nv_color_sboc_deserialize(&db[i].boc, s) == 0);
+		nv_free(s);
+		
+		T::pack(buf, &packed[i], &db[i]);
+		packed[i].offset = (int64_t)packed_blob.size();
+		NV_ASSERT(packed[i].len == (int32_t)buf.size());
+		packed_blob.insert(packed_blob.end(), buf.begin(), buf.end());
+		
+		T::pack(buf, &cascade[i], &db[i]);
+		cascade[i].offset = (int64_t)cascade_blob.size();
+		NV_ASSERT(cascade[i].len == (int32_t)sizeof(typename T::dense_t));
+		cascade_blob.insert(cascade_blob.end(), buf.begin(), buf.end());
+	}
+	NV_ASSERT(packed[0].len == 0);
+	for (i = 0; i < ndb; ++i) {
+		memset(bovw, 0xff, sizeof(*bovw));
+		T::unpack(bovw, &packed[i], &packed_blob[0]);
+		NV_ASSERT(memcmp(bovw->bovw, db[i].bovw, sizeof(db[i].bovw)) == 0);
+		NV_ASSERT(bovw->norm == db[i].norm);
+		NV_ASSERT(memcmp(&bovw->boc, &db[i].boc, sizeof(db[i].boc)) == 0);
+		
+		memset(bovw, 0xff, sizeof(*bovw));
+		T::unpack(bovw, &cascade[i], &cascade_blob[0]);
+		NV_ASSERT(memcmp(bovw, &db[i], sizeof(*bovw)) == 0);
+	}
+	
+	NV_ASSERT(ctx->open() == 0);
+	for (c = 0; c < (int)(sizeof(color_weights) / sizeof(color_weights[0])); ++c) {
+		for (q = 0; q < 5; ++q) {
+			const typename T::dense_t *query = &db[2 + nv_rand_index((int)ndb - 2)];
+			int n1 = ctx->search(results1, k, db, ndb, query,
+								 NV_BOVW_RERANK_NONE, color_weights[c]);
+			int n2 = ctx->search(results2, k, &packed[0], &packed_blob[0], ndb, query,
+								 NV_BOVW_RERANK_NONE, color_weights[c]);
+			NV_ASSERT(n1 == n2);
+			for (j = 0; j < n1; ++j) {
+				NV_ASSERT(results1[j].similarity == results2[j].similarity);
+			}
+			/* all rows reach the second stage */
+			n2 = ctx->search(results2, k, &cascade[0], &cascade_blob[0], ndb, query,
+							 NV_BOVW_RERANK_NONE, color_weights[c],
+							 NULL, NULL, (int)ndb);
+			NV_ASSERT(n1 == n2);
+			for (j = 0; j < n1; ++j) {
+				NV_ASSERT(results1[j].similarity == results2[j].similarity);
+			}
+		}
+	}
+	
+	nv_aligned_free(db);
+	nv_aligned_free(bovw);
+	nv_free(results1);
+	nv_free(results2);
+	delete ctx;
+}
+
+/* the cascade scores the best coarse records only, recall@k against the exact scan */
+template<typename T>
+static void
+otama_test_bovw_cascade_recall_tpl(void)
+{
+	const int64_t ndb = 500;
+	const int k = 10;
+	const int nq = 50;
+	const int words = 300;
+	std::vector<float> cdf(T::BIT);
+	std::vector<typename T::cascade_t> cascade(ndb);
+	std::vector<uint8_t> blob, buf;
+	typename T::dense_t *db, *queries;
+	nv_bovw_result_t *exact = nv_alloc_type(nv_bovw_result_t, k);
+	nv_bovw_result_t *results = nv_alloc_type(nv_bovw_result_t, k);
+	T *ctx = new T;
+	int hits = 0;
+	int64_t i;
+	int j, l, q;
+	
+	cdf[0] = 1.0f;
+	for (j = 1; j < T::BIT; ++j) {
+		cdf[j] = cdf[j - 1] + 1.0f / (float)(j + 1);
+	}
+	nv_aligned_malloc((void **)&db, 16, sizeof(typename T::dense_t) * ndb);
+	nv_aligned_malloc((void **)&queries, 16, sizeof(typename T::dense_t) * nq);
+	memset(db, 0, sizeof(typename T::dense_t) * ndb);
+	memset(queries, 0, sizeof(typename T::dense_t) * nq);
+	for (i = 0; i < ndb; ++i) {
+		otama_test_bovw_zipf<T>(&db[i], cdf, words);
+		T::pack(buf, &cascade[i], &db[i]);
+		cascade[i].offset = (int64_t)blob.size();
+		blob.insert(blob.end(), buf.begin(), buf.end());
+	}
+	for (q = 0; q < nq; ++q) {
+		otama_test_bovw_zipf<T>(&queries[q], cdf, words / 2, &db[nv_rand_index((int)ndb)]);
+	}
+	NV_ASSERT(ctx->open() == 0);
+	for (q = 0; q < nq; ++q) {
+		int ne = ctx->search(exact, k, db, ndb, &queries[q], NV_BOVW_RERANK_NONE, 0.0f);
+		int n = ctx->search(results, k, &cascade[0], &blob[0], ndb, &queries[q],
+							NV_BOVW_RERANK_NONE, 0.0f);
+		NV_ASSERT(n == ne);
+		for (j = 0; j < ne; ++j) {
+			for (l = 0; l < n; ++l) {
+				if (results[l].index == exact[j].index) {
+					++hits;
+				}
+			}
+		}
+	}
+	NV_ASSERT(hits >= nq * k * 9 / 10);
+	
+	nv_aligned_free(db);
+	nv_aligned_free(queries);
+	nv_free(exact);
+	nv_free(results);
+	delete ctx;
+}
+
+static void
+otama_test_sboc_norm_pruning(void)
+{
+	const int64_t ndb = NV_COLOR_BOC_NORM_BLOCK_SIZE * 5 + 123;
+	const int k = 20;
+	nv_color_sboc_t *db = nv_alloc_type(nv_color_sboc_t, ndb);
+	nv_color_boc_norm_index_t *norm_index = nv_color_boc_norm_index_alloc();
+	nv_color_boc_result_t *results1 = nv_alloc_type(nv_color_boc_result_t, k);
+	nv_color_boc_result_t *results2 = nv_alloc_type(nv_color_boc_result_t, k);
+	int64_t i;
+	int j, q;
+	
+	OTAMA_TEST_NAME;
+	
+	for (i = 0; i < ndb; ++i) {
+		int density = nv_rand_index(30);
+		char *s;
+		for (j = 0; j < NV_COLOR_SBOC_INT_BLOCKS; ++j) {
+			db[i].color[j] = otama_test_rand_bits(density);
+		}
+		/* compute norms */
+		s = nv_color_sboc_serialize(&db[i]);
+		NV_ASSERT(nv_color_sboc_deserialize(&db[i], s) == 0);
+		nv_free(s);
+	}
+	nv_color_sboc_norm_index_update(norm_index, db, ndb / 3);
+	nv_color_sboc_norm_index_update(norm_index, db, ndb);
+	NV_ASSERT(norm_index->count == ndb);
+	
+	for (q = 0; q < 10; ++q) {
+		const nv_color_sboc_t *query = &db[nv_rand_index((int)ndb)];
+		int n1 = nv_color_sboc_search(results1, k, db, ndb, query);
+		int n2 = nv_color_sboc_search_pruned(results2, k, db, ndb, query, norm_index, NULL);
+		NV_ASSERT(n1 == n2);
+		for (j = 0; j < n1; ++j) {
+			NV_ASSERT(results1[j].cosine == results2[j].cosine);
+		}
+	}
+	/* stale index falls back to the exact scan */
+	NV_ASSERT(nv_color_sboc_search_pruned(results2, k, db, ndb - 1, &db[0], norm_index, NULL) == k);
+	
+	nv_color_boc_norm_index_free(&norm_index);
+	nv_free(db);
+	nv_free(results1);
+	nv_free(results2);
+}
+
+/* every color kernel returns the same similarities and results as the scalar kernel */
+static void
+otama_test_color_boc_kernel(void)
+{
+	const int64_t ndb = 1000;
+	const int k = 20;
+	nv_color_sboc_t *sboc = nv_alloc_type(nv_color_sboc_t, ndb);
+	nv_color_boc_t *boc = nv_alloc_type(nv_color_boc_t, ndb);
+	float *sboc_base = nv_alloc_type(float, ndb);
+	float *boc_base = nv_alloc_type(float, ndb);
+	nv_color_boc_result_t *sboc_results1 = nv_alloc_type(nv_color_boc_result_t, k);
+	nv_color_boc_result_t *sboc_results2 = nv_alloc_type(nv_color_boc_result_t, k);
+	nv_color_boc_result_t *boc_results1 = nv_alloc_type(nv_color_boc_result_t, k);
+	nv_color_boc_result_t *boc_results2 = nv_alloc_type(nv_color_boc_result_t, k);
+	int64_t i;
+	int j, kernel;
+	
+	OTAMA_TEST_NAME;
+	
+	for (i = 0; i < ndb; ++i) {
+		/* an empty record, a full record, then random densities */
+		int density = i == 0 ? 0 : (i == 1 ? 100 : nv_rand_index(40));
+		char *s;
+		for (j = 0; j < NV_COLOR_SBOC_INT_BLOCKS; ++j) {
+			sboc[i].color[j] = otama_test_rand_bits(density);
+		}
+		s = nv_color_sboc_serialize(&sboc[i]);
+		NV_ASSERT(nv_color_sboc_deserialize(&sboc[i], s) == 0);
+		nv_free(s);
+		for (j = 0; j < NV_COLOR_BOC_INT_BLOCKS; ++j) {
+			boc[i].color[j] = sboc[i].color[j];
+		}
+		s = nv_color_boc_serialize(&boc[i]);
+		NV_ASSERT(nv_color_boc_deserialize(&boc[i], s) == 0);
+		nv_free(s);
+	}
+	
+	printf("best kernel: %s\n", nv_color_boc_kernel_name(nv_color_boc_kernel_best()));
+	NV_ASSERT(nv_color_boc_kernel_set(NV_COLOR_BOC_KERNEL_SCALAR) == 0);
+	for (i = 0; i < ndb; ++i) {
+		sboc_base[i] = nv_color_sboc_similarity(&sboc[2], &sboc[i]);
+		boc_base[i] = nv_color_boc_similarity(&boc[2], &boc[i]);
+	}
+	nv_color_sboc_search(sboc_results1, k, sboc, ndb, &sboc[2]);
+	nv_color_boc_search(boc_results1, k, boc, ndb, &boc[2]);
+	
+	for (kernel = 0; kernel < NV_COLOR_BOC_KERNEL_MAX; ++kernel) {
+		if (nv_color_boc_kernel_set((nv_color_boc_kernel_e)kernel) != 0) {
+			printf("%s: skip\n", nv_color_boc_kernel_name((nv_color_boc_kernel_e)kernel));
+			continue;
+		}
+		for (i = 0; i < ndb; ++i) {
+			NV_ASSERT(nv_color_sboc_similarity(&sboc[2], &sboc[i]) == sboc_base[i]);
+			NV_ASSERT(nv_color_boc_similarity(&boc[2], &boc[i]) == boc_base[i]);
+		}
+		/* the empty and the full record as the query */
+		NV_ASSERT(nv_color_sboc_similarity(&sboc[0], &sboc[2]) == 0.0f);
+		NV_ASSERT(OTAMA_TEST_EQ1(nv_color_sboc_similarity(&sboc[1], &sboc[1])));
+		NV_ASSERT(OTAMA_TEST_EQ1(nv_color_boc_similarity(&boc[1], &boc[1])));
+		
+		NV_ASSERT(nv_color_sboc_search(sboc_results2, k, sboc, ndb, &sboc[2]) == k);
+		NV_ASSERT(nv_color_boc_search(boc_results2, k, boc, ndb, &boc[2]) == k);
+		for (j = 0; j < k; ++j) {
+			NV_ASSERT(sboc_results1[j].index == sboc_results2[j].index);
+			NV_ASSERT(sboc_results1[j].cosine == sboc_results2[j].cosine);
+			NV_ASSERT(boc_results1[j].index == boc_results2[j].index);
+			NV_ASSERT(boc_results1[j].cosine == boc_results2[j].cosine);
+		}
+	}
+	NV_ASSERT(nv_color_boc_kernel_set(nv_color_boc_kernel_best()) == 0);
+	
+	nv_free(sboc);
+	nv_free(boc);
+	nv_free(sboc_base);
+	nv_free(boc_base);
+	nv_free(sboc_results1);
+	nv_free(sboc_results2);
+	nv_free(boc_results1);
+	nv_free(boc_results2);
+}
+
 void
 otama_test_bovw(void)
 {
 	OTAMA_TEST_NAME;
 	
+	otama_test_bovw_popcnt();
 	otama_test_bovw_tpl<nv_bovw_ctx<NV_BOVW_BIT2K, nv_color_boc_t> >();
 	otama_test_bovw_tpl<nv_bovw_ctx<NV_BOVW_BIT8K, nv_color_boc_t> >();
 	otama_test_bovw_tpl<nv_bovw_ctx<NV_BOVW_BIT512K, nv_color_boc_t> >();
@@ -263,4 +921,13 @@ otama_test_bovw(void)
 	otama_test_bovw_tpl<nv_bovw_ctx<NV_BOVW_BIT8K, nv_color_sboc_t> >();
 	otama_test_bovw_tpl<nv_bovw_ctx<NV_BOVW_BIT512K, nv_color_sboc_t> >();
 	otama_test_bovw_svec_tpl<nv_bovw_ctx<NV_BOVW_BIT512K, nv_color_sboc_t> >();	
+	otama_test_bovw_norm_pruning_tpl<nv_bovw_ctx<NV_BOVW_BIT2K, nv_color_sboc_t> >();
+	otama_test_bovw_norm_pruning_tpl<nv_bovw_ctx<NV_BOVW_BIT8K, nv_color_sboc_t> >();
+	otama_test_bovw_sparse_query_tpl<nv_bovw_ctx<NV_BOVW_BIT2K, nv_color_sboc_t> >();
+	otama_test_bovw_sparse_query_tpl<nv_bovw_ctx<NV_BOVW_BIT8K, nv_color_sboc_t> >();
+	otama_test_bovw_pack_tpl<nv_bovw_ctx<NV_BOVW_BIT512K, nv_color_sboc_t> >();
+	otama_test_bovw_idf_planes_tpl<nv_bovw_ctx<NV_BOVW_BIT8K, nv_color_sboc_t> >();
+	otama_test_bovw_cascade_recall_tpl<nv_bovw_ctx<NV_BOVW_BIT512K, nv_color_sboc_t> >();
+	otama_test_sboc_norm_pruning();
+	otama_test_color_boc_kernel();
 }
@@ -0,0 +1,122 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2013 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#undef NDEBUG
+
+#include "otama_config.h"
+#include "otama_test.h"
+#include "nv_core.h"
+#include "otama.h"
+#include "otama_util.h"
+#include "otama_inverted_index_bucket.hpp"
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace otama;
+
+#define BUCKET_TEST_SNAPSHOT "./data/bucket_test_bucket.snapshot"
+
+static InvertedIndexBucket *
+bucket_test_open(otama_variant_t *options, InvertedIndex::WeightFunction *weight_func)
+{
+	InvertedIndexBucket *index = new InvertedIndexBucket(options);
+
+	index->prefix("bucket_test");
+	index->weight_func(weight_func);
+	NV_ASSERT(index->open() == OTAMA_STATUS_OK);
+
+	return index;
+}
+
+/*
+ * a snapshot is read back by the next open(),
+ * a truncated one is ignored and is not mapped past its end.
+ */
+static void
+otama_test_bucket_snapshot(void)
+{
+	static const int NREC = 2000;
+	otama_variant_pool_t *pool = otama_variant_pool_alloc();
+	otama_variant_t *options = otama_variant_new(pool);
+	otama_variant_t *driver;
+	InvertedIndex::WeightFunction weight_func;
+	InvertedIndex::sparse_vec_t vec;
+	InvertedIndexBucket *index;
+	int64_t hash_counts[3] = {0, 0, 0};
+	int64_t size;
+	otama_id_t id;
+	int64_t no;
+	int h;
+
+	OTAMA_TEST_NAME;
+
+	otama_variant_set_hash(options);
+	driver = otama_variant_hash_at(options, "driver");
+	otama_variant_set_hash(driver);
+	otama_variant_set_string(otama_variant_hash_at(driver, "data_dir"), "./data");
+	otama_variant_set_int(otama_variant_hash_at(driver, "snapshot"), 1);
+	memset(&id, 0, sizeof(id));
+
+	index = bucket_test_open(options, &weight_func);
+	NV_ASSERT(index->clear() == OTAMA_STATUS_OK);
+	for (no = 1; no <= NREC; ++no) {
+		vec.clear();
+		for (h = 0; h < 3; ++h) {
+			if (no % (h + 2) == 0) {
+				vec.push_back((uint32_t)h + 1);
+				hash_counts[h] += 1;
+			}
+		}
+		NV_ASSERT(index->set(no, &id, vec) == OTAMA_STATUS_OK);
+	}
+	NV_ASSERT(index->set_last_no(NREC));
+	NV_ASSERT(index->set_last_commit_no(NREC));
+	NV_ASSERT(index->vacuum() == OTAMA_STATUS_OK);
+	NV_ASSERT(index->close() == OTAMA_STATUS_OK);
+	delete index;
+
+	index = bucket_test_open(options, &weight_func);
+	NV_ASSERT(index->count() == NREC);
+	NV_ASSERT(index->get_last_no() == NREC);
+	for (h = 0; h < 3; ++h) {
+		NV_ASSERT(index->hash_count((uint32_t)h + 1) == hash_counts[h]);
+	}
+	NV_ASSERT(index->close() == OTAMA_STATUS_OK);
+	delete index;
+
+	size = otama_file_size(BUCKET_TEST_SNAPSHOT);
+	NV_ASSERT(size > 0);
+	NV_ASSERT(truncate(BUCKET_TEST_SNAPSHOT, size - 1) == 0);
+	index = bucket_test_open(options, &weight_func);
+	NV_ASSERT(index->count() == 0);
+	NV_ASSERT(index->get_last_no() == -1);
+	NV_ASSERT(index->hash_count(1) == 0);
+	NV_ASSERT(index->clear() == OTAMA_STATUS_OK);
+	NV_ASSERT(index->close() == OTAMA_STATUS_OK);
+	delete index;
+
+	otama_variant_pool_free(&pool);
+}
+
+void
+otama_test_bucket(void)
+{
+	otama_test_bucket_snapshot();
+}
@@ -0,0 +1,213 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#undef NDEBUG
+
+#include "otama_test.h"
+#include "nv_core.h"
+#include "otama.h"
+#include "otama_log.h"
+#include "otama_fixed_strage.hpp"
+#include <string>
+#include <vector>
+
+typedef struct {
+	float v[4];
+} strage_test_vec_t;
+typedef otama::FixedStrage<strage_test_vec_t> strage_test_t;
+
+#define STRAGE_TEST_DIR "./data"
+#define STRAGE_TEST_PREFIX "strage_test"
+
+static bool
+strage_test_exists(const std::string &name)
+{
+	otama_mmap_t *shm;
+
+	if (otama_mmap_open(&shm, STRAGE_TEST_DIR, name.c_str(), 1) != 0) {
+		return false;
+	}
+	otama_mmap_close(&shm);
+	return true;
+}
+
+static void
+strage_test_vec(strage_test_vec_t *vec, int64_t seq)
+{
+	int i;
+	for (i = 0; i < 4; ++i) {
+		vec->v[i] = (float)(seq * 4 + i);
+	}
+}
+
+/* seqs 1..count in a new strage s */
+static void
+strage_test_fill(strage_test_t &s, int64_t count)
+{
+	int64_t i;
+
+	s.unlink_files();
+	NV_ASSERT(s.create() == OTAMA_STATUS_OK);
+	NV_ASSERT(s.open() == OTAMA_STATUS_OK);
+	NV_ASSERT(s.extend(count) == OTAMA_STATUS_OK);
+	for (i = 0; i < count; ++i) {
+		strage_test_vec_t vec;
+		otama_id_t id;
+
+		memset(&id, 0, sizeof(id));
+		strage_test_vec(&vec, i + 1);
+		s.set(i, i + 1, &id, 0, &vec);
+	}
+	s.set_count(count);
+	s.set_last_no(count);
+	s.sync();
+}
+
+static void
+strage_test_check(strage_test_t &s, const int64_t *seqs, int64_t count)
+{
+	int64_t i;
+
+	NV_ASSERT(s.count() == count);
+	for (i = 0; i < count; ++i) {
+		strage_test_vec_t vec;
+
+		strage_test_vec(&vec, seqs[i]);
+		NV_ASSERT(s.seq_at(i) == seqs[i]);
+		NV_ASSERT(memcmp(&s.vec()[i], &vec, sizeof(vec)) == 0);
+	}
+}
+
+/* vacuum() drops the deleted rows and leaves no temporary file */
+static void
+otama_test_fixed_strage_vacuum(void)
+{
+	static const int64_t seqs[] = { 1, 3 };
+	strage_test_t s(STRAGE_TEST_DIR, STRAGE_TEST_PREFIX);
+	std::vector<strage_test_t::record_t> restore;
+	int64_t reclaimed_bytes;
+
+	OTAMA_TEST_NAME;
+
+	strage_test_fill(s, 3);
+	s.update_flag(2, 0x01); /* FLAG_DELETE */
+	NV_ASSERT(s.vacuum(restore, &reclaimed_bytes) == OTAMA_STATUS_OK);
+	strage_test_check(s, seqs, 2);
+	NV_ASSERT(!strage_test_exists(s.metadata_name() + strage_test_t::VACUUM_SUFFIX()));
+	NV_ASSERT(!strage_test_exists(s.vector_name() + strage_test_t::VACUUM_SUFFIX()));
+	NV_ASSERT(!strage_test_exists(s.metadata_name() + strage_test_t::VACUUM_COMMIT_SUFFIX()));
+	s.close();
+	s.unlink_files();
+}
+
+/* a crash while vacuum() creates its files, open() keeps the current files */
+static void
+otama_test_fixed_strage_partial_vacuum(void)
+{
+	static const int64_t seqs[] = { 1, 2, 3 };
+	const std::string suffix = strage_test_t::VACUUM_SUFFIX();
+	strage_test_t s(STRAGE_TEST_DIR, STRAGE_TEST_PREFIX);
+
+	OTAMA_TEST_NAME;
+
+	strage_test_fill(s, 3);
+	s.close();
+	NV_ASSERT(otama_mmap_create(STRAGE_TEST_DIR, (s.metadata_name() + suffix).c_str(),
+								64) == 0);
+	NV_ASSERT(otama_mmap_create(STRAGE_TEST_DIR, (s.index_name() + suffix).c_str(),
+								64) == 0);
+	NV_ASSERT(s.open() == OTAMA_STATUS_OK);
+	strage_test_check(s, seqs, 3);
+	NV_ASSERT(!strage_test_exists(s.metadata_name() + suffix));
+	NV_ASSERT(!strage_test_exists(s.index_name() + suffix));
+	s.close();
+	s.unlink_files();
+}
+
+/* open() leaves the files of a vacuum() that holds the lock */
+static void
+otama_test_fixed_strage_locked_vacuum(void)
+{
+	static const int64_t seqs[] = { 1, 2, 3 };
+	const std::string suffix = strage_test_t::VACUUM_SUFFIX();
+	strage_test_t s(STRAGE_TEST_DIR, STRAGE_TEST_PREFIX);
+	otama_mmap_lock_t *lock = NULL;
+
+	OTAMA_TEST_NAME;
+
+	strage_test_fill(s, 3);
+	s.close();
+	NV_ASSERT(otama_mmap_create(STRAGE_TEST_DIR, (s.metadata_name() + suffix).c_str(),
+								64) == 0);
+	NV_ASSERT(otama_mmap_lock(&lock, STRAGE_TEST_DIR,
+							  (s.metadata_name() + strage_test_t::VACUUM_LOCK_SUFFIX()).c_str(),
+							  1) == 0);
+	NV_ASSERT(s.open() == OTAMA_STATUS_OK);
+	strage_test_check(s, seqs, 3);
+	NV_ASSERT(strage_test_exists(s.metadata_name() + suffix));
+	s.close();
+	otama_mmap_unlock(&lock);
+	NV_ASSERT(s.open() == OTAMA_STATUS_OK);
+	NV_ASSERT(!strage_test_exists(s.metadata_name() + suffix));
+	s.close();
+	s.unlink_files();
+}
+
+/* a committed vacuum() that stopped after the vector rename, open() finishes it */
+static void
+otama_test_fixed_strage_committed_vacuum(void)
+{
+	static const int64_t seqs[] = { 1, 2 };
+	const std::string suffix = strage_test_t::VACUUM_SUFFIX();
+	strage_test_t s(STRAGE_TEST_DIR, STRAGE_TEST_PREFIX);
+	strage_test_t tmp(STRAGE_TEST_DIR, STRAGE_TEST_PREFIX);
+
+	OTAMA_TEST_NAME;
+
+	strage_test_fill(s, 3);
+	s.close();
+	tmp.metadata_name(s.metadata_name() + suffix);
+	tmp.index_name(s.index_name() + suffix);
+	tmp.vector_name(s.vector_name() + suffix);
+	tmp.deleted_name(s.deleted_name() + suffix);
+	strage_test_fill(tmp, 2);
+	tmp.close();
+	NV_ASSERT(otama_mmap_create(STRAGE_TEST_DIR,
+								(s.metadata_name() + strage_test_t::VACUUM_COMMIT_SUFFIX()).c_str(),
+								sizeof(int64_t)) == 0);
+	NV_ASSERT(otama_mmap_rename(STRAGE_TEST_DIR, tmp.vector_name().c_str(),
+								s.vector_name().c_str()) == 0);
+	NV_ASSERT(s.open() == OTAMA_STATUS_OK);
+	strage_test_check(s, seqs, 2);
+	NV_ASSERT(!strage_test_exists(tmp.metadata_name()));
+	NV_ASSERT(!strage_test_exists(s.metadata_name() + strage_test_t::VACUUM_COMMIT_SUFFIX()));
+	s.close();
+	s.unlink_files();
+}
+
+void
+otama_test_fixed_strage(void)
+{
+#if !OTAMA_WINDOWS
+	otama_test_fixed_strage_vacuum();
+	otama_test_fixed_strage_partial_vacuum();
+	otama_test_fixed_strage_locked_vacuum();
+	otama_test_fixed_strage_committed_vacuum();
+#endif
+}
@@ -0,0 +1,322 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#undef NDEBUG
+
+#include "otama_test.h"
+#include "nv_core.h"
+#include "nv_lmca.hpp"
+#include "nv_lmca_ivf.hpp"
+#include <vector>
+#include <algorithm>
+
+static void
+otama_test_lmca_normalize(float *v, int n)
+{
+	float norm = 0.0f;
+	int i;
+
+	for (i = 0; i < n; ++i) {
+		norm += v[i] * v[i];
+	}
+	norm = sqrtf(norm);
+	for (i = 0; i < n; ++i) {
+		v[i] /= norm;
+	}
+}
+
+static void
+otama_test_lmca_color(nv_lmca_empty_color_t *color)
+{
+	color->v[0] = 0.0f;
+}
+
+static void
+otama_test_lmca_color(nv_lmca_colorcode_t *color)
+{
+	int i;
+	for (i = 0; i < 4; ++i) {
+		color->v[i] = nv_rand() * 255.0f;
+	}
+}
+
+static void
+otama_test_lmca_color(nv_lmca_hsv_t *color)
+{
+	int i;
+	for (i = 0; i < NV_LMCA_HSV_DIM; ++i) {
+		color->v[i] = nv_rand() - 0.5f;
+	}
+	otama_test_lmca_normalize(color->v, NV_LMCA_HSV_DIM);
+}
+
+/* the per-record score of search(), color_weight 0 and 1 use one side only */
+template<typename T>
+static float
+otama_test_lmca_similarity(const typename T::vector_t *a,
+						   const typename T::vector_t *query,
+						   typename T::color_method_e method,
+						   const float color_weight,
+						   const float color_threshold)
+{
+	if (color_weight == 1.0f) {
+		return T::similarity(&a->color, &query->color);
+	} else if (color_weight == 0.0f) {
+		return T::similarity(a->v, query->v);
+	}
+	return T::similarity(a, query, method, color_weight, color_threshold);
+}
+
+/*
+ * search() scores the records in blocks of SEARCH_BLOCK (a short block
+ * is padded with its last record), every record must get the score of
+ * the per-record similarity() in every mode.
+ */
+template<typename T>
+static void
+otama_test_lmca_block_tpl(void)
+{
+	static const int64_t ndbs[] = {
+		1, 7, T::SEARCH_BLOCK, T::SEARCH_BLOCK + 1,
+		T::SEARCH_CHUNK * 2 + T::SEARCH_BLOCK / 2 + 3
+	};
+	static const float color_weights[] = { 0.0f, 1.0f, 0.3f };
+	const int64_t ndb_max = ndbs[sizeof(ndbs) / sizeof(ndbs[0]) - 1];
+	typename T::vector_t *db;
+	uint64_t *deleted = nv_alloc_type(uint64_t, (ndb_max + 63) / 64);
+	nv_lmca_result_t *results = nv_alloc_type(nv_lmca_result_t, ndb_max);
+	std::vector<float> score(ndb_max);
+	std::vector<bool> seen(ndb_max);
+	int64_t i;
+	size_t n, c;
+	int j;
+
+	OTAMA_TEST_NAME;
+
+	nv_aligned_malloc((void **)&db, 32, sizeof(typename T::vector_t) * ndb_max);
+	for (i = 0; i < ndb_max; ++i) {
+		for (j = 0; j < T::LMCA_DIM; ++j) {
+			db[i].v[j] = nv_rand() - 0.5f;
+		}
+		otama_test_lmca_normalize(db[i].v, T::LMCA_DIM);
+		otama_test_lmca_color(&db[i].color);
+	}
+	memset(deleted, 0, sizeof(uint64_t) * ((ndb_max + 63) / 64));
+
+	/* distance() is the squared distance */
+	for (i = 0; i < 10; ++i) {
+		float dist = 0.0f;
+		for (j = 0; j < T::LMCA_DIM; ++j) {
+			dist += (db[i].v[j] - db[0].v[j]) * (db[i].v[j] - db[0].v[j]);
+		}
+		NV_ASSERT(fabsf(T::distance(db[i].v, db[0].v) - dist) < 1e-5f);
+	}
+
+	for (n = 0; n < sizeof(ndbs) / sizeof(ndbs[0]); ++n) {
+		const int64_t ndb = ndbs[n];
+		const typename T::vector_t *query = &db[nv_rand_index((int)ndb)];
+
+		for (c = 0; c < sizeof(color_weights) / sizeof(color_weights[0]) * 2; ++c) {
+			const typename T::color_method_e method =
+				c % 2 == 0 ? T::COLOR_METHOD_LINEAR : T::COLOR_METHOD_STEP;
+			const float color_weight = color_weights[c / 2];
+			int nresults, nscores = 0;
+
+			/* a NaN score (the colorcode distance can be negative) never enters */
+			for (i = 0; i < ndb; ++i) {
+				score[i] = otama_test_lmca_similarity<T>(&db[i], query, method, color_weight, 0.5f);
+				if (score[i] == score[i]) {
+					++nscores;
+				}
+			}
+			/* k >= ndb returns every record once, the padding never enters */
+			nresults = T::search(results, (int)ndb, db, ndb, query,
+								 method, color_weight, 0.5f);
+			NV_ASSERT(nresults == nscores);
+			std::fill(seen.begin(), seen.end(), false);
+			for (j = 0; j < nresults; ++j) {
+				NV_ASSERT(results[j].index < (uint64_t)ndb);
+				NV_ASSERT(!seen[results[j].index]);
+				seen[results[j].index] = true;
+				NV_ASSERT(results[j].similarity == score[results[j].index]);
+				if (j > 0) {
+					NV_ASSERT(results[j - 1].similarity >= results[j].similarity);
+				}
+			}
+			/* a deleted record in the first block */
+			if (ndb > 1) {
+				deleted[0] |= 1ULL;
+				nresults = T::search(results, (int)ndb, db, ndb, query,
+									 method, color_weight, 0.5f, deleted);
+				NV_ASSERT(nresults == nscores - (score[0] == score[0] ? 1 : 0));
+				for (j = 0; j < nresults; ++j) {
+					NV_ASSERT(results[j].index != 0);
+					NV_ASSERT(results[j].similarity == score[results[j].index]);
+				}
+				deleted[0] &= ~1ULL;
+			}
+		}
+	}
+
+	nv_aligned_free(db);
+	nv_free(deleted);
+	nv_free(results);
+}
+
+/* nlist centroids picked from db, or random unit vectors when db is NULL */
+template<typename T>
+static void
+otama_test_lmca_ivf_save(const char *file, int nlist,
+						 const typename T::vector_t *db, int64_t ndb)
+{
+	nv_matrix_t *centroids = nv_matrix_alloc(T::LMCA_DIM, nlist);
+	int k, j;
+
+	for (k = 0; k < nlist; ++k) {
+		if (db != NULL) {
+			const typename T::vector_t *x = &db[nv_rand_index((int)ndb)];
+			for (j = 0; j < T::LMCA_DIM; ++j) {
+				NV_MAT_V(centroids, k, j) = x->v[j];
+			}
+		} else {
+			for (j = 0; j < T::LMCA_DIM; ++j) {
+				NV_MAT_V(centroids, k, j) = nv_rand() - 0.5f;
+			}
+			otama_test_lmca_normalize(&NV_MAT_V(centroids, k, 0), T::LMCA_DIM);
+		}
+	}
+	NV_ASSERT(nv_save_matrix(file, centroids) == 0);
+	nv_matrix_free(&centroids);
+}
+
+/*
+ * nprobe <= 0 scans every list and returns the results of search(),
+ * the recall of the exact top k does not fall when nprobe grows.
+ */
+template<nv_lmca_feature_e F, typename C>
+static void
+otama_test_lmca_ivf_tpl(void)
+{
+	typedef nv_lmca_ctx<F, C> T;
+	typedef nv_lmca_ivf<F, C> IT;
+	static const int64_t ndb = 4000;
+	static const int nlist = 16;
+	static const int k = 20;
+	static const int nquery = 10;
+	static const float color_weights[] = { 0.0f, 0.3f };
+	typename T::vector_t *db;
+	typename T::vector_t query;
+	std::vector<typename IT::list_t> lists(nlist);
+	nv_lmca_result_t exact[k], results[k];
+	IT ivf;
+	int64_t i;
+	int q, j, l;
+	size_t c;
+
+	OTAMA_TEST_NAME;
+
+	nv_aligned_malloc((void **)&db, 32, sizeof(typename T::vector_t) * ndb);
+	for (i = 0; i < ndb; ++i) {
+		for (j = 0; j < T::LMCA_DIM; ++j) {
+			db[i].v[j] = nv_rand() - 0.5f;
+		}
+		otama_test_lmca_normalize(db[i].v, T::LMCA_DIM);
+		otama_test_lmca_color(&db[i].color);
+	}
+	otama_test_lmca_ivf_save<T>("./data/lmca_ivf_test.mat", nlist, db, ndb);
+	NV_ASSERT(ivf.open("./data/lmca_ivf_test.mat") == 0);
+	NV_ASSERT(ivf.nlist() == nlist);
+	for (i = 0; i < ndb; ++i) {
+		lists[ivf.assign(&db[i])].push_back(i);
+	}
+
+	for (c = 0; c < sizeof(color_weights) / sizeof(color_weights[0]); ++c) {
+		const float color_weight = color_weights[c];
+		std::vector<int> recall(nlist + 1, 0);
+
+		for (q = 0; q < nquery; ++q) {
+			int nexact, nresults, prev_hits = 0;
+
+			for (j = 0; j < T::LMCA_DIM; ++j) {
+				query.v[j] = nv_rand() - 0.5f;
+			}
+			otama_test_lmca_normalize(query.v, T::LMCA_DIM);
+			otama_test_lmca_color(&query.color);
+
+			nexact = T::search(exact, k, db, ndb, &query,
+							   T::COLOR_METHOD_LINEAR, color_weight, 0.5f);
+			for (l = -1; l <= 0; ++l) {
+				nresults = ivf.search(results, k, db, &lists[0], &query,
+									  T::COLOR_METHOD_LINEAR, color_weight, 0.5f,
+									  NULL, l);
+				NV_ASSERT(nresults == nexact);
+				for (j = 0; j < nresults; ++j) {
+					NV_ASSERT(results[j].index == exact[j].index);
+					NV_ASSERT(results[j].similarity == exact[j].similarity);
+				}
+			}
+			for (l = 1; l <= nlist; ++l) {
+				int hits = 0, e;
+
+				nresults = ivf.search(results, k, db, &lists[0], &query,
+									  T::COLOR_METHOD_LINEAR, color_weight, 0.5f,
+									  NULL, l);
+				NV_ASSERT(nresults <= nexact);
+				for (e = 0; e < nexact; ++e) {
+					for (j = 0; j < nresults; ++j) {
+						if (results[j].index == exact[e].index) {
+							++hits;
+							break;
+						}
+					}
+				}
+				/* the lists probed by l - 1 are a subset of the lists probed by l */
+				NV_ASSERT(hits >= prev_hits);
+				prev_hits = hits;
+				recall[l] += hits;
+			}
+		}
+		NV_ASSERT(recall[nlist] == nquery * k);
+		printf("lmca ivf recall@%d: nprobe 1 %f, nprobe %d %f, nprobe %d %f\n", k,
+			   (float)recall[1] / (nquery * k),
+			   nlist / 4, (float)recall[nlist / 4] / (nquery * k),
+			   nlist, (float)recall[nlist] / (nquery * k));
+	}
+
+	nv_aligned_free(db);
+}
+
+/* the centroid file of config/lmca_vlad_ivf.yaml */
+void
+otama_test_lmca_ivf_centroids(const char *file)
+{
+	typedef nv_lmca_ctx<NV_LMCA_FEATURE_VLAD, nv_lmca_empty_color_t> T;
+	otama_test_lmca_ivf_save<T>(file, 16, NULL, 0);
+}
+
+void
+otama_test_lmca(void)
+{
+	otama_test_lmca_block_tpl<nv_lmca_ctx<NV_LMCA_FEATURE_VLAD, nv_lmca_empty_color_t> >();
+	otama_test_lmca_block_tpl<nv_lmca_ctx<NV_LMCA_FEATURE_HSV, nv_lmca_empty_color_t> >();
+	otama_test_lmca_block_tpl<nv_lmca_ctx<NV_LMCA_FEATURE_VLAD_COLORCODE, nv_lmca_colorcode_t> >();
+	otama_test_lmca_block_tpl<nv_lmca_ctx<NV_LMCA_FEATURE_VLAD_HSV, nv_lmca_hsv_t> >();
+	otama_test_lmca_ivf_tpl<NV_LMCA_FEATURE_VLAD, nv_lmca_empty_color_t>();
+	otama_test_lmca_ivf_tpl<NV_LMCA_FEATURE_VLAD_HSV, nv_lmca_hsv_t>();
+}
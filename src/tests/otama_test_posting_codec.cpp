@@ -0,0 +1,347 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2013 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#undef NDEBUG
+
+#include "otama_config.h"
+#include "otama_test.h"
+#include "nv_core.h"
+#include "otama.h"
+#include "otama_posting_codec.hpp"
+#if OTAMA_WITH_LEVELDB
+#  include "otama_inverted_index_leveldb.hpp"
+#endif
+#include <vector>
+
+using namespace otama;
+
+/* the block tags of otama_posting_codec.cpp */
+#define POSTING_CODEC_TEST_BLOCK_VBYTE 0
+#define POSTING_CODEC_TEST_BLOCK_STREAM_VBYTE 1
+#define POSTING_CODEC_TEST_BLOCK_PACKED 2
+#define POSTING_CODEC_TEST_BLOCK_BITMAP 3
+
+typedef enum {
+	POSTING_CODEC_TEST_RANDOM,
+	POSTING_CODEC_TEST_DENSE,
+	POSTING_CODEC_TEST_DUPLICATE,
+	POSTING_CODEC_TEST_HUGE,
+	POSTING_CODEC_TEST_MAX
+} posting_codec_test_list_e;
+
+/* a delta of 0 to 32 bits */
+static inline int64_t
+posting_codec_test_delta(void)
+{
+	const int bits = nv_rand_index(33);
+	const uint64_t r = ((uint64_t)nv_rand_index(0x10000) << 16)
+		| (uint64_t)nv_rand_index(0x10000);
+
+	return bits == 0 ? 0 : (int64_t)(r >> (32 - bits));
+}
+
+/* n nos after first */
+static void
+posting_codec_test_list(std::vector<int64_t> &nos,
+						posting_codec_test_list_e type,
+						int64_t first, int n)
+{
+	int64_t no = first;
+	int i;
+
+	nos.resize(n);
+	for (i = 0; i < n; ++i) {
+		switch (type) {
+		case POSTING_CODEC_TEST_RANDOM:
+			no += posting_codec_test_delta();
+			break;
+		case POSTING_CODEC_TEST_DENSE:
+			no += 1 + nv_rand_index(2);
+			break;
+		case POSTING_CODEC_TEST_DUPLICATE:
+			no += nv_rand_index(3) == 0 ? 1 : 0;
+			break;
+		case POSTING_CODEC_TEST_HUGE:
+			no += i % 17 == 3 ? (1LL << 32) + posting_codec_test_delta() : 1 + nv_rand_index(1000);
+			break;
+		default:
+			NV_ASSERT(0);
+			break;
+		}
+		nos[i] = no;
+	}
+}
+
+/* the tag of the first block of a list of BLOCK_LEN nos */
+static int
+posting_codec_test_block_type(posting_codec_e codec, posting_codec_test_list_e type)
+{
+	if (type == POSTING_CODEC_TEST_HUGE) {
+		return POSTING_CODEC_TEST_BLOCK_VBYTE;
+	}
+	if (codec == POSTING_CODEC_STREAM_VBYTE) {
+		return POSTING_CODEC_TEST_BLOCK_STREAM_VBYTE;
+	}
+	if (type == POSTING_CODEC_TEST_DENSE) {
+		return POSTING_CODEC_TEST_BLOCK_BITMAP;
+	}
+	return POSTING_CODEC_TEST_BLOCK_PACKED;
+}
+
+/* encodes nos in two calls, then decodes them in one */
+static void
+posting_codec_test_roundtrip(posting_codec_e codec,
+							 const std::vector<int64_t> &nos,
+							 int64_t first, size_t split)
+{
+	std::vector<uint8_t> data;
+	std::vector<int64_t> decoded;
+	int64_t last_no = first;
+	int64_t decoded_no = first;
+
+	PostingCodec::encode(codec, nos.empty() ? NULL : &nos[0], split, last_no, data);
+	PostingCodec::encode(codec, nos.empty() ? NULL : &nos[0] + split, nos.size() - split,
+						 last_no, data);
+	NV_ASSERT(last_no == (nos.empty() ? first : nos.back()));
+	PostingCodec::decode(codec, data.empty() ? NULL : &data[0], data.size(),
+						 decoded_no, decoded);
+	NV_ASSERT(decoded == nos);
+	NV_ASSERT(decoded_no == last_no);
+}
+
+/*
+ * every list type of every length around BLOCK_LEN is decoded to
+ * the same nos by every kernel.
+ */
+template<posting_codec_e C>
+static void
+otama_test_posting_codec_tpl(void)
+{
+	static const int ns[] = {
+		0, 1, 3, 4, 5,
+		PostingCodec::BLOCK_LEN - 1, PostingCodec::BLOCK_LEN, PostingCodec::BLOCK_LEN + 1,
+		PostingCodec::BLOCK_LEN * 7 + 13
+	};
+	static const int64_t firsts[] = { 0, 1000, (1LL << 40) + 7 };
+	const PostingCodec::kernel_e kernel = PostingCodec::kernel();
+	std::vector<int64_t> nos;
+	int k, t;
+	size_t i, f;
+
+	OTAMA_TEST_NAME;
+
+	for (k = 0; k < PostingCodec::KERNEL_MAX; ++k) {
+		if (!PostingCodec::kernel_set((PostingCodec::kernel_e)k)) {
+			continue;
+		}
+		for (t = 0; t < POSTING_CODEC_TEST_MAX; ++t) {
+			for (i = 0; i < sizeof(ns) / sizeof(ns[0]); ++i) {
+				for (f = 0; f < sizeof(firsts) / sizeof(firsts[0]); ++f) {
+					posting_codec_test_list(nos, (posting_codec_test_list_e)t, firsts[f], ns[i]);
+					posting_codec_test_roundtrip(C, nos, firsts[f], 0);
+					posting_codec_test_roundtrip(C, nos, firsts[f], nos.size() / 2);
+					posting_codec_test_roundtrip(C, nos, firsts[f], nos.size() / 3);
+				}
+			}
+			/* the blocks of the list type */
+			if (C != POSTING_CODEC_VBYTE) {
+				std::vector<uint8_t> data;
+				int64_t last_no = 0;
+
+				posting_codec_test_list(nos, (posting_codec_test_list_e)t, 0,
+										PostingCodec::BLOCK_LEN);
+				PostingCodec::encode(C, &nos[0], nos.size(), last_no, data);
+				NV_ASSERT(data[0] == posting_codec_test_block_type(C, (posting_codec_test_list_e)t));
+			}
+		}
+	}
+	NV_ASSERT(PostingCodec::kernel_set(kernel));
+}
+
+/*
+ * svb_decode_ssse3 and svb_decode_scalar decode the same blocks.
+ * the deltas have 1 to 4 bytes, and a short last group is decoded by
+ * the scalar tail of the SSSE3 kernel.
+ */
+static void
+otama_test_posting_codec_svb_kernels(void)
+{
+	const PostingCodec::kernel_e kernel = PostingCodec::kernel();
+	std::vector<int64_t> nos, scalar, simd;
+	std::vector<uint8_t> data;
+	int n;
+
+	OTAMA_TEST_NAME;
+
+	NV_ASSERT(PostingCodec::kernel_set(PostingCodec::KERNEL_SCALAR));
+	for (n = 1; n <= PostingCodec::BLOCK_LEN * 3; n += 1 + nv_rand_index(7)) {
+		int64_t last_no = 0;
+
+		posting_codec_test_list(nos, POSTING_CODEC_TEST_RANDOM, 0, n);
+		data.clear();
+		PostingCodec::encode(POSTING_CODEC_STREAM_VBYTE, &nos[0], nos.size(), last_no, data);
+		NV_ASSERT(data[0] == POSTING_CODEC_TEST_BLOCK_STREAM_VBYTE);
+
+		NV_ASSERT(PostingCodec::kernel_set(PostingCodec::KERNEL_SCALAR));
+		scalar.clear();
+		last_no = 0;
+		PostingCodec::decode_blocks(&data[0], data.size(), last_no, scalar);
+		NV_ASSERT(scalar == nos);
+
+		if (PostingCodec::kernel_set(PostingCodec::KERNEL_SSSE3)) {
+			simd.clear();
+			last_no = 0;
+			PostingCodec::decode_blocks(&data[0], data.size(), last_no, simd);
+			NV_ASSERT(simd == scalar);
+		}
+	}
+	NV_ASSERT(PostingCodec::kernel_set(kernel));
+}
+
+#if OTAMA_WITH_LEVELDB
+class PostingCodecTestIndex: public InvertedIndexLevelDB
+{
+public:
+	PostingCodecTestIndex(otama_variant_t *options)
+		: InvertedIndexLevelDB(options) {}
+
+	void decode(uint32_t hash, std::vector<int64_t> &nos) { decode_vbc(hash, nos); }
+
+	int32_t
+	nsealed(uint32_t hash)
+	{
+		posting_tail_t tail;
+		get_posting_tail(hash, &tail);
+		return tail.nsealed;
+	}
+};
+
+static void
+posting_codec_test_leveldb_check(PostingCodecTestIndex &index,
+								 const std::vector<int64_t> *expected, int nhash)
+{
+	std::vector<int64_t> nos;
+	int h;
+
+	for (h = 0; h < nhash; ++h) {
+		index.decode((uint32_t)h + 1, nos);
+		NV_ASSERT(nos == expected[h]);
+	}
+}
+
+/*
+ * the full vbyte blocks of a list are sealed by append_posting(),
+ * vacuum() converts the lists between vbyte and the codec.
+ */
+static void
+otama_test_posting_codec_leveldb(posting_codec_e codec)
+{
+	static const int NHASH = 3;
+	otama_variant_pool_t *pool = otama_variant_pool_alloc();
+	otama_variant_t *options = otama_variant_new(pool);
+	otama_variant_t *driver, *posting_codec;
+	InvertedIndex::WeightFunction weight_func;
+	InvertedIndex::sparse_vec_t vec;
+	std::vector<int64_t> expected[NHASH];
+	otama_id_t id;
+	int64_t no = 0;
+	int i;
+
+	OTAMA_TEST_NAME;
+
+	otama_variant_set_hash(options);
+	driver = otama_variant_hash_at(options, "driver");
+	otama_variant_set_hash(driver);
+	otama_variant_set_string(otama_variant_hash_at(driver, "data_dir"), "./data");
+	posting_codec = otama_variant_hash_at(driver, "posting_codec");
+	otama_variant_set_string(posting_codec, PostingCodec::name(codec));
+	memset(&id, 0, sizeof(id));
+	{
+		PostingCodecTestIndex index(options);
+
+		index.prefix("posting_codec_test");
+		index.weight_func(&weight_func);
+		NV_ASSERT(index.open() == OTAMA_STATUS_OK);
+		NV_ASSERT(index.clear() == OTAMA_STATUS_OK);
+		/* hash 1: every no, hash 2: dense, hash 3: sparse */
+		for (i = 0; i < 20000; ++i) {
+			no += i % 5000 == 4999 ? (1LL << 33) : 1 + nv_rand_index(3);
+			vec.clear();
+			vec.push_back(1);
+			expected[0].push_back(no);
+			if (nv_rand_index(2) == 0) {
+				vec.push_back(2);
+				expected[1].push_back(no);
+			}
+			if (nv_rand_index(50) == 0) {
+				vec.push_back(3);
+				expected[2].push_back(no);
+			}
+			NV_ASSERT(index.set(no, &id, vec) == OTAMA_STATUS_OK);
+		}
+		/* an index with no last no takes the codec of the next open() */
+		NV_ASSERT(index.set_last_no(no));
+		posting_codec_test_leveldb_check(index, expected, NHASH);
+		NV_ASSERT(index.nsealed(1) > 0);
+		NV_ASSERT(index.vacuum() == OTAMA_STATUS_OK);
+		posting_codec_test_leveldb_check(index, expected, NHASH);
+		index.close();
+	}
+	{
+		/* to vbyte and back */
+		otama_variant_set_string(posting_codec, PostingCodec::name(POSTING_CODEC_VBYTE));
+		PostingCodecTestIndex index(options);
+
+		index.prefix("posting_codec_test");
+		index.weight_func(&weight_func);
+		NV_ASSERT(index.open() == OTAMA_STATUS_OK);
+		NV_ASSERT(index.vacuum() == OTAMA_STATUS_OK);
+		NV_ASSERT(index.nsealed(1) == 0);
+		posting_codec_test_leveldb_check(index, expected, NHASH);
+		index.close();
+	}
+	{
+		otama_variant_set_string(posting_codec, PostingCodec::name(codec));
+		PostingCodecTestIndex index(options);
+
+		index.prefix("posting_codec_test");
+		index.weight_func(&weight_func);
+		NV_ASSERT(index.open() == OTAMA_STATUS_OK);
+		NV_ASSERT(index.vacuum() == OTAMA_STATUS_OK);
+		NV_ASSERT(index.nsealed(1) > 0);
+		posting_codec_test_leveldb_check(index, expected, NHASH);
+		NV_ASSERT(index.clear() == OTAMA_STATUS_OK);
+		index.close();
+	}
+	otama_variant_pool_free(&pool);
+}
+#endif
+
+void
+otama_test_posting_codec(void)
+{
+	otama_test_posting_codec_tpl<POSTING_CODEC_VBYTE>();
+	otama_test_posting_codec_tpl<POSTING_CODEC_STREAM_VBYTE>();
+	otama_test_posting_codec_tpl<POSTING_CODEC_BP128>();
+	otama_test_posting_codec_svb_kernels();
+#if OTAMA_WITH_LEVELDB
+	otama_test_posting_codec_leveldb(POSTING_CODEC_STREAM_VBYTE);
+	otama_test_posting_codec_leveldb(POSTING_CODEC_BP128);
+#endif
+}
@@ -0,0 +1,208 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#undef NDEBUG
+
+#include "otama_test.h"
+#include "nv_core.h"
+#include "otama_topk.hpp"
+#include <vector>
+#include <algorithm>
+
+typedef struct {
+	float similarity;
+	uint64_t index;
+} topk_result_t;
+
+typedef otama::TopK<topk_result_t> topk_t;
+
+static void
+topk_reference(std::vector<topk_result_t> &ref, int k,
+			   const std::vector<float> &scores)
+{
+	size_t i;
+
+	ref.resize(scores.size());
+	for (i = 0; i < scores.size(); ++i) {
+		ref[i].similarity = scores[i];
+		ref[i].index = (uint64_t)i;
+	}
+	std::sort(ref.begin(), ref.end(), topk_t::better);
+	if ((size_t)k < ref.size()) {
+		ref.resize((size_t)k);
+	}
+}
+
+/* records are pushed to the parts in order, or to a random part when shuffle */
+static int
+topk_parts(std::vector<topk_result_t> &results, int k,
+		   const std::vector<float> &scores, int parts, bool shuffle)
+{
+	std::vector<topk_t> topn((size_t)parts, topk_t(k));
+	std::vector<size_t> order(scores.size());
+	size_t i;
+	int n;
+
+	for (i = 0; i < scores.size(); ++i) {
+		order[i] = i;
+	}
+	if (shuffle) {
+		for (i = scores.size(); i > 1; --i) {
+			std::swap(order[i - 1], order[(size_t)nv_rand_index((int)i)]);
+		}
+	}
+	for (i = 0; i < order.size(); ++i) {
+		topk_result_t r;
+
+		r.similarity = scores[order[i]];
+		r.index = (uint64_t)order[i];
+		topn[shuffle ? (size_t)nv_rand_index(parts) : i % (size_t)parts].push(r);
+	}
+	results.resize((size_t)std::max(k, 1));
+	n = otama::topk_merge(&results[0], k, &topn[0], parts);
+	results.resize((size_t)n);
+
+	return n;
+}
+
+static void
+topk_check(int k, const std::vector<float> &scores)
+{
+	static const int parts[] = { 1, 3, 8 };
+	std::vector<topk_result_t> ref;
+	size_t i, j;
+
+	topk_reference(ref, k, scores);
+	for (i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i) {
+		std::vector<topk_result_t> results;
+
+		NV_ASSERT(topk_parts(results, k, scores, parts[i], false) == (int)ref.size());
+		for (j = 0; j < ref.size(); ++j) {
+			NV_ASSERT(results[j].similarity == ref[j].similarity);
+			NV_ASSERT(results[j].index == ref[j].index);
+		}
+		NV_ASSERT(topk_parts(results, k, scores, parts[i], true) == (int)ref.size());
+		for (j = 0; j < ref.size(); ++j) {
+			NV_ASSERT(results[j].similarity == ref[j].similarity);
+			NV_ASSERT(results[j].index == ref[j].index);
+		}
+	}
+}
+
+static void
+otama_test_topk_random(void)
+{
+	static const int ks[] = { 1, 10, 100 };
+	std::vector<float> scores(1000);
+	size_t i, j;
+
+	OTAMA_TEST_NAME;
+
+	for (i = 0; i < sizeof(ks) / sizeof(ks[0]); ++i) {
+		for (j = 0; j < scores.size(); ++j) {
+			scores[j] = nv_rand();
+		}
+		topk_check(ks[i], scores);
+	}
+}
+
+static void
+otama_test_topk_ties(void)
+{
+	static const int ks[] = { 1, 10, 100 };
+	std::vector<float> scores(1000);
+	size_t i, j;
+
+	OTAMA_TEST_NAME;
+
+	/* a few distinct scores, the lower index wins */
+	for (i = 0; i < sizeof(ks) / sizeof(ks[0]); ++i) {
+		for (j = 0; j < scores.size(); ++j) {
+			scores[j] = (float)nv_rand_index(4) * 0.25f;
+		}
+		topk_check(ks[i], scores);
+	}
+	/* all equal */
+	std::fill(scores.begin(), scores.end(), 0.5f);
+	for (i = 0; i < sizeof(ks) / sizeof(ks[0]); ++i) {
+		std::vector<topk_result_t> results;
+
+		topk_check(ks[i], scores);
+		topk_parts(results, ks[i], scores, 8, true);
+		for (j = 0; j < results.size(); ++j) {
+			NV_ASSERT(results[j].index == (uint64_t)j);
+		}
+	}
+}
+
+static void
+otama_test_topk_bounds(void)
+{
+	std::vector<float> scores(50);
+	std::vector<topk_result_t> results;
+	topk_t topk;
+	topk_result_t r;
+	size_t i;
+
+	OTAMA_TEST_NAME;
+
+	for (i = 0; i < scores.size(); ++i) {
+		scores[i] = nv_rand();
+	}
+
+	/* k > n, every record is returned in order */
+	topk_check(100, scores);
+	NV_ASSERT(topk_parts(results, 100, scores, 8, true) == (int)scores.size());
+
+	/* k == 0 */
+	topk_check(0, scores);
+	NV_ASSERT(topk_parts(results, 0, scores, 8, true) == 0);
+	topk.reset(0);
+	NV_ASSERT(topk.threshold() == FLT_MAX);
+	r.similarity = FLT_MAX;
+	r.index = 0;
+	topk.push(r);
+	NV_ASSERT(topk.size() == 0);
+	NV_ASSERT(topk.finish() == 0);
+
+	/* the threshold is -FLT_MAX until k results are held */
+	topk.reset(2);
+	NV_ASSERT(topk.threshold() == -FLT_MAX);
+	r.similarity = 0.5f;
+	topk.push(r);
+	NV_ASSERT(topk.threshold() == -FLT_MAX);
+	r.similarity = 0.25f;
+	r.index = 1;
+	topk.push(r);
+	NV_ASSERT(topk.threshold() == 0.25f);
+	/* a tie enters when its index is lower */
+	r.index = 0;
+	topk.push(r);
+	NV_ASSERT(topk.finish() == 2);
+	NV_ASSERT(topk.data()[0].similarity == 0.5f);
+	NV_ASSERT(topk.data()[1].similarity == 0.25f && topk.data()[1].index == 0);
+}
+
+void
+otama_test_topk(void)
+{
+	otama_test_topk_random();
+	otama_test_topk_ties();
+	otama_test_topk_bounds();
+}
@@ -0,0 +1,151 @@
+/*
+ * This file is part of otama.
+ *
+ * Copyright (C) 2012 nagadomi@nurs.or.jp
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License,
+ * or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nv_core.h"
+#include "otama_topk.hpp"
+#include <queue>
+#include <functional>
+
+#define DATA_M  10000000
+#define PARTS   8
+#define TRIES   3
+
+typedef struct result {
+	float similarity;
+	uint64_t index;
+
+	inline bool
+	operator>(const struct result &lhs) const
+	{
+		return similarity > lhs.similarity;
+	}
+} result_t;
+
+typedef std::priority_queue<result_t, std::vector<result_t>,
+							std::greater<std::vector<result_t>::value_type> > queue_t;
+
+/* the selection the scans used before otama::TopK */
+static int
+queue_topk(result_t *results, int k, const float *scores, int64_t n)
+{
+	std::vector<queue_t> topn(PARTS);
+	std::vector<float> cosine_min(PARTS, -FLT_MAX);
+	queue_t merged;
+	int64_t i;
+	int j, jmax;
+
+	for (i = 0; i < n; ++i) {
+		queue_t &q = topn[i % PARTS];
+		float &th = cosine_min[i % PARTS];
+		result_t r;
+
+		r.similarity = scores[i];
+		r.index = (uint64_t)i;
+		if (q.size() < (unsigned int)k) {
+			q.push(r);
+			th = q.top().similarity;
+		} else if (r.similarity > th) {
+			q.pop();
+			q.push(r);
+			th = q.top().similarity;
+		}
+	}
+	for (j = 0; j < PARTS; ++j) {
+		while (!topn[j].empty()) {
+			merged.push(topn[j].top());
+			topn[j].pop();
+		}
+	}
+	while (merged.size() > (unsigned int)k) {
+		merged.pop();
+	}
+	jmax = (int)merged.size();
+	for (j = jmax - 1; j >= 0; --j) {
+		results[j] = merged.top();
+		merged.pop();
+	}
+	return jmax;
+}
+
+template <typename P> static int
+selector_topk(result_t *results, int k, const float *scores, int64_t n)
+{
+	std::vector<P> topn(PARTS, P(k));
+	int64_t i;
+
+	for (i = 0; i < n; ++i) {
+		result_t r;
+
+		r.similarity = scores[i];
+		r.index = (uint64_t)i;
+		topn[i % PARTS].push(r);
+	}
+	return otama::topk_merge(results, k, &topn[0], PARTS);
+}
+
+static void
+benchmark(const char *name, const float *scores, int64_t n)
+{
+	static const int ks[] = { 10, 100, 1000, 10000 };
+	size_t i;
+
+	printf("\n---- %s (%d records, %d parts)\n", name, (int)n, PARTS);
+	printf("%8s %12s %12s\n", "k", "queue", "TopK");
+	for (i = 0; i < sizeof(ks) / sizeof(ks[0]); ++i) {
+		const int k = ks[i];
+		std::vector<result_t> a(k), b(k);
+		long t_queue = 0, t_heap = 0;
+		int j, na = 0, nb = 0;
+
+		for (j = 0; j < TRIES; ++j) {
+			long t = nv_clock();
+			na = queue_topk(&a[0], k, scores, n);
+			t_queue += nv_clock() - t;
+
+			t = nv_clock();
+			nb = selector_topk<otama::TopK<result_t> >(&b[0], k, scores, n);
+			t_heap += nv_clock() - t;
+		}
+		NV_ASSERT(na == nb);
+		for (j = 0; j < k; ++j) {
+			NV_ASSERT(a[j].similarity == b[j].similarity);
+		}
+		printf("%8d %10ldms %10ldms\n", k, t_queue / TRIES, t_heap / TRIES);
+	}
+}
+
+int
+main(void)
+{
+	std::vector<float> scores(DATA_M);
+	int64_t i;
+
+	for (i = 0; i < DATA_M; ++i) {
+		scores[(size_t)i] = nv_rand();
+	}
+	benchmark("random", &scores[0], DATA_M);
+
+	/* every record enters the top-k */
+	for (i = 0; i < DATA_M; ++i) {
+		scores[(size_t)i] = (float)i / DATA_M;
+	}
+	benchmark("ascending", &scores[0], DATA_M);
+
+	return 0;
+}